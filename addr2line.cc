@@ -5,9 +5,14 @@
 
 #include "addr2line.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <map>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/commandlineflags.h"
 #include "base/logging.h"
@@ -39,6 +44,43 @@ llvm::object::OwningBinary<llvm::object::ObjectFile> GetOwningBinary(
   }
   return std::move(object_owning_binary_or_err.get());
 }
+
+// Calls ADD_BOUNDARY with the start and end of each address range of DIE and
+// of the subprograms and inlined subroutines it contains.
+void AddDieBoundaries(const llvm::DWARFDie &die,
+                      const std::function<void(uint64_t)> &add_boundary) {
+  if (die.getTag() == llvm::dwarf::DW_TAG_subprogram ||
+      die.getTag() == llvm::dwarf::DW_TAG_inlined_subroutine) {
+    auto die_ranges = die.getAddressRanges();
+    if (die_ranges) {
+      for (const auto &range : *die_ranges) {
+        add_boundary(range.LowPC);
+        add_boundary(range.HighPC);
+      }
+    } else {
+      llvm::consumeError(die_ranges.takeError());
+    }
+  }
+  for (const llvm::DWARFDie &child : die.children()) {
+    AddDieBoundaries(child, add_boundary);
+  }
+}
+
+// Stores in DIR_NAME and FILE_NAME the name of the file FILE of LINE_TABLE,
+// or leaves them empty if it has no such file.
+void GetFileName(const llvm::DWARFDebugLine::LineTable *line_table,
+                 uint32_t file, std::string *dir_name,
+                 std::string *file_name) {
+  if (!line_table->hasFileAtIndex(file)) return;
+  const auto &entry = line_table->Prologue.getFileNameEntry(file);
+  *file_name = llvm::dwarf::toString(entry.Name).value();
+  if (entry.DirIdx > 0 &&
+      entry.DirIdx <= line_table->Prologue.IncludeDirectories.size())
+    *dir_name =
+        llvm::dwarf::toString(
+            line_table->Prologue.IncludeDirectories[entry.DirIdx - 1])
+            .value();
+}
 }  // namespace
 
 namespace devtools_crosstool_autofdo {
@@ -85,6 +127,13 @@ void LLVMAddr2line::GetInlineStack(uint64_t address, SourceStack *stack) const {
 
   uint32_t row_index = line_table->lookupAddress(
       {address, llvm::object::SectionedAddress::UndefSection});
+  AppendInlineStack(line_table, row_index, InlinedChain, stack);
+}
+
+void LLVMAddr2line::AppendInlineStack(
+    const llvm::DWARFDebugLine::LineTable *line_table, uint32_t row_index,
+    const llvm::SmallVectorImpl<llvm::DWARFDie> &InlinedChain,
+    SourceStack *stack) const {
   uint32_t file = (row_index == -1U ? -1U : line_table->Rows[row_index].File);
   uint32_t line = (row_index == -1U ? 0 : line_table->Rows[row_index].Line);
   uint32_t discriminator =
@@ -96,20 +145,238 @@ void LLVMAddr2line::GetInlineStack(uint64_t address, SourceStack *stack) const {
     uint32_t start_line = FunctionDIE.getDeclLine();
     std::string file_name;
     std::string dir_name;
-    if (line_table->hasFileAtIndex(file)) {
-      const auto &entry = line_table->Prologue.getFileNameEntry(file);
-      file_name = llvm::dwarf::toString(entry.Name).value();
-      if (entry.DirIdx > 0 &&
-          entry.DirIdx <= line_table->Prologue.IncludeDirectories.size())
-        dir_name =
-            llvm::dwarf::toString(
-                line_table->Prologue.IncludeDirectories[entry.DirIdx - 1])
-                .value();
-    }
+    GetFileName(line_table, file, &dir_name, &file_name);
     stack->emplace_back(function_name, dir_name, file_name, start_line, line,
                         discriminator);
     uint32_t col;
     FunctionDIE.getCallerFrame(file, line, col, discriminator);
   }
 }
+
+void LLVMAddr2line::GetInlineStacks(absl::Span<const uint64_t> addrs,
+                                    SourceStack *stacks) const {
+  const llvm::DWARFDebugLine::LineTable *line_table = nullptr;
+  llvm::DWARFUnit *unit = nullptr;
+  // The address ranges of the function of the previous address, and the
+  // sorted boundaries of the ranges of the function and of its inlined
+  // subroutines. Empty if the previous address is in no function.
+  llvm::DWARFAddressRangesVector function_ranges;
+  std::vector<uint64_t> boundaries;
+  // The inlined chain of the previous address, valid in [CHAIN_LOW,
+  // CHAIN_HIGH).
+  llvm::SmallVector<llvm::DWARFDie, 4> chain;
+  uint64_t chain_low = 0, chain_high = 0;
+  // The line table row of the previous address, which covers [ROW_LOW,
+  // ROW_HIGH).
+  uint32_t row_index = -1U;
+  uint64_t row_low = 0, row_high = 0;
+
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    const uint64_t address = addrs[i];
+    SourceStack *stack = &stacks[i];
+    stack->clear();
+
+    bool in_function = false;
+    for (const auto &range : function_ranges) {
+      if (range.LowPC <= address && address < range.HighPC) {
+        in_function = true;
+        break;
+      }
+    }
+    if (!in_function) {
+      function_ranges.clear();
+      boundaries.clear();
+      chain_low = chain_high = 0;
+      auto cu_iter =
+          unit_map_.find(dwarf_info_->getDebugAranges()->findAddress(address));
+      llvm::DWARFUnit *new_unit =
+          cu_iter == unit_map_.end() ? nullptr : cu_iter->second;
+      if (new_unit != unit) {
+        unit = new_unit;
+        line_table =
+            unit == nullptr ? nullptr : dwarf_info_->getLineTableForUnit(unit);
+        row_index = -1U;
+        row_low = row_high = 0;
+      }
+      if (line_table == nullptr) continue;
+      llvm::DWARFDie function = unit->getSubroutineForAddress(address);
+      if (function.isValid()) {
+        auto ranges = function.getAddressRanges();
+        if (ranges) {
+          function_ranges = std::move(*ranges);
+        } else {
+          llvm::consumeError(ranges.takeError());
+        }
+        AddDieBoundaries(function,
+                         [&](uint64_t addr) { boundaries.push_back(addr); });
+        std::sort(boundaries.begin(), boundaries.end());
+      }
+    }
+
+    // The chain only changes at the boundaries of the function and of its
+    // inlined subroutines.
+    if (address < chain_low || address >= chain_high) {
+      chain.clear();
+      unit->getInlinedChainForAddress(address, chain);
+      auto next = std::upper_bound(boundaries.begin(), boundaries.end(),
+                                   address);
+      if (next == boundaries.begin() || next == boundaries.end()) {
+        chain_low = chain_high = 0;
+      } else {
+        chain_low = *(next - 1);
+        chain_high = *next;
+      }
+    }
+
+    // The rows of a sequence are sorted, so the row of the next address is
+    // usually the same or the next one.
+    if (address < row_low || address >= row_high) {
+      const auto &rows = line_table->Rows;
+      if (row_index != -1U && address >= row_high &&
+          row_index + 2 < rows.size() && !rows[row_index + 1].EndSequence &&
+          rows[row_index + 2].Address.Address > address) {
+        ++row_index;
+      } else {
+        row_index = line_table->lookupAddress(
+            {address, llvm::object::SectionedAddress::UndefSection});
+      }
+      if (row_index == -1U || row_index + 1 >= rows.size()) {
+        row_low = row_high = 0;
+      } else {
+        row_low = rows[row_index].Address.Address;
+        row_high = rows[row_index + 1].Address.Address;
+      }
+    }
+    AppendInlineStack(line_table, row_index, chain, stack);
+  }
+}
+
+void LLVMAddr2line::GetInlineStackRanges(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<std::pair<uint64_t, SourceStack>> *ranges) const {
+  auto cu_iter =
+      unit_map_.find(dwarf_info_->getDebugAranges()->findAddress(start_addr));
+  const llvm::DWARFDebugLine::LineTable *line_table =
+      cu_iter == unit_map_.end()
+          ? nullptr
+          : dwarf_info_->getLineTableForUnit(cu_iter->second);
+  if (line_table == nullptr) {
+    Addr2line::GetInlineStackRanges(start_addr, end_addr, ranges);
+    return;
+  }
+
+  // The inline stack of an address is made of the line table row which
+  // covers it, and of the chain of the function and inlined subroutines
+  // whose address ranges contain it. It can thus only change at the
+  // boundaries of the rows, of the sequences of rows, and of those ranges.
+  std::vector<uint64_t> boundaries = {start_addr};
+  auto add_boundary = [&](uint64_t addr) {
+    if (addr > start_addr && addr < end_addr) boundaries.push_back(addr);
+  };
+  for (const auto &sequence : line_table->Sequences) {
+    if (sequence.HighPC <= start_addr || sequence.LowPC >= end_addr) continue;
+    add_boundary(sequence.LowPC);
+    add_boundary(sequence.HighPC);
+    for (uint32_t i = sequence.FirstRowIndex; i < sequence.LastRowIndex; ++i) {
+      add_boundary(line_table->Rows[i].Address.Address);
+    }
+  }
+
+  // Walks the functions which cover [START_ADDR, END_ADDR), usually a single
+  // one, skipping the addresses of each function.
+  std::set<uint64_t> visited_functions;
+  for (uint64_t addr = start_addr; addr < end_addr;) {
+    uint64_t next_addr = addr + 1;
+    llvm::DWARFDie function = cu_iter->second->getSubroutineForAddress(addr);
+    if (function.isValid()) {
+      if (visited_functions.insert(function.getOffset()).second) {
+        AddDieBoundaries(function, add_boundary);
+      }
+      auto function_ranges = function.getAddressRanges();
+      if (function_ranges) {
+        for (const auto &range : *function_ranges) {
+          if (range.LowPC <= addr && addr < range.HighPC) {
+            next_addr = range.HighPC;
+          }
+        }
+      } else {
+        llvm::consumeError(function_ranges.takeError());
+      }
+    }
+    addr = next_addr;
+  }
+  std::sort(boundaries.begin(), boundaries.end());
+  boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                   boundaries.end());
+
+  ranges->clear();
+  std::vector<SourceStack> stacks(boundaries.size());
+  GetInlineStacks(boundaries, stacks.data());
+  for (size_t i = 0; i < boundaries.size(); ++i) {
+    if (ranges->empty() || ranges->back().second != stacks[i]) {
+      ranges->emplace_back(boundaries[i], std::move(stacks[i]));
+    }
+  }
+}
+
+void LLVMAddr2line::GetLineRanges(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<std::pair<uint64_t, SourceInfo>> *ranges) const {
+  auto cu_iter =
+      unit_map_.find(dwarf_info_->getDebugAranges()->findAddress(start_addr));
+  const llvm::DWARFDebugLine::LineTable *line_table =
+      cu_iter == unit_map_.end()
+          ? nullptr
+          : dwarf_info_->getLineTableForUnit(cu_iter->second);
+  if (line_table == nullptr) {
+    Addr2line::GetLineRanges(start_addr, end_addr, ranges);
+    return;
+  }
+
+  // The rows of the sequences which overlap [START_ADDR, END_ADDR), by
+  // address. A sequence ends with a row which covers no address, and which
+  // sorts before the first row of a sequence starting at the same address.
+  struct Row {
+    uint64_t address;
+    bool starts_location;
+    uint32_t index;
+    bool operator<(const Row &other) const {
+      return std::tie(address, starts_location, index) <
+             std::tie(other.address, other.starts_location, other.index);
+    }
+  };
+  std::vector<Row> rows;
+  for (const auto &sequence : line_table->Sequences) {
+    if (sequence.HighPC <= start_addr || sequence.LowPC >= end_addr) continue;
+    for (uint32_t i = sequence.FirstRowIndex; i < sequence.LastRowIndex; ++i) {
+      const auto &row = line_table->Rows[i];
+      rows.push_back({row.Address.Address, !row.EndSequence, i});
+    }
+  }
+  std::sort(rows.begin(), rows.end());
+
+  // As for a lookup, an address is covered by the last row at or before it.
+  ranges->clear();
+  ranges->emplace_back(start_addr, SourceInfo());
+  for (const Row &row : rows) {
+    if (row.address >= end_addr) break;
+    SourceInfo line;
+    if (row.starts_location) {
+      const auto &table_row = line_table->Rows[row.index];
+      std::string file_name;
+      std::string dir_name;
+      GetFileName(line_table, table_row.File, &dir_name, &file_name);
+      line = SourceInfo(nullptr, dir_name, file_name, 0, table_row.Line,
+                        table_row.Discriminator);
+    }
+    if (row.address <= ranges->back().first) {
+      ranges->back().second = line;
+      if (ranges->size() > 1 && (*ranges)[ranges->size() - 2].second == line) {
+        ranges->pop_back();
+      }
+    } else if (ranges->back().second != line) {
+      ranges->emplace_back(row.address, line);
+    }
+  }
+}
 }  // namespace devtools_crosstool_autofdo
@@ -9,10 +9,13 @@
 #include <cstdint>
 #include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/integral_types.h"
 #include "base/macros.h"
 #include "source_info.h"
+#include "third_party/abseil/absl/types/span.h"
 #if defined(HAVE_LLVM)
 #include "llvm/DebugInfo/DWARF/DWARFContext.h"
 #include "llvm/Object/Binary.h"
@@ -40,6 +43,40 @@ class Addr2line {
   // Stores the inline stack of ADDR in STACK.
   virtual void GetInlineStack(uint64_t addr, SourceStack *stack) const = 0;
 
+  // Stores the inline stack of each address of ADDRS, which are sorted, in
+  // the stack with the same index in STACKS. The default implementation
+  // queries each address in turn, the implementations reuse what they found
+  // for an address to find the stack of the next one.
+  virtual void GetInlineStacks(absl::Span<const uint64_t> addrs,
+                               SourceStack *stacks) const;
+
+  // Stores in STACKS the inline stacks which the samples of ADDR also count
+  // for, besides the one given by GetInlineStack. The default implementation
+  // stores none: with pseudo probes, several probes can share an address.
+  virtual void GetOtherInlineStacks(uint64_t addr,
+                                    std::vector<SourceStack> *stacks) const {
+    stacks->clear();
+  }
+
+  // Stores in RANGES the inline stacks of the addresses in
+  // [START_ADDR, END_ADDR), as the sorted start addresses of the runs of
+  // consecutive addresses which have the same inline stack, and that stack.
+  // Each run ends where the next one starts, the last one at END_ADDR. The
+  // default implementation queries every address.
+  virtual void GetInlineStackRanges(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<std::pair<uint64_t, SourceStack>> *ranges) const;
+
+  // Stores in RANGES the source locations of the addresses in
+  // [START_ADDR, END_ADDR) given by the line table, without their inline
+  // stacks, in the format of GetInlineStackRanges. The locations only have a
+  // file, a line and a discriminator, and are empty for the addresses without
+  // line. The default implementation takes the innermost entry of the inline
+  // stacks.
+  virtual void GetLineRanges(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<std::pair<uint64_t, SourceInfo>> *ranges) const;
+
  protected:
   std::string binary_name_;
 
@@ -47,14 +84,90 @@ class Addr2line {
   DISALLOW_COPY_AND_ASSIGN(Addr2line);
 };
 
+// The default implementations are shared by the LLVM and the legacy
+// symbolizers, which are defined in different files.
+inline void Addr2line::GetInlineStacks(absl::Span<const uint64_t> addrs,
+                                       SourceStack *stacks) const {
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    stacks[i].clear();
+    GetInlineStack(addrs[i], &stacks[i]);
+  }
+}
+
+inline void Addr2line::GetInlineStackRanges(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<std::pair<uint64_t, SourceStack>> *ranges) const {
+  ranges->clear();
+  // Queries the addresses by batches of consecutive addresses.
+  constexpr uint64_t kBatchSize = 1024;
+  std::vector<uint64_t> addrs;
+  std::vector<SourceStack> stacks;
+  for (uint64_t batch = start_addr; batch < end_addr; batch += kBatchSize) {
+    addrs.clear();
+    for (uint64_t addr = batch; addr < end_addr && addr < batch + kBatchSize;
+         addr++) {
+      addrs.push_back(addr);
+    }
+    stacks.resize(addrs.size());
+    GetInlineStacks(addrs, stacks.data());
+    for (size_t i = 0; i < addrs.size(); ++i) {
+      if (ranges->empty() || ranges->back().second != stacks[i]) {
+        ranges->emplace_back(addrs[i], std::move(stacks[i]));
+      }
+    }
+  }
+}
+
+inline void Addr2line::GetLineRanges(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<std::pair<uint64_t, SourceInfo>> *ranges) const {
+  ranges->clear();
+  std::vector<std::pair<uint64_t, SourceStack>> stack_ranges;
+  GetInlineStackRanges(start_addr, end_addr, &stack_ranges);
+  for (const auto &range : stack_ranges) {
+    SourceInfo line;
+    if (!range.second.empty()) {
+      line = range.second[0];
+      line.func_name = nullptr;
+      line.start_line = 0;
+    }
+    if (ranges->empty() || ranges->back().second != line) {
+      ranges->emplace_back(range.first, line);
+    }
+  }
+}
+
 #if defined(HAVE_LLVM)
 class LLVMAddr2line : public Addr2line {
  public:
   explicit LLVMAddr2line(const std::string &binary_name);
   bool Prepare() override;
   void GetInlineStack(uint64_t address, SourceStack *stack) const override;
+  // Reuses the compilation unit and the function of the previous address
+  // while the addresses stay in that function, its line table row while they
+  // stay before the next row, and its inlined subroutine chain while they
+  // stay between the same inlined subroutine boundaries.
+  void GetInlineStacks(absl::Span<const uint64_t> addrs,
+                       SourceStack *stacks) const override;
+  // Only queries the addresses where a line table row or the address range
+  // of a function or inlined subroutine starts or ends.
+  void GetInlineStackRanges(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<std::pair<uint64_t, SourceStack>> *ranges) const override;
+  // Only reads the rows of the line table.
+  void GetLineRanges(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<std::pair<uint64_t, SourceInfo>> *ranges) const override;
 
  private:
+  // Appends to STACK the inline stack made of the row ROW_INDEX of
+  // LINE_TABLE, or no row if it is -1U, and of the inlined subroutine CHAIN,
+  // innermost first.
+  void AppendInlineStack(const llvm::DWARFDebugLine::LineTable *line_table,
+                         uint32_t row_index,
+                         const llvm::SmallVectorImpl<llvm::DWARFDie> &chain,
+                         SourceStack *stack) const;
+
   // map from cu_offset to the CompileUnit.
   std::map<uint32_t, llvm::DWARFUnit *> unit_map_;
   llvm::object::OwningBinary<llvm::object::ObjectFile> binary_;
@@ -63,9 +176,10 @@ class LLVMAddr2line : public Addr2line {
 #else
 class AddressQuery;
 class InlineStackHandler;
-class LineIdentifier;
+struct LineIdentifier;
 class ElfReader;
 class AddressToLineMap;
+class SubprogramInfo;
 
 class Google3Addr2line : public Addr2line {
  public:
@@ -74,8 +188,22 @@ class Google3Addr2line : public Addr2line {
   virtual ~Google3Addr2line();
   virtual bool Prepare();
   virtual void GetInlineStack(uint64_t address, SourceStack *stack) const;
+  // Walks the line map forward from the entry of the previous address, and
+  // reuses its subprogram while the addresses stay in its range.
+  virtual void GetInlineStacks(absl::Span<const uint64_t> addrs,
+                               SourceStack *stacks) const;
+  // Only reads the line map.
+  virtual void GetLineRanges(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<std::pair<uint64_t, SourceInfo>> *ranges) const;
 
  private:
+  // Appends to STACK the inline stack of the line LI in the subprogram
+  // SUBPROG, which may be NULL.
+  void AppendInlineStack(const LineIdentifier &LI,
+                         const SubprogramInfo *subprog,
+                         SourceStack *stack) const;
+
   AddressToLineMap *line_map_;
   InlineStackHandler *inline_stack_handler_;
   ElfReader *elf_;
@@ -0,0 +1,147 @@
+// Bump allocator for the profile data structures.
+
+#ifndef AUTOFDO_ARENA_H_
+#define AUTOFDO_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+
+namespace devtools_crosstool_autofdo {
+
+// Allocates objects out of large blocks, and releases them all at once when
+// it is destroyed. The objects with a non-trivial destructor are destroyed
+// then, in the reverse order of their allocation.
+//
+// Memory is never returned before that, so the arena suits data structures
+// which mostly grow, like the symbols of a profile. The arena is not
+// thread-safe.
+class Arena {
+ public:
+  Arena() = default;
+
+  ~Arena() {
+    for (Cleanup *cleanup = cleanups_; cleanup != nullptr;
+         cleanup = cleanup->next) {
+      cleanup->destroy(cleanup->object);
+    }
+    for (char *block : blocks_) free(block);
+  }
+
+  // Returns SIZE bytes aligned on ALIGNMENT, which must be a power of two.
+  void *Allocate(size_t size, size_t alignment) {
+    num_allocations_++;
+    bytes_allocated_ += size;
+    uintptr_t start = (reinterpret_cast<uintptr_t>(ptr_) + alignment - 1) &
+                      ~(alignment - 1);
+    if (ptr_ == nullptr ||
+        start + size > reinterpret_cast<uintptr_t>(end_)) {
+      // A large allocation gets a block of its own, so that the current
+      // block keeps its free space.
+      if (size + alignment > kBlockSize / 4) {
+        return AlignUp(NewBlock(size + alignment), alignment);
+      }
+      ptr_ = NewBlock(kBlockSize);
+      end_ = ptr_ + kBlockSize;
+      start = reinterpret_cast<uintptr_t>(AlignUp(ptr_, alignment));
+    }
+    ptr_ = reinterpret_cast<char *>(start + size);
+    return reinterpret_cast<void *>(start);
+  }
+
+  // Constructs a T from ARGS in the arena.
+  template <class T, class... Args>
+  T *New(Args &&... args) {
+    T *object = new (Allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      Cleanup *cleanup = new (Allocate(sizeof(Cleanup), alignof(Cleanup)))
+          Cleanup{[](void *object) { static_cast<T *>(object)->~T(); },
+                  object, cleanups_};
+      cleanups_ = cleanup;
+    }
+    return object;
+  }
+
+  // The number of allocations and of bytes requested from the arena.
+  uint64_t num_allocations() const { return num_allocations_; }
+  uint64_t bytes_allocated() const { return bytes_allocated_; }
+  // The number of bytes the arena holds, free space included.
+  uint64_t bytes_reserved() const { return bytes_reserved_; }
+
+ private:
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  // An object to destroy with the arena.
+  struct Cleanup {
+    void (*destroy)(void *);
+    void *object;
+    Cleanup *next;
+  };
+
+  static char *AlignUp(char *ptr, size_t alignment) {
+    return reinterpret_cast<char *>(
+        (reinterpret_cast<uintptr_t>(ptr) + alignment - 1) & ~(alignment - 1));
+  }
+
+  char *NewBlock(size_t size) {
+    char *block = static_cast<char *>(malloc(size));
+    CHECK(block != nullptr) << "Cannot allocate " << size << " bytes";
+    blocks_.push_back(block);
+    bytes_reserved_ += size;
+    return block;
+  }
+
+  // The free space of the current block.
+  char *ptr_ = nullptr;
+  char *end_ = nullptr;
+  std::vector<char *> blocks_;
+  Cleanup *cleanups_ = nullptr;
+  uint64_t num_allocations_ = 0;
+  uint64_t bytes_allocated_ = 0;
+  uint64_t bytes_reserved_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// Allocator of the standard and of the absl containers which allocates their
+// nodes and their tables in an Arena. The memory freed by the container is
+// only reclaimed with the arena.
+template <class T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena *arena) : arena_(arena) {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, size_t) {}
+
+  Arena *arena() const { return arena_; }
+
+  template <class U>
+  bool operator==(const ArenaAllocator<U> &other) const {
+    return arena_ == other.arena();
+  }
+  template <class U>
+  bool operator!=(const ArenaAllocator<U> &other) const {
+    return arena_ != other.arena();
+  }
+
+ private:
+  Arena *arena_;
+};
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_ARENA_H_
@@ -0,0 +1,74 @@
+// Alignment, large blocks, destructors and containers of Arena allocations.
+
+#include "arena.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using devtools_crosstool_autofdo::Arena;
+using devtools_crosstool_autofdo::ArenaAllocator;
+
+// Counts its destructions.
+struct Counted {
+  explicit Counted(int *destroyed) : destroyed(destroyed) {}
+  ~Counted() { (*destroyed)++; }
+  int *destroyed;
+};
+
+TEST(ArenaTest, AlignsAllocations) {
+  Arena arena;
+  for (size_t alignment : {1, 2, 8, 16, 64}) {
+    arena.Allocate(1, 1);
+    void *ptr = arena.Allocate(3, alignment);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignment, 0);
+  }
+  EXPECT_EQ(arena.num_allocations(), 10);
+  EXPECT_EQ(arena.bytes_allocated(), 20);
+}
+
+TEST(ArenaTest, LargeAllocations) {
+  Arena arena;
+  char *small = static_cast<char *>(arena.Allocate(16, 8));
+  char *large = static_cast<char *>(arena.Allocate(1 << 20, 8));
+  char *next = static_cast<char *>(arena.Allocate(16, 8));
+  // The large allocation does not waste the current block.
+  EXPECT_EQ(next, small + 16);
+  large[(1 << 20) - 1] = 1;
+  EXPECT_GE(arena.bytes_reserved(), (1 << 20) + 32);
+}
+
+TEST(ArenaTest, DestroysObjects) {
+  int destroyed = 0;
+  {
+    Arena arena;
+    for (int i = 0; i < 10000; ++i) {
+      EXPECT_EQ(arena.New<Counted>(&destroyed)->destroyed, &destroyed);
+    }
+    EXPECT_EQ(*arena.New<uint64_t>(42), 42);
+    EXPECT_EQ(destroyed, 0);
+  }
+  EXPECT_EQ(destroyed, 10000);
+}
+
+TEST(ArenaTest, Containers) {
+  Arena arena;
+  typedef std::map<uint64_t, std::string, std::less<uint64_t>,
+                   ArenaAllocator<std::pair<const uint64_t, std::string>>>
+      Map;
+  Map *map = arena.New<Map>(Map::allocator_type(&arena));
+  const uint64_t num_allocations = arena.num_allocations();
+  for (uint64_t i = 0; i < 1000; ++i) {
+    (*map)[i] = std::to_string(i);
+  }
+  EXPECT_EQ(arena.num_allocations(), num_allocations + 1000);
+  EXPECT_EQ(map->at(999), "999");
+  EXPECT_EQ(map->get_allocator().arena(), &arena);
+}
+}  // namespace
@@ -0,0 +1,48 @@
+#include "branch_stack_cache.h"
+
+#include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/strings/str_format.h"
+
+ABSL_FLAG(uint64_t, lbr_stack_cache_size, 0,
+          "Maximum number of distinct LBR branch stacks counted before they "
+          "are aggregated. Repeated stacks are then translated and aggregated "
+          "once with their multiplicity. 0 disables the cache.");
+
+namespace devtools_crosstool_autofdo {
+
+void BranchStackCache::Add(uint32_t pid, absl::Span<const uint64_t> stack) {
+  ++samples_;
+  if (capacity_ == 0) {
+    ++flushed_stacks_;
+    flush_(pid, stack, 1);
+    return;
+  }
+  lookup_key_.pid = pid;
+  lookup_key_.stack.assign(stack.begin(), stack.end());
+  auto iter = counts_.find(lookup_key_);
+  if (iter != counts_.end()) {
+    ++hits_;
+    ++iter->second;
+    return;
+  }
+  if (counts_.size() >= capacity_) {
+    Flush();
+  }
+  counts_.emplace(lookup_key_, 1);
+}
+
+void BranchStackCache::Flush() {
+  for (const auto &[key, count] : counts_) {
+    flush_(key.pid, key.stack, count);
+  }
+  flushed_stacks_ += counts_.size();
+  counts_.clear();
+}
+
+std::string BranchStackCache::StatsString() const {
+  return absl::StrFormat(
+      "%u samples, %u distinct stacks aggregated, %.2f%% cache hit rate",
+      samples_, flushed_stacks_, hit_rate() * 100);
+}
+
+}  // namespace devtools_crosstool_autofdo
@@ -0,0 +1,94 @@
+// Pre-aggregation of repeated LBR branch stacks.
+
+#ifndef AUTOFDO_BRANCH_STACK_CACHE_H_
+#define AUTOFDO_BRANCH_STACK_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/commandlineflags.h"
+#include "base/macros.h"
+#include "third_party/abseil/absl/container/flat_hash_map.h"
+#include "third_party/abseil/absl/flags/declare.h"
+#include "third_party/abseil/absl/types/span.h"
+
+ABSL_DECLARE_FLAG(uint64_t, lbr_stack_cache_size);
+
+namespace devtools_crosstool_autofdo {
+
+// Counts identical branch stacks before they are aggregated.
+//
+// LBR samples taken in tight loops carry the same branch stack over and over.
+// Instead of translating and aggregating every entry of every sample, the
+// samples are first hashed into a bounded table of distinct stacks with their
+// multiplicities. Each distinct stack is handed once to the flush callback
+// with its count, when the table is full and when Flush() is called.
+//
+// A stack is an opaque sequence of words chosen by the caller, along with the
+// pid of the sampled process. It must contain everything that the flush
+// callback needs to process the sample, e.g. the raw addresses when the
+// mapping from runtime addresses to the binary is fixed for a given pid.
+class BranchStackCache {
+ public:
+  // Processes STACK, sampled in process PID, COUNT times.
+  typedef std::function<void(uint32_t pid, absl::Span<const uint64_t> stack,
+                             uint64_t count)>
+      FlushCallback;
+
+  // Creates a cache holding at most CAPACITY distinct stacks. With a capacity
+  // of 0, every stack is passed straight to FLUSH.
+  BranchStackCache(size_t capacity, FlushCallback flush)
+      : capacity_(capacity), flush_(std::move(flush)) {}
+
+  // Counts one sample of STACK.
+  void Add(uint32_t pid, absl::Span<const uint64_t> stack);
+
+  // Hands all the cached stacks to the flush callback, and empties the cache.
+  // Must be called once all the samples have been added.
+  void Flush();
+
+  // Number of samples added.
+  uint64_t samples() const { return samples_; }
+  // Number of samples whose stack was already in the cache.
+  uint64_t hits() const { return hits_; }
+  // Number of stacks handed to the flush callback.
+  uint64_t flushed_stacks() const { return flushed_stacks_; }
+  double hit_rate() const {
+    return samples_ ? static_cast<double>(hits_) / samples_ : 0;
+  }
+  // Returns the statistics above in a human readable form.
+  std::string StatsString() const;
+
+ private:
+  struct Key {
+    uint32_t pid;
+    std::vector<uint64_t> stack;
+
+    bool operator==(const Key &other) const {
+      return pid == other.pid && stack == other.stack;
+    }
+    template <typename H>
+    friend H AbslHashValue(H h, const Key &key) {
+      return H::combine(std::move(h), key.pid, key.stack);
+    }
+  };
+
+  const size_t capacity_;
+  const FlushCallback flush_;
+  absl::flat_hash_map<Key, uint64_t> counts_;
+  // Reused for lookups so that hits do not allocate.
+  Key lookup_key_;
+  uint64_t samples_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t flushed_stacks_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(BranchStackCache);
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_BRANCH_STACK_CACHE_H_
@@ -0,0 +1,59 @@
+// Stack counts flushed by a BranchStackCache of any capacity.
+
+#include "branch_stack_cache.h"
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using devtools_crosstool_autofdo::BranchStackCache;
+
+typedef std::map<std::pair<uint32_t, std::vector<uint64_t>>, uint64_t>
+    StackCounts;
+
+// Adds 1000 samples of 10 distinct stacks over 2 pids to a cache of CAPACITY,
+// and returns the stack counts received by the flush callback. HITS is set
+// to the number of cache hits.
+StackCounts AddSamples(size_t capacity, uint64_t *hits) {
+  StackCounts counts;
+  BranchStackCache cache(
+      capacity,
+      [&](uint32_t pid, absl::Span<const uint64_t> stack, uint64_t count) {
+        counts[{pid, std::vector<uint64_t>(stack.begin(), stack.end())}] +=
+            count;
+      });
+  for (uint64_t i = 0; i < 1000; ++i) {
+    std::vector<uint64_t> stack = {i % 5, 0x1000, 0x2000 + i % 5};
+    cache.Add(i % 2, stack);
+  }
+  cache.Flush();
+  EXPECT_EQ(cache.samples(), 1000);
+  *hits = cache.hits();
+  return counts;
+}
+
+TEST(BranchStackCacheTest, CountsStacks) {
+  uint64_t hits = 0;
+  StackCounts counts = AddSamples(64, &hits);
+  ASSERT_EQ(counts.size(), 10);
+  for (const auto &[stack, count] : counts) {
+    EXPECT_EQ(count, 100);
+  }
+  // Only the first sample of each stack is a miss.
+  EXPECT_EQ(hits, 990);
+}
+
+TEST(BranchStackCacheTest, SmallCapacity) {
+  uint64_t hits = 0;
+  StackCounts expected = AddSamples(64, &hits);
+  EXPECT_EQ(AddSamples(0, &hits), expected);
+  EXPECT_EQ(hits, 0);
+  EXPECT_EQ(AddSamples(3, &hits), expected);
+}
+
+}  // namespace
@@ -0,0 +1,129 @@
+// Benchmark comparing the sample counter containers.
+//
+// The address, range and branch counters of the given perf.data files are
+// replayed, one increment per sample in a shuffled order, into a std::map and
+// into a FlatCountMap. For each container the insert throughput and the growth
+// of the resident set size are reported. For example:
+//
+//   count_map_benchmark --perf_data="testdata/perf-kernel.data;testdata/perf-vmlinux.data"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base/logging.h"
+#include "flat_count_map.h"
+#include "sample_reader.h"
+#include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/flags/parse.h"
+#include "third_party/abseil/absl/flags/usage.h"
+#include "third_party/abseil/absl/strings/str_split.h"
+#include "third_party/abseil/absl/time/clock.h"
+#include "third_party/abseil/absl/time/time.h"
+
+ABSL_FLAG(std::string, perf_data,
+          "testdata/perf-kernel.data;testdata/perf-vmlinux.data",
+          "perf.data files to replay, separated by ';'.");
+ABSL_FLAG(std::string, focus_binary_re, "",
+          "RE for the binary whose samples are replayed, all by default.");
+ABSL_FLAG(uint64_t, max_increments, 20000000,
+          "Maximum number of increments replayed per counter type.");
+
+namespace {
+using devtools_crosstool_autofdo::Branch;
+using devtools_crosstool_autofdo::FlatCountMap;
+using devtools_crosstool_autofdo::PerfDataSampleReader;
+using devtools_crosstool_autofdo::Range;
+
+// Returns the resident set size of this process in bytes.
+uint64_t ResidentBytes() {
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp == nullptr) return 0;
+  uint64_t size = 0, resident = 0;
+  if (fscanf(fp, "%lu %lu", &size, &resident) != 2) resident = 0;
+  fclose(fp);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Expands the counters into one key per increment, in a deterministic random
+// order.
+template <class Key, class CountMap>
+std::vector<Key> GetIncrements(const CountMap &counts) {
+  uint64_t total = 0;
+  for (const auto &[key, count] : counts) total += count;
+  const uint64_t max_increments = absl::GetFlag(FLAGS_max_increments);
+  const double scale =
+      total > max_increments ? static_cast<double>(max_increments) / total : 1;
+  std::vector<Key> increments;
+  for (const auto &[key, count] : counts) {
+    uint64_t n = std::max<uint64_t>(1, count * scale);
+    increments.insert(increments.end(), n, key);
+  }
+  std::shuffle(increments.begin(), increments.end(), std::mt19937_64(42));
+  return increments;
+}
+
+// A FlatCountMap is sorted before its counters are read in order.
+template <class CountMap>
+void Freeze(CountMap *counts) {}
+
+template <class Key>
+void Freeze(FlatCountMap<Key> *counts) {
+  counts->Freeze();
+}
+
+template <class CountMap, class Key>
+void Replay(const char *container, const char *counter,
+            const std::vector<Key> &increments) {
+  const uint64_t rss_before = ResidentBytes();
+  const absl::Time start = absl::Now();
+  CountMap *counts = new CountMap();
+  for (const Key &key : increments) ++(*counts)[key];
+  // Reading the counters in order is part of the cost.
+  Freeze(counts);
+  uint64_t checksum = 0;
+  for (const auto &[key, count] : *counts) checksum += count;
+  const absl::Duration elapsed = absl::Now() - start;
+  const uint64_t rss_after = ResidentBytes();
+  CHECK_EQ(checksum, increments.size());
+  printf("%-14s %-8s %10zu keys %12zu incs %10.2f M incs/s %10.2f MiB\n",
+         container, counter, counts->size(), increments.size(),
+         increments.size() / absl::ToDoubleMicroseconds(elapsed),
+         (rss_after - rss_before) / 1048576.0);
+  delete counts;
+}
+
+template <class Key, class CountMap>
+void Benchmark(const char *counter, const CountMap &counts) {
+  std::vector<Key> increments = GetIncrements<Key>(counts);
+  Replay<std::map<Key, uint64_t>>("std::map", counter, increments);
+  Replay<FlatCountMap<Key>>("FlatCountMap", counter, increments);
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  absl::SetProgramUsageMessage(argv[0]);
+  absl::ParseCommandLine(argc, argv);
+
+  std::vector<std::string> profiles =
+      absl::StrSplit(absl::GetFlag(FLAGS_perf_data), ';', absl::SkipEmpty());
+  for (const std::string &profile : profiles) {
+    PerfDataSampleReader reader(profile, absl::GetFlag(FLAGS_focus_binary_re),
+                                "");
+    if (!reader.ReadAndSetTotalCount()) {
+      LOG(ERROR) << "Cannot read " << profile;
+      return 1;
+    }
+    printf("%s\n", profile.c_str());
+    Benchmark<uint64_t>("address", reader.address_count_map());
+    Benchmark<Range>("range", reader.range_count_map());
+    Benchmark<Branch>("branch", reader.branch_count_map());
+  }
+  return 0;
+}
@@ -6,9 +6,9 @@
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/strings/match.h"
 #if defined(HAVE_LLVM)
-#include <fstream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base/commandlineflags.h"
 #include "base/logging.h"
@@ -16,19 +16,20 @@
 #include "llvm_propeller_options.pb.h"
 #include "llvm_propeller_options_builder.h"
 #include "llvm_propeller_profile_writer.h"
+#include "perf_sample_filter.h"
 #include "profile_creator.h"
+#include "sample_reader.h"
 #include "third_party/abseil/absl/status/status.h"
-#include "third_party/abseil/absl/strings/str_split.h"
 #include "third_party/abseil/absl/flags/parse.h"
 #include "third_party/abseil/absl/flags/usage.h"
 
 ABSL_FLAG(std::string, profile, "perf.data",
-          "Input profile file name. When --format=propeller, this accepts "
-          "multiple profile file names concatnated by ';' and if the file name "
-          "has prefix \"@\", then the profile is treated as a list file whose "
-          "lines are interpreted as input profile paths.");
+          "Input profile file name. This accepts multiple profile file names "
+          "concatnated by ';' and if the file name has prefix \"@\", then the "
+          "profile is treated as a list file whose lines are interpreted as "
+          "input profile paths. Multiple profiles are merged.");
 ABSL_FLAG(std::string, profiler, "perf",
-          "Input profile type. Possible values: perf, text, or prefetch");
+          "Input profile type. Possible values: perf, text, binary, or prefetch");
 ABSL_FLAG(std::string, prefetch_hints, "", "Input cache prefetch hints");
 ABSL_FLAG(std::string, out, "", "Output profile file name");
 ABSL_FLAG(std::string, gcov, "",
@@ -107,22 +108,18 @@ ABSL_FLAG(bool, propeller_layout_only, false,
           "hot ones. Default to \"false\". Mutually exclusive with "
           "--propeller_split_only. Only valid when --format=propeller.");
 
-devtools_crosstool_autofdo::PropellerOptions CreatePropellerOptionsFromFlags() {
+devtools_crosstool_autofdo::PropellerOptions CreatePropellerOptionsFromFlags(
+    const devtools_crosstool_autofdo::PerfSampleFilter &sample_filter) {
   devtools_crosstool_autofdo::PropellerOptionsBuilder option_builder;
-  std::string pstr = absl::GetFlag(FLAGS_profile);
-  if (!pstr.empty() && pstr[0] == '@') {
-    std::ifstream fin(pstr.substr(1));
-    std::string pf;
-    while (std::getline(fin, pf)) {
-      if (!pf.empty() && pf[0] != '#') {
-        option_builder.AddPerfNames(pf);
-      }
-    }
-  } else {
-    std::vector<std::string> perf_files = absl::StrSplit(pstr, ';');
-    for (const std::string &pf : perf_files)
-      if (!pf.empty()) option_builder.AddPerfNames(pf);
-  }
+  for (const std::string &pf : devtools_crosstool_autofdo::GetProfileNames(
+           absl::GetFlag(FLAGS_profile)))
+    option_builder.AddPerfNames(pf);
+  for (uint32_t pid : sample_filter.pids())
+    option_builder.AddPerfSamplePids(pid);
+  for (uint32_t tid : sample_filter.tids())
+    option_builder.AddPerfSampleTids(tid);
+  for (uint32_t cpu : sample_filter.cpus())
+    option_builder.AddPerfSampleCpus(cpu);
   if (!absl::GetFlag(FLAGS_propeller_cfg_dump_dir).empty()) {
     option_builder.SetCfgDumpDirName(
         absl::GetFlag(FLAGS_propeller_cfg_dump_dir));
@@ -151,6 +148,12 @@ devtools_crosstool_autofdo::PropellerOptions CreatePropellerOptionsFromFlags() {
           .SetCodeLayoutParamsInterFunctionReordering(
               absl::GetFlag(FLAGS_propeller_inter_function_ordering))
           .SetHttp(absl::GetFlag(FLAGS_http))
+          .SetPerfSampleDownsampleFactor(
+              absl::GetFlag(FLAGS_perf_downsample_factor))
+          .SetPerfSampleDownsampleSeed(
+              absl::GetFlag(FLAGS_perf_downsample_seed))
+          .SetPerfSampleMinTimeNs(sample_filter.min_time_ns())
+          .SetPerfSampleMaxTimeNs(sample_filter.max_time_ns())
           .SetVerboseClusterOutput(
               absl::GetFlag(FLAGS_propeller_verbose_cluster_output)));
 }
@@ -193,8 +196,13 @@ int main(int argc, char **argv) {
                     "--propeller_split_only can be used.";
       return 1;
     }
+    devtools_crosstool_autofdo::PerfSampleFilter sample_filter;
+    if (!devtools_crosstool_autofdo::PerfSampleFilter::FromFlags(
+            &sample_filter)) {
+      return 1;
+    }
     absl::Status status = devtools_crosstool_autofdo::GeneratePropellerProfiles(
-        CreatePropellerOptionsFromFlags());
+        CreatePropellerOptionsFromFlags(sample_filter));
     if (!status.ok()) {
       LOG(ERROR) << status;
       return 1;
@@ -202,18 +210,11 @@ int main(int argc, char **argv) {
     return 0;
   }
 
-  // Make sure "--profile" does not contain multiple perf files when dealing
-  // with non-propeller profiles.
-  if (absl::StrContains(absl::GetFlag(FLAGS_profile), ";")) {
-    LOG(ERROR) << "Multiple profiles are only supported under "
-                  "--format=propeller. (Please check ';' in the filename)";
-    return 1;
-  }
-  // "--profile=@list_file" is only supported when --format=propeller.
-  if (!absl::GetFlag(FLAGS_profile).empty() &&
-      absl::GetFlag(FLAGS_profile)[0] == '@') {
-    LOG(ERROR) << "Profile list file is only supported under "
-                  "--format=propeller. (Please check '@' in the filename)";
+  std::vector<std::string> profile_names =
+      devtools_crosstool_autofdo::GetProfileNames(absl::GetFlag(FLAGS_profile));
+  if (profile_names.empty()) {
+    LOG(ERROR) << "No input profile found in --profile="
+               << absl::GetFlag(FLAGS_profile);
     return 1;
   }
 
@@ -244,7 +245,7 @@ int main(int argc, char **argv) {
   devtools_crosstool_autofdo::ProfileCreator creator(
       absl::GetFlag(FLAGS_binary));
   absl::SetFlag(&FLAGS_use_discriminator_encoding, true);
-  if (creator.CreateProfile(absl::GetFlag(FLAGS_profile),
+  if (creator.CreateProfile(profile_names,
                             absl::GetFlag(FLAGS_profiler), writer.get(),
                             absl::GetFlag(FLAGS_out),
                             absl::GetFlag(FLAGS_prof_sym_list))) {
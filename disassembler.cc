@@ -0,0 +1,329 @@
+// Class to disassemble the functions of a binary.
+
+#include "disassembler.h"
+
+#include <string.h>
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/MC/MCInstrDesc.h"
+#include "llvm/MC/MCTargetOptions.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/MC/TargetRegistry.h"
+#else
+#include "llvm/Support/TargetRegistry.h"
+#endif
+
+namespace devtools_crosstool_autofdo {
+namespace {
+// Largest number of entries read from a jump table whose size is not known.
+constexpr uint64 kMaxJumpTableEntries = 1 << 16;
+
+// Operand indices of an x86 memory reference, from its first operand.
+constexpr int kMemBase = 0;
+constexpr int kMemScale = 1;
+constexpr int kMemIndex = 2;
+constexpr int kMemDisp = 3;
+
+void InitializeTargets() {
+  static std::once_flag initialized;
+  std::call_once(initialized, [] {
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllDisassemblers();
+  });
+}
+
+// Returns true if operands [FIRST, FIRST + 4) of INST are a memory reference
+// without segment, whose displacement is an immediate.
+bool IsMemoryReference(const llvm::MCInst &inst, int first) {
+  return inst.getNumOperands() >= first + 5 &&
+         inst.getOperand(first + kMemBase).isReg() &&
+         inst.getOperand(first + kMemScale).isImm() &&
+         inst.getOperand(first + kMemIndex).isReg() &&
+         inst.getOperand(first + kMemDisp).isImm();
+}
+}  // namespace
+
+bool Disassembler::Init(const std::string &binary_name) {
+  InitializeTargets();
+  auto binary_or_err =
+      llvm::object::ObjectFile::createObjectFile(llvm::StringRef(binary_name));
+  if (!binary_or_err) {
+    LOG(ERROR) << "Cannot read " << binary_name << ": "
+               << llvm::toString(binary_or_err.takeError());
+    return false;
+  }
+  binary_ = std::move(binary_or_err.get());
+  const llvm::object::ObjectFile *object = binary_.getBinary();
+
+  const std::string triple = object->makeTriple().getTriple();
+  std::string error;
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (target == nullptr) {
+    LOG(ERROR) << "Cannot disassemble " << binary_name << ": " << error;
+    return false;
+  }
+  register_info_.reset(target->createMCRegInfo(triple));
+  if (register_info_ != nullptr) {
+    asm_info_.reset(target->createMCAsmInfo(*register_info_, triple,
+                                            llvm::MCTargetOptions()));
+  }
+  subtarget_info_.reset(target->createMCSubtargetInfo(triple, "", ""));
+  instr_info_.reset(target->createMCInstrInfo());
+  if (register_info_ == nullptr || asm_info_ == nullptr ||
+      subtarget_info_ == nullptr || instr_info_ == nullptr) {
+    LOG(ERROR) << "Cannot disassemble " << binary_name
+               << ": no MC support for " << triple;
+    return false;
+  }
+  context_ = std::make_unique<llvm::MCContext>(
+      llvm::Triple(triple), asm_info_.get(), register_info_.get(),
+      subtarget_info_.get());
+  disassembler_.reset(target->createMCDisassembler(*subtarget_info_, *context_));
+  instr_analysis_.reset(target->createMCInstrAnalysis(instr_info_.get()));
+  if (disassembler_ == nullptr || instr_analysis_ == nullptr) {
+    LOG(ERROR) << "Cannot disassemble " << binary_name
+               << ": no disassembler for " << triple;
+    return false;
+  }
+
+  sections_.clear();
+  for (const llvm::object::SectionRef &section : object->sections()) {
+    if (section.isBSS() || section.isVirtual() || section.getAddress() == 0) {
+      continue;
+    }
+    llvm::Expected<llvm::StringRef> contents = section.getContents();
+    if (!contents) {
+      llvm::consumeError(contents.takeError());
+      continue;
+    }
+    sections_.push_back({section.getAddress(), *contents, section.isText()});
+  }
+  return true;
+}
+
+const Disassembler::Section *Disassembler::FindSection(uint64 addr,
+                                                       uint64 size) const {
+  for (const Section &section : sections_) {
+    if (addr >= section.address &&
+        addr - section.address <= section.contents.size() &&
+        size <= section.contents.size() - (addr - section.address)) {
+      return &section;
+    }
+  }
+  return nullptr;
+}
+
+bool Disassembler::ReadJumpTableEntry(const JumpTable &table, uint64 index,
+                                      uint64 *target) const {
+  const uint64 addr = table.address + index * table.entry_size;
+  const Section *section = FindSection(addr, table.entry_size);
+  if (section == nullptr) {
+    return false;
+  }
+  const char *entry = section->contents.data() + (addr - section->address);
+  if (table.entry_size == 8) {
+    uint64_t value;
+    memcpy(&value, entry, sizeof(value));
+    *target = value;
+  } else {
+    int32_t value;
+    memcpy(&value, entry, sizeof(value));
+    *target = table.relative ? table.address + value
+                             : static_cast<uint32_t>(value);
+  }
+  return true;
+}
+
+std::vector<uint64> Disassembler::GetJumpTableTargets(
+    const llvm::MCInst &inst,
+    const std::map<unsigned, JumpTable> &reg_jump_tables, uint64 max_entries,
+    uint64 start_addr, uint64 end_addr) const {
+  const llvm::StringRef name = instr_info_->getName(inst.getOpcode());
+  JumpTable table;
+  if (name == "JMP64m" && IsMemoryReference(inst, 0) &&
+      inst.getOperand(kMemBase).getReg() == 0 &&
+      inst.getOperand(kMemScale).getImm() == 8 &&
+      inst.getOperand(kMemIndex).getReg() != 0) {
+    // jmp *table(,%index,8)
+    table = {static_cast<uint64>(inst.getOperand(kMemDisp).getImm()), 8,
+             false};
+  } else if (inst.getNumOperands() == 1 && inst.getOperand(0).isReg() &&
+             reg_jump_tables.count(inst.getOperand(0).getReg())) {
+    table = reg_jump_tables.at(inst.getOperand(0).getReg());
+  } else {
+    return {};
+  }
+
+  std::vector<uint64> targets;
+  const uint64 num_entries = max_entries ? max_entries : kMaxJumpTableEntries;
+  for (uint64 i = 0; i < num_entries; ++i) {
+    uint64 target;
+    if (!ReadJumpTableEntry(table, i, &target) || target < start_addr ||
+        target >= end_addr) {
+      break;
+    }
+    targets.push_back(target);
+  }
+  return targets;
+}
+
+bool Disassembler::DisassembleRange(uint64 start_addr, uint64 end_addr) {
+  addr_set_.clear();
+  const Section *section =
+      start_addr < end_addr ? FindSection(start_addr, end_addr - start_addr)
+                            : nullptr;
+  if (disassembler_ == nullptr || section == nullptr || !section->executable) {
+    return false;
+  }
+  const llvm::ArrayRef<uint8_t> bytes(
+      reinterpret_cast<const uint8_t *>(section->contents.data()) +
+          (start_addr - section->address),
+      end_addr - start_addr);
+
+  // The jump tables are recognized from the instructions which load them
+  // into registers, in the same basic block as the indirect jump: those
+  // loading their absolute entries
+  //   mov table(,%index,8),%reg
+  // or, in position independent code, their entries relative to the table
+  //   lea table(%rip),%base
+  //   movslq (%base,%index,4),%reg
+  //   add %base,%reg
+  // The number of entries is the bound of the index checked before, by
+  //   cmp $max_index,%index
+  std::map<unsigned, uint64> reg_addresses;
+  std::map<unsigned, JumpTable> reg_jump_tables;
+  uint64 max_entries = 0;
+  auto clobber = [&](unsigned reg) {
+    for (auto it = reg_addresses.begin(); it != reg_addresses.end();) {
+      it = register_info_->isSuperOrSubRegisterEq(it->first, reg)
+               ? reg_addresses.erase(it)
+               : std::next(it);
+    }
+    for (auto it = reg_jump_tables.begin(); it != reg_jump_tables.end();) {
+      it = register_info_->isSuperOrSubRegisterEq(it->first, reg)
+               ? reg_jump_tables.erase(it)
+               : std::next(it);
+    }
+  };
+  auto end_block = [&]() {
+    reg_addresses.clear();
+    reg_jump_tables.clear();
+    max_entries = 0;
+  };
+
+  for (uint64 offset = 0; offset < bytes.size();) {
+    const uint64 addr = start_addr + offset;
+    llvm::MCInst inst;
+    uint64_t size;
+    if (disassembler_->getInstruction(inst, size, bytes.slice(offset), addr,
+                                      llvm::nulls()) !=
+            llvm::MCDisassembler::Success ||
+        size == 0) {
+      LOG(WARNING) << "Cannot disassemble the instruction at 0x" << std::hex
+                   << addr;
+      return false;
+    }
+    addr_set_.insert(addr);
+    offset += size;
+
+    const llvm::MCInstrDesc &desc = instr_info_->get(inst.getOpcode());
+    uint64_t target;
+    if (desc.isReturn()) {
+      HandleTerminator(addr);
+      end_block();
+    } else if (desc.isCall()) {
+      if (instr_analysis_->evaluateBranch(inst, addr, size, target)) {
+        HandleDirectCall(addr, target);
+      }
+      end_block();
+    } else if (desc.isConditionalBranch()) {
+      if (instr_analysis_->evaluateBranch(inst, addr, size, target)) {
+        HandleConditionalJump(addr, addr + size, target);
+      }
+    } else if (desc.isUnconditionalBranch()) {
+      if (instr_analysis_->evaluateBranch(inst, addr, size, target)) {
+        HandleUnconditionalJump(addr, target);
+      }
+      end_block();
+    } else if (desc.isIndirectBranch()) {
+      HandleIndirectJump(addr,
+                         GetJumpTableTargets(inst, reg_jump_tables, max_entries,
+                                             start_addr, end_addr));
+      end_block();
+    } else {
+      const llvm::StringRef name = instr_info_->getName(inst.getOpcode());
+      if (name.startswith("CMP") && inst.getNumOperands() > 0 &&
+          inst.getOperand(inst.getNumOperands() - 1).isImm()) {
+        const int64_t max_index =
+            inst.getOperand(inst.getNumOperands() - 1).getImm();
+        max_entries =
+            max_index >= 0 && static_cast<uint64>(max_index) <
+                                  kMaxJumpTableEntries
+                ? max_index + 1
+                : 0;
+        continue;
+      }
+      if (desc.getNumDefs() == 0 || !inst.getOperand(0).isReg()) {
+        continue;
+      }
+      // Find what the instruction loads into its destination register before
+      // forgetting what the register held.
+      const unsigned dest = inst.getOperand(0).getReg();
+      bool has_address = false;
+      uint64 address = 0;
+      bool has_jump_table = false;
+      JumpTable table;
+      if (name == "LEA64r" && IsMemoryReference(inst, 1) &&
+          register_info_->getName(inst.getOperand(1 + kMemBase).getReg()) ==
+              llvm::StringRef("RIP") &&
+          inst.getOperand(1 + kMemIndex).getReg() == 0) {
+        has_address = true;
+        address = addr + size + inst.getOperand(1 + kMemDisp).getImm();
+      } else if (name == "MOV64rm" && IsMemoryReference(inst, 1) &&
+                 inst.getOperand(1 + kMemBase).getReg() == 0 &&
+                 inst.getOperand(1 + kMemScale).getImm() == 8 &&
+                 inst.getOperand(1 + kMemIndex).getReg() != 0) {
+        has_jump_table = true;
+        table = {static_cast<uint64>(inst.getOperand(1 + kMemDisp).getImm()),
+                 8, false};
+      } else if (name == "MOVSX64rm32" && IsMemoryReference(inst, 1) &&
+                 reg_addresses.count(inst.getOperand(1 + kMemBase).getReg()) &&
+                 inst.getOperand(1 + kMemScale).getImm() == 4 &&
+                 inst.getOperand(1 + kMemIndex).getReg() != 0 &&
+                 inst.getOperand(1 + kMemDisp).getImm() == 0) {
+        has_jump_table = true;
+        table = {reg_addresses.at(inst.getOperand(1 + kMemBase).getReg()), 4,
+                 true};
+      } else if (name == "ADD64rr" && inst.getNumOperands() == 3 &&
+                 reg_jump_tables.count(inst.getOperand(1).getReg()) &&
+                 reg_addresses.count(inst.getOperand(2).getReg()) &&
+                 reg_jump_tables.at(inst.getOperand(1).getReg()).relative &&
+                 reg_jump_tables.at(inst.getOperand(1).getReg()).address ==
+                     reg_addresses.at(inst.getOperand(2).getReg())) {
+        has_jump_table = true;
+        table = reg_jump_tables.at(inst.getOperand(1).getReg());
+      }
+      for (unsigned i = 0; i < desc.getNumDefs(); ++i) {
+        if (inst.getOperand(i).isReg()) clobber(inst.getOperand(i).getReg());
+      }
+      if (has_address) reg_addresses[dest] = address;
+      if (has_jump_table) reg_jump_tables[dest] = table;
+    }
+  }
+  return true;
+}
+
+}  // namespace devtools_crosstool_autofdo
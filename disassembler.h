@@ -0,0 +1,119 @@
+// Class to disassemble the functions of a binary.
+
+#ifndef AUTOFDO_DISASSEMBLER_H_
+#define AUTOFDO_DISASSEMBLER_H_
+
+#if defined(HAVE_LLVM)
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/common.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrAnalysis.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Object/ObjectFile.h"
+
+namespace devtools_crosstool_autofdo {
+
+// Disassembles address ranges of a binary with the LLVM MC disassembler of
+// its architecture, recording the start address of each instruction. The
+// control flow instructions are reported to the Handle* methods, which do
+// nothing by default, together with their targets when they are known.
+class Disassembler {
+ public:
+  Disassembler() = default;
+  virtual ~Disassembler() = default;
+
+  // Reads BINARY_NAME and sets up the disassembler for its architecture.
+  // Returns false if the binary cannot be read, or its architecture is not
+  // supported.
+  bool Init(const std::string &binary_name);
+
+  // Disassembles the instructions of [START_ADDR, END_ADDR), replacing the
+  // start addresses of addr_set_ by those of the instructions of the range.
+  // Returns false if the range is not in an executable section, or does not
+  // decode to a sequence of instructions ending at END_ADDR.
+  bool DisassembleRange(uint64 start_addr, uint64 end_addr);
+
+  // Returns the start addresses of the instructions of the range last given
+  // to DisassembleRange.
+  const std::set<uint64> &addrs() const { return addr_set_; }
+
+ protected:
+  // Called for a conditional jump at ADDR to TARGET, otherwise continuing to
+  // FALL_THROUGH.
+  virtual void HandleConditionalJump(uint64 addr, uint64 fall_through,
+                                     uint64 target) {}
+  // Called for a direct unconditional jump at ADDR to TARGET.
+  virtual void HandleUnconditionalJump(uint64 addr, uint64 target) {}
+  // Called for a direct call at ADDR to TARGET.
+  virtual void HandleDirectCall(uint64 addr, uint64 target) {}
+  // Called for an indirect jump at ADDR. TARGETS are the entries of its jump
+  // table, in order, when it is recognized, and empty otherwise.
+  virtual void HandleIndirectJump(uint64 addr, std::vector<uint64> targets) {}
+  // Called for a return at ADDR.
+  virtual void HandleTerminator(uint64 addr) {}
+
+  std::set<uint64> addr_set_;
+
+ private:
+  // A jump table whose entries are either absolute addresses, or offsets from
+  // the table.
+  struct JumpTable {
+    uint64 address;
+    int entry_size;
+    bool relative;
+  };
+
+  // A section of the binary, with its contents.
+  struct Section {
+    uint64 address;
+    llvm::StringRef contents;
+    bool executable;
+  };
+
+  // Returns the section containing [ADDR, ADDR + SIZE), or nullptr.
+  const Section *FindSection(uint64 addr, uint64 size) const;
+
+  // Returns the targets of the indirect jump INST, whose jump table is read
+  // from its memory operand or found in REG_JUMP_TABLES, the jump tables
+  // loaded into registers by the preceding instructions. The table has
+  // MAX_ENTRIES entries, or as many as there are targets in
+  // [START_ADDR, END_ADDR) if MAX_ENTRIES is 0.
+  std::vector<uint64> GetJumpTableTargets(
+      const llvm::MCInst &inst,
+      const std::map<unsigned, JumpTable> &reg_jump_tables,
+      uint64 max_entries, uint64 start_addr, uint64 end_addr) const;
+
+  // Reads the target of entry INDEX of TABLE into TARGET. Returns false if
+  // the entry is not in the binary.
+  bool ReadJumpTableEntry(const JumpTable &table, uint64 index,
+                          uint64 *target) const;
+
+  llvm::object::OwningBinary<llvm::object::ObjectFile> binary_;
+  std::vector<Section> sections_;
+  std::unique_ptr<const llvm::MCRegisterInfo> register_info_;
+  std::unique_ptr<const llvm::MCAsmInfo> asm_info_;
+  std::unique_ptr<const llvm::MCSubtargetInfo> subtarget_info_;
+  std::unique_ptr<const llvm::MCInstrInfo> instr_info_;
+  std::unique_ptr<llvm::MCContext> context_;
+  std::unique_ptr<const llvm::MCDisassembler> disassembler_;
+  std::unique_ptr<const llvm::MCInstrAnalysis> instr_analysis_;
+
+  DISALLOW_COPY_AND_ASSIGN(Disassembler);
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // HAVE_LLVM
+
+#endif  // AUTOFDO_DISASSEMBLER_H_
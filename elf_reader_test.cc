@@ -0,0 +1,206 @@
+// Reading of the compressed debug sections of a binary, and their cache.
+//
+// compressed_debug.bin is a small C program built with 'gcc -g -O2'. The
+// compressed_debug_{zlib,zstd,zlib_gnu}.bin binaries are copies of it with
+// their debug sections compressed by 'objcopy --compress-debug-sections', so
+// that they decompress to the very same sections, with the same build-id.
+// objcopy leaves .debug_line uncompressed, as compressing it saves nothing.
+
+#include "symbolize/elf_reader.h"
+
+#include <elf.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "third_party/abseil/absl/flags/declare.h"
+#include "third_party/abseil/absl/flags/flag.h"
+
+ABSL_DECLARE_FLAG(std::string, debug_section_cache_dir);
+
+#define FLAGS_test_tmpdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+#define FLAGS_test_srcdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+namespace {
+
+using devtools_crosstool_autofdo::ElfReader;
+
+constexpr char kBuildId[] = "9e9e17ca093bd69af84d7072b19a3025f3d52746";
+
+std::string TestBinary(const std::string &name) {
+  return FLAGS_test_srcdir + "/testdata/" + name;
+}
+
+// Returns the contents of the section NAME of BINARY, or "<missing>".
+std::string ReadSection(const std::string &binary, const std::string &name) {
+  ElfReader reader(binary);
+  size_t size;
+  const char *contents = reader.GetSectionByName(name, &size);
+  if (contents == nullptr) return "<missing>";
+  return std::string(contents, size);
+}
+
+void WriteFile(const std::string &file_name, const std::string &contents) {
+  std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+  file << contents;
+}
+
+std::string ReadFile(const std::string &file_name) {
+  std::ifstream file(file_name, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+class ElfReaderCompressedTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    for (const char *name : {".debug_info", ".debug_abbrev", ".debug_line"}) {
+      const std::string contents =
+          ReadSection(TestBinary("compressed_debug.bin"), name);
+      ASSERT_NE(contents, "<missing>") << name;
+      sections_.emplace_back(name, contents);
+    }
+  }
+
+  void ExpectSameSections(const std::string &binary) {
+    ElfReader reader(TestBinary(binary));
+    EXPECT_EQ(reader.GetBuildId(), kBuildId);
+    for (const auto &[name, contents] : sections_) {
+      size_t size;
+      const char *decompressed = reader.GetSectionByName(name, &size);
+      ASSERT_NE(decompressed, nullptr) << binary << " " << name;
+      EXPECT_EQ(std::string(decompressed, size), contents)
+          << binary << " " << name;
+      ElfReader::SectionInfo info;
+      ASSERT_NE(reader.GetSectionInfoByName(name, &info), nullptr);
+      EXPECT_EQ(info.size, contents.size()) << binary << " " << name;
+      EXPECT_EQ(info.flags & SHF_COMPRESSED, 0) << binary << " " << name;
+    }
+  }
+
+  // The uncompressed debug sections, by name.
+  std::vector<std::pair<std::string, std::string>> sections_;
+};
+
+TEST_F(ElfReaderCompressedTest, DecompressesZlibSections) {
+  ExpectSameSections("compressed_debug_zlib.bin");
+}
+
+TEST_F(ElfReaderCompressedTest, DecompressesZstdSections) {
+#if defined(HAVE_ZSTD)
+  ExpectSameSections("compressed_debug_zstd.bin");
+#else
+  EXPECT_EQ(ReadSection(TestBinary("compressed_debug_zstd.bin"),
+                        ".debug_info"),
+            "<missing>");
+#endif
+}
+
+TEST_F(ElfReaderCompressedTest, DecompressesGnuZdebugSections) {
+  ExpectSameSections("compressed_debug_zlib_gnu.bin");
+}
+
+TEST_F(ElfReaderCompressedTest, DecompressesSectionsConcurrently) {
+  // All the threads read all the sections of the same reader, each in a
+  // different order, so that they race to decompress each section.
+  ElfReader reader(TestBinary("compressed_debug_zlib.bin"));
+  constexpr int kNumThreads = 8;
+  std::vector<std::vector<const char *>> contents(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      contents[t].resize(sections_.size());
+      for (int i = 0; i < sections_.size(); ++i) {
+        const int s = (i + t) % sections_.size();
+        size_t size;
+        contents[t][s] = reader.GetSectionByName(sections_[s].first, &size);
+        if (contents[t][s] != nullptr &&
+            std::string(contents[t][s], size) != sections_[s].second) {
+          contents[t][s] = nullptr;
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+  for (int s = 0; s < sections_.size(); ++s) {
+    ASSERT_NE(contents[0][s], nullptr) << sections_[s].first;
+    // The section is decompressed once, and shared by all the threads.
+    for (int t = 1; t < kNumThreads; ++t) {
+      EXPECT_EQ(contents[t][s], contents[0][s]) << sections_[s].first;
+    }
+  }
+}
+
+class ElfReaderCacheTest : public ElfReaderCompressedTest {
+ protected:
+  void SetUp() override {
+    ElfReaderCompressedTest::SetUp();
+    cache_dir_ = FLAGS_test_tmpdir + "/debug_section_cache";
+    mkdir(cache_dir_.c_str(), 0755);
+    cache_file_ = cache_dir_ + "/" + kBuildId + ".debug_info";
+    remove(cache_file_.c_str());
+    absl::SetFlag(&FLAGS_debug_section_cache_dir, cache_dir_);
+  }
+
+  void TearDown() override {
+    absl::SetFlag(&FLAGS_debug_section_cache_dir, "");
+    for (const auto &[name, contents] : sections_) {
+      remove((cache_dir_ + "/" + kBuildId + name).c_str());
+    }
+    rmdir(cache_dir_.c_str());
+  }
+
+  const std::string &debug_info() const { return sections_[0].second; }
+
+  std::string cache_dir_;
+  std::string cache_file_;
+};
+
+TEST_F(ElfReaderCacheTest, SavesDecompressedSections) {
+  ExpectSameSections("compressed_debug_zlib.bin");
+  EXPECT_EQ(ReadFile(cache_file_), debug_info());
+  EXPECT_EQ(ReadFile(cache_dir_ + "/" + kBuildId + ".debug_abbrev"),
+            sections_[1].second);
+  // Only the compressed sections are saved.
+  EXPECT_NE(access((cache_dir_ + "/" + kBuildId + ".debug_line").c_str(), F_OK),
+            0);
+}
+
+TEST_F(ElfReaderCacheTest, MapsCachedSection) {
+  // A cache file of the right size is used as it is, without decompressing
+  // the section again.
+  const std::string cached(debug_info().size(), 'x');
+  WriteFile(cache_file_, cached);
+  EXPECT_EQ(ReadSection(TestBinary("compressed_debug_zlib.bin"), ".debug_info"),
+            cached);
+  // Uncompressed sections are never read from the cache.
+  EXPECT_EQ(ReadSection(TestBinary("compressed_debug.bin"), ".debug_info"),
+            debug_info());
+}
+
+TEST_F(ElfReaderCacheTest, IgnoresCacheOfOtherBuildId) {
+  const std::string other_file =
+      cache_dir_ + "/0000000000000000000000000000000000000000.debug_info";
+  WriteFile(other_file, std::string(debug_info().size(), 'x'));
+  EXPECT_EQ(ReadSection(TestBinary("compressed_debug_zlib.bin"), ".debug_info"),
+            debug_info());
+  EXPECT_EQ(ReadFile(cache_file_), debug_info());
+  remove(other_file.c_str());
+}
+
+TEST_F(ElfReaderCacheTest, ReplacesTruncatedCacheFile) {
+  WriteFile(cache_file_, debug_info().substr(0, debug_info().size() / 2));
+  EXPECT_EQ(ReadSection(TestBinary("compressed_debug_zlib.bin"), ".debug_info"),
+            debug_info());
+  EXPECT_EQ(ReadFile(cache_file_), debug_info());
+}
+}  // namespace
@@ -0,0 +1,153 @@
+// Counter container used to aggregate samples.
+
+#ifndef AUTOFDO_FLAT_COUNT_MAP_H_
+#define AUTOFDO_FLAT_COUNT_MAP_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "third_party/abseil/absl/container/flat_hash_map.h"
+
+namespace devtools_crosstool_autofdo {
+
+// A map from Key to a uint64_t counter, which is optimized for the way sample
+// counters are used: a long accumulation phase, made of random increments,
+// followed by ordered scans and lookups.
+//
+// While accumulating, the counters are stored in an open addressing hash map,
+// so that each increment is a single probe instead of a red-black tree
+// insertion. Freeze() then moves the counters into a vector sorted by key, so
+// that iteration is ordered and contiguous, and lookups are binary searches.
+//
+// Freezing is an explicit step of the owner of the map: the ordered reads
+// (iteration, find, comparison) CHECK that the map is frozen, and the writes
+// CHECK that it is not, until clear() starts a new accumulation. The const
+// methods never modify the map, so a frozen map can be read concurrently.
+// Merge and MergeAndClear read the other map in either phase.
+template <class Key>
+class FlatCountMap {
+ public:
+  typedef Key key_type;
+  typedef uint64_t mapped_type;
+  typedef std::pair<Key, uint64_t> value_type;
+  typedef typename std::vector<value_type>::const_iterator const_iterator;
+  typedef const_iterator iterator;
+
+  FlatCountMap() = default;
+  FlatCountMap(std::initializer_list<value_type> init) {
+    for (const value_type &entry : init) counts_[entry.first] += entry.second;
+  }
+
+  // Returns the counter of key, inserting a zero counter if needed.
+  uint64_t &operator[](const Key &key) {
+    CHECK(!frozen_) << "Writing to a frozen FlatCountMap.";
+    return counts_[key];
+  }
+
+  // Sorts the counters, after which the map can be read but not written.
+  // Freezing a frozen map does nothing.
+  void Freeze() {
+    if (frozen_) return;
+    frozen_ = true;
+    sorted_.assign(counts_.begin(), counts_.end());
+    std::sort(sorted_.begin(), sorted_.end(),
+              [](const value_type &a, const value_type &b) {
+                return a.first < b.first;
+              });
+    // Release the hash table memory, clear() keeps the capacity.
+    absl::flat_hash_map<Key, uint64_t>().swap(counts_);
+  }
+  bool frozen() const { return frozen_; }
+
+  const_iterator begin() const {
+    CheckFrozen();
+    return sorted_.begin();
+  }
+  const_iterator end() const {
+    CheckFrozen();
+    return sorted_.end();
+  }
+
+  const_iterator find(const Key &key) const {
+    CheckFrozen();
+    const_iterator iter = std::lower_bound(
+        sorted_.begin(), sorted_.end(), key,
+        [](const value_type &entry, const Key &k) { return entry.first < k; });
+    if (iter != sorted_.end() && iter->first == key) return iter;
+    return sorted_.end();
+  }
+
+  size_t count(const Key &key) const { return find(key) != end() ? 1 : 0; }
+
+  size_t size() const { return counts_.size() + sorted_.size(); }
+  bool empty() const { return counts_.empty() && sorted_.empty(); }
+
+  // Removes all the counters, and starts a new accumulation phase.
+  void clear() {
+    absl::flat_hash_map<Key, uint64_t>().swap(counts_);
+    std::vector<value_type>().swap(sorted_);
+    frozen_ = false;
+  }
+
+  void swap(FlatCountMap &other) {
+    counts_.swap(other.counts_);
+    sorted_.swap(other.sorted_);
+    std::swap(frozen_, other.frozen_);
+  }
+
+  // Pre-allocates room for n counters in the accumulation phase.
+  void reserve(size_t n) {
+    CHECK(!frozen_) << "Writing to a frozen FlatCountMap.";
+    counts_.reserve(n);
+  }
+
+  // Adds the counters of other to this map.
+  void Merge(const FlatCountMap &other) {
+    CHECK(!frozen_) << "Writing to a frozen FlatCountMap.";
+    for (const value_type &entry : other.counts_) {
+      counts_[entry.first] += entry.second;
+    }
+    for (const value_type &entry : other.sorted_) {
+      counts_[entry.first] += entry.second;
+    }
+  }
+
+  // Adds the counters of other to this map, and clears other. When this map
+  // is empty and other is not frozen, the maps are swapped instead of copied.
+  void MergeAndClear(FlatCountMap *other) {
+    CHECK(!frozen_) << "Writing to a frozen FlatCountMap.";
+    if (empty() && !other->frozen_) {
+      swap(*other);
+    } else {
+      Merge(*other);
+    }
+    other->clear();
+  }
+
+  bool operator==(const FlatCountMap &other) const {
+    CheckFrozen();
+    other.CheckFrozen();
+    return sorted_ == other.sorted_;
+  }
+  bool operator!=(const FlatCountMap &other) const { return !(*this == other); }
+
+ private:
+  void CheckFrozen() const {
+    CHECK(frozen_) << "Reading a FlatCountMap before Freeze().";
+  }
+
+  // Only one of counts_, while accumulating, and sorted_, once frozen, is
+  // non-empty.
+  absl::flat_hash_map<Key, uint64_t> counts_;
+  std::vector<value_type> sorted_;
+  bool frozen_ = false;
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_FLAT_COUNT_MAP_H_
@@ -0,0 +1,146 @@
+// Accumulation, freezing and merging of FlatCountMap counters.
+
+#include "flat_count_map.h"
+
+#include <cstdint>
+#include <map>
+#include <utility>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using devtools_crosstool_autofdo::FlatCountMap;
+
+TEST(FlatCountMapTest, IteratesInKeyOrder) {
+  FlatCountMap<uint64_t> map;
+  std::map<uint64_t, uint64_t> expected;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    uint64_t key = (i * 7919) % 613;
+    map[key] += i;
+    expected[key] += i;
+  }
+  EXPECT_EQ(map.size(), expected.size());
+  map.Freeze();
+  EXPECT_EQ(map.size(), expected.size());
+  auto expected_iter = expected.begin();
+  for (const auto &[key, count] : map) {
+    ASSERT_NE(expected_iter, expected.end());
+    EXPECT_EQ(key, expected_iter->first);
+    EXPECT_EQ(count, expected_iter->second);
+    ++expected_iter;
+  }
+  EXPECT_EQ(expected_iter, expected.end());
+}
+
+TEST(FlatCountMapTest, FindAfterFreeze) {
+  typedef std::pair<uint64_t, uint64_t> Range;
+  FlatCountMap<Range> map;
+  map[{0x20, 0x30}] += 2;
+  map[{0x10, 0x18}] += 1;
+  EXPECT_FALSE(map.frozen());
+  map.Freeze();
+  EXPECT_TRUE(map.frozen());
+
+  auto iter = map.find({0x20, 0x30});
+  ASSERT_NE(iter, map.end());
+  EXPECT_EQ(iter->second, 2);
+  EXPECT_EQ(map.find({0x20, 0x31}), map.end());
+  EXPECT_EQ(map.count({0x10, 0x18}), 1);
+  EXPECT_EQ(map.begin()->first, Range(0x10, 0x18));
+
+  // Freezing again keeps the counts.
+  map.Freeze();
+  EXPECT_EQ(map.size(), 2);
+  EXPECT_EQ(map.find({0x20, 0x30})->second, 2);
+}
+
+TEST(FlatCountMapDeathTest, WriteAfterFreeze) {
+  FlatCountMap<uint64_t> map;
+  map[1] += 1;
+  map.Freeze();
+  EXPECT_DEATH(map[1] += 1, "Writing to a frozen FlatCountMap");
+  EXPECT_DEATH(map.reserve(10), "Writing to a frozen FlatCountMap");
+  FlatCountMap<uint64_t> other;
+  other[2] = 1;
+  EXPECT_DEATH(map.Merge(other), "Writing to a frozen FlatCountMap");
+
+  // clear() starts a new accumulation.
+  map.clear();
+  EXPECT_FALSE(map.frozen());
+  map[2] += 3;
+  map.Freeze();
+  EXPECT_EQ(map.size(), 1);
+  EXPECT_EQ(map.find(2)->second, 3);
+}
+
+TEST(FlatCountMapDeathTest, ReadBeforeFreeze) {
+  FlatCountMap<uint64_t> map;
+  map[1] += 1;
+  EXPECT_DEATH(map.find(1), "Reading a FlatCountMap before Freeze");
+  EXPECT_DEATH(map.begin(), "Reading a FlatCountMap before Freeze");
+  // The size is known in both phases.
+  EXPECT_EQ(map.size(), 1);
+  EXPECT_FALSE(map.empty());
+}
+
+TEST(FlatCountMapTest, Merge) {
+  FlatCountMap<uint64_t> frozen = {{1, 10}, {2, 20}};
+  frozen.Freeze();
+  FlatCountMap<uint64_t> accumulating = {{2, 1}, {3, 2}};
+
+  FlatCountMap<uint64_t> map;
+  map.Merge(frozen);
+  map.Merge(accumulating);
+  map.Freeze();
+  FlatCountMap<uint64_t> expected = {{1, 10}, {2, 21}, {3, 2}};
+  expected.Freeze();
+  EXPECT_EQ(map, expected);
+}
+
+TEST(FlatCountMapTest, MergeAndClear) {
+  // An empty map takes the counters of an accumulating map.
+  FlatCountMap<uint64_t> map;
+  FlatCountMap<uint64_t> other = {{1, 10}};
+  map.MergeAndClear(&other);
+  EXPECT_TRUE(other.empty());
+  EXPECT_FALSE(other.frozen());
+
+  // The counters of a frozen map are added.
+  other[2] = 20;
+  other[1] = 1;
+  other.Freeze();
+  map.MergeAndClear(&other);
+  EXPECT_TRUE(other.empty());
+  EXPECT_FALSE(other.frozen());
+  EXPECT_FALSE(map.frozen());
+  map.Freeze();
+  EXPECT_EQ(map.size(), 2);
+  EXPECT_EQ(map.find(1)->second, 11);
+  EXPECT_EQ(map.find(2)->second, 20);
+}
+
+TEST(FlatCountMapTest, CompareSwapAndClear) {
+  FlatCountMap<uint64_t> a = {{1, 10}, {2, 20}};
+  a.Freeze();
+  FlatCountMap<uint64_t> b;
+  b[2] = 20;
+  b[1] = 10;
+  b.Freeze();
+  EXPECT_EQ(a, b);
+  FlatCountMap<uint64_t> c = {{1, 10}, {2, 20}, {3, 1}};
+  c.Freeze();
+  EXPECT_NE(a, c);
+
+  FlatCountMap<uint64_t> d;
+  d.swap(c);
+  EXPECT_TRUE(c.empty());
+  EXPECT_FALSE(c.frozen());
+  EXPECT_TRUE(d.frozen());
+  EXPECT_EQ(d.size(), 3);
+  d.clear();
+  EXPECT_TRUE(d.empty());
+  d.Freeze();
+  EXPECT_EQ(d.begin(), d.end());
+}
+}  // namespace
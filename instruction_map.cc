@@ -8,9 +8,16 @@
 #include <string.h>
 
 #include <cstdint>
+#include <iterator>
+#include <map>
+#include <set>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "addr2line.h"
+#include "disassembler.h"
 #include "symbol_map.h"
 
 namespace devtools_crosstool_autofdo {
@@ -22,18 +29,157 @@ void InstructionMap::BuildPerFunctionInstructionMap(const std::string &name,
     return;
   }
 
-  // Make sure nobody has set up inst_map_ yet.
-  CHECK(inst_map_.empty());
+  // Make sure nobody has set up the map yet.
+  CHECK(starts_.empty());
 
   start_addr_ = start_addr;
-  inst_map_.resize(end_addr - start_addr);
-  for (uint64_t addr = start_addr; addr < end_addr; addr++) {
-    InstInfo *info = &inst_map_[addr - start_addr];
-    addr2line_->GetInlineStack(addr, &info->source_stack);
-    if (info->source_stack.size() > 0) {
-      symbol_map_->AddSourceCount(name, info->source_stack, 0, 1, 1,
+  end_addr_ = end_addr;
+  Symbol *symbol = symbol_map_->GetMutableSymbolByName(name);
+  std::vector<std::pair<uint64_t, SourceStack>> ranges;
+  addr2line_->GetInlineStackRanges(start_addr, end_addr, &ranges);
+
+  // The addresses mapped are the starts of the instructions, or of the runs
+  // of addresses with the same inline stack if the function cannot be
+  // disassembled.
+  std::vector<uint64_t> starts;
+#if defined(HAVE_LLVM)
+  if (disassembler_ != nullptr &&
+      disassembler_->DisassembleRange(start_addr, end_addr)) {
+    starts.assign(disassembler_->addrs().begin(),
+                  disassembler_->addrs().end());
+    instructions_only_ = true;
+  }
+#endif
+  if (!instructions_only_) {
+    for (const auto &range : ranges) {
+      starts.push_back(range.first);
+    }
+  }
+
+  starts_.reserve(starts.size());
+  info_indices_.reserve(starts.size());
+  infos_.reserve(ranges.size());
+  size_t next_start = 0;
+  for (size_t i = 0; i < ranges.size(); i++) {
+    const uint64_t range_end =
+        i + 1 < ranges.size() ? ranges[i + 1].first : end_addr;
+    uint64_t num_starts = 0;
+    for (; next_start < starts.size() && starts[next_start] < range_end;
+         next_start++, num_starts++) {
+      starts_.push_back(starts[next_start]);
+      info_indices_.push_back(infos_.size());
+    }
+    if (num_starts == 0) {
+      continue;
+    }
+    InstInfo info = {std::move(ranges[i].second)};
+    addr2line_->GetOtherInlineStacks(ranges[i].first, &info.other_stacks);
+    // Without the instructions, each address of the range counts as one.
+    const uint64_t num_insts =
+        instructions_only_ ? num_starts : range_end - ranges[i].first;
+    if (info.source_stack.size() > 0) {
+      symbol_map_->AddSourceCount(symbol, info.source_stack, 0, num_insts, 1,
                                   SymbolMap::PERFDATA);
     }
+    for (const SourceStack &stack : info.other_stacks) {
+      symbol_map_->AddSourceCount(symbol, stack, 0, num_insts, 1,
+                                  SymbolMap::PERFDATA);
+    }
+    infos_.push_back(std::move(info));
+  }
+}
+
+void InstructionMap::BuildSampledInstructionMap(
+    const std::string &name, uint64_t start_addr, uint64_t end_addr,
+    absl::Span<const uint64_t> sampled_addrs) {
+  if (start_addr >= end_addr) {
+    return;
+  }
+
+  // Make sure nobody has set up the map yet.
+  CHECK(starts_.empty());
+
+  start_addr_ = start_addr;
+  end_addr_ = end_addr;
+  instructions_only_ = true;
+  Symbol *symbol = symbol_map_->GetMutableSymbolByName(name);
+  const std::set<uint64> *insts = nullptr;
+#if defined(HAVE_LLVM)
+  if (disassembler_ != nullptr &&
+      disassembler_->DisassembleRange(start_addr, end_addr)) {
+    insts = &disassembler_->addrs();
+  }
+#endif
+  // A sampled address inside an instruction is mapped by the instruction,
+  // which lookup_containing() finds for it.
+  std::vector<uint64_t> addrs;
+  addrs.reserve(sampled_addrs.size());
+  for (uint64_t addr : sampled_addrs) {
+    if (addr < start_addr || addr >= end_addr) {
+      continue;
+    }
+    if (insts != nullptr) {
+      auto inst = insts->upper_bound(addr);
+      if (inst == insts->begin()) {
+        continue;
+      }
+      addr = *std::prev(inst);
+    }
+    if (addrs.empty() || addrs.back() != addr) {
+      addrs.push_back(addr);
+    }
+  }
+
+  // The number of instructions of each location, or its number of addresses
+  // if the function cannot be disassembled. A location inlined along several
+  // paths adds up the instructions of all of them.
+  typedef std::tuple<uint32_t, uint32_t, uint32_t> LineKey;
+  std::map<LineKey, uint64_t> num_insts;
+  std::vector<std::pair<uint64_t, SourceInfo>> lines;
+  addr2line_->GetLineRanges(start_addr, end_addr, &lines);
+  for (size_t i = 0; i < lines.size(); i++) {
+    const SourceInfo &line = lines[i].second;
+    if (line.line == 0) {
+      continue;
+    }
+    const uint64_t line_end =
+        i + 1 < lines.size() ? lines[i + 1].first : end_addr;
+    num_insts[{line.file_index, line.line, line.discriminator}] +=
+        insts == nullptr ? line_end - lines[i].first
+                         : static_cast<uint64_t>(std::distance(
+                               insts->lower_bound(lines[i].first),
+                               insts->lower_bound(line_end)));
+  }
+
+  std::vector<SourceStack> stacks(addrs.size());
+  addr2line_->GetInlineStacks(addrs, stacks.data());
+  starts_.reserve(addrs.size());
+  info_indices_.reserve(addrs.size());
+  for (size_t i = 0; i < addrs.size(); i++) {
+    starts_.push_back(addrs[i]);
+    if (!infos_.empty() && infos_.back().source_stack == stacks[i]) {
+      info_indices_.push_back(infos_.size() - 1);
+      continue;
+    }
+    info_indices_.push_back(infos_.size());
+    InstInfo info = {std::move(stacks[i])};
+    addr2line_->GetOtherInlineStacks(addrs[i], &info.other_stacks);
+    if (info.source_stack.size() > 0) {
+      const SourceInfo &line = info.source_stack[0];
+      auto num_inst = num_insts.find({line.file_index, line.line,
+                                      line.discriminator});
+      if (num_inst != num_insts.end() && num_inst->second != 0) {
+        // The probes sharing the address share its instructions.
+        symbol_map_->AddSourceCount(symbol, info.source_stack, 0,
+                                    num_inst->second, 1, SymbolMap::PERFDATA);
+        for (const SourceStack &stack : info.other_stacks) {
+          symbol_map_->AddSourceCount(symbol, stack, 0, num_inst->second, 1,
+                                      SymbolMap::PERFDATA);
+        }
+        num_inst->second = 0;
+      }
+    }
+    infos_.push_back(std::move(info));
   }
 }
 
@@ -10,17 +10,20 @@
 #include <map>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "base/integral_types.h"
 #include "base/logging.h"
 #include "base/macros.h"
 #include "symbol_map.h"
+#include "third_party/abseil/absl/types/span.h"
 
 
 namespace devtools_crosstool_autofdo {
 
 class SampleReader;
 class Addr2line;
+class Disassembler;
 
 // InstructionMap stores all the disassembled instructions in
 // the binary, and maps it to its information.
@@ -31,32 +34,97 @@ class InstructionMap {
   //   symbol: the symbol map. This object is not const because
   //           we will update the file name of each symbol
   //           according to the debug info of each instruction.
+  //   disassembler: if not null, used to only map the addresses where an
+  //                 instruction starts.
   InstructionMap(Addr2line *addr2line,
-                 SymbolMap *symbol)
-      : symbol_map_(symbol), addr2line_(addr2line) {
+                 SymbolMap *symbol,
+                 Disassembler *disassembler = nullptr)
+      : symbol_map_(symbol), addr2line_(addr2line),
+        disassembler_(disassembler) {
   }
 
   // Builds instruction map for a function.
   void BuildPerFunctionInstructionMap(const std::string &name,
                                       uint64_t start_addr, uint64_t end_addr);
 
+  // Builds the instruction map of a function for the sorted addresses
+  // SAMPLED_ADDRS only, which are the ones with samples. The number of
+  // instructions of each source location is counted from the line table
+  // rather than from the inline stack of every instruction, and goes to the
+  // inline stack of its first sampled address. The locations without samples
+  // get no instruction count.
+  void BuildSampledInstructionMap(const std::string &name, uint64_t start_addr,
+                                  uint64_t end_addr,
+                                  absl::Span<const uint64_t> sampled_addrs);
+
   // Contains information about each instruction.
   struct InstInfo {
     SourceStack source_stack;
+    // The other stacks the samples of the instruction count for, see
+    // Addr2line::GetOtherInlineStacks.
+    std::vector<SourceStack> other_stacks;
   };
 
-  InstInfo *lookup(uint64_t addr) {
-    uint64_t idx = addr - start_addr_;  // May underflow, which is OK.
-    return idx < inst_map_.size() ? &inst_map_[idx] : nullptr;
+  // Returns the information of ADDR, or nullptr if ADDR is out of the
+  // function or, in an instruction map, is not the start of an instruction.
+  const InstInfo *lookup(uint64_t addr) const {
+    const uint64_t *entry = FindEntry(addr);
+    if (entry == nullptr || (instructions_only_ && *entry != addr)) {
+      return nullptr;
+    }
+    return &infos_[info_indices_[entry - starts_.data()]];
+  }
+
+  // Returns the information of the entry containing ADDR, or nullptr if ADDR
+  // is out of the function. In an instruction map, this is the instruction
+  // which ADDR is a byte of. Counting the samples of every byte this way
+  // weights each instruction by its length, like the addresses of the runs
+  // and like Profile::ProfileMaps::GetAggregatedCount().
+  const InstInfo *lookup_containing(uint64_t addr) const {
+    const uint64_t *entry = FindEntry(addr);
+    if (entry == nullptr) {
+      return nullptr;
+    }
+    return &infos_[info_indices_[entry - starts_.data()]];
   }
 
  private:
-  // A map from instruction address to its information.
-  std::vector<InstInfo> inst_map_;
+  // Returns the last entry of starts_ at or before ADDR, or nullptr if ADDR
+  // is out of the function.
+  const uint64_t *FindEntry(uint64_t addr) const {
+    if (addr < start_addr_ || addr >= end_addr_ || starts_.empty() ||
+        addr < starts_.front()) {
+      return nullptr;
+    }
+    // Branchless binary search of the last entry starting at or before addr.
+    const uint64_t *base = starts_.data();
+    for (size_t n = starts_.size(); n > 1; n -= n / 2) {
+      base = base[n / 2] <= addr ? base + n / 2 : base;
+    }
+    return base;
+  }
+
+  // The sorted start addresses of the entries of the map. When the function
+  // was disassembled, there is an entry for each instruction, and only the
+  // addresses of the entries are mapped. Otherwise, an entry is a run of
+  // consecutive addresses which share the same information: the first one
+  // starts at start_addr_, each run ends where the next one starts, and the
+  // last one at end_addr_.
+  std::vector<uint64_t> starts_;
 
-  // The starting address for inst_map_.  inst_map_[pc - start_addr_] maps to
-  // the information associated with pc.
-  uint64_t start_addr_;
+  // The index in infos_ of the information of each entry.
+  std::vector<uint32_t> info_indices_;
+
+  // The information of the instructions, shared by the consecutive entries
+  // with the same inline stack.
+  std::vector<InstInfo> infos_;
+
+  // Whether the entries are the instructions of the function.
+  bool instructions_only_ = false;
+
+  // The address range of the function.
+  uint64_t start_addr_ = 0;
+  uint64_t end_addr_ = 0;
 
   // A map from symbol name to symbol data.
   SymbolMap *symbol_map_;
@@ -64,6 +132,9 @@ class InstructionMap {
   // Addr2line driver which is used to derive source stack.
   Addr2line *addr2line_;
 
+  // Disassembler which is used to find the instructions, or nullptr.
+  Disassembler *disassembler_;
+
   DISALLOW_COPY_AND_ASSIGN(InstructionMap);
 };
 }  // namespace devtools_crosstool_autofdo
@@ -6,8 +6,14 @@
 
 #include "instruction_map.h"
 
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "base/commandlineflags.h"
 #include "addr2line.h"
+#include "disassembler.h"
 #include "sample_reader.h"
 #include "symbol_map.h"
 #include "gtest/gtest.h"
@@ -49,4 +55,174 @@ TEST_F(InstructionMapTest, PerFunctionInstructionMap) {
   inst_map.BuildPerFunctionInstructionMap("longest_match", 0x401680, 0x401871);
   delete addr2line;
 }
+
+TEST_F(InstructionMapTest, LookupMatchesInlineStack) {
+  Addr2line *addr2line = Addr2line::Create(FLAGS_test_srcdir +
+                                           kTestDataDir + "test.binary");
+  devtools_crosstool_autofdo::SymbolMap symbol_map(
+      FLAGS_test_srcdir + kTestDataDir + "test.binary");
+  devtools_crosstool_autofdo::InstructionMap inst_map(
+      addr2line, &symbol_map);
+  symbol_map.AddSymbol("longest_match");
+  inst_map.BuildPerFunctionInstructionMap("longest_match", 0x401680, 0x401871);
+
+  EXPECT_EQ(inst_map.lookup(0x40167f), nullptr);
+  EXPECT_EQ(inst_map.lookup(0x401871), nullptr);
+  for (uint64_t addr = 0x401680; addr < 0x401871; ++addr) {
+    const devtools_crosstool_autofdo::InstructionMap::InstInfo *info =
+        inst_map.lookup(addr);
+    ASSERT_NE(info, nullptr);
+    devtools_crosstool_autofdo::SourceStack stack;
+    addr2line->GetInlineStack(addr, &stack);
+    EXPECT_TRUE(info->source_stack == stack) << std::hex << addr;
+  }
+  delete addr2line;
+}
+
+TEST_F(InstructionMapTest, GetInlineStacksMatchesInlineStack) {
+  Addr2line *addr2line = Addr2line::Create(FLAGS_test_srcdir +
+                                           kTestDataDir + "test.binary");
+  ASSERT_NE(addr2line, nullptr);
+  // Crosses the bounds of longest_match, with gaps between the addresses.
+  std::vector<uint64_t> addrs;
+  for (uint64_t addr = 0x401600; addr < 0x401900; addr += 3) {
+    addrs.push_back(addr);
+  }
+  std::vector<devtools_crosstool_autofdo::SourceStack> stacks(addrs.size());
+  addr2line->GetInlineStacks(addrs, stacks.data());
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    devtools_crosstool_autofdo::SourceStack stack;
+    addr2line->GetInlineStack(addrs[i], &stack);
+    EXPECT_TRUE(stacks[i] == stack) << std::hex << addrs[i];
+  }
+  delete addr2line;
+}
+
+TEST_F(InstructionMapTest, LineRangesMatchInlineStack) {
+  Addr2line *addr2line = Addr2line::Create(FLAGS_test_srcdir +
+                                           kTestDataDir + "test.binary");
+  ASSERT_NE(addr2line, nullptr);
+  std::vector<std::pair<uint64_t, devtools_crosstool_autofdo::SourceInfo>>
+      lines;
+  addr2line->GetLineRanges(0x401680, 0x401871, &lines);
+  ASSERT_FALSE(lines.empty());
+  EXPECT_EQ(lines[0].first, 0x401680);
+  size_t next = 0;
+  for (uint64_t addr = 0x401680; addr < 0x401871; ++addr) {
+    while (next < lines.size() && lines[next].first <= addr) ++next;
+    devtools_crosstool_autofdo::SourceStack stack;
+    addr2line->GetInlineStack(addr, &stack);
+    if (stack.empty() || stack[0].line == 0) continue;
+    // The innermost entry of the stack, without its function.
+    devtools_crosstool_autofdo::SourceInfo line = stack[0];
+    line.func_name = nullptr;
+    line.start_line = 0;
+    EXPECT_TRUE(lines[next - 1].second == line) << std::hex << addr;
+  }
+  delete addr2line;
+}
+
+TEST_F(InstructionMapTest, SampledInstructionMap) {
+  Addr2line *addr2line = Addr2line::Create(FLAGS_test_srcdir +
+                                           kTestDataDir + "test.binary");
+  devtools_crosstool_autofdo::SymbolMap symbol_map(
+      FLAGS_test_srcdir + kTestDataDir + "test.binary");
+  devtools_crosstool_autofdo::InstructionMap inst_map(
+      addr2line, &symbol_map);
+  symbol_map.AddSymbol("longest_match");
+  // Some addresses are out of the function, and are not mapped.
+  std::vector<uint64_t> sampled_addrs;
+  for (uint64_t addr = 0x401600; addr < 0x401900; addr += 5) {
+    sampled_addrs.push_back(addr);
+  }
+  inst_map.BuildSampledInstructionMap("longest_match", 0x401680, 0x401871,
+                                      sampled_addrs);
+
+  for (uint64_t addr = 0x401600; addr < 0x401900; ++addr) {
+    const devtools_crosstool_autofdo::InstructionMap::InstInfo *info =
+        inst_map.lookup(addr);
+    if (addr < 0x401680 || addr >= 0x401871 || (addr - 0x401600) % 5 != 0) {
+      EXPECT_EQ(info, nullptr) << std::hex << addr;
+      continue;
+    }
+    ASSERT_NE(info, nullptr);
+    devtools_crosstool_autofdo::SourceStack stack;
+    addr2line->GetInlineStack(addr, &stack);
+    EXPECT_TRUE(info->source_stack == stack) << std::hex << addr;
+  }
+  delete addr2line;
+}
+
+TEST_F(InstructionMapTest, DisassembledInstructionMap) {
+  Addr2line *addr2line = Addr2line::Create(FLAGS_test_srcdir +
+                                           kTestDataDir + "test.binary");
+  devtools_crosstool_autofdo::SymbolMap symbol_map(
+      FLAGS_test_srcdir + kTestDataDir + "test.binary");
+  devtools_crosstool_autofdo::Disassembler disassembler;
+  ASSERT_TRUE(disassembler.Init(FLAGS_test_srcdir + kTestDataDir +
+                                "test.binary"));
+  devtools_crosstool_autofdo::InstructionMap inst_map(
+      addr2line, &symbol_map, &disassembler);
+  symbol_map.AddSymbol("longest_match");
+  inst_map.BuildPerFunctionInstructionMap("longest_match", 0x401680, 0x401871);
+
+  // Only the instructions are mapped.
+  ASSERT_FALSE(disassembler.addrs().empty());
+  for (uint64_t addr = 0x401680; addr < 0x401871; ++addr) {
+    const devtools_crosstool_autofdo::InstructionMap::InstInfo *info =
+        inst_map.lookup(addr);
+    if (disassembler.addrs().count(addr) == 0) {
+      EXPECT_EQ(info, nullptr) << std::hex << addr;
+      continue;
+    }
+    ASSERT_NE(info, nullptr);
+    devtools_crosstool_autofdo::SourceStack stack;
+    addr2line->GetInlineStack(addr, &stack);
+    EXPECT_TRUE(info->source_stack == stack) << std::hex << addr;
+  }
+  delete addr2line;
+}
+
+TEST_F(InstructionMapTest, InstructionCountsWeightedByLength) {
+  Addr2line *addr2line = Addr2line::Create(FLAGS_test_srcdir +
+                                           kTestDataDir + "test.binary");
+  devtools_crosstool_autofdo::Disassembler disassembler;
+  ASSERT_TRUE(disassembler.Init(FLAGS_test_srcdir + kTestDataDir +
+                                "test.binary"));
+  // The same per-byte counts go through the map of the runs and through the
+  // map of the instructions, and must give the same totals.
+  std::vector<uint64_t> totals;
+  std::vector<std::map<std::pair<uint64_t, std::string>, uint64_t>>
+      callsite_totals;
+  for (bool disassemble : {false, true}) {
+    devtools_crosstool_autofdo::SymbolMap symbol_map(
+        FLAGS_test_srcdir + kTestDataDir + "test.binary");
+    devtools_crosstool_autofdo::InstructionMap inst_map(
+        addr2line, &symbol_map, disassemble ? &disassembler : nullptr);
+    devtools_crosstool_autofdo::Symbol *symbol =
+        symbol_map.AddSymbol("longest_match");
+    inst_map.BuildPerFunctionInstructionMap("longest_match", 0x401680,
+                                            0x401871);
+    for (uint64_t addr = 0x401680; addr < 0x401871; ++addr) {
+      const devtools_crosstool_autofdo::InstructionMap::InstInfo *info =
+          inst_map.lookup_containing(addr);
+      ASSERT_NE(info, nullptr);
+      if (!info->source_stack.empty()) {
+        symbol_map.AddSourceCount(
+            symbol, info->source_stack, addr % 5 + 1, 0, 1,
+            devtools_crosstool_autofdo::SymbolMap::PERFDATA);
+      }
+    }
+    totals.push_back(symbol->total_count);
+    callsite_totals.emplace_back();
+    for (const auto &[callsite, callee] : symbol->callsites) {
+      callsite_totals.back()[{callsite.first, callsite.second}] =
+          callee->total_count;
+    }
+  }
+  EXPECT_EQ(totals[0], 1491);
+  EXPECT_EQ(totals[1], totals[0]);
+  EXPECT_EQ(callsite_totals[1], callsite_totals[0]);
+  delete addr2line;
+}
 }  // namespace
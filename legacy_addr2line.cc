@@ -18,6 +18,17 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "base/commandlineflags.h"
 #include "base/logging.h"
 #include "symbolize/bytereader.h"
 #include "symbolize/dwarf2reader.h"
@@ -25,7 +36,17 @@
 #include "symbolize/addr2line_inlinestack.h"
 #include "symbolize/functioninfo.h"
 #include "symbolize/elf_reader.h"
+#include "symbolize/split_dwarf_loader.h"
 #include "symbol_map.h"
+#include "third_party/abseil/absl/flags/flag.h"
+
+ABSL_FLAG(int, symbolizer_threads, 0,
+          "Number of threads used to read the compilation units of the "
+          "binary. 0 means one thread per hardware thread.");
+ABSL_FLAG(int, split_dwarf_prefetch_threads, 8,
+          "Number of threads reading ahead the .dwo files or the .dwp "
+          "contributions of the compilation units of a binary built with "
+          "split DWARF. 0 disables reading ahead.");
 
 namespace {
 void GetSection(const devtools_crosstool_autofdo::SectionMap &sections,
@@ -52,9 +73,310 @@ void GetSection(const devtools_crosstool_autofdo::SectionMap &sections,
   if (size_p)
     *size_p = size;
 }
+template <typename T>
+T ReadLittleEndian(const char *data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Returns the offsets and sizes of the compilation units of the .debug_info
+// section DATA, found from their headers. A truncated unit is returned last,
+// so that reading it reports the section as malformed.
+std::vector<std::pair<uint64, uint64>> ListCompilationUnits(const char *data,
+                                                            size_t size) {
+  std::vector<std::pair<uint64, uint64>> units;
+  for (size_t pos = 0; pos < size;) {
+    uint64 length = 0;
+    uint64 header_size = 4;
+    if (size - pos >= 4) {
+      length = ReadLittleEndian<uint32>(data + pos);
+    }
+    if (length == 0xffffffff) {
+      header_size = 12;
+      length = size - pos >= 12 ? ReadLittleEndian<uint64>(data + pos + 4) : 0;
+    }
+    if (size - pos < header_size || length > size - pos - header_size) {
+      units.emplace_back(pos, size - pos);
+      break;
+    }
+    units.emplace_back(pos, header_size + length);
+    pos += header_size + length;
+  }
+  return units;
+}
+
+// Reads the .debug_aranges section DATA. Adds to DESCRIBED the offsets of the
+// compilation units it describes, and to SAMPLED those which have an address
+// range overlapping a function of SAMPLED_FUNCTIONS.
+void ReadArangesUnits(const char *data, size_t size,
+                      const std::map<uint64_t, uint64_t> &sampled_functions,
+                      std::set<uint64> *described, std::set<uint64> *sampled) {
+  for (size_t pos = 0; pos + 4 <= size;) {
+    const size_t set_start = pos;
+    uint64 length = ReadLittleEndian<uint32>(data + pos);
+    size_t offset_size = 4;
+    pos += 4;
+    if (length == 0xffffffff) {
+      if (size - pos < 8) return;
+      length = ReadLittleEndian<uint64>(data + pos);
+      offset_size = 8;
+      pos += 8;
+    }
+    if (length > size - pos) return;
+    const size_t set_end = pos + length;
+    // Skips the version, which precedes the unit offset.
+    if (length < 2 + offset_size + 2) {
+      pos = set_end;
+      continue;
+    }
+    pos += 2;
+    const uint64 unit_offset = offset_size == 4
+                                   ? ReadLittleEndian<uint32>(data + pos)
+                                   : ReadLittleEndian<uint64>(data + pos);
+    pos += offset_size;
+    const uint8 address_size = data[pos];
+    const uint8 segment_size = data[pos + 1];
+    pos += 2;
+    if ((address_size != 4 && address_size != 8) || segment_size != 0) {
+      pos = set_end;
+      continue;
+    }
+    described->insert(unit_offset);
+    // The tuples are aligned to their size from the start of the set.
+    const size_t tuple_size = 2 * address_size;
+    pos = set_start +
+          (pos - set_start + tuple_size - 1) / tuple_size * tuple_size;
+    for (; pos + tuple_size <= set_end; pos += tuple_size) {
+      const uint64 start = address_size == 4
+                               ? ReadLittleEndian<uint32>(data + pos)
+                               : ReadLittleEndian<uint64>(data + pos);
+      const uint64 range_size =
+          address_size == 4
+              ? ReadLittleEndian<uint32>(data + pos + address_size)
+              : ReadLittleEndian<uint64>(data + pos + address_size);
+      if (start == 0 && range_size == 0) break;
+      // The last function starting before the end of the range is the only
+      // one which may overlap it, as functions do not overlap.
+      auto iter = sampled_functions.lower_bound(start + range_size);
+      if (iter != sampled_functions.begin() &&
+          std::prev(iter)->first + std::prev(iter)->second > start) {
+        sampled->insert(unit_offset);
+        break;
+      }
+    }
+    pos = set_end;
+  }
+}
 }  // namespace
 
 namespace devtools_crosstool_autofdo {
+namespace {
+// The state of a worker reading a batch of consecutive compilation units.
+// The line map and the subprograms it reads are merged in the order of the
+// batches, which is the order in which a single reader would add them.
+struct CompilationUnitBatch {
+  std::vector<uint64> unit_offsets;
+  std::unique_ptr<ByteReader> reader;
+  std::unique_ptr<AddressRangeList> debug_ranges;
+  std::unique_ptr<InlineStackHandler> inline_stack_handler;
+  AddressToLineMap line_map;
+  // Whether reading stopped at a malformed compilation unit.
+  bool malformed = false;
+};
+
+// Reads the compilation units UNITS of the .debug_info section of BINARY_NAME
+// with --symbolizer_threads threads, each into its own line map and inline
+// stack handler, which are then merged into LINE_MAP and INLINE_STACK_HANDLER
+// after the units they already hold. Returns false if a unit is malformed.
+bool ReadCompilationUnitBatches(
+    const string &binary_name, ElfReader *elf,
+    const std::map<uint64_t, uint64_t> *sampled_functions,
+    const SectionMap &sections, const char *debug_ranges_data,
+    size_t debug_ranges_size, bool is_rnglists_section,
+    const char *debug_addr_data, size_t debug_addr_size, int width,
+    const std::vector<std::pair<uint64, uint64>> &units,
+    AddressToLineMap *line_map, InlineStackHandler *inline_stack_handler) {
+  // Splits the units into batches of about the same size, several per thread
+  // so that the threads stay busy until the end.
+  int num_threads = absl::GetFlag(FLAGS_symbolizer_threads);
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  uint64 total_size = 0;
+  for (const auto &unit : units) {
+    total_size += unit.second;
+  }
+  const uint64 batch_size = std::max<uint64>(1, total_size / (4 * num_threads));
+  std::vector<CompilationUnitBatch> batches;
+  uint64 current_batch_size = batch_size;
+  for (const auto &unit : units) {
+    if (current_batch_size >= batch_size) {
+      batches.emplace_back();
+      current_batch_size = 0;
+    }
+    batches.back().unit_offsets.push_back(unit.first);
+    current_batch_size += unit.second;
+  }
+
+  // The split DWARF of the units is read ahead in the order of the batches,
+  // while they are parsed.
+  SplitDwarfLoader split_dwarf_loader(binary_name);
+  const int num_prefetch_threads =
+      absl::GetFlag(FLAGS_split_dwarf_prefetch_threads);
+  if (num_prefetch_threads > 0) {
+    std::vector<std::vector<uint64>> unit_batches;
+    for (const CompilationUnitBatch &batch : batches) {
+      unit_batches.push_back(batch.unit_offsets);
+    }
+    split_dwarf_loader.Prefetch(sections, width, unit_batches,
+                                num_prefetch_threads, num_threads);
+  }
+
+  const uint64 vaddr_of_first_load_segment = elf->VaddrOfFirstLoadSegment();
+  std::atomic<size_t> next_batch(0);
+  auto read_batches = [&]() {
+    for (size_t i = next_batch++; i < batches.size(); i = next_batch++) {
+      CompilationUnitBatch &batch = batches[i];
+      split_dwarf_loader.StartBatch(i);
+      // The reader is set up by each compilation unit, so it is not shared.
+      batch.reader.reset(new ByteReader(ENDIANNESS_LITTLE));
+      batch.reader->SetAddressSize(width);
+      batch.debug_ranges.reset(new AddressRangeList(
+          debug_ranges_data, debug_ranges_size, batch.reader.get(),
+          is_rnglists_section, debug_addr_data, debug_addr_size));
+      batch.inline_stack_handler.reset(new InlineStackHandler(
+          batch.debug_ranges.get(), sections, batch.reader.get(),
+          sampled_functions, vaddr_of_first_load_segment));
+      for (uint64 unit_offset : batch.unit_offsets) {
+        DirectoryVector dirs;
+        FileVector files;
+        CULineInfoHandler handler(&files, &dirs, &batch.line_map,
+                                  sampled_functions);
+        batch.inline_stack_handler->set_directory_names(&dirs);
+        batch.inline_stack_handler->set_file_names(&files);
+        batch.inline_stack_handler->set_line_handler(&handler);
+        CompilationUnit compilation_unit(binary_name, sections, unit_offset,
+                                         batch.reader.get(),
+                                         batch.inline_stack_handler.get());
+        compilation_unit.set_split_dwarf_loader(&split_dwarf_loader);
+        compilation_unit.Start();
+        if (compilation_unit.malformed()) {
+          batch.malformed = true;
+          break;
+        }
+      }
+    }
+  };
+  num_threads = std::min<size_t>(num_threads, batches.size());
+  std::vector<std::thread> workers;
+  for (int i = 1; i < num_threads; ++i) {
+    workers.emplace_back(read_batches);
+  }
+  read_batches();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  split_dwarf_loader.Stop();
+
+  for (CompilationUnitBatch &batch : batches) {
+    line_map->MergeFrom(batch.line_map);
+    inline_stack_handler->MergeFrom(batch.inline_stack_handler.get());
+    if (batch.malformed) {
+      LOG(WARNING) << "File '" << binary_name << "' has mangled "
+                   << ".debug_info section.";
+      // If the compilation unit is malformed, we do not know how
+      // big it is, so it is only safe to give up.
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads the compilation units of the .debug_info section of BINARY_NAME into
+// LINE_MAP and INLINE_STACK_HANDLER, only those which cover SAMPLED_FUNCTIONS
+// or which they refer to if .debug_aranges tells which they are.
+void ReadCompilationUnits(
+    const string &binary_name, ElfReader *elf,
+    const std::map<uint64_t, uint64_t> *sampled_functions,
+    const SectionMap &sections, const char *debug_info_data,
+    size_t debug_info_size, const char *debug_ranges_data,
+    size_t debug_ranges_size, bool is_rnglists_section,
+    const char *debug_addr_data, size_t debug_addr_size, int width,
+    AddressToLineMap *line_map, InlineStackHandler *inline_stack_handler) {
+  std::vector<std::pair<uint64, uint64>> units =
+      ListCompilationUnits(debug_info_data, debug_info_size);
+
+  // Only the compilation units covering a sampled function are read, when
+  // .debug_aranges tells which they are. The units it does not describe are
+  // all read.
+  std::map<uint64, uint64> skipped_units;
+  size_t debug_aranges_size = 0;
+  const char *debug_aranges_data =
+      elf->GetSectionByName(".debug_aranges", &debug_aranges_size);
+  if (sampled_functions != NULL && debug_aranges_data != NULL) {
+    std::set<uint64> described_units;
+    std::set<uint64> sampled_units;
+    ReadArangesUnits(debug_aranges_data, debug_aranges_size,
+                     *sampled_functions, &described_units, &sampled_units);
+    const size_t num_units = units.size();
+    units.erase(
+        std::remove_if(units.begin(), units.end(),
+                       [&](const std::pair<uint64, uint64> &unit) {
+                         if (described_units.count(unit.first) == 0 ||
+                             sampled_units.count(unit.first) > 0) {
+                           return false;
+                         }
+                         skipped_units.insert(unit);
+                         return true;
+                       }),
+        units.end());
+    LOG(INFO) << "Reading " << units.size() << " of " << num_units
+              << " compilation units, which cover the sampled functions.";
+  }
+
+  if (!ReadCompilationUnitBatches(
+          binary_name, elf, sampled_functions, sections, debug_ranges_data,
+          debug_ranges_size, is_rnglists_section, debug_addr_data,
+          debug_addr_size, width, units, line_map, inline_stack_handler)) {
+    return;
+  }
+
+  // The subprograms may refer to the declarations and abstract origins of
+  // other units with DW_FORM_ref_addr, e.g. after LTO. The skipped units
+  // which hold them are read too, until none of them is referred to. They
+  // cover no sampled function, so reading them last does not change the
+  // inline stacks of the sampled addresses.
+  while (!skipped_units.empty()) {
+    std::set<uint64> references;
+    inline_stack_handler->GetUnresolvedReferences(&references);
+    std::vector<std::pair<uint64, uint64>> referenced_units;
+    for (uint64 reference : references) {
+      auto unit = skipped_units.upper_bound(reference);
+      if (unit == skipped_units.begin())
+        continue;
+      --unit;
+      if (reference - unit->first < unit->second) {
+        referenced_units.push_back(*unit);
+        skipped_units.erase(unit);
+      }
+    }
+    if (referenced_units.empty())
+      break;
+    std::sort(referenced_units.begin(), referenced_units.end());
+    LOG(INFO) << "Reading " << referenced_units.size()
+              << " more compilation units, which the sampled ones refer to.";
+    if (!ReadCompilationUnitBatches(
+            binary_name, elf, sampled_functions, sections, debug_ranges_data,
+            debug_ranges_size, is_rnglists_section, debug_addr_data,
+            debug_addr_size, width, referenced_units, line_map,
+            inline_stack_handler)) {
+      return;
+    }
+  }
+}
+
+}  // namespace
 
 Addr2line *Addr2line::Create(const string &binary_name) {
   return CreateWithSampledFunctions(binary_name, NULL);
@@ -145,26 +467,11 @@ bool Google3Addr2line::Prepare() {
   // .debug_info. Otherwise, we'll iterate through .debug_line section,
   // assuming that compilation units are stored continuously in it.
   if (debug_info_size > 0) {
-    size_t debug_info_pos = 0;
-    while (debug_info_pos < debug_info_size) {
-      DirectoryVector dirs;
-      FileVector files;
-      CULineInfoHandler handler(&files, &dirs, line_map_, sampled_functions_);
-      inline_stack_handler_->set_directory_names(&dirs);
-      inline_stack_handler_->set_file_names(&files);
-      inline_stack_handler_->set_line_handler(&handler);
-      CompilationUnit compilation_unit(
-          binary_name_, sections, debug_info_pos, &reader,
-          inline_stack_handler_);
-      debug_info_pos += compilation_unit.Start();
-      if (compilation_unit.malformed()) {
-        LOG(WARNING) << "File '" << binary_name_ << "' has mangled "
-                     << ".debug_info section.";
-        // If the compilation unit is malformed, we do not know how
-        // big it is, so it is only safe to give up.
-        break;
-      }
-    }
+    ReadCompilationUnits(binary_name_, elf_, sampled_functions_, sections,
+                         debug_info_data, debug_info_size, debug_ranges_data,
+                         debug_ranges_size, is_rnglists_section,
+                         debug_addr_data, debug_addr_size, width, line_map_,
+                         inline_stack_handler_);
   } else {
     const char *data;
     size_t size;
@@ -208,7 +515,86 @@ void Google3Addr2line::GetInlineStack(uint64_t address,
 
   const SubprogramInfo *subprog =
       inline_stack_handler_->GetSubprogramForAddress(address);
+  AppendInlineStack(LI, subprog, stack);
+}
+
+void Google3Addr2line::GetInlineStacks(absl::Span<const uint64_t> addrs,
+                                       SourceStack *stacks) const {
+  // The line map entry of the previous address, and the next entry.
+  AddressToLineMap::const_iterator line = line_map_->end();
+  AddressToLineMap::const_iterator next_line = line_map_->end();
+  // The subprogram of the previous address, valid in [SUBPROG_LOW,
+  // SUBPROG_HIGH).
+  const SubprogramInfo *subprog = NULL;
+  uint64 subprog_low = 0, subprog_high = 0;
+
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    const uint64_t address = addrs[i];
+    SourceStack *stack = &stacks[i];
+    stack->clear();
+
+    // Steps to the next entry if it covers the address, and searches the
+    // map again if the address is further away.
+    if (line == line_map_->end() || address < line->first ||
+        (next_line != line_map_->end() && next_line->first <= address)) {
+      if (line != line_map_->end() && address >= line->first &&
+          (std::next(next_line) == line_map_->end() ||
+           std::next(next_line)->first > address)) {
+        line = next_line++;
+      } else {
+        next_line = line_map_->upper_bound(address);
+        if (next_line == line_map_->begin()) {
+          line = line_map_->end();
+          continue;
+        }
+        line = std::prev(next_line);
+      }
+    }
+    if (line->second == 0)
+      continue;
+
+    const LineIdentifier &LI = line_map_->GetLogical(line->second);
+    if (LI.line == 0)
+      continue;
+
+    if (address < subprog_low || address >= subprog_high) {
+      subprog = inline_stack_handler_->GetSubprogramForAddress(
+          address, &subprog_low, &subprog_high);
+      if (subprog == NULL)
+        subprog_low = subprog_high = 0;
+    }
+    AppendInlineStack(LI, subprog, stack);
+  }
+}
+
+void Google3Addr2line::GetLineRanges(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<std::pair<uint64_t, SourceInfo>> *ranges) const {
+  auto get_line = [this](uint32_t logical) {
+    if (logical == 0)
+      return SourceInfo();
+    const LineIdentifier &LI = line_map_->GetLogical(logical);
+    if (LI.line == 0)
+      return SourceInfo();
+    return SourceInfo(NULL, LI.file.first, LI.file.second, 0, LI.line,
+                      LI.discriminator);
+  };
+
+  ranges->clear();
+  AddressToLineMap::const_iterator line = line_map_->upper_bound(start_addr);
+  ranges->emplace_back(start_addr, line == line_map_->begin()
+                                       ? SourceInfo()
+                                       : get_line(std::prev(line)->second));
+  for (; line != line_map_->end() && line->first < end_addr; ++line) {
+    SourceInfo info = get_line(line->second);
+    if (info != ranges->back().second)
+      ranges->emplace_back(line->first, info);
+  }
+}
 
+void Google3Addr2line::AppendInlineStack(const LineIdentifier &LI,
+                                         const SubprogramInfo *subprog,
+                                         SourceStack *stack) const {
   const char *function_name = NULL;
   uint32_t start_line = 0;
   if (subprog != NULL) {
@@ -0,0 +1,54 @@
+// Inline stacks whose abstract origin is in a compilation unit that
+// Google3Addr2line skips.
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "addr2line.h"
+#include "gtest/gtest.h"
+#include "source_info.h"
+
+#define FLAGS_test_srcdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+namespace {
+
+using devtools_crosstool_autofdo::Addr2line;
+using devtools_crosstool_autofdo::SourceStack;
+
+const char kTestDataDir[] = "/testdata/";
+
+// cross_cu_lto.binary is built with
+// 'gcc -O2 -gdwarf-4 -flto -flto-partition=none' from a.c, whose main calls
+// callee and other, and b.c, which defines them. The callee inlined in main
+// refers with DW_FORM_ref_addr to its abstract origin in the compilation unit
+// of b.c. A set describing that unit with the address range of other was
+// added to .debug_aranges, so that the unit is skipped when only main is
+// sampled.
+TEST(LegacyAddr2lineTest, CrossUnitAbstractOrigin) {
+  const std::string binary =
+      FLAGS_test_srcdir + kTestDataDir + "cross_cu_lto.binary";
+  const std::map<uint64_t, uint64_t> sampled_functions = {{0x1040, 0x30}};
+  std::unique_ptr<Addr2line> all(Addr2line::Create(binary));
+  std::unique_ptr<Addr2line> sampled(
+      Addr2line::CreateWithSampledFunctions(binary, &sampled_functions));
+  ASSERT_NE(all, nullptr);
+  ASSERT_NE(sampled, nullptr);
+
+  int num_inlined = 0;
+  for (uint64_t addr = 0x1040; addr < 0x1070; ++addr) {
+    SourceStack expected;
+    SourceStack stack;
+    all->GetInlineStack(addr, &expected);
+    sampled->GetInlineStack(addr, &stack);
+    EXPECT_TRUE(stack == expected) << std::hex << addr;
+    if (stack.size() == 2) {
+      EXPECT_STREQ(stack[0].func_name, "callee") << std::hex << addr;
+      EXPECT_STREQ(stack[1].func_name, "main") << std::hex << addr;
+      ++num_inlined;
+    }
+  }
+  EXPECT_GT(num_inlined, 0);
+}
+}  // namespace
@@ -72,13 +72,14 @@ void LLVMProfileReader::ReadFromFunctionSamples(
 
   if (stack.empty() && !shouldMergeProfileForSym(func_name)) return;
 
-  const char *top_func_name = nullptr;
+  // The samples are added to the symbol of the outline function, looked up
+  // once for all of them.
+  Symbol *top_symbol = nullptr;
   if (stack.empty()) {
-    top_func_name = func_name;
-    symbol_map_->AddSymbol(func_name);
-    symbol_map_->AddSymbolEntryCount(func_name, fs.getHeadSamples());
+    top_symbol = symbol_map_->AddSymbol(func_name);
+    symbol_map_->AddSymbolEntryCount(top_symbol, fs.getHeadSamples());
   } else {
-    top_func_name = stack.back().func_name;
+    top_symbol = symbol_map_->GetMutableSymbolByName(stack.back().func_name);
   }
   for (const auto &loc_sample : fs.getBodySamples()) {
     SourceInfo info(func_name, "", "", 0, loc_sample.first.LineOffset,
@@ -86,10 +87,10 @@ void LLVMProfileReader::ReadFromFunctionSamples(
     SourceStack new_stack;
     new_stack.push_back(info);
     new_stack.insert(new_stack.end(), stack.begin(), stack.end());
-    symbol_map_->AddSourceCount(top_func_name, new_stack,
+    symbol_map_->AddSourceCount(top_symbol, new_stack,
                                 loc_sample.second.getSamples(), 1);
     for (const auto &target_count : loc_sample.second.getCallTargets()) {
-      symbol_map_->AddIndirectCallTarget(top_func_name, new_stack,
+      symbol_map_->AddIndirectCallTarget(top_symbol, new_stack,
                                          GetName(target_count.getKey()),
                                          target_count.getValue());
     }
@@ -111,9 +112,8 @@ void LLVMProfileReader::ReadFromFunctionSamples(
   // NB: For inline instances, this can theoritically happen if lines without
   // debug information receive samples and lines with debug information don't.
   // It's not something we have seen in practice so it's not being implemented.
-  if (stack.empty() &&
-      symbol_map_->map().at(func_name)->total_count == 0) {
-    symbol_map_->AddSymbolEntryCount(func_name, 0, fs.getTotalSamples());
+  if (stack.empty() && top_symbol->total_count == 0) {
+    symbol_map_->AddSymbolEntryCount(top_symbol, 0, fs.getTotalSamples());
   }
 }
 
@@ -40,6 +40,10 @@ bool LLVMProfileBuilder::Write(
   // Tell the profile writer if FS Discriminators are used.
   llvm::sampleprof::FunctionSamples::ProfileIsFS =
       SourceInfo::use_fs_discriminator;
+  // Tell the profile writer if the locations are pseudo probes, whose
+  // profiles also carry the CFG checksums of the functions.
+  llvm::sampleprof::FunctionSamples::ProfileIsProbeBased =
+      SourceInfo::use_pseudo_probe;
 #endif
 
   if (profiles.empty()) {
@@ -67,6 +71,7 @@ const llvm::sampleprof::SampleProfileMap &LLVMProfileBuilder::ConvertProfiles(
 const llvm::StringMap<llvm::sampleprof::FunctionSamples>
     &LLVMProfileBuilder::ConvertProfiles(const SymbolMap &symbol_map) {
 #endif
+  symbol_map_ = &symbol_map;
   Start(symbol_map);
   return GetProfiles();
 }
@@ -86,6 +91,10 @@ void LLVMProfileBuilder::VisitTopSymbol(const std::string &name,
                << "': " << EC.message();
 
   profile.setName(name_ref);
+#if LLVM_VERSION_MAJOR >= 12
+  if (SourceInfo::use_pseudo_probe)
+    profile.setFunctionHash(symbol_map_->GetFunctionHash(name));
+#endif
   inline_stack_.clear();
   inline_stack_.push_back(&profile);
 }
@@ -104,6 +113,11 @@ void LLVMProfileBuilder::VisitCallsite(const Callsite &callsite) {
       caller_profile.functionSamplesAt(llvm::sampleprof::LineLocation(
           line, discriminator))[std::string(CalleeName)];
   callee_profile.setName(CalleeName);
+#if LLVM_VERSION_MAJOR >= 12
+  if (SourceInfo::use_pseudo_probe)
+    callee_profile.setFunctionHash(
+        symbol_map_->GetFunctionHash(Symbol::Name(callsite.second)));
+#endif
   inline_stack_.push_back(&callee_profile);
 }
 
@@ -170,6 +184,7 @@ llvm::sampleprof::SampleProfileWriter *LLVMProfileWriter::CreateSampleWriter(
     return nullptr;
   }
   sample_prof_writer_ = std::move(WriterOrErr.get());
+  sample_prof_writer_filename_ = output_filename;
   return sample_prof_writer_.get();
 }
 
@@ -181,9 +196,10 @@ bool LLVMProfileWriter::WriteToFile(const std::string &output_filename) {
   StringIndexMap name_table;
   StringTableUpdater::Update(*symbol_map_, &name_table);
 
-  // If the underlying llvm profile writer has not been created yet,
-  // create it here.
-  if (!sample_prof_writer_) {
+  // If the underlying llvm profile writer has not been created yet, or writes
+  // to another file, create it here.
+  if (!sample_prof_writer_ ||
+      sample_prof_writer_filename_ != output_filename) {
     if (!CreateSampleWriter(output_filename)) {
       return false;
     }
@@ -30,6 +30,8 @@ class LLVMProfileWriter : public ProfileWriter {
  private:
   llvm::sampleprof::SampleProfileFormat format_;
   std::unique_ptr<llvm::sampleprof::SampleProfileWriter> sample_prof_writer_;
+  // The file sample_prof_writer_ writes to.
+  std::string sample_prof_writer_filename_;
 
   DISALLOW_COPY_AND_ASSIGN(LLVMProfileWriter);
 };
@@ -40,7 +42,8 @@ class LLVMProfileBuilder : public SymbolTraverser {
       : profiles_(),
         result_(llvm::sampleprof_error::success),
         inline_stack_(),
-        name_table_(name_table) {}
+        name_table_(name_table),
+        symbol_map_(nullptr) {}
 
   static bool Write(
       const std::string &output_filename,
@@ -84,6 +87,8 @@ class LLVMProfileBuilder : public SymbolTraverser {
   llvm::sampleprof_error result_;
   std::vector<llvm::sampleprof::FunctionSamples *> inline_stack_;
   const StringIndexMap &name_table_;
+  // The symbol map being converted.
+  const SymbolMap *symbol_map_;
 
   DISALLOW_COPY_AND_ASSIGN(LLVMProfileBuilder);
 };
@@ -113,6 +113,48 @@ PropellerOptionsBuilder& PropellerOptionsBuilder::SetHttp(bool value) {
   return *this;
 }
 
+PropellerOptionsBuilder& PropellerOptionsBuilder::SetPerfSampleDownsampleFactor(
+    uint32_t value) {
+  data_.set_perf_sample_downsample_factor(value);
+  return *this;
+}
+
+PropellerOptionsBuilder& PropellerOptionsBuilder::SetPerfSampleDownsampleSeed(
+    uint64_t value) {
+  data_.set_perf_sample_downsample_seed(value);
+  return *this;
+}
+
+PropellerOptionsBuilder& PropellerOptionsBuilder::SetPerfSampleMinTimeNs(
+    uint64_t value) {
+  data_.set_perf_sample_min_time_ns(value);
+  return *this;
+}
+
+PropellerOptionsBuilder& PropellerOptionsBuilder::SetPerfSampleMaxTimeNs(
+    uint64_t value) {
+  data_.set_perf_sample_max_time_ns(value);
+  return *this;
+}
+
+PropellerOptionsBuilder& PropellerOptionsBuilder::AddPerfSamplePids(
+    uint32_t value) {
+  data_.add_perf_sample_pids(value);
+  return *this;
+}
+
+PropellerOptionsBuilder& PropellerOptionsBuilder::AddPerfSampleTids(
+    uint32_t value) {
+  data_.add_perf_sample_tids(value);
+  return *this;
+}
+
+PropellerOptionsBuilder& PropellerOptionsBuilder::AddPerfSampleCpus(
+    uint32_t value) {
+  data_.add_perf_sample_cpus(value);
+  return *this;
+}
+
 PropellerOptionsBuilder& PropellerOptionsBuilder::SetCodeLayoutParamsCallChainClustering(bool value) {
   data_.mutable_code_layout_params()->set_call_chain_clustering(value);
   return *this;
@@ -41,6 +41,13 @@ class PropellerOptionsBuilder {
   PropellerOptionsBuilder& SetVerboseClusterOutput(bool value);
   PropellerOptionsBuilder& SetCfgDumpDirName(const std::string & value);
   PropellerOptionsBuilder& SetHttp(bool value);
+  PropellerOptionsBuilder& SetPerfSampleDownsampleFactor(uint32_t value);
+  PropellerOptionsBuilder& SetPerfSampleDownsampleSeed(uint64_t value);
+  PropellerOptionsBuilder& SetPerfSampleMinTimeNs(uint64_t value);
+  PropellerOptionsBuilder& SetPerfSampleMaxTimeNs(uint64_t value);
+  PropellerOptionsBuilder& AddPerfSamplePids(uint32_t value);
+  PropellerOptionsBuilder& AddPerfSampleTids(uint32_t value);
+  PropellerOptionsBuilder& AddPerfSampleCpus(uint32_t value);
   PropellerOptionsBuilder& SetCodeLayoutParamsCallChainClustering(bool value);
   PropellerOptionsBuilder& SetCodeLayoutParamsClusterMergeSizeThreshold(uint32_t value);
   PropellerOptionsBuilder& SetCodeLayoutParamsReorderHotBlocks(bool value);
@@ -21,6 +21,8 @@
 #include "llvm_propeller_formatting.h"
 #include "llvm_propeller_options.pb.h"
 #include "llvm_propeller_perf_data_provider.h"
+#include "perf_data_decompressor.h"
+#include "perf_sample_filter.h"
 #include "perfdata_reader.h"
 #include "third_party/abseil/absl/algorithm/container.h"
 #include "third_party/abseil/absl/container/btree_map.h"
@@ -37,7 +39,9 @@
 #include "llvm/Object/ELFTypes.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FormatAdapters.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 // The following inclusions are automatically deleted when prepare source for
 // upstream.
@@ -230,6 +234,17 @@ absl::StatusOr<LBRAggregation> PropellerWholeProgramInfo::ParsePerfData() {
 
   LBRAggregation lbr_aggregation;
 
+  PerfSampleFilter sample_filter;
+  sample_filter.set_time_range(options_.perf_sample_min_time_ns(),
+                               options_.perf_sample_max_time_ns());
+  sample_filter.set_pids(PerfSampleFilter::IdSet(
+      options_.perf_sample_pids().begin(), options_.perf_sample_pids().end()));
+  sample_filter.set_tids(PerfSampleFilter::IdSet(
+      options_.perf_sample_tids().begin(), options_.perf_sample_tids().end()));
+  sample_filter.set_cpus(PerfSampleFilter::IdSet(
+      options_.perf_sample_cpus().begin(), options_.perf_sample_cpus().end()));
+  perf_data_reader_.SetSampleFilter(sample_filter);
+
   binary_perf_info_.ResetPerfInfo();
   while (true) {
     ASSIGN_OR_RETURN(std::optional<PerfDataProvider::BufferHandle> perf_data,
@@ -237,6 +252,38 @@ absl::StatusOr<LBRAggregation> PropellerWholeProgramInfo::ParsePerfData() {
 
     if (!perf_data.has_value()) break;
 
+    llvm::StringRef raw_data = perf_data->buffer->getBuffer();
+    if (IsCompressedPerfData(
+            absl::string_view(raw_data.data(), raw_data.size()))) {
+      // Expand the records of 'perf record -z' profiles, which quipper cannot
+      // read, without writing the expanded profile to disk.
+      std::string expanded;
+      if (!DecompressPerfData(
+              absl::string_view(raw_data.data(), raw_data.size()),
+              &expanded)) {
+        LOG(WARNING) << "Skipped profile " << perf_data->description
+                     << ", because its compressed records cannot be read.";
+        continue;
+      }
+      perf_data->buffer = llvm::MemoryBuffer::getMemBufferCopy(
+          expanded, perf_data->buffer->getBufferIdentifier());
+    }
+
+    if (sample_filter.HasTimeRange()) {
+      // Drop the parts of the profile outside of the time window before it is
+      // parsed. The index is saved next to the profile when it is a file.
+      std::string file_name = perf_data->buffer->getBufferIdentifier().str();
+      if (!llvm::sys::fs::is_regular_file(file_name)) file_name.clear();
+      llvm::StringRef data = perf_data->buffer->getBuffer();
+      std::string filtered;
+      if (sample_filter.SkipByTime(
+              file_name, absl::string_view(data.data(), data.size()),
+              &filtered)) {
+        perf_data->buffer = llvm::MemoryBuffer::getMemBufferCopy(
+            filtered, perf_data->buffer->getBufferIdentifier());
+      }
+    }
+
     std::string description = perf_data->description;
     LOG(INFO) << "Parsing " << description << " ...";
     if (!PerfDataReader().SelectPerfInfo(std::move(*perf_data), match_mmap_name,
@@ -252,7 +299,9 @@ absl::StatusOr<LBRAggregation> PropellerWholeProgramInfo::ParsePerfData() {
     }
     stats_.binary_mmap_num += binary_perf_info_.binary_mmaps.size();
     ++stats_.perf_file_parsed;
-    perf_data_reader_.AggregateLBR(binary_perf_info_, &lbr_aggregation);
+    perf_data_reader_.AggregateLBR(binary_perf_info_, &lbr_aggregation,
+                                   options_.perf_sample_downsample_factor(),
+                                   options_.perf_sample_downsample_seed());
     if (!options_.keep_frontend_intermediate_data()) {
       // "keep_frontend_intermediate_data" is only used by tests.
       binary_perf_info_.ResetPerfInfo();  // Release quipper parser memory.
@@ -0,0 +1,109 @@
+// History of the mmaps of the profiled binary in the processes of a profile.
+
+#include "mmap_history.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace devtools_crosstool_autofdo {
+
+void MMapHistory::AddMMap(uint64_t time, uint32_t pid, uint64_t start,
+                          uint64_t len, uint64_t pgoff, bool binary) {
+  events_.push_back({time, pid, false, 0, start, len, pgoff, binary});
+  if (binary) num_binary_mmaps_++;
+}
+
+void MMapHistory::AddFork(uint64_t time, uint32_t pid, uint32_t ppid) {
+  if (pid == ppid) return;
+  events_.push_back({time, pid, true, ppid, 0, 0, 0, false});
+}
+
+void MMapHistory::Finish() {
+  CHECK(times_.empty()) << "Finish can only be called once.";
+  // Only the other mmaps which hide a part of a mapping of the binary, in any
+  // process, matter.
+  std::vector<std::pair<uint64_t, uint64_t>> binary_ranges;
+  for (const Event &event : events_) {
+    if (event.binary) {
+      binary_ranges.emplace_back(event.start, event.start + event.len);
+    }
+  }
+  std::sort(binary_ranges.begin(), binary_ranges.end());
+  // The ranges starting before an address, with the furthest end so far.
+  std::vector<uint64_t> max_ends;
+  for (const auto &range : binary_ranges) {
+    max_ends.push_back(
+        std::max(range.second, max_ends.empty() ? 0 : max_ends.back()));
+  }
+  auto overlaps_binary = [&](const Event &event) {
+    auto range = std::lower_bound(
+        binary_ranges.begin(), binary_ranges.end(),
+        std::make_pair(event.start + event.len, uint64_t{0}));
+    return range != binary_ranges.begin() &&
+           max_ends[range - binary_ranges.begin() - 1] > event.start;
+  };
+  events_.erase(std::remove_if(events_.begin(), events_.end(),
+                               [&](const Event &event) {
+                                 return !event.is_fork && !event.binary &&
+                                        !overlaps_binary(event);
+                               }),
+                events_.end());
+
+  std::stable_sort(
+      events_.begin(), events_.end(),
+      [](const Event &a, const Event &b) { return a.time < b.time; });
+  CHECK_LT(events_.size(), std::numeric_limits<uint32_t>::max());
+  times_.reserve(events_.size());
+  for (uint32_t i = 0; i < events_.size(); ++i) {
+    times_.push_back(events_[i].time);
+    events_by_pid_[events_[i].pid].push_back(i);
+  }
+}
+
+uint32_t MMapHistory::Epoch(uint64_t time) const {
+  return std::upper_bound(times_.begin(), times_.end(), time) - times_.begin();
+}
+
+bool MMapHistory::ProcessToOffset(uint32_t pid, uint32_t epoch, uint64_t addr,
+                                  uint64_t *offset, bool *mapped) const {
+  *mapped = false;
+  for (;;) {
+    auto iter = events_by_pid_.find(pid);
+    if (iter == events_by_pid_.end()) return false;
+    const std::vector<uint32_t> &indices = iter->second;
+    // The events of the process before EPOCH, the latest first. Before its
+    // fork, the process has the mappings of its parent.
+    auto index = std::lower_bound(indices.begin(), indices.end(), epoch);
+    const Event *fork = nullptr;
+    while (index != indices.begin()) {
+      const Event &event = events_[*--index];
+      if (event.is_fork) {
+        fork = &event;
+        break;
+      }
+      if (addr - event.start < event.len) {
+        *mapped = true;
+        if (!event.binary) return false;
+        *offset = addr - event.start + event.pgoff;
+        return true;
+      }
+    }
+    if (fork == nullptr) return false;
+    pid = fork->ppid;
+    epoch = *index;
+  }
+}
+
+bool MMapHistory::ToOffset(uint32_t pid, uint32_t epoch, uint64_t addr,
+                           uint64_t *offset) const {
+  bool mapped;
+  if (ProcessToOffset(pid, epoch, addr, offset, &mapped)) return true;
+  return !mapped && pid != kAllPids &&
+         ProcessToOffset(kAllPids, epoch, addr, offset, &mapped);
+}
+
+}  // namespace devtools_crosstool_autofdo
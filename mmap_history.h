@@ -0,0 +1,90 @@
+// History of the mmaps of the profiled binary in the processes of a profile.
+
+#ifndef AUTOFDO_MMAP_HISTORY_H_
+#define AUTOFDO_MMAP_HISTORY_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "base/macros.h"
+#include "third_party/abseil/absl/container/flat_hash_map.h"
+
+namespace devtools_crosstool_autofdo {
+
+// Tracks where the profiled binary is mapped in each process over the time of
+// a perf.data recording, from its mmap and fork events. A sample is then
+// translated with the mappings live at its time, like quipper::PerfParser does
+// when it processes the events in order:
+//  - a later mmap replaces an earlier one for the addresses they share,
+//    whether or not it maps the profiled binary;
+//  - a forked process starts with the mappings of its parent at the time of
+//    the fork.
+//
+// The mappings only change at the events, so a sample is translated at its
+// epoch, the number of events at or before its time. The samples with the same
+// epoch see the same mappings, whatever their exact time.
+class MMapHistory {
+ public:
+  // The pid of the mmaps shared by all the processes, e.g. the kernel image.
+  static constexpr uint32_t kAllPids = std::numeric_limits<uint32_t>::max();
+
+  MMapHistory() = default;
+
+  // Adds the mmap of [START, START + LEN), at the file offset PGOFF, in the
+  // process PID at TIME. BINARY tells if it maps the profiled binary.
+  void AddMMap(uint64_t time, uint32_t pid, uint64_t start, uint64_t len,
+               uint64_t pgoff, bool binary);
+  // Adds the fork of the process PID from the process PPID at TIME. The
+  // threads of a process, for which PID is PPID, share its mappings already.
+  void AddFork(uint64_t time, uint32_t pid, uint32_t ppid);
+
+  // Orders the events by time, the events with the same time staying in the
+  // order they were added. Must be called once, after the last event is added
+  // and before the lookups.
+  void Finish();
+
+  // Returns true if no mmap maps the profiled binary.
+  bool empty() const { return num_binary_mmaps_ == 0; }
+
+  // Returns the epoch of TIME.
+  uint32_t Epoch(uint64_t time) const;
+
+  // Translates the address ADDR of the process PID at EPOCH to the offset in
+  // the profiled binary. Returns false if the binary is not mapped at ADDR.
+  bool ToOffset(uint32_t pid, uint32_t epoch, uint64_t addr,
+                uint64_t *offset) const;
+
+ private:
+  struct Event {
+    uint64_t time;
+    uint32_t pid;
+    bool is_fork;
+    // The parent process of a fork.
+    uint32_t ppid;
+    // The range of an mmap, and if it maps the profiled binary.
+    uint64_t start;
+    uint64_t len;
+    uint64_t pgoff;
+    bool binary;
+  };
+
+  // Translates ADDR with the events of the process PID and of its ancestors
+  // before EPOCH. Sets *MAPPED if ADDR is mapped in the process, to the
+  // profiled binary or not.
+  bool ProcessToOffset(uint32_t pid, uint32_t epoch, uint64_t addr,
+                       uint64_t *offset, bool *mapped) const;
+
+  std::vector<Event> events_;
+  // The times of events_, sorted by Finish.
+  std::vector<uint64_t> times_;
+  // The indices in events_ of the events of each process, in order.
+  absl::flat_hash_map<uint32_t, std::vector<uint32_t>> events_by_pid_;
+  uint64_t num_binary_mmaps_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(MMapHistory);
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_MMAP_HISTORY_H_
@@ -0,0 +1,100 @@
+// Translation of the sampled addresses with the mmaps live at their time.
+
+#include "mmap_history.h"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using devtools_crosstool_autofdo::MMapHistory;
+
+// Returns the offset of ADDR in the binary for PID at TIME, or -1 if the
+// binary is not mapped there.
+int64_t Translate(const MMapHistory &mmaps, uint32_t pid, uint64_t time,
+                  uint64_t addr) {
+  uint64_t offset;
+  if (!mmaps.ToOffset(pid, mmaps.Epoch(time), addr, &offset)) return -1;
+  return offset;
+}
+
+TEST(MMapHistoryTest, Empty) {
+  MMapHistory mmaps;
+  mmaps.AddMMap(10, 1, 0x1000, 0x1000, 0, false);
+  mmaps.Finish();
+  EXPECT_TRUE(mmaps.empty());
+  EXPECT_EQ(Translate(mmaps, 1, 20, 0x1800), -1);
+}
+
+TEST(MMapHistoryTest, MMapsApplyInTimeOrder) {
+  MMapHistory mmaps;
+  // Added out of order: the binary is mapped at 0x1000 at time 10, another
+  // file replaces the second page at time 30, and the binary is mapped again
+  // at 0x5000 at time 20.
+  mmaps.AddMMap(30, 1, 0x2000, 0x1000, 0, false);
+  mmaps.AddMMap(10, 1, 0x1000, 0x2000, 0x400, true);
+  mmaps.AddMMap(20, 1, 0x5000, 0x1000, 0, true);
+  // An unrelated mmap of another process.
+  mmaps.AddMMap(5, 2, 0x8000, 0x1000, 0, false);
+  mmaps.Finish();
+  EXPECT_FALSE(mmaps.empty());
+
+  EXPECT_EQ(Translate(mmaps, 1, 5, 0x1010), -1);
+  EXPECT_EQ(Translate(mmaps, 1, 10, 0x1010), 0x410);
+  EXPECT_EQ(Translate(mmaps, 1, 15, 0x2010), 0x1410);
+  EXPECT_EQ(Translate(mmaps, 1, 15, 0x5010), -1);
+  EXPECT_EQ(Translate(mmaps, 1, 25, 0x5010), 0x10);
+  // The other file only hides the page it maps.
+  EXPECT_EQ(Translate(mmaps, 1, 30, 0x2010), -1);
+  EXPECT_EQ(Translate(mmaps, 1, 30, 0x1010), 0x410);
+  EXPECT_EQ(Translate(mmaps, 2, 30, 0x1010), -1);
+}
+
+TEST(MMapHistoryTest, ForkedProcessesInheritMMaps) {
+  MMapHistory mmaps;
+  mmaps.AddMMap(10, 1, 0x1000, 0x1000, 0, true);
+  mmaps.AddFork(20, 2, 1);
+  // The parent maps the binary again after the fork, the child does not see
+  // it.
+  mmaps.AddMMap(30, 1, 0x5000, 0x1000, 0, true);
+  // A grandchild, which maps the binary somewhere else.
+  mmaps.AddFork(40, 3, 2);
+  mmaps.AddMMap(50, 3, 0x1000, 0x1000, 0, false);
+  mmaps.AddMMap(50, 3, 0x9000, 0x1000, 0x100, true);
+  // A thread of the first process.
+  mmaps.AddFork(60, 1, 1);
+  mmaps.Finish();
+
+  EXPECT_EQ(Translate(mmaps, 2, 15, 0x1010), -1);
+  EXPECT_EQ(Translate(mmaps, 2, 20, 0x1010), 0x10);
+  EXPECT_EQ(Translate(mmaps, 2, 35, 0x1010), 0x10);
+  EXPECT_EQ(Translate(mmaps, 2, 35, 0x5010), -1);
+  EXPECT_EQ(Translate(mmaps, 1, 35, 0x5010), 0x10);
+  EXPECT_EQ(Translate(mmaps, 3, 45, 0x1010), 0x10);
+  EXPECT_EQ(Translate(mmaps, 3, 55, 0x1010), -1);
+  EXPECT_EQ(Translate(mmaps, 3, 55, 0x9010), 0x110);
+  EXPECT_EQ(Translate(mmaps, 1, 65, 0x1010), 0x10);
+}
+
+TEST(MMapHistoryTest, MMapsOfAllProcesses) {
+  MMapHistory mmaps;
+  mmaps.AddMMap(0, MMapHistory::kAllPids, 0x100000, 0x1000, 0x200, true);
+  mmaps.AddMMap(10, 1, 0x1000, 0x1000, 0, false);
+  mmaps.Finish();
+  EXPECT_EQ(Translate(mmaps, 1, 20, 0x100010), 0x210);
+  EXPECT_EQ(Translate(mmaps, 1, 20, 0x1010), -1);
+}
+
+TEST(MMapHistoryTest, SameEpochSameMappings) {
+  MMapHistory mmaps;
+  mmaps.AddMMap(10, 1, 0x1000, 0x1000, 0, true);
+  mmaps.AddMMap(20, 1, 0x1000, 0x1000, 0, false);
+  mmaps.Finish();
+  EXPECT_EQ(mmaps.Epoch(0), 0);
+  EXPECT_EQ(mmaps.Epoch(10), 1);
+  EXPECT_EQ(mmaps.Epoch(15), 1);
+  EXPECT_EQ(mmaps.Epoch(20), 2);
+  EXPECT_EQ(mmaps.Epoch(UINT64_MAX), 2);
+}
+}  // namespace
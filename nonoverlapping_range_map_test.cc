@@ -0,0 +1,127 @@
+// Lookups in a NonOverlappingRangeMap, before and after it is frozen.
+
+#include "symbolize/nonoverlapping_range_map.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using devtools_crosstool_autofdo::NonOverlappingRangeMap;
+
+// Returns the value and bounds of the range of MAP containing ADDRESS as
+// "value [low, high)", or "none".
+std::string LookupString(const NonOverlappingRangeMap<int> &map,
+                         uint64_t address) {
+  uint64 low = 0, high = 0;
+  const int *value = map.Lookup(address, &low, &high);
+  if (value == nullptr) return "none";
+  return std::to_string(*value) + " [" + std::to_string(low) + ", " +
+         std::to_string(high) + ")";
+}
+
+// Looks up each of ADDRESSES in MAP, then freezes it and checks that the
+// lookups give the same results. Returns the results.
+std::vector<std::string> LookupBeforeAndAfterFreeze(
+    NonOverlappingRangeMap<int> *map, const std::vector<uint64_t> &addresses) {
+  std::vector<std::string> results;
+  for (uint64_t address : addresses) {
+    results.push_back(LookupString(*map, address));
+  }
+  map->Freeze();
+  EXPECT_TRUE(map->Frozen());
+  for (int i = 0; i < addresses.size(); ++i) {
+    EXPECT_EQ(LookupString(*map, addresses[i]), results[i])
+        << "address " << addresses[i];
+  }
+  return results;
+}
+
+TEST(NonOverlappingRangeMapTest, Empty) {
+  NonOverlappingRangeMap<int> map;
+  EXPECT_TRUE(map.Empty());
+  EXPECT_EQ(LookupBeforeAndAfterFreeze(&map, {0, 1, UINT64_MAX}),
+            std::vector<std::string>({"none", "none", "none"}));
+  EXPECT_TRUE(map.Empty());
+  EXPECT_TRUE(map.FrozenRanges().empty());
+}
+
+TEST(NonOverlappingRangeMapTest, SingleRange) {
+  NonOverlappingRangeMap<int> map;
+  map.InsertRange(0x10, 0x20, 1);
+  EXPECT_EQ(LookupBeforeAndAfterFreeze(&map, {0, 0xf, 0x10, 0x1f, 0x20}),
+            std::vector<std::string>(
+                {"none", "none", "1 [16, 32)", "1 [16, 32)", "none"}));
+  EXPECT_FALSE(map.Empty());
+  ASSERT_EQ(map.FrozenRanges().size(), 1);
+  EXPECT_EQ(map.FrozenRanges()[0].first.first, 0x10);
+  EXPECT_EQ(map.FrozenRanges()[0].first.second, 0x20);
+}
+
+TEST(NonOverlappingRangeMapTest, GapsBetweenRanges) {
+  NonOverlappingRangeMap<int> map;
+  map.InsertRange(20, 30, 2);
+  map.InsertRange(10, 15, 1);
+  // Adjacent to the range before it.
+  map.InsertRange(30, 35, 3);
+  map.InsertRange(50, 60, 4);
+  EXPECT_EQ(
+      LookupBeforeAndAfterFreeze(
+          &map, {5, 10, 14, 15, 19, 20, 29, 30, 34, 35, 49, 50, 59, 60, 1000,
+                 UINT64_MAX}),
+      std::vector<std::string>(
+          {"none", "1 [10, 15)", "1 [10, 15)", "none", "none", "2 [20, 30)",
+           "2 [20, 30)", "3 [30, 35)", "3 [30, 35)", "none", "none",
+           "4 [50, 60)", "4 [50, 60)", "none", "none", "none"}));
+}
+
+TEST(NonOverlappingRangeMapTest, SplitRanges) {
+  NonOverlappingRangeMap<int> map;
+  // The inner range splits the outer one, and the enclosing range fills the
+  // gaps around them.
+  map.InsertRange(10, 40, 1);
+  map.InsertRange(20, 30, 2);
+  map.InsertRange(0, 50, 3);
+  EXPECT_EQ(LookupBeforeAndAfterFreeze(&map, {0, 10, 20, 30, 40, 49, 50}),
+            std::vector<std::string>({"3 [0, 10)", "1 [10, 20)", "2 [20, 30)",
+                                      "1 [30, 40)", "3 [40, 50)", "3 [40, 50)",
+                                      "none"}));
+}
+
+TEST(NonOverlappingRangeMapTest, AllTreeShapes) {
+  // The maps of 1 to 70 ranges cover complete, full and partial last levels
+  // of the Eytzinger tree.
+  for (int n = 1; n <= 70; ++n) {
+    NonOverlappingRangeMap<int> map;
+    std::vector<uint64_t> addresses;
+    for (int i = 0; i < n; ++i) {
+      // Ranges of varying lengths, with a gap after every third one.
+      const uint64_t low = 100 * i;
+      const uint64_t high = low + (i % 3 == 2 ? 50 : 100);
+      map.InsertRange(low, high, i);
+      addresses.insert(addresses.end(), {low, low + 1, high - 1, high});
+    }
+    addresses.push_back(UINT64_MAX);
+    const std::vector<std::string> results =
+        LookupBeforeAndAfterFreeze(&map, addresses);
+    // Both ends of the last range, and past it.
+    const uint64_t last_low = 100 * (n - 1);
+    const std::string last_range = std::to_string(n - 1) + " [" +
+                                   std::to_string(last_low) + ", " +
+                                   std::to_string(addresses[4 * n - 1]) + ")";
+    EXPECT_EQ(results[4 * n - 4], last_range);
+    EXPECT_EQ(results[4 * n - 2], last_range);
+    EXPECT_EQ(results[4 * n - 1], "none");
+    EXPECT_EQ(results[4 * n], "none");
+    // The first range, and the gaps.
+    EXPECT_EQ(results[0], "0 [0, 100)");
+    for (int i = 2; i < n; i += 3) {
+      EXPECT_EQ(results[4 * i + 3], "none") << n << " " << i;
+    }
+  }
+}
+}  // namespace
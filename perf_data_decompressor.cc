@@ -0,0 +1,261 @@
+#include "perf_data_decompressor.h"
+
+#include <string.h>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "perf_data_index.h"
+#include "third_party/abseil/absl/numeric/bits.h"
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace devtools_crosstool_autofdo {
+namespace {
+// Layout of the perf.data file, see tools/perf/util/header.h in the kernel.
+constexpr uint64_t kPerfMagic = 0x32454c4946524550ULL;  // "PERFILE2"
+constexpr uint64_t kFileHeaderSize = 104;
+constexpr uint64_t kDataSectionOffset = 40;
+constexpr uint64_t kFeaturesOffset = 72;
+constexpr int kFeatureCompressed = 27;
+// Size of a perf_event_header {type, misc, size}.
+constexpr uint64_t kEventHeaderSize = 8;
+// The payload of a PERF_RECORD_COMPRESSED record directly follows its header,
+// that of a PERF_RECORD_COMPRESSED2 record follows its u64 size, and is
+// padded to 8 bytes.
+constexpr uint32_t kRecordCompressed = 81;
+constexpr uint32_t kRecordCompressed2 = 83;
+constexpr int kFeatureWords = 4;
+// Size of a perf_file_section {offset, size}.
+constexpr uint64_t kSectionSize = 16;
+
+template <typename T>
+T Read(absl::string_view data, uint64_t offset) {
+  T value;
+  memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+template <typename T>
+void Write(uint64_t offset, T value, std::string *data) {
+  memcpy(&(*data)[offset], &value, sizeof(value));
+}
+
+// Removes the HEADER_COMPRESSED feature of the perf.data contents DATA, whose
+// records have been decompressed, as perf inject does. Its section is left in
+// place, but its entry of the feature table is removed.
+bool RemoveCompressedFeature(std::string *data) {
+  const uint64_t table = Read<uint64_t>(*data, kDataSectionOffset) +
+                         Read<uint64_t>(*data, kDataSectionOffset + 8);
+  const uint64_t features = Read<uint64_t>(*data, kFeaturesOffset);
+  const int index =
+      absl::popcount(features & ((1ULL << kFeatureCompressed) - 1));
+  int num_features = 0;
+  for (int i = 0; i < kFeatureWords; ++i) {
+    num_features +=
+        absl::popcount(Read<uint64_t>(*data, kFeaturesOffset + 8 * i));
+  }
+  if (table + num_features * kSectionSize > data->size()) {
+    return false;
+  }
+  data->erase(table + index * kSectionSize, kSectionSize);
+  Write<uint64_t>(kFeaturesOffset, features & ~(1ULL << kFeatureCompressed),
+                  data);
+  for (int i = 0; i < num_features - 1; ++i) {
+    const uint64_t entry = table + i * kSectionSize;
+    const uint64_t offset = Read<uint64_t>(*data, entry);
+    if (offset > table) {
+      Write<uint64_t>(entry, offset - kSectionSize, data);
+    }
+  }
+  return true;
+}
+
+#if defined(HAVE_ZSTD)
+// Decompresses the zstd stream of the compressed records of a perf.data file.
+// The stream continues from one record to the next.
+class RecordDecompressor {
+ public:
+  RecordDecompressor() : stream_(ZSTD_createDStream()) {
+    ZSTD_initDStream(stream_);
+  }
+  ~RecordDecompressor() { ZSTD_freeDStream(stream_); }
+
+  // Appends the decompressed contents of PAYLOAD to OUTPUT, growing it by at
+  // most the recommended output size of zstd at a time.
+  bool Append(absl::string_view payload, std::string *output) {
+    const size_t step = ZSTD_DStreamOutSize();
+    ZSTD_inBuffer in = {payload.data(), payload.size(), 0};
+    while (true) {
+      const size_t begin = output->size();
+      output->resize(begin + step);
+      ZSTD_outBuffer out = {&(*output)[begin], step, 0};
+      const size_t result = ZSTD_decompressStream(stream_, &out, &in);
+      output->resize(begin + out.pos);
+      frame_complete_ = result == 0;
+      if (ZSTD_isError(result)) {
+        LOG(ERROR) << "Cannot decompress perf.data record: "
+                   << ZSTD_getErrorName(result);
+        return false;
+      }
+      // The output is only partially flushed when the step is full.
+      if (in.pos == in.size && out.pos < out.size) {
+        return true;
+      }
+    }
+  }
+
+  // Appends to OUTPUT the events held by RECORD if it is a compressed record,
+  // or RECORD itself otherwise.
+  bool AppendRecord(absl::string_view record, std::string *output) {
+    const uint32_t type = Read<uint32_t>(record, 0);
+    if (type == kRecordCompressed) {
+      return Append(record.substr(kEventHeaderSize), output);
+    }
+    if (type == kRecordCompressed2) {
+      if (record.size() < kEventHeaderSize + 8 ||
+          Read<uint64_t>(record, kEventHeaderSize) >
+              record.size() - kEventHeaderSize - 8) {
+        return false;
+      }
+      return Append(record.substr(kEventHeaderSize + 8,
+                                  Read<uint64_t>(record, kEventHeaderSize)),
+                    output);
+    }
+    output->append(record.data(), record.size());
+    return true;
+  }
+
+  // Returns true if the stream does not end in the middle of a frame.
+  bool frame_complete() const { return frame_complete_; }
+
+ private:
+  ZSTD_DStream *stream_;
+  bool frame_complete_ = true;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordDecompressor);
+};
+#endif
+}  // namespace
+
+bool IsCompressedPerfData(absl::string_view data) {
+  return data.size() >= kFileHeaderSize &&
+         Read<uint64_t>(data, 0) == kPerfMagic &&
+         (Read<uint64_t>(data, kFeaturesOffset) >> kFeatureCompressed) & 1;
+}
+
+bool DecompressPerfData(absl::string_view data, std::string *output) {
+#if defined(HAVE_ZSTD)
+  if (!IsCompressedPerfData(data)) {
+    return false;
+  }
+  const uint64_t data_offset = Read<uint64_t>(data, kDataSectionOffset);
+  const uint64_t data_size = Read<uint64_t>(data, kDataSectionOffset + 8);
+  if (data_offset > data.size() || data_size > data.size() - data_offset) {
+    LOG(ERROR) << "Malformed perf.data header";
+    return false;
+  }
+  const uint64_t end = data_offset + data_size;
+  output->clear();
+  output->append(data.data(), data_offset);
+  RecordDecompressor decompressor;
+  for (uint64_t pos = data_offset; pos < end;) {
+    if (end - pos < kEventHeaderSize) {
+      LOG(ERROR) << "Truncated perf.data record at offset " << pos;
+      return false;
+    }
+    const uint16_t size = Read<uint16_t>(data, pos + 6);
+    if (size < kEventHeaderSize || size > end - pos) {
+      LOG(ERROR) << "Malformed perf.data record at offset " << pos;
+      return false;
+    }
+    if (!decompressor.AppendRecord(data.substr(pos, size), output)) {
+      LOG(ERROR) << "Malformed perf.data record at offset " << pos;
+      return false;
+    }
+    pos += size;
+  }
+  if (!decompressor.frame_complete()) {
+    LOG(ERROR) << "Truncated compressed perf.data records";
+    return false;
+  }
+  return FinishPerfDataRewrite(data, output) &&
+         RemoveCompressedFeature(output);
+#else
+  LOG(ERROR) << "Cannot read compressed perf.data: autofdo was built without "
+                "zstd support";
+  return false;
+#endif
+}
+
+bool DecompressPerfDataFile(const std::string &file_name,
+                            std::string *output) {
+#if defined(HAVE_ZSTD)
+  std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+  if (!file) {
+    LOG(ERROR) << "Cannot open " << file_name;
+    return false;
+  }
+  const uint64_t file_size = file.tellg();
+  std::string header(kFileHeaderSize, '\0');
+  if (!file.seekg(0) || !file.read(&header[0], header.size()) ||
+      !IsCompressedPerfData(header)) {
+    return false;
+  }
+  const uint64_t data_offset = Read<uint64_t>(header, kDataSectionOffset);
+  const uint64_t data_size = Read<uint64_t>(header, kDataSectionOffset + 8);
+  if (data_offset < kFileHeaderSize || data_offset > file_size ||
+      data_size > file_size - data_offset) {
+    LOG(ERROR) << "Malformed perf.data header in " << file_name;
+    return false;
+  }
+  const uint64_t end = data_offset + data_size;
+  output->assign(header);
+  output->resize(data_offset);
+  if (!file.read(&(*output)[kFileHeaderSize],
+                 data_offset - kFileHeaderSize)) {
+    return false;
+  }
+  // The records are read one at a time, and are at most 64KB.
+  RecordDecompressor decompressor;
+  std::string record(UINT16_MAX, '\0');
+  for (uint64_t pos = data_offset; pos < end;) {
+    if (end - pos < kEventHeaderSize ||
+        !file.read(&record[0], kEventHeaderSize)) {
+      LOG(ERROR) << "Truncated perf.data record at offset " << pos << " of "
+                 << file_name;
+      return false;
+    }
+    const uint16_t size = Read<uint16_t>(record, 6);
+    if (size < kEventHeaderSize || size > end - pos ||
+        !file.read(&record[kEventHeaderSize], size - kEventHeaderSize) ||
+        !decompressor.AppendRecord(absl::string_view(record).substr(0, size),
+                                   output)) {
+      LOG(ERROR) << "Malformed perf.data record at offset " << pos << " of "
+                 << file_name;
+      return false;
+    }
+    pos += size;
+  }
+  if (!decompressor.frame_complete()) {
+    LOG(ERROR) << "Truncated compressed perf.data records in " << file_name;
+    return false;
+  }
+  std::string features(file_size - end, '\0');
+  if (!file.read(&features[0], features.size())) {
+    return false;
+  }
+  return AppendPerfDataFeatures(features, output) &&
+         RemoveCompressedFeature(output);
+#else
+  LOG(ERROR) << "Cannot read compressed perf.data: autofdo was built without "
+                "zstd support";
+  return false;
+#endif
+}
+
+}  // namespace devtools_crosstool_autofdo
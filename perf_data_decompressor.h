@@ -0,0 +1,31 @@
+// Expansion of the compressed records of a perf.data file.
+
+#ifndef AUTOFDO_PERF_DATA_DECOMPRESSOR_H_
+#define AUTOFDO_PERF_DATA_DECOMPRESSOR_H_
+
+#include <string>
+
+#include "third_party/abseil/absl/strings/string_view.h"
+
+namespace devtools_crosstool_autofdo {
+
+// Returns true if DATA, the contents of a perf.data file, was recorded with
+// 'perf record -z', i.e. has the HEADER_COMPRESSED feature. Such files hold
+// their events in PERF_RECORD_COMPRESSED records, which quipper cannot read.
+bool IsCompressedPerfData(absl::string_view data);
+
+// Sets OUTPUT to the compressed perf.data contents DATA with each
+// PERF_RECORD_COMPRESSED record replaced by the events it holds, like 'perf
+// inject' does, but without writing the expanded file to disk. The zstd
+// stream is decompressed record by record straight into OUTPUT. Returns false
+// if DATA is malformed, or autofdo was built without zstd.
+bool DecompressPerfData(absl::string_view data, std::string *output);
+
+// Like DecompressPerfData, for the compressed perf.data file FILE_NAME. The
+// file is read record by record through a fixed-size buffer, so that only the
+// expanded contents are held in memory.
+bool DecompressPerfDataFile(const std::string &file_name, std::string *output);
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_PERF_DATA_DECOMPRESSOR_H_
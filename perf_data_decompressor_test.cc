@@ -0,0 +1,142 @@
+// Expansion of the compressed records of perf.data files.
+
+#include "perf_data_decompressor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "perf_data_index.h"
+#include "third_party/abseil/absl/numeric/bits.h"
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#define FLAGS_test_srcdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+namespace {
+
+using devtools_crosstool_autofdo::DecompressPerfData;
+using devtools_crosstool_autofdo::DecompressPerfDataFile;
+using devtools_crosstool_autofdo::IsCompressedPerfData;
+
+std::string ReadTestData(const std::string &name) {
+  std::ifstream file(FLAGS_test_srcdir + "/testdata/" + name,
+                     std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+uint64_t ReadU64(const std::string &data, uint64_t offset) {
+  uint64_t value;
+  memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+void WriteU64(uint64_t offset, uint64_t value, std::string *data) {
+  memcpy(&(*data)[offset], &value, sizeof(value));
+}
+
+TEST(PerfDataDecompressorTest, UncompressedFile) {
+  const std::string data = ReadTestData("test.lbr");
+  ASSERT_FALSE(data.empty());
+  EXPECT_FALSE(IsCompressedPerfData(data));
+  std::string output;
+  EXPECT_FALSE(DecompressPerfData(data, &output));
+}
+
+#if defined(HAVE_ZSTD)
+// Returns DATA as 'perf record -z' would have written it: the data section is
+// a zstd stream split into PERF_RECORD_COMPRESSED records of at most
+// RECORD_SIZE bytes, and the HEADER_COMPRESSED feature is set.
+std::string Compress(const std::string &data, size_t record_size) {
+  const uint64_t data_offset = ReadU64(data, 40);
+  const uint64_t data_size = ReadU64(data, 48);
+  std::string output = data.substr(0, data_offset);
+  ZSTD_CCtx *context = ZSTD_createCCtx();
+  std::string payload(record_size - 8, '\0');
+  ZSTD_inBuffer in = {data.data() + data_offset, data_size, 0};
+  size_t remaining;
+  do {
+    ZSTD_outBuffer out = {&payload[0], payload.size(), 0};
+    remaining = ZSTD_compressStream2(context, &out, &in, ZSTD_e_end);
+    const uint32_t type = 81;
+    const uint16_t misc = 0;
+    const uint16_t size = out.pos + 8;
+    output.append(reinterpret_cast<const char *>(&type), sizeof(type));
+    output.append(reinterpret_cast<const char *>(&misc), sizeof(misc));
+    output.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    output.append(payload.data(), out.pos);
+  } while (remaining != 0);
+  ZSTD_freeCCtx(context);
+  EXPECT_TRUE(devtools_crosstool_autofdo::FinishPerfDataRewrite(data, &output));
+
+  // Add the HEADER_COMPRESSED feature, whose section is appended at the end.
+  const uint64_t table = ReadU64(output, 40) + ReadU64(output, 48);
+  const uint64_t features = ReadU64(output, 72);
+  const int index = absl::popcount(features & ((1ULL << 27) - 1));
+  int num_features = 0;
+  for (int i = 0; i < 4; ++i) {
+    num_features += absl::popcount(ReadU64(output, 72 + 8 * i));
+  }
+  for (int i = 0; i < num_features; ++i) {
+    const uint64_t offset = ReadU64(output, table + 16 * i);
+    if (offset > table) WriteU64(table + 16 * i, offset + 16, &output);
+  }
+  output.insert(table + 16 * index, 16, '\0');
+  WriteU64(table + 16 * index, output.size(), &output);
+  WriteU64(table + 16 * index + 8, 8, &output);
+  output.append("zstd cfg", 8);
+  WriteU64(72, features | (1ULL << 27), &output);
+  return output;
+}
+
+TEST(PerfDataDecompressorTest, DecompressFile) {
+  const std::string data = ReadTestData("test.lbr");
+  const std::string compressed = Compress(data, 4096);
+  ASSERT_TRUE(IsCompressedPerfData(compressed));
+  EXPECT_LT(compressed.size(), data.size());
+
+  std::string output;
+  ASSERT_TRUE(DecompressPerfData(compressed, &output));
+  EXPECT_FALSE(IsCompressedPerfData(output));
+  // The section of the HEADER_COMPRESSED feature is left at the end.
+  ASSERT_EQ(output.size(), data.size() + 8);
+  EXPECT_EQ(output.substr(0, data.size()), data);
+
+  // A corrupted stream is an error.
+  std::string corrupted = compressed;
+  corrupted.replace(ReadU64(corrupted, 40) + 8, 4, 4, '\0');
+  EXPECT_FALSE(DecompressPerfData(corrupted, &output));
+}
+
+TEST(PerfDataDecompressorTest, DecompressFileFromDisk) {
+  const std::string data = ReadTestData("test.lbr");
+  const std::string compressed = Compress(data, 4096);
+  const std::string file_name = testing::TempDir() + "/compressed.perf.data";
+  {
+    std::ofstream file(file_name, std::ios::binary);
+    file.write(compressed.data(), compressed.size());
+  }
+  std::string expected;
+  ASSERT_TRUE(DecompressPerfData(compressed, &expected));
+  std::string output;
+  ASSERT_TRUE(DecompressPerfDataFile(file_name, &output));
+  EXPECT_EQ(output, expected);
+
+  // A truncated file is an error.
+  {
+    std::ofstream file(file_name, std::ios::binary);
+    file.write(compressed.data(), ReadU64(compressed, 40) + 100);
+  }
+  EXPECT_FALSE(DecompressPerfDataFile(file_name, &output));
+  remove(file_name.c_str());
+}
+#endif
+
+}  // namespace
@@ -0,0 +1,305 @@
+#include "perf_data_index.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "base/logging.h"
+#include "third_party/abseil/absl/numeric/bits.h"
+
+namespace devtools_crosstool_autofdo {
+namespace {
+// Layout of the perf.data file, see tools/perf/util/header.h in the kernel.
+constexpr uint64_t kPerfMagic = 0x32454c4946524550ULL;  // "PERFILE2"
+constexpr uint64_t kFileHeaderSize = 104;
+// Offsets of the perf_file_header fields.
+constexpr uint64_t kAttrSizeOffset = 16;
+constexpr uint64_t kAttrsSectionOffset = 24;
+constexpr uint64_t kDataSectionOffset = 40;
+constexpr uint64_t kFeaturesOffset = 72;
+constexpr int kFeatureWords = 4;
+// Size of a perf_file_section {offset, size}.
+constexpr uint64_t kSectionSize = 16;
+// Offset of sample_type in perf_event_attr.
+constexpr uint64_t kSampleTypeOffset = 24;
+// Size of a perf_event_header {type, misc, size}.
+constexpr uint64_t kEventHeaderSize = 8;
+constexpr uint32_t kRecordSample = 9;
+// The sample_type bits of the fields that precede the time in a sample.
+constexpr uint64_t kSampleIp = 1ULL << 0;
+constexpr uint64_t kSampleTid = 1ULL << 1;
+constexpr uint64_t kSampleTime = 1ULL << 2;
+constexpr uint64_t kSampleIdentifier = 1ULL << 16;
+
+constexpr int kIndexVersion = 1;
+
+template <typename T>
+T Read(absl::string_view data, uint64_t offset) {
+  T value;
+  memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+template <typename T>
+void Write(uint64_t offset, T value, std::string *data) {
+  memcpy(&(*data)[offset], &value, sizeof(value));
+}
+
+struct FileLayout {
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t time_offset;
+};
+
+// Reads the layout of the perf.data contents DATA. Returns false if DATA is
+// not a supported perf.data file.
+bool GetFileLayout(absl::string_view data, FileLayout *layout) {
+  if (data.size() < kFileHeaderSize || Read<uint64_t>(data, 0) != kPerfMagic ||
+      Read<uint64_t>(data, 8) != kFileHeaderSize) {
+    return false;
+  }
+  const uint64_t attr_size = Read<uint64_t>(data, kAttrSizeOffset);
+  const uint64_t attrs_offset = Read<uint64_t>(data, kAttrsSectionOffset);
+  const uint64_t attrs_size = Read<uint64_t>(data, kAttrsSectionOffset + 8);
+  layout->data_offset = Read<uint64_t>(data, kDataSectionOffset);
+  layout->data_size = Read<uint64_t>(data, kDataSectionOffset + 8);
+  if (attr_size < kSampleTypeOffset + 8 || attrs_size == 0 ||
+      attrs_offset > data.size() || attrs_size > data.size() - attrs_offset ||
+      layout->data_offset > data.size() ||
+      layout->data_size > data.size() - layout->data_offset) {
+    return false;
+  }
+
+  // The time of a sample is found without knowing which attr it belongs to,
+  // so all the attrs must agree on the fields preceding it.
+  const uint64_t kPrefixFields =
+      kSampleIdentifier | kSampleIp | kSampleTid | kSampleTime;
+  uint64_t prefix = 0;
+  const uint64_t attrs_end = attrs_offset + attrs_size;
+  for (uint64_t offset = attrs_offset; offset + attr_size <= attrs_end;
+       offset += attr_size) {
+    uint64_t sample_type =
+        Read<uint64_t>(data, offset + kSampleTypeOffset) & kPrefixFields;
+    if (offset != attrs_offset && sample_type != prefix) {
+      return false;
+    }
+    prefix = sample_type;
+  }
+  if (!(prefix & kSampleTime)) {
+    return false;
+  }
+  layout->time_offset = kEventHeaderSize;
+  for (uint64_t field : {kSampleIdentifier, kSampleIp, kSampleTid}) {
+    if (prefix & field) layout->time_offset += 8;
+  }
+  return true;
+}
+}  // namespace
+
+bool PerfDataIndex::Build(absl::string_view data, uint64_t chunk_size) {
+  FileLayout layout;
+  if (!GetFileLayout(data, &layout)) {
+    return false;
+  }
+  file_size_ = data.size();
+  data_offset_ = layout.data_offset;
+  data_size_ = layout.data_size;
+  time_offset_ = layout.time_offset;
+  chunks_.clear();
+
+  const uint64_t end = data_offset_ + data_size_;
+  const Chunk empty_chunk = {0, 0, std::numeric_limits<uint64_t>::max(), 0};
+  Chunk chunk = empty_chunk;
+  chunk.begin = data_offset_;
+  uint64_t pos = data_offset_;
+  while (pos < end) {
+    if (end - pos < kEventHeaderSize) {
+      LOG(WARNING) << "Truncated perf.data record at offset " << pos;
+      return false;
+    }
+    const uint32_t type = Read<uint32_t>(data, pos);
+    const uint16_t size = Read<uint16_t>(data, pos + 6);
+    if (size < kEventHeaderSize || size > end - pos) {
+      LOG(WARNING) << "Malformed perf.data record at offset " << pos;
+      return false;
+    }
+    if (type == kRecordSample && time_offset_ + 8 <= size) {
+      const uint64_t time = Read<uint64_t>(data, pos + time_offset_);
+      chunk.min_time = std::min(chunk.min_time, time);
+      chunk.max_time = std::max(chunk.max_time, time);
+    }
+    pos += size;
+    if (pos - chunk.begin >= chunk_size || pos == end) {
+      chunk.end = pos;
+      chunks_.push_back(chunk);
+      chunk = empty_chunk;
+      chunk.begin = pos;
+    }
+  }
+  return true;
+}
+
+bool PerfDataIndex::Load(const std::string &index_file,
+                         absl::string_view data) {
+  FileLayout layout;
+  if (!GetFileLayout(data, &layout)) {
+    return false;
+  }
+  FILE *fp = fopen(index_file.c_str(), "r");
+  if (fp == nullptr) {
+    return false;
+  }
+  int version = 0;
+  uint64_t num_chunks = 0;
+  bool valid =
+      fscanf(fp, "perf_data_index %d\n", &version) == 1 &&
+      version == kIndexVersion &&
+      fscanf(fp, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 "\n",
+             &file_size_, &data_offset_, &data_size_, &time_offset_) == 4 &&
+      file_size_ == data.size() && data_offset_ == layout.data_offset &&
+      data_size_ == layout.data_size && time_offset_ == layout.time_offset &&
+      fscanf(fp, "%" SCNu64 "\n", &num_chunks) == 1;
+  chunks_.clear();
+  for (uint64_t i = 0; valid && i < num_chunks; ++i) {
+    Chunk chunk;
+    valid = fscanf(fp, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 "\n",
+                   &chunk.begin, &chunk.end, &chunk.min_time,
+                   &chunk.max_time) == 4;
+    // The chunks must cover the data section without gaps.
+    const uint64_t begin = chunks_.empty() ? data_offset_ : chunks_.back().end;
+    valid = valid && chunk.begin == begin && chunk.end > chunk.begin &&
+            chunk.end <= data_offset_ + data_size_;
+    chunks_.push_back(chunk);
+  }
+  fclose(fp);
+  valid = valid && (chunks_.empty() ? data_size_ == 0
+                                    : chunks_.back().end ==
+                                          data_offset_ + data_size_);
+  if (!valid) {
+    LOG(INFO) << "Ignoring stale or malformed perf.data index " << index_file;
+    chunks_.clear();
+  }
+  return valid;
+}
+
+bool PerfDataIndex::Save(const std::string &index_file) const {
+  FILE *fp = fopen(index_file.c_str(), "w");
+  if (fp == nullptr) {
+    return false;
+  }
+  fprintf(fp, "perf_data_index %d\n", kIndexVersion);
+  fprintf(fp, "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", file_size_,
+          data_offset_, data_size_, time_offset_);
+  fprintf(fp, "%zu\n", chunks_.size());
+  for (const Chunk &chunk : chunks_) {
+    fprintf(fp, "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+            chunk.begin, chunk.end, chunk.min_time, chunk.max_time);
+  }
+  return fclose(fp) == 0;
+}
+
+bool PerfDataIndex::FilterByTime(absl::string_view data, uint64_t min_time,
+                                 uint64_t max_time,
+                                 std::string *output) const {
+  FileLayout layout;
+  if (!GetFileLayout(data, &layout) || data.size() != file_size_ ||
+      layout.data_offset != data_offset_ || layout.data_size != data_size_) {
+    return false;
+  }
+  output->clear();
+  output->reserve(data.size());
+  output->append(data.data(), data_offset_);
+  for (const Chunk &chunk : chunks_) {
+    if (chunk.min_time <= max_time && chunk.max_time >= min_time) {
+      output->append(data.data() + chunk.begin, chunk.end - chunk.begin);
+      continue;
+    }
+    // The records are walked again, and must still fit in their chunk, e.g.
+    // in case the index was built from another file with the same layout.
+    for (uint64_t pos = chunk.begin; pos < chunk.end;) {
+      if (chunk.end - pos < kEventHeaderSize) {
+        LOG(WARNING) << "Truncated perf.data record at offset " << pos;
+        return false;
+      }
+      const uint16_t size = Read<uint16_t>(data, pos + 6);
+      if (size < kEventHeaderSize || size > chunk.end - pos) {
+        LOG(WARNING) << "Malformed perf.data record at offset " << pos;
+        return false;
+      }
+      if (Read<uint32_t>(data, pos) != kRecordSample) {
+        output->append(data.data() + pos, size);
+      }
+      pos += size;
+    }
+  }
+  return FinishPerfDataRewrite(data, output);
+}
+
+bool FilterPerfDataByTime(const std::string &file_name, absl::string_view data,
+                          uint64_t min_time, uint64_t max_time,
+                          std::string *output) {
+  PerfDataIndex index;
+  const std::string index_file = file_name.empty() ? "" : file_name + ".index";
+  if (index_file.empty() || !index.Load(index_file, data)) {
+    if (!index.Build(data)) {
+      return false;
+    }
+    if (!index_file.empty() && !index.Save(index_file)) {
+      LOG(WARNING) << "Cannot write the perf.data index " << index_file;
+    }
+  }
+  return index.FilterByTime(data, min_time, max_time, output);
+}
+
+bool FinishPerfDataRewrite(absl::string_view data, std::string *output) {
+  if (data.size() < kFileHeaderSize) {
+    return false;
+  }
+  const uint64_t data_offset = Read<uint64_t>(data, kDataSectionOffset);
+  const uint64_t data_size = Read<uint64_t>(data, kDataSectionOffset + 8);
+  if (data_offset > data.size() || data_size > data.size() - data_offset ||
+      output->size() < kFileHeaderSize ||
+      output->compare(0, kFileHeaderSize, data.data(), kFileHeaderSize) != 0) {
+    return false;
+  }
+  return AppendPerfDataFeatures(data.substr(data_offset + data_size), output);
+}
+
+bool AppendPerfDataFeatures(absl::string_view features, std::string *output) {
+  if (output->size() < kFileHeaderSize) {
+    return false;
+  }
+  const uint64_t data_offset = Read<uint64_t>(*output, kDataSectionOffset);
+  const uint64_t data_size = Read<uint64_t>(*output, kDataSectionOffset + 8);
+  const uint64_t data_end = data_offset + data_size;
+  if (output->size() < data_offset) {
+    return false;
+  }
+  const uint64_t new_data_size = output->size() - data_offset;
+  Write<uint64_t>(kDataSectionOffset + 8, new_data_size, output);
+  output->append(features.data(), features.size());
+
+  // The feature sections, which follow the data section, have moved.
+  int num_features = 0;
+  for (int i = 0; i < kFeatureWords; ++i) {
+    num_features +=
+        absl::popcount(Read<uint64_t>(*output, kFeaturesOffset + 8 * i));
+  }
+  const uint64_t table = data_offset + new_data_size;
+  if (table + num_features * kSectionSize > output->size()) {
+    return false;
+  }
+  for (int i = 0; i < num_features; ++i) {
+    const uint64_t entry = table + i * kSectionSize;
+    const uint64_t offset = Read<uint64_t>(*output, entry);
+    if (offset >= data_end) {
+      Write<uint64_t>(entry, offset - data_size + new_data_size, output);
+    }
+  }
+  return true;
+}
+
+}  // namespace devtools_crosstool_autofdo
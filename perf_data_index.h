@@ -0,0 +1,98 @@
+// Index of the samples of a perf.data file by time.
+
+#ifndef AUTOFDO_PERF_DATA_INDEX_H_
+#define AUTOFDO_PERF_DATA_INDEX_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "third_party/abseil/absl/strings/string_view.h"
+
+namespace devtools_crosstool_autofdo {
+
+// Splits the data section of a perf.data file into chunks of consecutive
+// records, and records the range of the sample times of each chunk. This is
+// found by walking the record headers and reading the time field of the
+// sample records, without decoding them.
+//
+// The index is used to convert only the samples of a time window: the sample
+// records of the chunks outside of the window are dropped before the file is
+// given to quipper. All the other records are kept, so that the mmap, comm and
+// fork events, which describe the whole recording, are still known.
+//
+// Only perf.data files in file mode, with the native byte order, and whose
+// sample records all have the time at the same position are supported.
+class PerfDataIndex {
+ public:
+  // A run of consecutive records of the data section.
+  struct Chunk {
+    // File offsets of the first record and past the last record.
+    uint64_t begin;
+    uint64_t end;
+    // Range of the times of the sample records, min_time > max_time if there
+    // is no sample record in the chunk.
+    uint64_t min_time;
+    uint64_t max_time;
+  };
+
+  static constexpr uint64_t kDefaultChunkSize = 1 << 20;
+
+  PerfDataIndex() = default;
+
+  // Indexes DATA, the contents of a perf.data file, with chunks of about
+  // CHUNK_SIZE bytes. Returns false if DATA is not supported.
+  bool Build(absl::string_view data, uint64_t chunk_size = kDefaultChunkSize);
+
+  // Reads the index of DATA from INDEX_FILE. Returns false if INDEX_FILE does
+  // not exist, or was not built from a file laid out like DATA.
+  bool Load(const std::string &index_file, absl::string_view data);
+
+  // Writes the index to INDEX_FILE.
+  bool Save(const std::string &index_file) const;
+
+  // Copies DATA to OUTPUT, without the sample records of the chunks that have
+  // no sample in [MIN_TIME, MAX_TIME]. Returns false if the index was not
+  // built from DATA, e.g. if a record of a dropped chunk does not fit in it.
+  bool FilterByTime(absl::string_view data, uint64_t min_time,
+                    uint64_t max_time, std::string *output) const;
+
+  const std::vector<Chunk> &chunks() const { return chunks_; }
+
+ private:
+  // Layout of the indexed file, to check that the index matches a file.
+  uint64_t file_size_ = 0;
+  uint64_t data_offset_ = 0;
+  uint64_t data_size_ = 0;
+  // Offset of the time field from the start of a sample record.
+  uint64_t time_offset_ = 0;
+  std::vector<Chunk> chunks_;
+
+  DISALLOW_COPY_AND_ASSIGN(PerfDataIndex);
+};
+
+// Sets OUTPUT to the contents DATA of the perf.data file FILE_NAME, restricted
+// to the chunks which have samples in [MIN_TIME, MAX_TIME]. The index is read
+// from the sidecar file FILE_NAME.index, or built and written there if it is
+// missing or stale. FILE_NAME can be empty, in which case the index is built
+// but not saved. Returns false if DATA cannot be indexed.
+bool FilterPerfDataByTime(const std::string &file_name, absl::string_view data,
+                          uint64_t min_time, uint64_t max_time,
+                          std::string *output);
+
+// Completes OUTPUT, which holds the perf.data contents DATA up to their data
+// section, followed by the records replacing that data section: the size of
+// the data section is updated, and the feature sections of DATA, which follow
+// it, are appended and their offsets adjusted. Returns false if OUTPUT does not
+// start with the header of DATA, or the feature table is truncated.
+bool FinishPerfDataRewrite(absl::string_view data, std::string *output);
+
+// Like FinishPerfDataRewrite, when only the part of the perf.data contents
+// after their data section, FEATURES, is known. OUTPUT must start with the
+// header of these contents, not updated yet.
+bool AppendPerfDataFeatures(absl::string_view features, std::string *output);
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_PERF_DATA_INDEX_H_
@@ -0,0 +1,166 @@
+// Sample time index of perf.data files, and filtering them by time.
+
+#include "perf_data_index.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#define FLAGS_test_tmpdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+#define FLAGS_test_srcdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+namespace {
+
+using devtools_crosstool_autofdo::PerfDataIndex;
+
+std::string ReadTestData(const std::string &name) {
+  std::ifstream file(FLAGS_test_srcdir + "/testdata/" + name,
+                     std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+uint64_t ReadU64(const std::string &data, uint64_t offset) {
+  uint64_t value;
+  memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+// Returns the size of the data section of a perf.data file.
+uint64_t DataSize(const std::string &data) { return ReadU64(data, 48); }
+
+// Returns the contents of the first feature section of a perf.data file,
+// whose table follows the data section.
+std::string FirstFeature(const std::string &data) {
+  const uint64_t table = ReadU64(data, 40) + DataSize(data);
+  return data.substr(ReadU64(data, table), ReadU64(data, table + 8));
+}
+
+TEST(PerfDataIndexTest, BuildIndex) {
+  const std::string data = ReadTestData("test.lbr");
+  ASSERT_FALSE(data.empty());
+  PerfDataIndex index;
+  ASSERT_TRUE(index.Build(data, 64 * 1024));
+  ASSERT_GT(index.chunks().size(), 1);
+  uint64_t samples_min_time = std::numeric_limits<uint64_t>::max();
+  uint64_t samples_max_time = 0;
+  for (const auto &chunk : index.chunks()) {
+    EXPECT_LT(chunk.begin, chunk.end);
+    samples_min_time = std::min(samples_min_time, chunk.min_time);
+    samples_max_time = std::max(samples_max_time, chunk.max_time);
+  }
+  EXPECT_LT(samples_min_time, samples_max_time);
+  EXPECT_FALSE(index.Build("not a perf.data file"));
+}
+
+TEST(PerfDataIndexTest, BuildIndexWithSampleIdentifiers) {
+  // The first 1000 samples of test.lbr, for two events whose samples start
+  // with a PERF_SAMPLE_IDENTIFIER.
+  const std::string data = ReadTestData("test_two_events.lbr");
+  PerfDataIndex index;
+  ASSERT_TRUE(index.Build(data, 64 * 1024));
+  uint64_t samples_min_time = std::numeric_limits<uint64_t>::max();
+  uint64_t samples_max_time = 0;
+  for (const auto &chunk : index.chunks()) {
+    if (chunk.min_time <= chunk.max_time) {
+      samples_min_time = std::min(samples_min_time, chunk.min_time);
+      samples_max_time = std::max(samples_max_time, chunk.max_time);
+    }
+  }
+  EXPECT_EQ(samples_min_time, 174024746063718);
+  EXPECT_EQ(samples_max_time, 174025837635812);
+
+  std::string output;
+  ASSERT_TRUE(index.FilterByTime(data, 0, std::numeric_limits<uint64_t>::max(),
+                                 &output));
+  EXPECT_EQ(output, data);
+}
+
+TEST(PerfDataIndexTest, FilterByTime) {
+  const std::string data = ReadTestData("test.lbr");
+  PerfDataIndex index;
+  ASSERT_TRUE(index.Build(data, 64 * 1024));
+
+  // Nothing is removed when the time window covers the whole profile.
+  std::string output;
+  ASSERT_TRUE(index.FilterByTime(data, 0, std::numeric_limits<uint64_t>::max(),
+                                 &output));
+  EXPECT_EQ(output, data);
+
+  // Only keep the samples of the first chunk.
+  const PerfDataIndex::Chunk &first = index.chunks().front();
+  ASSERT_TRUE(
+      index.FilterByTime(data, first.min_time, first.min_time, &output));
+  EXPECT_LT(output.size(), data.size());
+  EXPECT_EQ(data.size() - output.size(), DataSize(data) - DataSize(output));
+  EXPECT_FALSE(FirstFeature(data).empty());
+  EXPECT_EQ(FirstFeature(output), FirstFeature(data));
+
+  // The filtered file can be indexed, and its chunks end at the same time.
+  PerfDataIndex filtered_index;
+  ASSERT_TRUE(filtered_index.Build(output, 64 * 1024));
+  uint64_t max_time = 0;
+  for (const auto &chunk : filtered_index.chunks()) {
+    if (chunk.min_time <= chunk.max_time) {
+      max_time = std::max(max_time, chunk.max_time);
+    }
+  }
+  EXPECT_LE(max_time, first.max_time);
+}
+
+TEST(PerfDataIndexTest, FilterByTimeRejectsMalformedRecords) {
+  std::string data = ReadTestData("test.lbr");
+  // Each chunk holds a single record.
+  PerfDataIndex index;
+  ASSERT_TRUE(index.Build(data, 1));
+  const uint64_t time = std::find_if(index.chunks().begin(),
+                                     index.chunks().end(),
+                                     [](const PerfDataIndex::Chunk &chunk) {
+                                       return chunk.min_time <= chunk.max_time;
+                                     })->min_time;
+  const PerfDataIndex::Chunk last = index.chunks().back();
+  ASSERT_FALSE(last.min_time <= time && time <= last.max_time);
+  std::string output;
+  ASSERT_TRUE(index.FilterByTime(data, time, time, &output));
+
+  // The record of the last chunk, which is outside of the window and thus
+  // walked, is made too small, then too large for its chunk.
+  for (int size : {0, 4, static_cast<int>(last.end - last.begin + 8)}) {
+    const uint16_t record_size = size;
+    memcpy(&data[last.begin + 6], &record_size, sizeof(record_size));
+    EXPECT_FALSE(index.FilterByTime(data, time, time, &output)) << size;
+  }
+}
+
+TEST(PerfDataIndexTest, SaveAndLoad) {
+  const std::string data = ReadTestData("test.lbr");
+  PerfDataIndex index;
+  ASSERT_TRUE(index.Build(data, 64 * 1024));
+  const std::string index_file = FLAGS_test_tmpdir + "/test.lbr.index";
+  ASSERT_TRUE(index.Save(index_file));
+
+  PerfDataIndex loaded_index;
+  ASSERT_TRUE(loaded_index.Load(index_file, data));
+  ASSERT_EQ(loaded_index.chunks().size(), index.chunks().size());
+  for (int i = 0; i < index.chunks().size(); ++i) {
+    EXPECT_EQ(loaded_index.chunks()[i].begin, index.chunks()[i].begin);
+    EXPECT_EQ(loaded_index.chunks()[i].end, index.chunks()[i].end);
+    EXPECT_EQ(loaded_index.chunks()[i].min_time, index.chunks()[i].min_time);
+    EXPECT_EQ(loaded_index.chunks()[i].max_time, index.chunks()[i].max_time);
+  }
+
+  // The index of another file is stale.
+  EXPECT_FALSE(loaded_index.Load(index_file, ReadTestData("ro_sample.perf")));
+  remove(index_file.c_str());
+}
+
+}  // namespace
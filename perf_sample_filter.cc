@@ -0,0 +1,173 @@
+#include "perf_sample_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+#include "base/logging.h"
+#include "perf_data_decompressor.h"
+#include "perf_data_index.h"
+#include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/strings/numbers.h"
+#include "third_party/abseil/absl/strings/str_split.h"
+
+ABSL_FLAG(double, perf_sample_min_time, 0,
+          "Only use the perf samples taken at or after this time, in seconds "
+          "of the perf clock as printed by 'perf script'. 0 means no bound.");
+ABSL_FLAG(double, perf_sample_max_time, 0,
+          "Only use the perf samples taken at or before this time, in seconds "
+          "of the perf clock as printed by 'perf script'. 0 means no bound. "
+          "With a time window, an index of the sample times is written next "
+          "to each perf.data file, and used by later conversions to skip the "
+          "parts of the file outside of the window.");
+ABSL_FLAG(std::string, perf_sample_pids, "",
+          "Comma separated list of the pids whose perf samples are used, all "
+          "by default.");
+ABSL_FLAG(std::string, perf_sample_tids, "",
+          "Comma separated list of the tids whose perf samples are used, all "
+          "by default.");
+ABSL_FLAG(std::string, perf_sample_cpus, "",
+          "Comma separated list of the CPUs whose perf samples are used, all "
+          "by default.");
+
+namespace devtools_crosstool_autofdo {
+namespace {
+// Size of the perf_file_header at the start of a perf.data file.
+constexpr uint64_t kPerfFileHeaderSize = 104;
+
+bool ParseIdSet(const char *flag_name, const std::string &value,
+                PerfSampleFilter::IdSet *ids) {
+  for (absl::string_view id : absl::StrSplit(value, ',', absl::SkipEmpty())) {
+    uint32_t parsed;
+    if (!absl::SimpleAtoi(id, &parsed)) {
+      LOG(ERROR) << "Invalid id '" << id << "' in --" << flag_name;
+      return false;
+    }
+    ids->insert(parsed);
+  }
+  return true;
+}
+
+bool ParseTime(const char *flag_name, double seconds, uint64_t *time_ns) {
+  if (seconds < 0) {
+    LOG(ERROR) << "Invalid negative time in --" << flag_name;
+    return false;
+  }
+  *time_ns = std::llround(seconds * 1e9);
+  return true;
+}
+}  // namespace
+
+bool PerfSampleFilter::FromFlags(PerfSampleFilter *filter) {
+  *filter = PerfSampleFilter();
+  uint64_t min_time_ns = 0;
+  uint64_t max_time_ns = 0;
+  if (!ParseTime("perf_sample_min_time",
+                 absl::GetFlag(FLAGS_perf_sample_min_time), &min_time_ns) ||
+      !ParseTime("perf_sample_max_time",
+                 absl::GetFlag(FLAGS_perf_sample_max_time), &max_time_ns)) {
+    return false;
+  }
+  if (max_time_ns == 0) {
+    max_time_ns = std::numeric_limits<uint64_t>::max();
+  }
+  if (min_time_ns > max_time_ns) {
+    LOG(ERROR) << "--perf_sample_min_time is after --perf_sample_max_time";
+    return false;
+  }
+  filter->set_time_range(min_time_ns, max_time_ns);
+  return ParseIdSet("perf_sample_pids", absl::GetFlag(FLAGS_perf_sample_pids),
+                    &filter->pids_) &&
+         ParseIdSet("perf_sample_tids", absl::GetFlag(FLAGS_perf_sample_tids),
+                    &filter->tids_) &&
+         ParseIdSet("perf_sample_cpus", absl::GetFlag(FLAGS_perf_sample_cpus),
+                    &filter->cpus_);
+}
+
+bool PerfSampleFilter::Matches(
+    const quipper::PerfDataProto::SampleEvent &event) const {
+  if (HasTimeRange() &&
+      (!event.has_sample_time_ns() || event.sample_time_ns() < min_time_ns_ ||
+       event.sample_time_ns() > max_time_ns_)) {
+    return false;
+  }
+  if (!pids_.empty() && (!event.has_pid() || !pids_.contains(event.pid()))) {
+    return false;
+  }
+  if (!tids_.empty() && (!event.has_tid() || !tids_.contains(event.tid()))) {
+    return false;
+  }
+  if (!cpus_.empty() && (!event.has_cpu() || !cpus_.contains(event.cpu()))) {
+    return false;
+  }
+  return true;
+}
+
+bool PerfSampleFilter::SkipByTime(const std::string &file_name,
+                                  absl::string_view data,
+                                  std::string *output) const {
+  return HasTimeRange() && FilterPerfDataByTime(file_name, data, min_time_ns_,
+                                                max_time_ns_, output);
+}
+
+bool PerfSampleFilter::Prepare(const std::string &file_name,
+                               PreparedFile *file) const {
+  *file = PreparedFile();
+  file->file_name = file_name;
+  std::ifstream stream(file_name, std::ios::binary | std::ios::ate);
+  if (!stream) {
+    LOG(ERROR) << "Cannot open " << file_name;
+    return false;
+  }
+  const uint64_t file_size = stream.tellg();
+  std::string header(std::min<uint64_t>(file_size, kPerfFileHeaderSize), '\0');
+  if (!stream.seekg(0) || !stream.read(&header[0], header.size())) {
+    LOG(ERROR) << "Cannot read " << file_name;
+    return false;
+  }
+  const bool compressed = IsCompressedPerfData(header);
+  if (!compressed && !HasTimeRange()) {
+    return true;
+  }
+
+  file->in_memory = true;
+  if (compressed) {
+    if (!DecompressPerfDataFile(file_name, &file->data)) {
+      LOG(ERROR) << "Cannot decompress " << file_name;
+      return false;
+    }
+  } else {
+    file->data.resize(file_size);
+    if (!stream.seekg(0) || !stream.read(&file->data[0], file_size)) {
+      LOG(ERROR) << "Cannot read " << file_name;
+      return false;
+    }
+  }
+  if (HasTimeRange()) {
+    std::string filtered;
+    if (SkipByTime(file_name, file->data, &filtered)) {
+      file->data.swap(filtered);
+    } else {
+      LOG(WARNING) << "Cannot index the sample times of " << file_name
+                   << ", all of its samples are decoded.";
+    }
+  }
+  return true;
+}
+
+bool PerfSampleFilter::ReadPrepared(const PreparedFile &file,
+                                    quipper::PerfReader *reader) const {
+  if (!file.in_memory) {
+    return reader->ReadFile(file.file_name);
+  }
+  return reader->ReadFromPointer(file.data.data(), file.data.size());
+}
+
+bool PerfSampleFilter::ReadFile(const std::string &file_name,
+                                quipper::PerfReader *reader) const {
+  PreparedFile file;
+  return Prepare(file_name, &file) && ReadPrepared(file, reader);
+}
+
+}  // namespace devtools_crosstool_autofdo
@@ -0,0 +1,111 @@
+// Selection of the perf samples by time, process and CPU.
+
+#ifndef AUTOFDO_PERF_SAMPLE_FILTER_H_
+#define AUTOFDO_PERF_SAMPLE_FILTER_H_
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "base/commandlineflags.h"
+#include "third_party/abseil/absl/container/flat_hash_set.h"
+#include "third_party/abseil/absl/flags/declare.h"
+#include "third_party/abseil/absl/strings/string_view.h"
+#include "quipper/perf_reader.h"
+
+ABSL_DECLARE_FLAG(double, perf_sample_min_time);
+ABSL_DECLARE_FLAG(double, perf_sample_max_time);
+ABSL_DECLARE_FLAG(std::string, perf_sample_pids);
+ABSL_DECLARE_FLAG(std::string, perf_sample_tids);
+ABSL_DECLARE_FLAG(std::string, perf_sample_cpus);
+
+namespace devtools_crosstool_autofdo {
+
+// Restricts the samples aggregated from a perf.data file to a time window and
+// to sets of pids, tids and CPUs, e.g. to get separate profiles of the
+// startup and of the steady state of a program from the same recording.
+// A default constructed filter accepts all the samples.
+class PerfSampleFilter {
+ public:
+  typedef absl::flat_hash_set<uint32_t> IdSet;
+
+  PerfSampleFilter() = default;
+
+  // Sets FILTER from the --perf_sample_* flags. Returns false if a flag is
+  // malformed.
+  static bool FromFlags(PerfSampleFilter *filter);
+
+  // Only accepts the samples whose time, in nanoseconds of the perf clock, is
+  // in [MIN_TIME_NS, MAX_TIME_NS].
+  void set_time_range(uint64_t min_time_ns, uint64_t max_time_ns) {
+    min_time_ns_ = min_time_ns;
+    max_time_ns_ = max_time_ns;
+  }
+  // Only accepts the samples of the given pids, tids or CPUs. An empty set
+  // accepts all of them.
+  void set_pids(IdSet pids) { pids_ = std::move(pids); }
+  void set_tids(IdSet tids) { tids_ = std::move(tids); }
+  void set_cpus(IdSet cpus) { cpus_ = std::move(cpus); }
+
+  uint64_t min_time_ns() const { return min_time_ns_; }
+  uint64_t max_time_ns() const { return max_time_ns_; }
+  const IdSet &pids() const { return pids_; }
+  const IdSet &tids() const { return tids_; }
+  const IdSet &cpus() const { return cpus_; }
+
+  bool HasTimeRange() const {
+    return min_time_ns_ > 0 ||
+           max_time_ns_ < std::numeric_limits<uint64_t>::max();
+  }
+  bool AcceptsAll() const {
+    return !HasTimeRange() && pids_.empty() && tids_.empty() && cpus_.empty();
+  }
+
+  // Returns true if EVENT is selected. When a criterion is set, the samples
+  // which do not record the corresponding field are rejected.
+  bool Matches(const quipper::PerfDataProto::SampleEvent &event) const;
+
+  // Sets OUTPUT to the perf.data contents DATA without the sample records
+  // that are far enough from the time window to be skipped without decoding
+  // them, using the sidecar index of FILE_NAME (see PerfDataIndex). Returns
+  // false if there is no time window, or DATA cannot be indexed.
+  bool SkipByTime(const std::string &file_name, absl::string_view data,
+                  std::string *output) const;
+
+  // A perf.data file ready to be read by quipper: its contents, decompressed
+  // and restricted to the time window, or only its name when quipper can read
+  // the file as is.
+  struct PreparedFile {
+    std::string file_name;
+    bool in_memory = false;
+    std::string data;
+  };
+
+  // Prepares the perf.data file FILE_NAME to be read by ReadPrepared(), once
+  // or several times. The records of files recorded with 'perf record -z' are
+  // decompressed, and the parts of the file outside of the time window are
+  // skipped, into FILE. Otherwise, quipper reads the file from its path, and
+  // the file is never held in memory as a whole.
+  bool Prepare(const std::string &file_name, PreparedFile *file) const;
+
+  // Reads FILE, prepared by Prepare(), into READER.
+  bool ReadPrepared(const PreparedFile &file,
+                    quipper::PerfReader *reader) const;
+
+  // Reads the perf.data file FILE_NAME into READER, like Prepare() and
+  // ReadPrepared() do.
+  bool ReadFile(const std::string &file_name,
+                quipper::PerfReader *reader) const;
+
+ private:
+  uint64_t min_time_ns_ = 0;
+  uint64_t max_time_ns_ = std::numeric_limits<uint64_t>::max();
+  IdSet pids_;
+  IdSet tids_;
+  IdSet cpus_;
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_PERF_SAMPLE_FILTER_H_
@@ -4,10 +4,16 @@
 #include <list>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "branch_stack_cache.h"
 #include "llvm_propeller_perf_data_provider.h"
+#include "sample_downsampler.h"
+#include "sample_pipeline.h"
+#include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/status/status.h"
 #include "third_party/abseil/absl/strings/str_format.h"
+#include "third_party/abseil/absl/types/span.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/BinaryFormat/ELF.h"
 #include "llvm/Object/ObjectFile.h"
@@ -416,33 +422,60 @@ uint64_t PerfDataReader::RuntimeAddressToBinaryAddress(
 }
 
 void PerfDataReader::AggregateLBR(const BinaryPerfInfo &binary_perf_info,
-                                  LBRAggregation *result) const {
+                                  LBRAggregation *result,
+                                  uint32_t downsample_factor,
+                                  uint64_t downsample_seed) const {
+  SampleDownsampler downsampler(downsample_factor, downsample_seed);
+  // The samples are translated and aggregated as quipper decodes them,
+  // possibly in a SamplePipeline. The binary mmaps are fixed for the whole
+  // profile, so the cached stacks are made of the raw (from, to) addresses,
+  // which are only translated once per distinct stack and pid.
+  SamplePipeline pipeline(
+      absl::GetFlag(FLAGS_lbr_stack_cache_size),
+      [this, &binary_perf_info](uint32_t pid, absl::Span<const uint64_t> stack,
+                                std::vector<uint64_t> *translated) {
+        for (uint64_t addr : stack) {
+          translated->push_back(
+              RuntimeAddressToBinaryAddress(pid, addr, binary_perf_info));
+        }
+      },
+      [result, factor = downsampler.factor()](absl::Span<const uint64_t> stack,
+                                              uint64_t count) {
+        count *= factor;
+        uint64_t last_from = kInvalidAddress;
+        uint64_t last_to = kInvalidAddress;
+        for (int p = stack.size() / 2 - 1; p >= 0; --p) {
+          uint64_t from = stack[2 * p];
+          uint64_t to = stack[2 * p + 1];
+          // NOTE(shenhan): LBR sometimes duplicates the first entry by
+          // mistake (*). For now we treat these to be true entries.
+          // (*)  (p == 0 && from == lastFrom && to == lastTo) ==> true
+
+          result->branch_counters[std::make_pair(from, to)] += count;
+          if (last_to != kInvalidAddress && last_to <= from)
+            result->fallthrough_counters[std::make_pair(last_to, from)] +=
+                count;
+          last_to = to;
+          last_from = from;
+        }
+      },
+      absl::GetFlag(FLAGS_pipeline_perf_samples));
+  std::vector<uint64_t> stack;
   auto process_event = [&](const quipper::PerfDataProto::SampleEvent &event) {
     if (!event.has_pid() || binary_perf_info.binary_mmaps.find(event.pid()) ==
                                 binary_perf_info.binary_mmaps.end())
       return;
 
-    uint64_t pid = event.pid();
     const auto &brstack = event.branch_stack();
-    if (brstack.empty()) return;
-    uint64_t last_from = kInvalidAddress;
-    uint64_t last_to = kInvalidAddress;
-    for (int p = brstack.size() - 1; p >= 0; --p) {
-      const auto &be = brstack.Get(p);
-      uint64_t from =
-          RuntimeAddressToBinaryAddress(pid, be.from_ip(), binary_perf_info);
-      uint64_t to =
-          RuntimeAddressToBinaryAddress(pid, be.to_ip(), binary_perf_info);
-      // NOTE(shenhan): LBR sometimes duplicates the first entry by mistake (*).
-      // For now we treat these to be true entries.
-      // (*)  (p == 0 && from == lastFrom && to == lastTo) ==> true
-
-      result->branch_counters[std::make_pair(from, to)]++;
-      if (last_to != kInvalidAddress && last_to <= from)
-        result->fallthrough_counters[std::make_pair(last_to, from)]++;
-      last_to = to;
-      last_from = from;
+    if (brstack.empty() || !sample_filter_.Matches(event) ||
+        !downsampler.KeepNext())
+      return;
+    stack.clear();
+    for (const auto &be : brstack) {
+      stack.push_back(be.from_ip());
+      stack.push_back(be.to_ip());
     }
+    pipeline.Add(event.pid(), stack);
   };
 
   quipper::PerfReader perf_reader;
@@ -459,6 +492,16 @@ void PerfDataReader::AggregateLBR(const BinaryPerfInfo &binary_perf_info,
     LOG(FATAL) << "Failed to read perf data file: "
                << binary_perf_info.perf_data->description;
   }
+  pipeline.Finish();
+  if (absl::GetFlag(FLAGS_lbr_stack_cache_size) > 0) {
+    LOG(INFO) << "LBR stack cache for "
+              << binary_perf_info.perf_data->description << ": "
+              << pipeline.cache().StatsString();
+  }
+  if (downsampler.factor() > 1) {
+    LOG(INFO) << "Downsampled " << binary_perf_info.perf_data->description
+              << ": " << downsampler.StatsString();
+  }
 }
 
 bool PerfDataReader::GetBuildIdNames(const quipper::PerfReader &perf_reader,
@@ -11,6 +11,7 @@
 #include <vector>
 
 #include "llvm_propeller_perf_data_provider.h"
+#include "perf_sample_filter.h"
 #include "llvm/BinaryFormat/ELF.h"
 #include "llvm/Object/ELFObjectFile.h"
 #include "llvm/Object/ELFTypes.h"
@@ -155,9 +156,12 @@ class PerfDataReader {
                       BinaryPerfInfo *binary_perf_info) const;
 
   // Parse LBR events that are matched by mmaps in perf_parse and store the data
-  // in the aggregated counters.
+  // in the aggregated counters. Only about one sample event in
+  // downsample_factor is aggregated, selected from downsample_seed, and the
+  // counters are scaled back up (see SampleDownsampler).
   void AggregateLBR(const BinaryPerfInfo &binary_perf_info,
-                    LBRAggregation *result) const;
+                    LBRAggregation *result, uint32_t downsample_factor = 1,
+                    uint64_t downsample_seed = 0) const;
 
   // "binary address" vs. "runtime address":
   //   binary address:  the address we get from "nm -n" or "readelf -s".
@@ -174,12 +178,20 @@ class PerfDataReader {
 
   static const uint64_t kInvalidAddress = static_cast<uint64_t>(-1);
 
+  // Only aggregates the samples selected by FILTER in AggregateLBR.
+  void SetSampleFilter(PerfSampleFilter filter) {
+    sample_filter_ = std::move(filter);
+  }
+  const PerfSampleFilter &sample_filter() const { return sample_filter_; }
+
  private:
   // Select mmap events from perfdata file by comparing the mmap event's
   // filename against "match_mmap_name".
   bool SelectMMaps(BinaryPerfInfo *info, const quipper::PerfReader &perf_reader,
                    const quipper::PerfParser &perf_parser,
                    const std::string &match_mmap_name) const;
+
+  PerfSampleFilter sample_filter_;
 };
 
 // Utility class that wraps utility functions that need templated
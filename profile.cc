@@ -4,8 +4,11 @@
 // Class to represent source level profile.
 #include "profile.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <map>
+#include <memory>
+#include <numeric>
 #include <string>
 #include <utility>
 #include <vector>
@@ -22,8 +25,37 @@
 ABSL_FLAG(bool, use_lbr, true,
             "Whether to use lbr profile.");
 ABSL_FLAG(bool, llc_misses, false, "The profile represents llc misses.");
+ABSL_FLAG(bool, symbolize_sampled_addresses_only, false,
+          "Only symbolize the addresses with samples instead of every "
+          "instruction of the sampled functions. The source lines without "
+          "samples then get no entry in the profile.");
 
 namespace devtools_crosstool_autofdo {
+void ExpandRangeCounts(const RangeCountMap &range_count_map,
+                       uint64_t start_addr, uint64_t end_addr,
+                       std::vector<uint64_t> *counts) {
+  counts->clear();
+  if (start_addr >= end_addr) {
+    return;
+  }
+  const uint64_t size = end_addr - start_addr;
+  // (*counts)[i] - (*counts)[i - 1] is accumulated first, the extra slot
+  // receives the decrements of the ranges that reach the end of the span.
+  counts->assign(size + 1, 0);
+  uint64_t *delta = counts->data();
+  for (const auto &[range, count] : range_count_map) {
+    uint64_t begin = range.first - start_addr;  // May underflow, which is OK.
+    if (begin >= size || range.second < range.first) {
+      continue;
+    }
+    uint64_t end = std::min(range.second - start_addr + 1, size);
+    delta[begin] += count;
+    delta[end] -= count;
+  }
+  std::partial_sum(counts->begin(), counts->end(), counts->begin());
+  counts->pop_back();
+}
+
 Profile::ProfileMaps *Profile::GetProfileMaps(uint64_t addr) {
   const std::string *name;
   uint64_t start_addr, end_addr;
@@ -72,6 +104,11 @@ void Profile::AggregatePerFunctionProfile() {
   for (const auto &[name, addr] : symbol_map_->GetNameAddrMap()) {
     CHECK(GetProfileMaps(addr));
   }
+  for (const auto &[name, maps] : symbol_profile_maps_) {
+    maps->address_count_map.Freeze();
+    maps->range_count_map.Freeze();
+    maps->branch_count_map.Freeze();
+  }
 }
 
 uint64_t Profile::ProfileMaps::GetAggregatedCount() const {
@@ -91,38 +128,84 @@ uint64_t Profile::ProfileMaps::GetAggregatedCount() const {
 
 void Profile::ProcessPerFunctionProfile(const std::string &func_name,
                                         const ProfileMaps &maps) {
+#if defined(HAVE_LLVM)
+  InstructionMap inst_map(addr2line_, symbol_map_, disassembler_.get());
+#else
   InstructionMap inst_map(addr2line_, symbol_map_);
-  inst_map.BuildPerFunctionInstructionMap(func_name, maps.start_addr,
-                                          maps.end_addr);
-
-  AddressCountMap map;
-  const AddressCountMap *map_ptr;
-  if (absl::GetFlag(FLAGS_use_lbr)) {
-    if (maps.range_count_map.empty()) {
-      LOG(WARNING) << "use_lbr was enabled but range_count_map was empty!";
-      return;
-    }
-    for (const auto &[range, count] : maps.range_count_map) {
-      for (uint64_t addr = range.first;
-           inst_map.lookup(addr) && addr <= range.second; ++addr) {
-        map[addr] += count;
+#endif
+  // The samples of the function are added to its symbol, looked up once.
+  Symbol *symbol = symbol_map_->GetMutableSymbolByName(func_name);
+
+  // With LBR, the per-address counts are expanded from the ranges into a
+  // dense vector indexed by addr - maps.start_addr.
+  const bool use_lbr = absl::GetFlag(FLAGS_use_lbr);
+  std::vector<uint64_t> lbr_counts;
+  if (use_lbr && !maps.range_count_map.empty()) {
+    ExpandRangeCounts(maps.range_count_map, maps.start_addr, maps.end_addr,
+                      &lbr_counts);
+  }
+
+  if (absl::GetFlag(FLAGS_symbolize_sampled_addresses_only)) {
+    std::vector<uint64_t> sampled_addrs;
+    if (use_lbr) {
+      for (uint64_t i = 0; i < lbr_counts.size(); ++i) {
+        if (lbr_counts[i] != 0) {
+          sampled_addrs.push_back(maps.start_addr + i);
+        }
       }
+    } else {
+      for (const auto &[address, count] : maps.address_count_map) {
+        sampled_addrs.push_back(address);
+      }
+    }
+    for (const auto &[branch, count] : maps.branch_count_map) {
+      sampled_addrs.push_back(branch.first);
     }
-    map_ptr = &map;
+    std::sort(sampled_addrs.begin(), sampled_addrs.end());
+    sampled_addrs.erase(std::unique(sampled_addrs.begin(), sampled_addrs.end()),
+                        sampled_addrs.end());
+    inst_map.BuildSampledInstructionMap(func_name, maps.start_addr,
+                                        maps.end_addr, sampled_addrs);
   } else {
-    map_ptr = &maps.address_count_map;
+    inst_map.BuildPerFunctionInstructionMap(func_name, maps.start_addr,
+                                            maps.end_addr);
   }
 
-  for (const auto &[address, count] : *map_ptr) {
-    const InstructionMap::InstInfo *info = inst_map.lookup(address);
+  if (use_lbr && maps.range_count_map.empty()) {
+    LOG(WARNING) << "use_lbr was enabled but range_count_map was empty!";
+    return;
+  }
+
+  // The samples inside an instruction count for it, so that the counts of
+  // the LBR ranges add up per byte, like GetAggregatedCount() and the
+  // emission threshold, whether or not the function is disassembled.
+  auto add_source_count = [&](uint64_t address, uint64_t count) {
+    const InstructionMap::InstInfo *info = inst_map.lookup_containing(address);
     if (info == nullptr) {
-      continue;
+      return;
     }
     if (!info->source_stack.empty()) {
-      symbol_map_->AddSourceCount(func_name, info->source_stack, count, 0,
+      symbol_map_->AddSourceCount(symbol, info->source_stack, count, 0,
                                   info->source_stack[0].DuplicationFactor(),
                                   SymbolMap::PERFDATA);
     }
+    // The probes sharing the address all get its samples.
+    for (const SourceStack &stack : info->other_stacks) {
+      symbol_map_->AddSourceCount(symbol, stack, count, 0,
+                                  stack[0].DuplicationFactor(),
+                                  SymbolMap::PERFDATA);
+    }
+  };
+  if (use_lbr) {
+    for (uint64_t i = 0; i < lbr_counts.size(); ++i) {
+      if (lbr_counts[i] != 0) {
+        add_source_count(maps.start_addr + i, lbr_counts[i]);
+      }
+    }
+  } else {
+    for (const auto &[address, count] : maps.address_count_map) {
+      add_source_count(address, count);
+    }
   }
 
   for (const auto &[branch, count] : maps.branch_count_map) {
@@ -135,15 +218,24 @@ void Profile::ProcessPerFunctionProfile(const std::string &func_name,
     if (!callee) {
       continue;
     }
-    if (symbol_map_->map().count(*callee)) {
-      symbol_map_->AddSymbolEntryCount(*callee, count);
-      symbol_map_->AddIndirectCallTarget(func_name, info->source_stack, *callee,
+    Symbol *callee_symbol = symbol_map_->GetMutableSymbolByName(*callee);
+    if (callee_symbol != nullptr) {
+      symbol_map_->AddSymbolEntryCount(callee_symbol, count);
+      symbol_map_->AddIndirectCallTarget(symbol, info->source_stack, *callee,
                                          count, SymbolMap::PERFDATA);
     }
   }
 
-  for (const auto &[addr, count] : *map_ptr) {
-    global_addr_count_map_[addr] = count;
+  if (use_lbr) {
+    for (uint64_t i = 0; i < lbr_counts.size(); ++i) {
+      if (lbr_counts[i] != 0) {
+        global_addr_count_map_[maps.start_addr + i] = lbr_counts[i];
+      }
+    }
+  } else {
+    for (const auto &[addr, count] : maps.address_count_map) {
+      global_addr_count_map_[addr] = count;
+    }
   }
 }
 
@@ -163,11 +255,16 @@ void Profile::ComputeProfile() {
       }
 
       CHECK(maps->branch_count_map.empty());
+      std::vector<uint64_t> pcs;
+      pcs.reserve(counts.size());
+      for (const auto &[pc, count] : counts) pcs.push_back(pc);
+      std::vector<SourceStack> stacks(pcs.size());
+      symbol_map_->get_addr2line()->GetInlineStacks(pcs, stacks.data());
+      Symbol *symbol = symbol_map_->GetMutableSymbolByName(func_name);
+      size_t index = 0;
       for (const auto &[pc, count] : counts) {
-        SourceStack stack;
-        symbol_map_->get_addr2line()->GetInlineStack(pc, &stack);
-        symbol_map_->AddIndirectCallTarget(func_name, stack, "__llc_misses__",
-                                           count);
+        symbol_map_->AddIndirectCallTarget(symbol, stacks[index++],
+                                           "__llc_misses__", count);
       }
     }
     symbol_map_->ElideSuffixesAndMerge();
@@ -192,6 +289,16 @@ void Profile::ComputeProfile() {
       }
     }
 
+#if defined(HAVE_LLVM)
+    // Only the instructions of the functions are symbolized when the binary
+    // can be disassembled.
+    disassembler_ = std::make_unique<Disassembler>();
+    if (!disassembler_->Init(binary_name_)) {
+      LOG(WARNING) << "Cannot disassemble " << binary_name_
+                   << ", all the addresses of the functions are symbolized.";
+      disassembler_.reset();
+    }
+#endif
     for (const auto &[name, profile] : symbol_profile_maps_) {
       const uint64_t count = symbol_counts.at(absl::StripSuffix(name, ".cold"));
       if (symbol_map_->ShouldEmit(count)) {
@@ -7,11 +7,14 @@
 #define AUTOFDO_PROFILE_H_
 
 #include <cstdint>
+#include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "base/integral_types.h"
 #include "base/macros.h"
+#include "disassembler.h"
 #include "sample_reader.h"
 #include "third_party/abseil/absl/container/node_hash_map.h"
 
@@ -20,6 +23,16 @@ namespace devtools_crosstool_autofdo {
 class Addr2line;
 class SymbolMap;
 
+// Expands LBR range counts into per-address counts over the function span
+// [start_addr, end_addr): (*counts)[addr - start_addr] is set to the total
+// count of the ranges that cover addr. Ranges that start outside of the span
+// are ignored, and ranges that extend past its end are clipped. This is
+// computed with a difference array and a prefix sum, in
+// O(#ranges + end_addr - start_addr).
+void ExpandRangeCounts(const RangeCountMap &range_count_map,
+                       uint64_t start_addr, uint64_t end_addr,
+                       std::vector<uint64_t> *counts);
+
 // Class to convert instruction level profile to source level profile.
 class Profile {
  public:
@@ -74,6 +87,11 @@ class Profile {
   SymbolMap *symbol_map_;
   AddressCountMap global_addr_count_map_;
   SymbolProfileMaps symbol_profile_maps_;
+#if defined(HAVE_LLVM)
+  // Finds the instructions of the functions, nullptr if the binary cannot be
+  // disassembled.
+  std::unique_ptr<Disassembler> disassembler_;
+#endif
 
   DISALLOW_COPY_AND_ASSIGN(Profile);
 };
@@ -6,10 +6,15 @@
 #include "profile_creator.h"
 
 #include <inttypes.h>
+#include <stdio.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
+#include <queue>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/commandlineflags.h"
 #include "base/integral_types.h"
@@ -19,17 +24,45 @@
 #if defined(HAVE_LLVM)
 #include "llvm_profile_writer.h"
 #include "profile_symbol_list.h"
+#include "pseudo_probe_addr2line.h"
 #endif
+#include "perf_sample_filter.h"
 #include "profile.h"
 #include "profile_writer.h"
 #include "sample_reader.h"
 #include "symbol_map.h"
+#include "symbolization_cache.h"
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/memory/memory.h"
+#include "third_party/abseil/absl/strings/ascii.h"
+#include "third_party/abseil/absl/strings/str_cat.h"
 #include "util/symbolize/elf_reader.h"
 
 ABSL_FLAG(std::string, focus_binary_re, "",
               "RE for the focused binary file name");
+ABSL_FLAG(int, sample_reader_threads, 0,
+          "Number of threads used to read multiple input profiles. 0 means "
+          "one thread per hardware thread.");
+ABSL_FLAG(uint32_t, perf_downsample_factor, 1,
+          "Only aggregate about one perf sample event in this many, and scale "
+          "the counts back up, to bound the conversion time of very large "
+          "perf.data files. 1 keeps all the samples.");
+ABSL_FLAG(uint64_t, perf_downsample_seed, 0,
+          "Seed of the deterministic selection of --perf_downsample_factor.");
+ABSL_FLAG(bool, downsample_overlap_check, false,
+          "When downsampling, also compute the profile from all the samples "
+          "and log its overlap with the downsampled profile. Meant to pick "
+          "--perf_downsample_factor on a small perf.data file.");
+ABSL_FLAG(bool, perf_event_profiles, false,
+          "Also write a profile for each perf event of the perf.data files, "
+          "e.g. cycles and LLC misses recorded together, computed from the "
+          "sampled addresses of that event only. Each is named after the "
+          "output profile, followed by '.' and the event name.");
+ABSL_FLAG(std::string, symbolization_cache_dir, "",
+          "If set, the inline stacks of the sampled functions of the binary "
+          "are cached in this directory, in a file named after the build-id "
+          "of the binary, and the functions found there are not symbolized "
+          "again from the DWARF of the binary.");
 
 #if defined(HAVE_LLVM)
 AUTOFDO_PROFILE_SYMBOL_LIST_FLAGS;
@@ -82,6 +115,11 @@ PrefetchHints ReadPrefetchHints(const std::string &file_name) {
 }  // namespace
 
 namespace devtools_crosstool_autofdo {
+ProfileCreator::ProfileCreator(const std::string &binary)
+    : sample_reader_(nullptr),
+      binary_(binary),
+      downsample_factor_(absl::GetFlag(FLAGS_perf_downsample_factor)) {}
+
 uint64_t ProfileCreator::GetTotalCountFromTextProfile(
     const std::string &input_profile_name) {
   ProfileCreator creator("");
@@ -106,15 +144,32 @@ bool ProfileCreator::CreateProfile(const std::string &input_profile_name,
                                    ProfileWriter *writer,
                                    const std::string &output_profile_name,
                                    bool store_sym_list_in_profile) {
+  return CreateProfile(std::vector<std::string>{input_profile_name}, profiler,
+                       writer, output_profile_name, store_sym_list_in_profile);
+}
+
+bool ProfileCreator::CreateProfile(
+    const std::vector<std::string> &input_profile_names,
+    const std::string &profiler, ProfileWriter *writer,
+    const std::string &output_profile_name, bool store_sym_list_in_profile) {
   SymbolMap symbol_map(binary_);
 
   writer->setSymbolMap(&symbol_map);
   if (profiler == "prefetch") {
+    if (input_profile_names.size() != 1) {
+      LOG(ERROR) << "Multiple profiles are not supported for prefetch hints.";
+      return false;
+    }
     symbol_map.set_ignore_thresholds(true);
-    if (!ConvertPrefetchHints(input_profile_name, &symbol_map)) return false;
+    if (!ConvertPrefetchHints(input_profile_names[0], &symbol_map))
+      return false;
   } else {
-    if (!ReadSample(input_profile_name, profiler)) return false;
+    if (!ReadSample(input_profile_names, profiler)) return false;
     if (!ComputeProfile(&symbol_map)) return false;
+    if (profiler == "perf" && downsample_factor_ > 1 &&
+        absl::GetFlag(FLAGS_downsample_overlap_check)) {
+      LogDownsamplingOverlap(input_profile_names, symbol_map);
+    }
   }
 
 #if defined(HAVE_LLVM)
@@ -137,11 +192,13 @@ bool ProfileCreator::CreateProfile(const std::string &input_profile_name,
   }
 #endif
 
-  return writer->WriteToFile(output_profile_name);
+  if (!writer->WriteToFile(output_profile_name)) return false;
+  return profiler == "prefetch" ||
+         WriteEventProfiles(writer, output_profile_name);
 }
 
-bool ProfileCreator::ReadSample(const std::string &input_profile_name,
-                                const std::string &profiler) {
+FileSampleReader *ProfileCreator::CreateSampleReader(
+    const std::string &input_profile_name, const std::string &profiler) {
   if (profiler == "perf") {
     std::string focus_binary_re;
     std::string build_id;
@@ -170,12 +227,46 @@ bool ProfileCreator::ReadSample(const std::string &input_profile_name,
         build_id.resize(kMinPerfBuildIDStringLength, '0');
     }
 
-    sample_reader_ = new PerfDataSampleReader(
-        input_profile_name, focus_binary_re, build_id);
+    PerfSampleFilter sample_filter;
+    if (!PerfSampleFilter::FromFlags(&sample_filter)) {
+      return nullptr;
+    }
+    PerfDataSampleReader *reader =
+        new PerfDataSampleReader(input_profile_name, focus_binary_re, build_id);
+    reader->SetDownsampling(downsample_factor_,
+                            absl::GetFlag(FLAGS_perf_downsample_seed));
+    reader->SetSampleFilter(std::move(sample_filter));
+    reader->SetPerEventCounts(absl::GetFlag(FLAGS_perf_event_profiles));
+    return reader;
   } else if (profiler == "text") {
-    sample_reader_ = new TextSampleReaderWriter(input_profile_name);
+    return new TextSampleReaderWriter(input_profile_name);
+  } else if (profiler == "binary") {
+    return new BinarySampleReaderWriter(input_profile_name);
   } else {
     LOG(ERROR) << "Unsupported profiler type: " << profiler;
+    return nullptr;
+  }
+}
+
+bool ProfileCreator::ReadSample(const std::string &input_profile_name,
+                                const std::string &profiler) {
+  return ReadSample(std::vector<std::string>{input_profile_name}, profiler);
+}
+
+bool ProfileCreator::ReadSample(
+    const std::vector<std::string> &input_profile_names,
+    const std::string &profiler) {
+  if (input_profile_names.size() == 1) {
+    sample_reader_ = CreateSampleReader(input_profile_names[0], profiler);
+  } else {
+    sample_reader_ = new MultiFileSampleReader(
+        input_profile_names,
+        [this, profiler](const std::string &input_profile_name) {
+          return CreateSampleReader(input_profile_name, profiler);
+        },
+        absl::GetFlag(FLAGS_sample_reader_threads));
+  }
+  if (sample_reader_ == nullptr) {
     return false;
   }
   if (!sample_reader_->ReadAndSetTotalCount()) {
@@ -184,20 +275,97 @@ bool ProfileCreator::ReadSample(const std::string &input_profile_name,
   }
   return true;
 }
+
 bool ProfileCreator::ComputeProfile(SymbolMap *symbol_map) {
-  std::set<uint64_t> sampled_addrs = sample_reader_->GetSampledAddresses();
+  return ComputeProfile(sample_reader_, symbol_map);
+}
+
+bool ProfileCreator::ComputeProfile(SampleReader *sample_reader,
+                                    SymbolMap *symbol_map) {
+  std::set<uint64_t> sampled_addrs = sample_reader->GetSampledAddresses();
   std::map<uint64_t, uint64_t> sampled_functions =
       symbol_map->GetSampledSymbolStartAddressSizeMap(sampled_addrs);
-  if (!CheckAndAssignAddr2Line(
-          symbol_map,
-          Addr2line::CreateWithSampledFunctions(binary_, &sampled_functions)))
-    return false;
-  Profile profile(sample_reader_, binary_, symbol_map->get_addr2line(),
+  Addr2line *addr2line = nullptr;
+  CachedAddr2line *cached_addr2line = nullptr;
+#if defined(HAVE_LLVM)
+  // The binaries with pseudo probes are symbolized from their probes, their
+  // DWARF is not read.
+  if (SourceInfo::use_pseudo_probe) {
+    PseudoProbeAddr2line *probe_addr2line =
+        PseudoProbeAddr2line::Create(binary_);
+    if (probe_addr2line == nullptr) return false;
+    for (const auto &[guid, desc] : probe_addr2line->function_descs()) {
+      symbol_map->SetFunctionHash(desc.FuncName, desc.FuncHash);
+    }
+    addr2line = probe_addr2line;
+  }
+#endif
+  const std::string cache_dir = absl::GetFlag(FLAGS_symbolization_cache_dir);
+  if (addr2line == nullptr && !cache_dir.empty()) {
+    cached_addr2line =
+        CachedAddr2line::Create(binary_, &sampled_functions, cache_dir);
+    addr2line = cached_addr2line;
+  }
+  if (addr2line == nullptr) {
+    addr2line =
+        Addr2line::CreateWithSampledFunctions(binary_, &sampled_functions);
+  }
+  if (!CheckAndAssignAddr2Line(symbol_map, addr2line)) return false;
+  Profile profile(sample_reader, binary_, symbol_map->get_addr2line(),
                   symbol_map);
   profile.ComputeProfile();
+  if (cached_addr2line != nullptr && !cached_addr2line->Flush()) {
+    LOG(WARNING) << "Cannot update the symbolization cache of " << binary_;
+  }
+  return true;
+}
+
+bool ProfileCreator::WriteEventProfiles(ProfileWriter *writer,
+                                        const std::string &output_profile_name) {
+  // The writer points at the symbol map of each event while writing its
+  // profile, and at the one of all the samples again afterwards.
+  const SymbolMap *symbol_map = writer->getSymbolMap();
+  for (const auto &[event, address_count_map] :
+       sample_reader_->event_address_count_maps()) {
+    std::string suffix = event;
+    for (char &c : suffix) {
+      if (!absl::ascii_isalnum(c) && c != '-' && c != '_' && c != '.') c = '_';
+    }
+    const std::string event_profile_name =
+        absl::StrCat(output_profile_name, ".", suffix);
+    AddressCountSampleReader event_reader(address_count_map);
+    SymbolMap event_symbol_map(binary_);
+    writer->setSymbolMap(&event_symbol_map);
+    if (!event_reader.ReadAndSetTotalCount() ||
+        !ComputeProfile(&event_reader, &event_symbol_map) ||
+        !writer->WriteToFile(event_profile_name)) {
+      LOG(ERROR) << "Cannot write the profile of perf event " << event;
+      writer->setSymbolMap(symbol_map);
+      return false;
+    }
+    LOG(INFO) << "Wrote the profile of perf event " << event << " to "
+              << event_profile_name;
+  }
+  writer->setSymbolMap(symbol_map);
   return true;
 }
 
+void ProfileCreator::LogDownsamplingOverlap(
+    const std::vector<std::string> &input_profile_names,
+    const SymbolMap &symbol_map) {
+  ProfileCreator full_creator(binary_);
+  full_creator.downsample_factor_ = 1;
+  SymbolMap full_symbol_map(binary_);
+  if (!full_creator.ReadSample(input_profile_names, "perf") ||
+      !full_creator.ComputeProfile(&full_symbol_map)) {
+    LOG(ERROR) << "Cannot compute the profile from all the samples.";
+    return;
+  }
+  LOG(INFO) << "Overlap of the profile downsampled by "
+            << downsample_factor_ << " with the full profile: "
+            << symbol_map.Overlap(full_symbol_map);
+}
+
 bool ProfileCreator::ConvertPrefetchHints(const std::string &profile_file,
                                           SymbolMap *symbol_map) {
   // Explicitly request constructing an Addr2line object with no sample profile
@@ -249,20 +417,26 @@ uint64_t ProfileCreator::TotalSamples() {
   }
 }
 
-bool MergeSample(const std::string &input_file,
-                 const std::string &input_profiler, const std::string &binary,
-                 const std::string &output_file) {
-  TextSampleReaderWriter writer(output_file);
-  if (writer.IsFileExist()) {
-    if (!writer.ReadAndSetTotalCount()) {
+namespace {
+// Merges the samples of input_file into writer, which first reads the samples
+// of output_file if it already exists, and writes them back.
+template <class SampleReaderWriter>
+bool MergeSampleInto(const std::string &input_file,
+                     const std::string &input_profiler,
+                     const std::string &binary, const std::string &output_file,
+                     SampleReaderWriter *writer) {
+  // The samples are appended rather than read, as reading freezes the maps
+  // that the new samples are merged into.
+  if (writer->IsFileExist()) {
+    if (!writer->Append(output_file)) {
       return false;
     }
   }
 
   ProfileCreator creator(binary);
   if (creator.ReadSample(input_file, input_profiler)) {
-    writer.Merge(creator.sample_reader());
-    if (writer.Write(nullptr)) {
+    writer->Merge(creator.sample_reader());
+    if (writer->Write(nullptr)) {
       return true;
     } else {
       return false;
@@ -271,4 +445,116 @@ bool MergeSample(const std::string &input_file,
     return false;
   }
 }
+
+// Merges the sorted sample files INPUT_FILES into OUTPUT_FILE, written in
+// OUTPUT_FORMAT, with one reader per input and a heap of their next records.
+bool MergeSortedSampleFiles(const std::vector<std::string> &input_files,
+                            const std::string &output_file,
+                            const std::string &output_format) {
+  std::vector<std::unique_ptr<SampleRecordReader>> readers;
+  std::vector<SampleRecord> heads(input_files.size());
+  // Min-heap of the indices of the readers, by their next record.
+  auto later = [&heads](int a, int b) {
+    return heads[b].key() < heads[a].key();
+  };
+  std::priority_queue<int, std::vector<int>, decltype(later)> heap(later);
+  for (const std::string &input_file : input_files) {
+    readers.push_back(SampleRecordReader::Open(input_file));
+    if (readers.back() == nullptr) {
+      return false;
+    }
+    if (readers.back()->Next(&heads[readers.size() - 1])) {
+      heap.push(readers.size() - 1);
+    }
+  }
+
+  std::unique_ptr<SampleRecordWriter> writer =
+      SampleRecordWriter::Create(output_file, output_format);
+  if (writer == nullptr) {
+    return false;
+  }
+  while (!heap.empty()) {
+    SampleRecord merged = heads[heap.top()];
+    merged.count = 0;
+    while (!heap.empty() && heads[heap.top()].key() == merged.key()) {
+      int index = heap.top();
+      heap.pop();
+      merged.count += heads[index].count;
+      if (readers[index]->Next(&heads[index])) {
+        heap.push(index);
+      }
+    }
+    if (!writer->Add(merged)) {
+      LOG(ERROR) << "Error writing to " << output_file;
+      return false;
+    }
+  }
+  for (const auto &reader : readers) {
+    if (reader->error()) {
+      return false;
+    }
+  }
+  return writer->Close();
+}
+}  // namespace
+
+bool MergeSample(const std::string &input_file,
+                 const std::string &input_profiler, const std::string &binary,
+                 const std::string &output_file,
+                 const std::string &output_format) {
+  if (output_format == "text") {
+    TextSampleReaderWriter writer(output_file);
+    return MergeSampleInto(input_file, input_profiler, binary, output_file,
+                           &writer);
+  } else if (output_format == "binary") {
+    BinarySampleReaderWriter writer(output_file);
+    return MergeSampleInto(input_file, input_profiler, binary, output_file,
+                           &writer);
+  } else {
+    LOG(ERROR) << "Unsupported sample output format: " << output_format;
+    return false;
+  }
+}
+
+bool MergeSampleFiles(const std::vector<std::string> &input_files,
+                      const std::string &output_file,
+                      const std::string &output_format, int max_open_files) {
+  if (max_open_files < 2) {
+    LOG(ERROR) << "At least 2 sample files must be merged at a time";
+    return false;
+  }
+  // With too many inputs, groups of them are first merged into intermediate
+  // binary files, which are merged in turn.
+  std::vector<std::string> inputs = input_files;
+  std::vector<std::string> intermediate_files;
+  bool success = true;
+  for (int round = 0; success && inputs.size() > max_open_files; ++round) {
+    std::vector<std::string> merged_files;
+    for (size_t begin = 0; success && begin < inputs.size();
+         begin += max_open_files) {
+      const std::vector<std::string> group(
+          inputs.begin() + begin,
+          inputs.begin() + std::min(inputs.size(), begin + max_open_files));
+      merged_files.push_back(absl::StrCat(output_file, ".merge", round, ".",
+                                          merged_files.size()));
+      success = MergeSortedSampleFiles(group, merged_files.back(), "binary");
+    }
+    // The intermediate files of the previous round are no longer needed.
+    for (const std::string &file : intermediate_files) remove(file.c_str());
+    intermediate_files = merged_files;
+    inputs.swap(merged_files);
+  }
+
+  // The output is only replaced once it is complete, it may be one of the
+  // inputs.
+  const std::string temp_file = output_file + ".tmp";
+  success = success &&
+            MergeSortedSampleFiles(inputs, temp_file, output_format) &&
+            rename(temp_file.c_str(), output_file.c_str()) == 0;
+  if (!success) {
+    remove(temp_file.c_str());
+  }
+  for (const std::string &file : intermediate_files) remove(file.c_str());
+  return success;
+}
 }  // namespace devtools_crosstool_autofdo
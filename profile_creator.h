@@ -8,18 +8,22 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #include "addr2line.h"
 #include "profile_writer.h"
 #include "sample_reader.h"
 #include "symbol_map.h"
+#include "third_party/abseil/absl/flags/declare.h"
+
+ABSL_DECLARE_FLAG(uint32_t, perf_downsample_factor);
+ABSL_DECLARE_FLAG(uint64_t, perf_downsample_seed);
 
 namespace devtools_crosstool_autofdo {
 
 class ProfileCreator {
  public:
-  explicit ProfileCreator(const std::string &binary)
-      : sample_reader_(nullptr), binary_(binary) {}
+  explicit ProfileCreator(const std::string &binary);
 
   ~ProfileCreator() {
     delete sample_reader_;
@@ -36,10 +40,24 @@ class ProfileCreator {
                      const std::string &output_profile_name,
                      bool store_sym_list_in_profile = false);
 
+  // Like above, but merges the samples of several input profiles, which are
+  // read in parallel.
+  bool CreateProfile(const std::vector<std::string> &input_profile_names,
+                     const std::string &profiler,
+                     devtools_crosstool_autofdo::ProfileWriter *writer,
+                     const std::string &output_profile_name,
+                     bool store_sym_list_in_profile = false);
+
   // Reads samples from the input profile.
   bool ReadSample(const std::string &input_profile_name,
                   const std::string &profiler);
 
+  // Reads and merges samples from the input profiles. When there is more than
+  // one input profile, they are read in parallel by --sample_reader_threads
+  // worker threads.
+  bool ReadSample(const std::vector<std::string> &input_profile_names,
+                  const std::string &profiler);
+
   // Returns total number of samples collected.
   uint64_t TotalSamples();
 
@@ -56,14 +74,43 @@ class ProfileCreator {
   bool ConvertPrefetchHints(const std::string &profile_file,
                             SymbolMap *symbol_map);
   bool CheckAndAssignAddr2Line(SymbolMap *symbol_map, Addr2line *addr2line);
+  // Computes the profile of the samples of SAMPLE_READER into SYMBOL_MAP.
+  bool ComputeProfile(SampleReader *sample_reader, SymbolMap *symbol_map);
+  // Writes with WRITER the profile of each perf event whose samples were
+  // counted separately, see --perf_event_profiles.
+  bool WriteEventProfiles(ProfileWriter *writer,
+                          const std::string &output_profile_name);
+  // Returns a new reader for the input profile of the given profiler type, or
+  // nullptr if the profiler type is not supported.
+  FileSampleReader *CreateSampleReader(const std::string &input_profile_name,
+                                       const std::string &profiler);
+
+  // Computes the profile from all the samples of the perf input profiles, and
+  // logs its overlap with SYMBOL_MAP, computed from the downsampled samples.
+  void LogDownsamplingOverlap(
+      const std::vector<std::string> &input_profile_names,
+      const SymbolMap &symbol_map);
 
   SampleReader *sample_reader_;
   std::string binary_;
+  // Only about one perf sample event in downsample_factor_ is aggregated.
+  uint32_t downsample_factor_;
 };
 
+// Merges the samples of input_file into output_file, which is written in
+// output_format, either "text" or "binary".
 bool MergeSample(const std::string &input_file,
                  const std::string &input_profiler, const std::string &binary,
-                 const std::string &output_file);
+                 const std::string &output_file,
+                 const std::string &output_format = "text");
+
+// Merges the text or binary sample files input_files into output_file, which
+// is written in output_format and may be one of the inputs. The files are
+// merged as sorted streams of records, so memory does not depend on their
+// size, and at most max_open_files of them are read at a time.
+bool MergeSampleFiles(const std::vector<std::string> &input_files,
+                      const std::string &output_file,
+                      const std::string &output_format, int max_open_files);
 }  // namespace devtools_crosstool_autofdo
 
 #endif  // AUTOFDO_PROFILE_CREATOR_H_
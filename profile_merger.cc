@@ -210,6 +210,9 @@ int main(int argc, char **argv) {
       }
       reader.reset(nullptr);
     }
+    LOG(INFO) << "The merged profile takes "
+              << symbol_map.arena().num_allocations() << " allocations, "
+              << symbol_map.arena().bytes_allocated() << " bytes";
     symbol_map.CalculateThreshold();
     std::unique_ptr<LLVMProfileWriter> writer(nullptr);
     if (absl::GetFlag(FLAGS_format) == "text") {
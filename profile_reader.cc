@@ -50,6 +50,10 @@ void AutoFDOProfileReader::ReadSymbolProfile(const SourceStack &stack,
       symbol_map_->AddSymbolEntryCount(name, head_count);
     }
   }
+  // The samples are added to the symbol of the outline function, looked up
+  // once for all of them.
+  Symbol *top_symbol = symbol_map_->GetMutableSymbolByName(
+      stack.empty() ? name : stack.back().func_name);
   for (int i = 0; i < num_pos_counts; i++) {
     uint32_t offset = gcov_read_unsigned();
     uint32_t num_targets = gcov_read_unsigned();
@@ -59,8 +63,7 @@ void AutoFDOProfileReader::ReadSymbolProfile(const SourceStack &stack,
     new_stack.push_back(info);
     new_stack.insert(new_stack.end(), stack.begin(), stack.end());
     if (force_update_ || update) {
-      symbol_map_->AddSourceCount(new_stack[new_stack.size() - 1].func_name,
-                                  new_stack, count, 1);
+      symbol_map_->AddSourceCount(top_symbol, new_stack, count, 1);
     }
     for (int j = 0; j < num_targets; j++) {
       // Only indirect call target histogram is supported now.
@@ -68,9 +71,8 @@ void AutoFDOProfileReader::ReadSymbolProfile(const SourceStack &stack,
       const std::string &target_name = names_.at(gcov_read_counter());
       uint64_t target_count = gcov_read_counter();
       if (force_update_ || update) {
-        symbol_map_->AddIndirectCallTarget(
-            new_stack[new_stack.size() - 1].func_name,
-            new_stack, target_name, target_count);
+        symbol_map_->AddIndirectCallTarget(top_symbol, new_stack, target_name,
+                                           target_count);
       }
     }
   }
@@ -230,9 +230,10 @@ class ProfileDumper : public SymbolTraverser {
 
  protected:
   void DumpSourceInfo(SourceInfo info, int indent) {
-    printf("%*sDirectory name: %s\n", indent, " ", info.dir_name.c_str());
-    printf("%*sFile name:      %s\n", indent, " ",
-           info.file_name.c_str());
+    printf("%*sDirectory name: %.*s\n", indent, " ",
+           static_cast<int>(info.dir_name().size()), info.dir_name().data());
+    printf("%*sFile name:      %.*s\n", indent, " ",
+           static_cast<int>(info.file_name().size()), info.file_name().data());
     printf("%*sFunction name:  %s\n", indent, " ", info.func_name);
     printf("%*sStart line:     %u\n", indent, " ", info.start_line);
     printf("%*sLine:           %u\n", indent, " ", info.line);
@@ -24,6 +24,7 @@ class ProfileWriter {
 
   virtual bool WriteToFile(const std::string &output_file) = 0;
   void setSymbolMap(const SymbolMap *symbol_map) { symbol_map_ = symbol_map; }
+  const SymbolMap *getSymbolMap() const { return symbol_map_; }
   void Dump();
 
  protected:
@@ -116,12 +117,14 @@ class SymbolTraverser {
 
  protected:
   SymbolTraverser() : level_(0) {}
+  // Visits the symbols in the order of their names, so that the output of
+  // the traversers is deterministic.
   virtual void Start(const SymbolMap &symbol_map) {
-    for (const auto &name_symbol : symbol_map.map()) {
+    for (const auto &name_symbol : symbol_map.GetSortedSymbols()) {
       if (!symbol_map.ShouldEmit(name_symbol.second->total_count)) {
         continue;
       }
-      VisitTopSymbol(name_symbol.first, name_symbol.second);
+      VisitTopSymbol(std::string(name_symbol.first), name_symbol.second);
       Traverse(name_symbol.second);
     }
   }
@@ -0,0 +1,258 @@
+// Addr2line which reads the pseudo probes of a binary instead of its DWARF.
+
+#if defined(HAVE_LLVM)
+#include "pseudo_probe_addr2line.h"
+
+#include <elf.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "third_party/abseil/absl/strings/match.h"
+#include "util/symbolize/elf_reader.h"
+
+namespace devtools_crosstool_autofdo {
+
+namespace {
+// Collects the address ranges of the function symbols of a binary.
+class FunctionRangeReader : public ElfReader::SymbolSink {
+ public:
+  explicit FunctionRangeReader(
+      std::vector<std::pair<uint64_t, uint64_t>> *ranges)
+      : ranges_(ranges) {}
+
+  void AddSymbol(const char *name, uint64_t address, uint64_t size,
+                 int binding, int type, int section) override {
+    if (size != 0 && (type == STT_FUNC || absl::EndsWith(name, ".cold"))) {
+      ranges_->emplace_back(address, address + size);
+    }
+  }
+
+ private:
+  std::vector<std::pair<uint64_t, uint64_t>> *ranges_;
+};
+
+// Returns the node of the function NODE is inlined in, or nullptr if NODE is
+// a function which is not inlined.
+const llvm::MCDecodedPseudoProbeInlineTree *GetInliner(
+    const llvm::MCDecodedPseudoProbeInlineTree *node) {
+  const auto *parent =
+      static_cast<const llvm::MCDecodedPseudoProbeInlineTree *>(node->Parent);
+  return parent == nullptr || parent->isRoot() ? nullptr : parent;
+}
+
+// Returns the number of functions PROBE is inlined in.
+int InlineDepth(const llvm::MCDecodedPseudoProbe &probe) {
+  int depth = 0;
+  for (const auto *node = GetInliner(probe.getInlineTreeNode());
+       node != nullptr; node = GetInliner(node)) {
+    depth++;
+  }
+  return depth;
+}
+}  // namespace
+
+PseudoProbeAddr2line *PseudoProbeAddr2line::Create(
+    const std::string &binary_name) {
+  PseudoProbeAddr2line *addr2line = new PseudoProbeAddr2line(binary_name);
+  if (!addr2line->Prepare()) {
+    delete addr2line;
+    return nullptr;
+  }
+  return addr2line;
+}
+
+bool PseudoProbeAddr2line::Prepare() {
+  ElfReader elf_reader(binary_name_);
+  size_t desc_size = 0;
+  size_t probe_size = 0;
+  const char *desc_section =
+      elf_reader.GetSectionByName(".pseudo_probe_desc", &desc_size);
+  const char *probe_section =
+      elf_reader.GetSectionByName(".pseudo_probe", &probe_size);
+  if (desc_section == nullptr || probe_section == nullptr) {
+    LOG(ERROR) << binary_name_ << " has no pseudo probes.";
+    return false;
+  }
+  // The decoder copies what it needs out of the sections.
+  if (!decoder_.buildGUID2FuncDescMap(
+          reinterpret_cast<const uint8_t *>(desc_section), desc_size) ||
+      !decoder_.buildAddress2ProbeMap(
+          reinterpret_cast<const uint8_t *>(probe_section), probe_size)) {
+    LOG(ERROR) << "Cannot decode the pseudo probes of " << binary_name_;
+    return false;
+  }
+
+  for (const auto &[address, probes] : decoder_.getAddress2ProbesMap()) {
+    std::vector<std::pair<int, const llvm::MCDecodedPseudoProbe *>> blocks;
+    for (const llvm::MCDecodedPseudoProbe &probe : probes) {
+      if (probe.isCall()) {
+        call_addrs_.push_back(address);
+      } else if (probe.isBlock()) {
+        blocks.emplace_back(-InlineDepth(probe), &probe);
+      }
+    }
+    std::stable_sort(
+        blocks.begin(), blocks.end(),
+        [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (const auto &block : blocks) {
+      block_probes_.emplace_back(address, block.second);
+    }
+  }
+  // The probes of an address stay in their order.
+  std::stable_sort(
+      block_probes_.begin(), block_probes_.end(),
+      [](const auto &a, const auto &b) { return a.first < b.first; });
+  std::sort(call_addrs_.begin(), call_addrs_.end());
+  call_addrs_.erase(std::unique(call_addrs_.begin(), call_addrs_.end()),
+                    call_addrs_.end());
+
+  // A block probe only covers the following addresses of its function.
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  FunctionRangeReader function_reader(&ranges);
+  elf_reader.VisitSymbols(&function_reader);
+  std::sort(ranges.begin(), ranges.end());
+  for (const auto &range : ranges) {
+    if (functions_.empty() || functions_.back().second <= range.first) {
+      functions_.push_back(range);
+    }
+  }
+  return true;
+}
+
+const char *PseudoProbeAddr2line::GetFunctionName(uint64_t guid) const {
+  auto iter = decoder_.getGUID2FuncDescMap().find(guid);
+  if (iter == decoder_.getGUID2FuncDescMap().end()) {
+    return nullptr;
+  }
+  return iter->second.FuncName.c_str();
+}
+
+void PseudoProbeAddr2line::AppendInlineStack(
+    const llvm::MCDecodedPseudoProbe &probe, SourceStack *stack) const {
+  SourceInfo info;
+  info.func_name = GetFunctionName(probe.getGuid());
+  info.line = probe.getIndex();
+  stack->push_back(info);
+  // An inlined function is called from a call probe of its inliner.
+  const llvm::MCDecodedPseudoProbeInlineTree *node = probe.getInlineTreeNode();
+  for (const auto *inliner = GetInliner(node); inliner != nullptr;
+       node = inliner, inliner = GetInliner(node)) {
+    info.func_name = GetFunctionName(inliner->Guid);
+    info.line = std::get<1>(node->ISite);
+    stack->push_back(info);
+  }
+}
+
+void PseudoProbeAddr2line::GetProbes(
+    uint64_t addr,
+    std::vector<const llvm::MCDecodedPseudoProbe *> *probes) const {
+  probes->clear();
+  if (std::binary_search(call_addrs_.begin(), call_addrs_.end(), addr)) {
+    const llvm::MCDecodedPseudoProbe *probe =
+        decoder_.getCallProbeForAddr(addr);
+    if (probe != nullptr) {
+      probes->push_back(probe);
+      return;
+    }
+  }
+
+  auto function = std::upper_bound(
+      functions_.begin(), functions_.end(),
+      std::make_pair(addr, UINT64_MAX));
+  if (function == functions_.begin() || (--function)->second <= addr) {
+    return;
+  }
+  auto block = std::upper_bound(
+      block_probes_.begin(), block_probes_.end(), addr,
+      [](uint64_t addr, const auto &probe) { return addr < probe.first; });
+  if (block == block_probes_.begin() ||
+      std::prev(block)->first < function->first) {
+    return;
+  }
+  const uint64_t block_addr = std::prev(block)->first;
+  for (auto probe = std::lower_bound(block_probes_.begin(), block,
+                                     block_addr,
+                                     [](const auto &probe, uint64_t addr) {
+                                       return probe.first < addr;
+                                     });
+       probe != block; ++probe) {
+    probes->push_back(probe->second);
+  }
+}
+
+void PseudoProbeAddr2line::GetInlineStack(uint64_t addr,
+                                          SourceStack *stack) const {
+  std::vector<const llvm::MCDecodedPseudoProbe *> probes;
+  GetProbes(addr, &probes);
+  if (!probes.empty()) {
+    AppendInlineStack(*probes[0], stack);
+  }
+}
+
+void PseudoProbeAddr2line::GetOtherInlineStacks(
+    uint64_t addr, std::vector<SourceStack> *stacks) const {
+  std::vector<const llvm::MCDecodedPseudoProbe *> probes;
+  GetProbes(addr, &probes);
+  stacks->clear();
+  for (size_t i = 1; i < probes.size(); ++i) {
+    stacks->emplace_back();
+    AppendInlineStack(*probes[i], &stacks->back());
+  }
+}
+
+void PseudoProbeAddr2line::GetInlineStackRanges(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<std::pair<uint64_t, SourceStack>> *ranges) const {
+  // The stack only changes at the block probes, at the call probes and the
+  // address after them, and at the bounds of the functions.
+  std::vector<uint64_t> boundaries = {start_addr};
+  auto add_boundary = [&](uint64_t addr) {
+    if (addr > start_addr && addr < end_addr) boundaries.push_back(addr);
+  };
+  for (auto block = std::lower_bound(block_probes_.begin(),
+                                     block_probes_.end(), start_addr,
+                                     [](const auto &probe, uint64_t addr) {
+                                       return probe.first < addr;
+                                     });
+       block != block_probes_.end() && block->first < end_addr; ++block) {
+    add_boundary(block->first);
+  }
+  for (auto call = std::lower_bound(call_addrs_.begin(), call_addrs_.end(),
+                                    start_addr);
+       call != call_addrs_.end() && *call < end_addr; ++call) {
+    add_boundary(*call);
+    add_boundary(*call + 1);
+  }
+  for (auto function = std::lower_bound(functions_.begin(), functions_.end(),
+                                        start_addr,
+                                        [](const auto &range, uint64_t addr) {
+                                          return range.second <= addr;
+                                        });
+       function != functions_.end() && function->first < end_addr;
+       ++function) {
+    add_boundary(function->first);
+    add_boundary(function->second);
+  }
+  std::sort(boundaries.begin(), boundaries.end());
+  boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                   boundaries.end());
+
+  ranges->clear();
+  std::vector<SourceStack> stacks(boundaries.size());
+  GetInlineStacks(boundaries, stacks.data());
+  for (size_t i = 0; i < boundaries.size(); ++i) {
+    if (ranges->empty() || ranges->back().second != stacks[i]) {
+      ranges->emplace_back(boundaries[i], std::move(stacks[i]));
+    }
+  }
+}
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // HAVE_LLVM
@@ -0,0 +1,86 @@
+// Addr2line which reads the pseudo probes of a binary instead of its DWARF.
+
+#ifndef AUTOFDO_PSEUDO_PROBE_ADDR2LINE_H_
+#define AUTOFDO_PSEUDO_PROBE_ADDR2LINE_H_
+
+#if defined(HAVE_LLVM)
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "addr2line.h"
+#include "source_info.h"
+#include "llvm/MC/MCPseudoProbe.h"
+
+namespace devtools_crosstool_autofdo {
+
+// Addr2line for the binaries built with pseudo probes, which does not need
+// their line tables. The .pseudo_probe section maps the addresses of the
+// probes to their index in their function and to their inline context, and
+// the .pseudo_probe_desc section gives the name and the CFG checksum of the
+// functions.
+//
+// The positions of the returned inline stacks are probes, see
+// SourceInfo::use_pseudo_probe: each entry has the name of its function, the
+// index of the probe as its line and no file. An address maps to the call
+// probe of the instruction at that address if there is one, or else to the
+// last block probes of its function at or before it. When several block
+// probes share an address, GetInlineStack returns the most inlined one, and
+// GetOtherInlineStacks the others, so that the samples count for all of them
+// like in llvm-profgen.
+class PseudoProbeAddr2line : public Addr2line {
+ public:
+  // Returns a new PseudoProbeAddr2line for BINARY_NAME, or nullptr if it
+  // has no pseudo probes.
+  static PseudoProbeAddr2line *Create(const std::string &binary_name);
+
+  bool Prepare() override;
+  void GetInlineStack(uint64_t addr, SourceStack *stack) const override;
+  // Only queries the addresses where the probe of an address can change.
+  void GetInlineStackRanges(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<std::pair<uint64_t, SourceStack>> *ranges) const override;
+  void GetOtherInlineStacks(uint64_t addr,
+                            std::vector<SourceStack> *stacks) const override;
+
+  // Stores in PROBES the probes which the samples of ADDR count for: its call
+  // probe, or else the block probes at the last block address of its function
+  // at or before it, the most inlined first.
+  void GetProbes(uint64_t addr,
+                 std::vector<const llvm::MCDecodedPseudoProbe *> *probes) const;
+
+  // The names and the CFG checksums of the functions, by GUID.
+  const llvm::GUIDProbeFunctionMap &function_descs() const {
+    return decoder_.getGUID2FuncDescMap();
+  }
+
+ private:
+  explicit PseudoProbeAddr2line(const std::string &binary_name)
+      : Addr2line(binary_name) {}
+
+  // Returns the name of the function GUID, or nullptr if it has no
+  // descriptor.
+  const char *GetFunctionName(uint64_t guid) const;
+
+  // Appends to STACK the inline stack of PROBE, innermost first.
+  void AppendInlineStack(const llvm::MCDecodedPseudoProbe &probe,
+                         SourceStack *stack) const;
+
+  llvm::MCPseudoProbeDecoder decoder_;
+  // The block probes by address, the most inlined first at each address.
+  std::vector<std::pair<uint64_t, const llvm::MCDecodedPseudoProbe *>>
+      block_probes_;
+  // The sorted addresses of the call probes.
+  std::vector<uint64_t> call_addrs_;
+  // The sorted, disjoint address ranges of the function symbols.
+  std::vector<std::pair<uint64_t, uint64_t>> functions_;
+
+  DISALLOW_COPY_AND_ASSIGN(PseudoProbeAddr2line);
+};
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // HAVE_LLVM
+
+#endif  // AUTOFDO_PSEUDO_PROBE_ADDR2LINE_H_
@@ -0,0 +1,115 @@
+// Probes, and their inline contexts, of a binary built with pseudo probes.
+
+#include "pseudo_probe_addr2line.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#define FLAGS_test_srcdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+namespace {
+
+using devtools_crosstool_autofdo::PseudoProbeAddr2line;
+using devtools_crosstool_autofdo::SourceStack;
+
+const char kTestDataDir[] = "/testdata/";
+
+// Returns STACK as "function:probe" entries, innermost first.
+std::vector<std::string> ToProbes(const SourceStack &stack) {
+  std::vector<std::string> probes;
+  for (const auto &info : stack) {
+    probes.push_back(std::string(info.func_name) + ":" +
+                     std::to_string(info.line));
+  }
+  return probes;
+}
+
+// Returns the stack of ADDR as "function:probe" entries, innermost first.
+std::vector<std::string> GetProbes(const PseudoProbeAddr2line &addr2line,
+                                   uint64_t addr) {
+  SourceStack stack;
+  addr2line.GetInlineStack(addr, &stack);
+  return ToProbes(stack);
+}
+
+TEST(PseudoProbeAddr2lineTest, NoPseudoProbes) {
+  std::unique_ptr<PseudoProbeAddr2line> addr2line(PseudoProbeAddr2line::Create(
+      FLAGS_test_srcdir + kTestDataDir + "test.binary"));
+  EXPECT_EQ(addr2line, nullptr);
+}
+
+TEST(PseudoProbeAddr2lineTest, GetInlineStack) {
+  std::unique_ptr<PseudoProbeAddr2line> addr2line(PseudoProbeAddr2line::Create(
+      FLAGS_test_srcdir + kTestDataDir + "pseudo_probe.binary"));
+  ASSERT_NE(addr2line, nullptr);
+
+  typedef std::vector<std::string> Probes;
+  // The block probes cover the following addresses of their function.
+  EXPECT_EQ(GetProbes(*addr2line, 0x1130), Probes({"callee:1"}));
+  EXPECT_EQ(GetProbes(*addr2line, 0x1137), Probes({"callee:2"}));
+  EXPECT_EQ(GetProbes(*addr2line, 0x113f), Probes());
+  // main starts before its first probe.
+  EXPECT_EQ(GetProbes(*addr2line, 0x1140), Probes());
+  EXPECT_EQ(GetProbes(*addr2line, 0x1144), Probes({"main:1"}));
+  // The calls of the inlined leaf map to their call probes only.
+  EXPECT_EQ(GetProbes(*addr2line, 0x1162), Probes({"leaf:4", "main:4"}));
+  EXPECT_EQ(GetProbes(*addr2line, 0x1163), Probes({"leaf:3", "main:4"}));
+  EXPECT_EQ(GetProbes(*addr2line, 0x1169), Probes({"leaf:5", "main:4"}));
+  // The entry of leaf shares its address with a block of main.
+  EXPECT_EQ(GetProbes(*addr2line, 0x1178), Probes({"leaf:1", "main:4"}));
+  EXPECT_EQ(GetProbes(*addr2line, 0x1184), Probes({"main:3"}));
+
+  bool found_main = false;
+  for (const auto &[guid, desc] : addr2line->function_descs()) {
+    if (desc.FuncName == "main") {
+      EXPECT_EQ(desc.FuncHash, 281527801309287);
+      found_main = true;
+    }
+  }
+  EXPECT_TRUE(found_main);
+}
+
+TEST(PseudoProbeAddr2lineTest, GetOtherInlineStacks) {
+  std::unique_ptr<PseudoProbeAddr2line> addr2line(PseudoProbeAddr2line::Create(
+      FLAGS_test_srcdir + kTestDataDir + "pseudo_probe.binary"));
+  ASSERT_NE(addr2line, nullptr);
+
+  typedef std::vector<std::string> Probes;
+  std::vector<SourceStack> stacks;
+  // The block of main at the entry of leaf gets the samples too, and so do
+  // the following addresses of the block.
+  for (uint64_t addr : {0x1178, 0x117c}) {
+    addr2line->GetOtherInlineStacks(addr, &stacks);
+    ASSERT_EQ(stacks.size(), 1) << std::hex << addr;
+    EXPECT_EQ(ToProbes(stacks[0]), Probes({"main:2"}));
+  }
+  // A call probe is alone at its address.
+  addr2line->GetOtherInlineStacks(0x1162, &stacks);
+  EXPECT_TRUE(stacks.empty());
+  addr2line->GetOtherInlineStacks(0x1144, &stacks);
+  EXPECT_TRUE(stacks.empty());
+}
+
+TEST(PseudoProbeAddr2lineTest, GetInlineStackRanges) {
+  std::unique_ptr<PseudoProbeAddr2line> addr2line(PseudoProbeAddr2line::Create(
+      FLAGS_test_srcdir + kTestDataDir + "pseudo_probe.binary"));
+  ASSERT_NE(addr2line, nullptr);
+  std::vector<std::pair<uint64_t, SourceStack>> ranges;
+  addr2line->GetInlineStackRanges(0x1100, 0x11a0, &ranges);
+  ASSERT_FALSE(ranges.empty());
+  EXPECT_EQ(ranges[0].first, 0x1100);
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    const uint64_t end = i + 1 < ranges.size() ? ranges[i + 1].first : 0x11a0;
+    for (uint64_t addr = ranges[i].first; addr < end; ++addr) {
+      SourceStack stack;
+      addr2line->GetInlineStack(addr, &stack);
+      EXPECT_TRUE(stack == ranges[i].second) << std::hex << addr;
+    }
+  }
+}
+}  // namespace
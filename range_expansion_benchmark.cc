@@ -0,0 +1,109 @@
+// Benchmark of the LBR range expansion done by Profile.
+//
+// Synthetic functions are covered with randomly placed, overlapping ranges,
+// which are expanded into per-address counts both byte by byte into a std::map,
+// the way the profile used to be computed, and with ExpandRangeCounts. The two
+// results are checked to be identical. For example:
+//
+//   range_expansion_benchmark --function_size=65536 --num_ranges=5000
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "base/logging.h"
+#include "profile.h"
+#include "sample_reader.h"
+#include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/flags/parse.h"
+#include "third_party/abseil/absl/flags/usage.h"
+#include "third_party/abseil/absl/time/clock.h"
+#include "third_party/abseil/absl/time/time.h"
+
+ABSL_FLAG(uint64_t, function_size, 65536, "Size of the function in bytes.");
+ABSL_FLAG(uint64_t, num_ranges, 5000, "Number of ranges in the function.");
+ABSL_FLAG(uint64_t, max_range_size, 512, "Maximum size of a range in bytes.");
+ABSL_FLAG(int, iterations, 20, "Number of times each expansion is run.");
+
+namespace {
+using devtools_crosstool_autofdo::ExpandRangeCounts;
+using devtools_crosstool_autofdo::Range;
+using devtools_crosstool_autofdo::RangeCountMap;
+
+constexpr uint64_t kStartAddr = 0x400000;
+
+// Ranges start inside the function, some of them cross its end.
+RangeCountMap GetRanges(uint64_t end_addr) {
+  const uint64_t function_size = absl::GetFlag(FLAGS_function_size);
+  const uint64_t max_range_size = absl::GetFlag(FLAGS_max_range_size);
+  CHECK_GT(function_size, 0);
+  std::mt19937_64 rng(42);
+  std::uniform_int_distribution<uint64_t> begin(kStartAddr, end_addr - 1);
+  std::uniform_int_distribution<uint64_t> size(0, max_range_size - 1);
+  std::uniform_int_distribution<uint64_t> count(1, 1000);
+  RangeCountMap ranges;
+  ranges.reserve(absl::GetFlag(FLAGS_num_ranges));
+  for (uint64_t i = 0; i < absl::GetFlag(FLAGS_num_ranges); ++i) {
+    uint64_t first = begin(rng);
+    ranges[Range(first, first + size(rng))] += count(rng);
+  }
+  ranges.Freeze();
+  return ranges;
+}
+
+// The expansion done before ExpandRangeCounts.
+void ExpandByteByByte(const RangeCountMap &ranges, uint64_t end_addr,
+                      std::map<uint64_t, uint64_t> *counts) {
+  counts->clear();
+  for (const auto &[range, count] : ranges) {
+    for (uint64_t addr = range.first; addr < end_addr && addr <= range.second;
+         ++addr) {
+      (*counts)[addr] += count;
+    }
+  }
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  absl::SetProgramUsageMessage(argv[0]);
+  absl::ParseCommandLine(argc, argv);
+
+  const uint64_t end_addr = kStartAddr + absl::GetFlag(FLAGS_function_size);
+  const int iterations = absl::GetFlag(FLAGS_iterations);
+  const RangeCountMap ranges = GetRanges(end_addr);
+
+  std::map<uint64_t, uint64_t> map_counts;
+  absl::Time start = absl::Now();
+  for (int i = 0; i < iterations; ++i) {
+    ExpandByteByByte(ranges, end_addr, &map_counts);
+  }
+  const absl::Duration map_elapsed = (absl::Now() - start) / iterations;
+
+  std::vector<uint64_t> dense_counts;
+  start = absl::Now();
+  for (int i = 0; i < iterations; ++i) {
+    ExpandRangeCounts(ranges, kStartAddr, end_addr, &dense_counts);
+  }
+  const absl::Duration dense_elapsed = (absl::Now() - start) / iterations;
+
+  uint64_t non_zero = 0;
+  for (uint64_t i = 0; i < dense_counts.size(); ++i) {
+    if (dense_counts[i] == 0) continue;
+    ++non_zero;
+    auto iter = map_counts.find(kStartAddr + i);
+    CHECK(iter != map_counts.end());
+    CHECK_EQ(iter->second, dense_counts[i]);
+  }
+  CHECK_EQ(non_zero, map_counts.size());
+
+  printf("%zu ranges, %zu addresses with samples\n", ranges.size(),
+         map_counts.size());
+  printf("byte by byte:      %10.2f us\n",
+         absl::ToDoubleMicroseconds(map_elapsed));
+  printf("ExpandRangeCounts: %10.2f us\n",
+         absl::ToDoubleMicroseconds(dense_elapsed));
+  return 0;
+}
@@ -0,0 +1,126 @@
+// Benchmark of the address lookups in NonOverlappingRangeMap.
+//
+// The function symbols of the given binary are inserted into two maps, one of
+// which is frozen into its Eytzinger layout. Random addresses of the text of
+// the binary are then looked up in both, and the results are checked to be
+// identical. For example:
+//
+//   range_map_benchmark --binary=/usr/bin/clang --num_lookups=20000000
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "symbolize/nonoverlapping_range_map.h"
+#include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/flags/parse.h"
+#include "third_party/abseil/absl/flags/usage.h"
+#include "third_party/abseil/absl/time/clock.h"
+#include "third_party/abseil/absl/time/time.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/ObjectFile.h"
+
+ABSL_FLAG(std::string, binary, "/proc/self/exe",
+          "Binary whose function symbols are looked up.");
+ABSL_FLAG(uint64_t, num_lookups, 10000000, "Number of addresses looked up.");
+
+namespace {
+using devtools_crosstool_autofdo::NonOverlappingRangeMap;
+
+// Appends to RANGES the address ranges of the function symbols in SYMBOLS.
+template <class SymbolRange>
+void AddFunctionRanges(const SymbolRange &symbols,
+                       std::vector<std::pair<uint64_t, uint64_t>> *ranges) {
+  for (const llvm::object::SymbolRef &symbol : symbols) {
+    auto type = symbol.getType();
+    auto address = symbol.getAddress();
+    if (!type || !address) {
+      llvm::consumeError(type.takeError());
+      llvm::consumeError(address.takeError());
+      continue;
+    }
+    const uint64_t size = llvm::object::ELFSymbolRef(symbol).getSize();
+    if (*type != llvm::object::SymbolRef::ST_Function || size == 0) continue;
+    ranges->emplace_back(*address, *address + size);
+  }
+}
+
+// Returns the sorted, non-overlapping address ranges of the function symbols
+// of BINARY, dynamic ones included. A symbol overlapping the previous one is
+// dropped.
+std::vector<std::pair<uint64_t, uint64_t>> GetFunctionRanges(
+    const std::string &binary) {
+  auto object = llvm::object::ObjectFile::createObjectFile(binary);
+  if (!object) {
+    LOG(FATAL) << "Cannot read " << binary << ": "
+               << llvm::toString(object.takeError());
+  }
+  const auto *elf =
+      llvm::dyn_cast<llvm::object::ELFObjectFileBase>(object->getBinary());
+  CHECK(elf != nullptr) << binary << " is not an ELF file";
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  AddFunctionRanges(elf->symbols(), &ranges);
+  AddFunctionRanges(elf->getDynamicSymbolIterators(), &ranges);
+  std::sort(ranges.begin(), ranges.end());
+  std::vector<std::pair<uint64_t, uint64_t>> disjoint;
+  for (const auto &range : ranges) {
+    if (disjoint.empty() || disjoint.back().second <= range.first)
+      disjoint.push_back(range);
+  }
+  return disjoint;
+}
+
+// Looks up ADDRS in MAP, and returns the elapsed time and the index of the
+// range found for each address, -1 for none.
+absl::Duration LookupAll(const NonOverlappingRangeMap<int> &map,
+                         const std::vector<uint64_t> &addrs,
+                         std::vector<int> *found) {
+  found->resize(addrs.size());
+  const absl::Time start = absl::Now();
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    const int *index = map.Lookup(addrs[i], nullptr, nullptr);
+    (*found)[i] = index != nullptr ? *index : -1;
+  }
+  return absl::Now() - start;
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  absl::SetProgramUsageMessage(argv[0]);
+  absl::ParseCommandLine(argc, argv);
+
+  const auto ranges = GetFunctionRanges(absl::GetFlag(FLAGS_binary));
+  CHECK(!ranges.empty()) << "No function symbol";
+  NonOverlappingRangeMap<int> tree_map;
+  NonOverlappingRangeMap<int> frozen_map;
+  for (int i = 0; i < ranges.size(); ++i) {
+    tree_map.InsertRange(ranges[i].first, ranges[i].second, i);
+    frozen_map.InsertRange(ranges[i].first, ranges[i].second, i);
+  }
+  frozen_map.Freeze();
+
+  std::mt19937_64 rng(42);
+  std::uniform_int_distribution<uint64_t> addr(ranges.front().first,
+                                               ranges.back().second - 1);
+  std::vector<uint64_t> addrs(absl::GetFlag(FLAGS_num_lookups));
+  for (uint64_t &a : addrs) a = addr(rng);
+
+  std::vector<int> tree_found, frozen_found;
+  const absl::Duration tree_elapsed = LookupAll(tree_map, addrs, &tree_found);
+  const absl::Duration frozen_elapsed =
+      LookupAll(frozen_map, addrs, &frozen_found);
+  CHECK(tree_found == frozen_found);
+
+  const double n = addrs.size();
+  printf("%zu ranges, %zu lookups\n", ranges.size(), addrs.size());
+  printf("std::map:  %8.2f ns/lookup\n",
+         absl::ToDoubleNanoseconds(tree_elapsed) / n);
+  printf("Eytzinger: %8.2f ns/lookup\n",
+         absl::ToDoubleNanoseconds(frozen_elapsed) / n);
+  return 0;
+}
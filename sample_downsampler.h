@@ -0,0 +1,77 @@
+// Deterministic downsampling of sample events.
+
+#ifndef AUTOFDO_SAMPLE_DOWNSAMPLER_H_
+#define AUTOFDO_SAMPLE_DOWNSAMPLER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+#include "third_party/abseil/absl/strings/str_format.h"
+
+namespace devtools_crosstool_autofdo {
+
+// Selects about one sample event in FACTOR, to trade accuracy for conversion
+// time on very large profiles. The counters aggregated from the selected
+// samples are then scaled back up by FACTOR.
+//
+// Each sample is kept independently with probability 1 / FACTOR, depending
+// only on a hash of its index in the profile and of the seed, so that a given
+// profile and seed always yield the same selection.
+class SampleDownsampler {
+ public:
+  SampleDownsampler(uint32_t factor, uint64_t seed)
+      : factor_(std::max<uint32_t>(factor, 1)),
+        threshold_(std::numeric_limits<uint64_t>::max() / factor_),
+        seed_(seed) {}
+
+  // Returns true if the next sample event of the profile is kept.
+  bool KeepNext() {
+    const uint64_t index = seen_++;
+    if (factor_ > 1 && Mix(seed_ ^ (index * 0x9e3779b97f4a7c15ULL)) >=
+                           threshold_) {
+      return false;
+    }
+    ++kept_;
+    return true;
+  }
+
+  uint32_t factor() const { return factor_; }
+  uint64_t seen() const { return seen_; }
+  uint64_t kept() const { return kept_; }
+
+  // Returns the expected relative standard error of a counter estimated from
+  // KEPT selected samples, i.e. sqrt((1 - 1 / factor) / kept).
+  double RelativeError(uint64_t kept) const {
+    if (kept == 0) return 0;
+    return std::sqrt((1 - 1.0 / factor_) / kept);
+  }
+
+  // Returns the selection statistics in a human readable form.
+  std::string StatsString() const {
+    return absl::StrFormat(
+        "kept %u of %u sample events (1 in %u), expected relative error of "
+        "the total count %.4f%%",
+        kept_, seen_, factor_, RelativeError(kept_) * 100);
+  }
+
+ private:
+  // The splitmix64 finalizer, which is a bijection with good avalanche.
+  static uint64_t Mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  const uint32_t factor_;
+  const uint64_t threshold_;
+  const uint64_t seed_;
+  uint64_t seen_ = 0;
+  uint64_t kept_ = 0;
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_SAMPLE_DOWNSAMPLER_H_
@@ -3,26 +3,55 @@
 
 // Main function to merge different type of profile into txt profile.
 
+#include <fstream>
+#include <string>
+#include <vector>
+
 #include "base/commandlineflags.h"
 #include "profile_creator.h"
+#include "sample_reader.h"
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/flags/parse.h"
 #include "third_party/abseil/absl/flags/usage.h"
 
-ABSL_FLAG(std::string, profile, "data.profile", "Profile file name");
-ABSL_FLAG(std::string, profiler, "perf", "Profile type");
+ABSL_FLAG(std::string, profile, "data.profile",
+          "Profile file name. Text and binary profiles can be a list of file "
+          "names separated by ';' or, with prefix '@', a file with one name "
+          "per line.");
+ABSL_FLAG(std::string, profiler, "perf",
+          "Profile type. Possible values: perf, text or binary");
 ABSL_FLAG(std::string, output_file, "data.txt", "Merged profile file name");
+ABSL_FLAG(std::string, output_format, "text",
+          "Merged profile format. Possible values: text, which is human "
+          "readable, or binary, which is much faster to read and write");
 ABSL_FLAG(std::string, binary, "data.binary", "Binary file name");
+ABSL_FLAG(int, max_open_files, 256,
+          "Maximum number of text or binary profiles read at the same time. "
+          "More profiles are merged in several rounds.");
 
 int main(int argc, char **argv) {
   absl::SetProgramUsageMessage(argv[0]);
   absl::ParseCommandLine(argc, argv);
 
-  if (devtools_crosstool_autofdo::MergeSample(
-          absl::GetFlag(FLAGS_profile), absl::GetFlag(FLAGS_profiler),
-          absl::GetFlag(FLAGS_binary), absl::GetFlag(FLAGS_output_file))) {
-    return 0;
+  const std::string profiler = absl::GetFlag(FLAGS_profiler);
+  const std::string output_file = absl::GetFlag(FLAGS_output_file);
+  bool success;
+  if (profiler == "text" || profiler == "binary") {
+    // Sample files are sorted, and are merged as streams of records into the
+    // output, which accumulates the samples of successive runs.
+    std::vector<std::string> profiles =
+        devtools_crosstool_autofdo::GetProfileNames(
+            absl::GetFlag(FLAGS_profile));
+    if (std::ifstream(output_file).good()) {
+      profiles.push_back(output_file);
+    }
+    success = devtools_crosstool_autofdo::MergeSampleFiles(
+        profiles, output_file, absl::GetFlag(FLAGS_output_format),
+        absl::GetFlag(FLAGS_max_open_files));
   } else {
-    return -1;
+    success = devtools_crosstool_autofdo::MergeSample(
+        absl::GetFlag(FLAGS_profile), profiler, absl::GetFlag(FLAGS_binary),
+        output_file, absl::GetFlag(FLAGS_output_format));
   }
+  return success ? 0 : -1;
 }
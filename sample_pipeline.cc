@@ -0,0 +1,127 @@
+#include "sample_pipeline.h"
+
+#include <utility>
+
+#include "third_party/abseil/absl/flags/flag.h"
+
+ABSL_FLAG(bool, pipeline_perf_samples, false,
+          "Translate and aggregate the perf samples on two more threads, "
+          "while the perf.data file is decoded.");
+
+namespace devtools_crosstool_autofdo {
+namespace {
+// A batch is sent once it holds this many words.
+constexpr size_t kBatchSize = 1 << 14;
+// Number of batches between two stages.
+constexpr int kBatchesPerLink = 8;
+}  // namespace
+
+SamplePipeline::Link::Link()
+    : full_(kBatchesPerLink + 1), free_(kBatchesPerLink) {
+  for (int i = 0; i < kBatchesPerLink; ++i) {
+    batches_.push_back(std::make_unique<Batch>());
+    batches_.back()->reserve(kBatchSize);
+    free_.Push(batches_.back().get());
+  }
+}
+
+void SamplePipeline::Link::Append(uint64_t key,
+                                  absl::Span<const uint64_t> stack) {
+  if (current_ == nullptr) {
+    current_ = free_.Pop();
+  }
+  current_->push_back(key);
+  current_->push_back(stack.size());
+  current_->insert(current_->end(), stack.begin(), stack.end());
+  if (current_->size() >= kBatchSize) {
+    full_.Push(current_);
+    current_ = nullptr;
+  }
+}
+
+void SamplePipeline::Link::Close() {
+  if (current_ != nullptr) {
+    full_.Push(current_);
+    current_ = nullptr;
+  }
+  full_.Push(nullptr);
+}
+
+void SamplePipeline::Link::Release(Batch *batch) {
+  batch->clear();
+  free_.Push(batch);
+}
+
+SamplePipeline::SamplePipeline(size_t cache_size, TranslateCallback translate,
+                               AggregateCallback aggregate, bool threaded)
+    : translate_(std::move(translate)),
+      aggregate_(std::move(aggregate)),
+      threaded_(threaded),
+      cache_(cache_size,
+             [this](uint32_t pid, absl::Span<const uint64_t> stack,
+                    uint64_t count) { Translate(pid, stack, count); }) {
+  if (threaded_) {
+    decoded_ = std::make_unique<Link>();
+    translated_stacks_ = std::make_unique<Link>();
+    stage2_ = std::thread(&SamplePipeline::RunStage2, this);
+    stage3_ = std::thread(&SamplePipeline::RunStage3, this);
+  }
+}
+
+SamplePipeline::~SamplePipeline() { Finish(); }
+
+void SamplePipeline::Add(uint32_t pid, absl::Span<const uint64_t> stack) {
+  if (threaded_) {
+    decoded_->Append(pid, stack);
+  } else {
+    cache_.Add(pid, stack);
+  }
+}
+
+void SamplePipeline::Finish() {
+  if (finished_) return;
+  finished_ = true;
+  if (threaded_) {
+    decoded_->Close();
+    stage2_.join();
+    stage3_.join();
+  } else {
+    cache_.Flush();
+  }
+}
+
+void SamplePipeline::Translate(uint32_t pid, absl::Span<const uint64_t> stack,
+                               uint64_t count) {
+  translated_.clear();
+  translate_(pid, stack, &translated_);
+  if (threaded_) {
+    translated_stacks_->Append(count, translated_);
+  } else {
+    aggregate_(translated_, count);
+  }
+}
+
+void SamplePipeline::RunStage2() {
+  while (Batch *batch = decoded_->Receive()) {
+    for (size_t pos = 0; pos < batch->size(); pos += 2 + (*batch)[pos + 1]) {
+      cache_.Add((*batch)[pos], absl::MakeConstSpan(batch->data() + pos + 2,
+                                                    (*batch)[pos + 1]));
+    }
+    decoded_->Release(batch);
+  }
+  cache_.Flush();
+  translated_stacks_->Close();
+}
+
+void SamplePipeline::RunStage3() {
+  while (Batch *batch = translated_stacks_->Receive()) {
+    for (size_t pos = 0; pos < batch->size(); pos += 2 + (*batch)[pos + 1]) {
+      aggregate_(
+          absl::MakeConstSpan(batch->data() + pos + 2, (*batch)[pos + 1]),
+          (*batch)[pos]);
+    }
+    translated_stacks_->Release(batch);
+  }
+}
+
+}  // namespace devtools_crosstool_autofdo
@@ -0,0 +1,117 @@
+// Pipelined processing of the branch stacks of perf samples.
+
+#ifndef AUTOFDO_SAMPLE_PIPELINE_H_
+#define AUTOFDO_SAMPLE_PIPELINE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "base/commandlineflags.h"
+#include "base/macros.h"
+#include "branch_stack_cache.h"
+#include "spsc_queue.h"
+#include "third_party/abseil/absl/flags/declare.h"
+#include "third_party/abseil/absl/types/span.h"
+
+ABSL_DECLARE_FLAG(bool, pipeline_perf_samples);
+
+namespace devtools_crosstool_autofdo {
+
+// Processes the branch stacks of the samples of a perf.data file in three
+// stages:
+//  1. the caller decodes the perf events, and Adds the raw stack of each
+//     sample;
+//  2. the stacks are counted in a BranchStackCache, and each distinct stack is
+//     translated from runtime to binary addresses by the translate callback;
+//  3. the translated stacks are handed to the aggregate callback, which updates
+//     the counters.
+//
+// When threaded, stages 2 and 3 each run on their own thread, and the stages
+// pass batches of stacks to each other through SpscQueues. A fixed number of
+// batches circulates between two stages, so a stage that gets ahead waits for
+// the next one and memory stays bounded. Otherwise, the stages run in turn in
+// the caller's thread. The callbacks are only called by one thread at a time,
+// and the counters are the same either way.
+class SamplePipeline {
+ public:
+  // Appends to TRANSLATED the translation of STACK, sampled in process PID.
+  typedef std::function<void(uint32_t pid, absl::Span<const uint64_t> stack,
+                             std::vector<uint64_t> *translated)>
+      TranslateCallback;
+  // Aggregates COUNT samples of the translated stack TRANSLATED.
+  typedef std::function<void(absl::Span<const uint64_t> translated,
+                             uint64_t count)>
+      AggregateCallback;
+
+  // Creates a pipeline whose stage 2 caches at most CACHE_SIZE distinct
+  // stacks, see BranchStackCache.
+  SamplePipeline(size_t cache_size, TranslateCallback translate,
+                 AggregateCallback aggregate, bool threaded);
+  ~SamplePipeline();
+
+  // Processes one sample of STACK in process PID.
+  void Add(uint32_t pid, absl::Span<const uint64_t> stack);
+
+  // Processes the stacks still in the pipeline, and waits for the stages to
+  // complete. No stack can be added afterwards.
+  void Finish();
+
+  // The cache of stage 2, whose statistics are final once Finish returns.
+  const BranchStackCache &cache() const { return cache_; }
+
+ private:
+  // Records of a key, the pid or count, the stack size and the stack.
+  typedef std::vector<uint64_t> Batch;
+
+  // The queues through which the batches go from one stage to the next, and
+  // come back empty.
+  class Link {
+   public:
+    Link();
+
+    // Producer side: appends a record to the current batch, which is sent when
+    // it is full. Close sends the last batch and the end of the stream.
+    void Append(uint64_t key, absl::Span<const uint64_t> stack);
+    void Close();
+
+    // Consumer side: Receive returns nullptr at the end of the stream, and
+    // each batch received must be released once processed.
+    Batch *Receive() { return full_.Pop(); }
+    void Release(Batch *batch);
+
+   private:
+    std::vector<std::unique_ptr<Batch>> batches_;
+    SpscQueue<Batch *> full_;
+    SpscQueue<Batch *> free_;
+    Batch *current_ = nullptr;
+
+    DISALLOW_COPY_AND_ASSIGN(Link);
+  };
+
+  // Called for each distinct stack leaving the cache.
+  void Translate(uint32_t pid, absl::Span<const uint64_t> stack,
+                 uint64_t count);
+  void RunStage2();
+  void RunStage3();
+
+  const TranslateCallback translate_;
+  const AggregateCallback aggregate_;
+  const bool threaded_;
+  BranchStackCache cache_;
+  std::vector<uint64_t> translated_;
+  std::unique_ptr<Link> decoded_;
+  std::unique_ptr<Link> translated_stacks_;
+  std::thread stage2_;
+  std::thread stage3_;
+  bool finished_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(SamplePipeline);
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_SAMPLE_PIPELINE_H_
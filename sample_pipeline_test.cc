@@ -0,0 +1,74 @@
+// Hand-over of values by SpscQueue, and counters of the SamplePipeline.
+
+#include "sample_pipeline.h"
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "spsc_queue.h"
+#include "third_party/abseil/absl/types/span.h"
+
+namespace {
+
+using devtools_crosstool_autofdo::SamplePipeline;
+using devtools_crosstool_autofdo::SpscQueue;
+
+TEST(SpscQueueTest, PushAndPop) {
+  SpscQueue<uint64_t> queue(5);
+  EXPECT_EQ(queue.capacity(), 8);
+  uint64_t value;
+  EXPECT_FALSE(queue.TryPop(&value));
+
+  constexpr uint64_t kNumValues = 100000;
+  std::thread producer([&queue]() {
+    for (uint64_t i = 1; i <= kNumValues; ++i) queue.Push(i);
+  });
+  uint64_t sum = 0;
+  for (uint64_t i = 1; i <= kNumValues; ++i) {
+    value = queue.Pop();
+    EXPECT_EQ(value, i);
+    sum += value;
+  }
+  producer.join();
+  EXPECT_EQ(sum, kNumValues * (kNumValues + 1) / 2);
+}
+
+// Aggregates random stacks, whose words are translated by adding the pid, and
+// returns the count of each translated word.
+std::map<uint64_t, uint64_t> Aggregate(size_t cache_size, bool threaded) {
+  std::map<uint64_t, uint64_t> counts;
+  SamplePipeline pipeline(
+      cache_size,
+      [](uint32_t pid, absl::Span<const uint64_t> stack,
+         std::vector<uint64_t> *translated) {
+        for (uint64_t word : stack) translated->push_back(word + pid);
+      },
+      [&counts](absl::Span<const uint64_t> translated, uint64_t count) {
+        for (uint64_t word : translated) counts[word] += count;
+      },
+      threaded);
+  std::mt19937 random(1);
+  std::vector<uint64_t> stack;
+  for (int i = 0; i < 50000; ++i) {
+    stack.assign(random() % 20, 0);
+    for (uint64_t &word : stack) word = random() % 64;
+    pipeline.Add(random() % 4 * 1000, stack);
+  }
+  pipeline.Finish();
+  EXPECT_EQ(pipeline.cache().samples(), 50000);
+  return counts;
+}
+
+TEST(SamplePipelineTest, SameCountsWhenThreaded) {
+  const std::map<uint64_t, uint64_t> expected = Aggregate(0, false);
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(Aggregate(0, true), expected);
+  EXPECT_EQ(Aggregate(1000, true), expected);
+  EXPECT_EQ(Aggregate(1000, false), expected);
+}
+
+}  // namespace
@@ -5,27 +5,122 @@
 
 #include "sample_reader.h"
 
+#include <fcntl.h>
 #include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <memory>
 #include <set>
 #include <string>
+#include <thread>  // NOLINT(build/c++11)
 #include <utility>
+#include <vector>
 
 #include "base/commandlineflags.h"
 #include "base/logging.h"
 #include "base/port.h"
+#include "mmap_history.h"
 #include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/memory/memory.h"
+#include "third_party/abseil/absl/strings/str_cat.h"
 #include "third_party/abseil/absl/strings/str_format.h"
 #include "third_party/abseil/absl/strings/str_join.h"
+#include "third_party/abseil/absl/strings/str_split.h"
+#include "third_party/abseil/absl/types/span.h"
 #include "quipper/perf_parser.h"
 #include "quipper/perf_reader.h"
 
 ABSL_FLAG(uint64_t, strip_dup_backedge_stride_limit, 0x1000,
           "Controls the limit of backedge stride hold by the heuristic "
           "to strip duplicated entries in LBR stack. ");
+ABSL_FLAG(bool, stream_perf_samples, false,
+          "Aggregate perf.data samples as they are decoded instead of parsing "
+          "all the events into memory first. This bounds the peak memory by "
+          "the number of distinct counters.");
+
+namespace {
+// Magic number at the beginning of binary sample files.
+constexpr char kBinarySampleMagic[8] = {'A', 'F', 'D', 'O', 'S', 'M', 'P', 0};
+
+void AppendVarint(uint64_t value, std::string *out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Decodes a varint at *pos, and advances *pos past it. Returns false if the
+// varint is truncated or too long.
+bool ReadVarint(const uint8_t **pos, const uint8_t *end, uint64_t *value) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+    uint8_t byte = *(*pos)++;
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t ZigZagDecode(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Appends the records of a map keyed by address pairs, e.g. a RangeCountMap or
+// a BranchCountMap.
+template <class PairCountMap>
+void AppendPairRecords(const PairCountMap &map, std::string *out) {
+  AppendVarint(map.size(), out);
+  uint64_t prev = 0;
+  for (const auto &[pair, count] : map) {
+    AppendVarint(pair.first - prev, out);
+    AppendVarint(ZigZagEncode(pair.second - pair.first), out);
+    AppendVarint(count, out);
+    prev = pair.first;
+  }
+}
+
+// Reads the records written by AppendPairRecords, adding the counts to map.
+template <class PairCountMap>
+bool ReadPairRecords(const uint8_t **pos, const uint8_t *end,
+                     PairCountMap *map) {
+  uint64_t num_records;
+  if (!ReadVarint(pos, end, &num_records)) return false;
+  uint64_t prev = 0;
+  // A record has three varints of at least one byte each, which bounds the
+  // number of records a corrupt count can reserve.
+  map->reserve(map->size() + std::min<uint64_t>(num_records, (end - *pos) / 3));
+  for (uint64_t i = 0; i < num_records; i++) {
+    uint64_t delta, zigzag, count;
+    if (!ReadVarint(pos, end, &delta) || !ReadVarint(pos, end, &zigzag) ||
+        !ReadVarint(pos, end, &count))
+      return false;
+    uint64_t first = prev + delta;
+    uint64_t second = first + ZigZagDecode(zigzag);
+    (*map)[std::make_pair(first, second)] += count;
+    prev = first;
+  }
+  return true;
+}
+}  // namespace
 
 namespace devtools_crosstool_autofdo {
 
@@ -48,18 +143,19 @@ bool PerfDataSampleReader::MatchBinary(
       return re_cache_it->second;
     }
 
-    bool is_found = std::regex_search(dso_and_offset.dso_name().c_str(), re_);
+    bool is_found = MatchBinaryName(dso_and_offset.dso_name());
     re_cache_[dso_and_offset.dso_info_] = is_found;
     return is_found;
   } else {
-    std::string name = dso_and_offset.dso_name();
-    for (const auto &binary_path : focus_bins_) {
-      if (name == binary_path) {
-        return true;
-      }
-    }
-    return false;
+    return MatchBinaryName(dso_and_offset.dso_name());
+  }
+}
+
+bool PerfDataSampleReader::MatchBinaryName(const std::string &name) const {
+  if (focus_bins_.empty()) {
+    return std::regex_search(name.c_str(), re_);
   }
+  return focus_bins_.find(name) != focus_bins_.end();
 }
 
 // Stores matching binary paths to focus_bins_ for a given build_id_.
@@ -137,6 +233,7 @@ bool SampleReader::ReadAndSetTotalCount() {
   if (!Read()) {
     return false;
   }
+  Freeze();
   if (range_count_map_.size() > 0) {
     for (const auto &[range, count] : range_count_map_) {
       total_count_ += count * (1 + range.second - range.first);
@@ -214,19 +311,27 @@ bool TextSampleReaderWriter::Append(const std::string &profile_file) {
   return true;
 }
 
-void TextSampleReaderWriter::Merge(const SampleReader &reader) {
-  for (const auto &[range, count] : reader.range_count_map()) {
-    range_count_map_[range] += count;
-  }
-  for (const auto &[addr, count] : reader.address_count_map()) {
-    address_count_map_[addr] += count;
+void SampleReader::Merge(const SampleReader &reader) {
+  range_count_map_.Merge(reader.range_count_map());
+  address_count_map_.Merge(reader.address_count_map());
+  branch_count_map_.Merge(reader.branch_count_map());
+  for (const auto &[event, map] : reader.event_address_count_maps()) {
+    event_address_count_maps_[event].Merge(map);
   }
-  for (const auto &[branch, count] : reader.branch_count_map()) {
-    branch_count_map_[branch] += count;
+}
+
+void SampleReader::MergeAndClear(SampleReader *reader) {
+  range_count_map_.MergeAndClear(&reader->range_count_map_);
+  address_count_map_.MergeAndClear(&reader->address_count_map_);
+  branch_count_map_.MergeAndClear(&reader->branch_count_map_);
+  for (auto &[event, map] : reader->event_address_count_maps_) {
+    event_address_count_maps_[event].MergeAndClear(&map);
   }
+  reader->event_address_count_maps_.clear();
 }
 
 bool TextSampleReaderWriter::Write(const char *aux_info) {
+  Freeze();
   FILE *fp = fopen(profile_file_.c_str(), "w");
   if (fp == nullptr) {
     LOG(ERROR) << "Cannot open " << profile_file_ << " to write";
@@ -252,7 +357,7 @@ bool TextSampleReaderWriter::Write(const char *aux_info) {
   return true;
 }
 
-bool TextSampleReaderWriter::IsFileExist() const {
+bool FileSampleReader::IsFileExist() const {
   FILE *fp = fopen(profile_file_.c_str(), "r");
   if (fp == nullptr) {
     return false;
@@ -262,12 +367,465 @@ bool TextSampleReaderWriter::IsFileExist() const {
   }
 }
 
+bool BinarySampleReaderWriter::Append(const std::string &profile_file) {
+  int fd = open(profile_file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Cannot open " << profile_file << " to read";
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(kBinarySampleMagic)) {
+    LOG(ERROR) << "Error reading from " << profile_file;
+    close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Cannot mmap " << profile_file;
+    return false;
+  }
+
+  const uint8_t *begin = static_cast<const uint8_t *>(data);
+  bool success = Decode(begin, begin + st.st_size);
+  if (!success) {
+    LOG(ERROR) << "Error reading from " << profile_file;
+  }
+  munmap(data, st.st_size);
+  return success;
+}
+
+bool BinarySampleReaderWriter::Decode(const uint8_t *pos, const uint8_t *end) {
+  if (memcmp(pos, kBinarySampleMagic, sizeof(kBinarySampleMagic)) != 0) {
+    LOG(ERROR) << "Not a binary sample file";
+    return false;
+  }
+  pos += sizeof(kBinarySampleMagic);
+  uint64_t version;
+  if (!ReadVarint(&pos, end, &version) || version != kVersion) {
+    LOG(ERROR) << "Unsupported binary sample file version";
+    return false;
+  }
+
+  if (!ReadPairRecords(&pos, end, &range_count_map_)) return false;
+
+  uint64_t num_records;
+  if (!ReadVarint(&pos, end, &num_records)) return false;
+  uint64_t addr = 0;
+  address_count_map_.reserve(address_count_map_.size() +
+                             std::min<uint64_t>(num_records, (end - pos) / 2));
+  for (uint64_t i = 0; i < num_records; i++) {
+    uint64_t delta, count;
+    if (!ReadVarint(&pos, end, &delta) || !ReadVarint(&pos, end, &count))
+      return false;
+    addr += delta;
+    address_count_map_[addr] += count;
+  }
+
+  return ReadPairRecords(&pos, end, &branch_count_map_);
+}
+
+bool BinarySampleReaderWriter::Write(const char *aux_info) {
+  Freeze();
+  std::string buffer(kBinarySampleMagic, sizeof(kBinarySampleMagic));
+  AppendVarint(kVersion, &buffer);
+  AppendPairRecords(range_count_map_, &buffer);
+  AppendVarint(address_count_map_.size(), &buffer);
+  uint64_t prev = 0;
+  for (const auto &[addr, count] : address_count_map_) {
+    AppendVarint(addr - prev, &buffer);
+    AppendVarint(count, &buffer);
+    prev = addr;
+  }
+  AppendPairRecords(branch_count_map_, &buffer);
+  if (aux_info) {
+    buffer.append(aux_info);
+  }
+
+  FILE *fp = fopen(profile_file_.c_str(), "wb");
+  if (fp == nullptr) {
+    LOG(ERROR) << "Cannot open " << profile_file_ << " to write";
+    return false;
+  }
+  bool success = fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+  if (fclose(fp) != 0 || !success) {
+    LOG(ERROR) << "Error writing to " << profile_file_;
+    return false;
+  }
+  return true;
+}
+
+namespace {
+// Reads the records of a text sample file, see TextSampleReaderWriter.
+class TextSampleRecordReader : public SampleRecordReader {
+ public:
+  TextSampleRecordReader(const std::string &profile_file, FILE *fp)
+      : SampleRecordReader(profile_file), fp_(fp) {}
+  ~TextSampleRecordReader() override { fclose(fp_); }
+
+ protected:
+  bool ReadCount(uint64_t *count) override {
+    return fscanf(fp_, "%" SCNu64 "\n", count) == 1;
+  }
+
+  bool ReadRecord(SampleRecord *record) override {
+    switch (record->section) {
+      case SampleRecord::kRange:
+        return fscanf(fp_, "%" SCNx64 "-%" SCNx64 ":%" SCNu64 "\n",
+                      &record->first, &record->second, &record->count) == 3;
+      case SampleRecord::kAddress:
+        return fscanf(fp_, "%" SCNx64 ":%" SCNu64 "\n", &record->first,
+                      &record->count) == 2;
+      case SampleRecord::kBranch:
+        return fscanf(fp_, "%" SCNx64 "->%" SCNx64 ":%" SCNu64 "\n",
+                      &record->first, &record->second, &record->count) == 3;
+    }
+    return false;
+  }
+
+ private:
+  FILE *fp_;
+};
+
+// Reads the records of a mmapped binary sample file, see
+// BinarySampleReaderWriter.
+class BinarySampleRecordReader : public SampleRecordReader {
+ public:
+  BinarySampleRecordReader(const std::string &profile_file, void *data,
+                           size_t size)
+      : SampleRecordReader(profile_file),
+        data_(data),
+        size_(size),
+        pos_(static_cast<const uint8_t *>(data) + sizeof(kBinarySampleMagic)),
+        end_(static_cast<const uint8_t *>(data) + size) {}
+  ~BinarySampleRecordReader() override { munmap(data_, size_); }
+
+  bool ReadHeader() {
+    uint64_t version;
+    return ReadVarint(&pos_, end_, &version) &&
+           version == BinarySampleReaderWriter::kVersion;
+  }
+
+ protected:
+  bool ReadCount(uint64_t *count) override {
+    prev_ = 0;
+    return ReadVarint(&pos_, end_, count);
+  }
+
+  bool ReadRecord(SampleRecord *record) override {
+    uint64_t delta, zigzag = 0;
+    if (!ReadVarint(&pos_, end_, &delta) ||
+        (record->section != SampleRecord::kAddress &&
+         !ReadVarint(&pos_, end_, &zigzag)) ||
+        !ReadVarint(&pos_, end_, &record->count)) {
+      return false;
+    }
+    record->first = prev_ + delta;
+    if (record->section != SampleRecord::kAddress) {
+      record->second = record->first + ZigZagDecode(zigzag);
+    }
+    prev_ = record->first;
+    return true;
+  }
+
+ private:
+  void *data_;
+  size_t size_;
+  const uint8_t *pos_;
+  const uint8_t *end_;
+  uint64_t prev_ = 0;
+};
+
+class TextSampleRecordWriter : public SampleRecordWriter {
+ public:
+  using SampleRecordWriter::SampleRecordWriter;
+
+ protected:
+  void WriteCount(uint64_t count) override {
+    // fscanf skips the padding when the count is read back.
+    fprintf(fp_, "%-20" PRIu64 "\n", count);
+  }
+
+  void WriteRecord(const SampleRecord &record) override {
+    switch (record.section) {
+      case SampleRecord::kRange:
+        absl::FPrintF(fp_, "%x-%x:%u\n", record.first, record.second,
+                      record.count);
+        break;
+      case SampleRecord::kAddress:
+        absl::FPrintF(fp_, "%x:%u\n", record.first, record.count);
+        break;
+      case SampleRecord::kBranch:
+        absl::FPrintF(fp_, "%x->%x:%u\n", record.first, record.second,
+                      record.count);
+        break;
+    }
+  }
+};
+
+class BinarySampleRecordWriter : public SampleRecordWriter {
+ public:
+  using SampleRecordWriter::SampleRecordWriter;
+
+ protected:
+  void WriteCount(uint64_t count) override {
+    // A varint padded to its maximal length of 10 bytes.
+    char bytes[10];
+    for (int i = 0; i < 9; ++i) {
+      bytes[i] = static_cast<char>((count & 0x7f) | 0x80);
+      count >>= 7;
+    }
+    bytes[9] = static_cast<char>(count);
+    fwrite(bytes, 1, sizeof(bytes), fp_);
+    prev_ = 0;
+  }
+
+  void WriteRecord(const SampleRecord &record) override {
+    buffer_.clear();
+    AppendVarint(record.first - prev_, &buffer_);
+    if (record.section != SampleRecord::kAddress) {
+      AppendVarint(ZigZagEncode(record.second - record.first), &buffer_);
+    }
+    AppendVarint(record.count, &buffer_);
+    fwrite(buffer_.data(), 1, buffer_.size(), fp_);
+    prev_ = record.first;
+  }
+
+ private:
+  uint64_t prev_ = 0;
+  std::string buffer_;
+};
+}  // namespace
+
+std::unique_ptr<SampleRecordReader> SampleRecordReader::Open(
+    const std::string &profile_file) {
+  int fd = open(profile_file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Cannot open " << profile_file << " to read";
+    return nullptr;
+  }
+  struct stat st;
+  char magic[sizeof(kBinarySampleMagic)];
+  if (fstat(fd, &st) == 0 && st.st_size >= sizeof(magic) &&
+      pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+      memcmp(magic, kBinarySampleMagic, sizeof(magic)) == 0) {
+    // The mapping does not keep the file open, so that many files can be
+    // read at the same time.
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      LOG(ERROR) << "Cannot mmap " << profile_file;
+      return nullptr;
+    }
+    auto reader = std::make_unique<BinarySampleRecordReader>(profile_file,
+                                                             data, st.st_size);
+    if (!reader->ReadHeader()) {
+      LOG(ERROR) << "Unsupported binary sample file version in "
+                 << profile_file;
+      return nullptr;
+    }
+    return reader;
+  }
+  FILE *fp = fdopen(fd, "r");
+  if (fp == nullptr) {
+    LOG(ERROR) << "Cannot open " << profile_file << " to read";
+    close(fd);
+    return nullptr;
+  }
+  return std::make_unique<TextSampleRecordReader>(profile_file, fp);
+}
+
+bool SampleRecordReader::Next(SampleRecord *record) {
+  if (error_) return false;
+  while (remaining_ == 0) {
+    if (next_section_ > SampleRecord::kBranch) return false;
+    next_section_++;
+    if (!ReadCount(&remaining_)) {
+      LOG(ERROR) << "Error reading from " << profile_file_;
+      error_ = true;
+      return false;
+    }
+  }
+  record->section = static_cast<SampleRecord::Section>(next_section_ - 1);
+  record->second = 0;
+  if (!ReadRecord(record)) {
+    LOG(ERROR) << "Error reading from " << profile_file_;
+    error_ = true;
+    return false;
+  }
+  if (has_last_ && !(last_.key() < record->key())) {
+    LOG(ERROR) << profile_file_ << " is not sorted";
+    error_ = true;
+    return false;
+  }
+  remaining_--;
+  has_last_ = true;
+  last_ = *record;
+  return true;
+}
+
+std::unique_ptr<SampleRecordWriter> SampleRecordWriter::Create(
+    const std::string &profile_file, const std::string &format) {
+  if (format != "text" && format != "binary") {
+    LOG(ERROR) << "Unsupported sample output format: " << format;
+    return nullptr;
+  }
+  FILE *fp = fopen(profile_file.c_str(), "wb");
+  if (fp == nullptr) {
+    LOG(ERROR) << "Cannot open " << profile_file << " to write";
+    return nullptr;
+  }
+  if (format == "text") {
+    return absl::WrapUnique(new TextSampleRecordWriter(profile_file, fp));
+  }
+  std::string header(kBinarySampleMagic, sizeof(kBinarySampleMagic));
+  AppendVarint(BinarySampleReaderWriter::kVersion, &header);
+  fwrite(header.data(), 1, header.size(), fp);
+  return absl::WrapUnique(new BinarySampleRecordWriter(profile_file, fp));
+}
+
+SampleRecordWriter::~SampleRecordWriter() {
+  if (fp_ != nullptr) {
+    fclose(fp_);
+  }
+}
+
+void SampleRecordWriter::NextSection() {
+  if (section_ >= 0) {
+    long end = ftell(fp_);  // NOLINT(runtime/int)
+    fseek(fp_, count_offset_, SEEK_SET);
+    WriteCount(count_);
+    fseek(fp_, end, SEEK_SET);
+  }
+  if (++section_ <= SampleRecord::kBranch) {
+    count_offset_ = ftell(fp_);
+    count_ = 0;
+    WriteCount(0);
+  }
+}
+
+bool SampleRecordWriter::Add(const SampleRecord &record) {
+  while (section_ < record.section) {
+    NextSection();
+  }
+  WriteRecord(record);
+  count_++;
+  return !ferror(fp_);
+}
+
+bool SampleRecordWriter::Close() {
+  while (section_ <= SampleRecord::kBranch) {
+    NextSection();
+  }
+  bool success = !ferror(fp_);
+  success = fclose(fp_) == 0 && success;
+  fp_ = nullptr;
+  if (!success) {
+    LOG(ERROR) << "Error writing to " << profile_file_;
+  }
+  return success;
+}
+
+void PerfDataSampleReader::AddEncodedSample(absl::Span<const uint64_t> stack,
+                                            uint64_t count) {
+  branch_stack_buffer_.clear();
+  for (size_t i = 3; i + 2 < stack.size(); i += 3) {
+    branch_stack_buffer_.push_back({stack[i], stack[i + 1],
+                                    (stack[i + 2] & 1) != 0,
+                                    (stack[i + 2] & 2) != 0});
+  }
+  AddSample(stack[1] != 0, stack[2], branch_stack_buffer_,
+            count * downsample_factor_);
+  if (per_event_counts_ && stack[1] != 0) {
+    event_address_count_maps_[event_names_[stack[0]]][stack[2]] +=
+        count * downsample_factor_;
+  }
+}
+
+void PerfDataSampleReader::ReadEventNames(const quipper::PerfReader &reader) {
+  event_names_.clear();
+  event_index_by_id_.clear();
+  if (!per_event_counts_ || reader.attrs().empty()) {
+    event_names_.push_back("");
+    return;
+  }
+  for (int i = 0; i < reader.attrs().size(); ++i) {
+    // The event descriptions, when present, are in the order of the attrs.
+    event_names_.push_back(i < reader.event_types().size()
+                               ? reader.event_types().Get(i).name()
+                               : absl::StrCat("event", i));
+    for (uint64_t id : reader.attrs().Get(i).ids()) {
+      event_index_by_id_[id] = i;
+    }
+  }
+}
+
+uint32_t PerfDataSampleReader::EventIndex(
+    const quipper::PerfDataProto::SampleEvent &event) const {
+  // Without sample ids, which perf records whenever there are several
+  // events, all the samples are attributed to the first event.
+  if (event_index_by_id_.empty() || !event.has_id()) return 0;
+  auto iter = event_index_by_id_.find(event.id());
+  return iter == event_index_by_id_.end() ? 0 : iter->second;
+}
+
+void PerfDataSampleReader::AddSample(
+    bool ip_matched, uint64_t ip, const std::vector<BranchEntry> &branch_stack,
+    uint64_t count) {
+  if (ip_matched) {
+    address_count_map_[ip] += count;
+  }
+  if (branch_stack.size() > 0 && branch_stack[0].to_matched &&
+      branch_stack[0].from_matched) {
+    branch_count_map_[Branch(branch_stack[0].from, branch_stack[0].to)] +=
+        count;
+  }
+  for (int i = 1; i < branch_stack.size(); i++) {
+    if (!branch_stack[i].to_matched) {
+      continue;
+    }
+
+    // TODO(b/62827958): Get rid of this temporary workaround once the issue
+    // of duplicate entries in LBR is resolved. It only happens at the head
+    // of the LBR. In addition, it is possible that the duplication is
+    // legitimate if there's self loop. However, it's very rare to have basic
+    // blocks larger than 0x1000 formed by such self loop. So, we're ignoring
+    // duplication when the resulting basic block is larger than 0x1000 (the
+    // default value of FLAGS_strip_dup_backedge_stride_limit).
+    if (i == 1 && (branch_stack[0].from == branch_stack[1].from) &&
+        (branch_stack[0].to == branch_stack[1].to) &&
+        (branch_stack[0].from - branch_stack[0].to >
+         absl::GetFlag(FLAGS_strip_dup_backedge_stride_limit)))
+      continue;
+    uint64_t begin = branch_stack[i].to;
+    uint64_t end = branch_stack[i - 1].from;
+    // The interval between two taken branches should not be too large.
+    if (end < begin || end - begin > (1 << 20)) {
+      LOG(WARNING) << "Bogus LBR data: " << begin << "->" << end;
+      continue;
+    }
+    range_count_map_[Range(begin, end)] += count;
+    if (branch_stack[i].from_matched) {
+      branch_count_map_[Branch(branch_stack[i].from, branch_stack[i].to)] +=
+          count;
+    }
+  }
+}
+
 bool PerfDataSampleReader::Append(const std::string &profile_file) {
+  if (absl::GetFlag(FLAGS_stream_perf_samples)) {
+    return AppendStreaming(profile_file);
+  }
+
   quipper::PerfReader reader;
   quipper::PerfParser parser(&reader);
-  if (!reader.ReadFile(profile_file) || !parser.ParseRawEvents()) {
+  if (!sample_filter_.ReadFile(profile_file, &reader) ||
+      !parser.ParseRawEvents()) {
     return false;
   }
+  // The cache is keyed by the DSOInfo objects owned by the parser, which do
+  // not outlive a single Append.
+  re_cache_.clear();
 
   // If we can find build_id from binary, and the exact build_id was found
   // in the profile, then we use focus_bins to match samples. Otherwise,
@@ -279,56 +837,247 @@ bool PerfDataSampleReader::Append(const std::string &profile_file) {
   } else {
     LOG(ERROR) << "No buildid found in binary";
   }
+  ReadEventNames(reader);
 
+  // The cached stacks are made of the translated addresses, see
+  // AddEncodedSample. The pid is thus irrelevant and not part of the key.
+  BranchStackCache cache(
+      absl::GetFlag(FLAGS_lbr_stack_cache_size),
+      [this](uint32_t pid, absl::Span<const uint64_t> stack, uint64_t count) {
+        AddEncodedSample(stack, count);
+      });
+  SampleDownsampler downsampler(downsample_factor_, downsample_seed_);
   for (const auto &event : parser.parsed_events()) {
     if (!event.event_ptr ||
-        event.event_ptr->header().type() != quipper::PERF_RECORD_SAMPLE) {
+        event.event_ptr->header().type() != quipper::PERF_RECORD_SAMPLE ||
+        !sample_filter_.Matches(event.event_ptr->sample_event()) ||
+        !downsampler.KeepNext()) {
       continue;
     }
-    if (MatchBinary(event.dso_and_offset)) {
-      address_count_map_[event.dso_and_offset.offset()]++;
+    stack_buffer_.clear();
+    stack_buffer_.push_back(EventIndex(event.event_ptr->sample_event()));
+    stack_buffer_.push_back(MatchBinary(event.dso_and_offset));
+    stack_buffer_.push_back(event.dso_and_offset.offset());
+    for (const auto &branch : event.branch_stack) {
+      stack_buffer_.push_back(branch.from.offset());
+      stack_buffer_.push_back(branch.to.offset());
+      stack_buffer_.push_back(MatchBinary(branch.from) |
+                              (MatchBinary(branch.to) << 1));
     }
-    if (event.branch_stack.size() > 0 &&
-        MatchBinary(event.branch_stack[0].to) &&
-        MatchBinary(event.branch_stack[0].from)) {
-      branch_count_map_[Branch(event.branch_stack[0].from.offset(),
-                               event.branch_stack[0].to.offset())]++;
+    cache.Add(0, stack_buffer_);
+  }
+  cache.Flush();
+  LogStats(profile_file, cache, downsampler);
+  return true;
+}
+
+void PerfDataSampleReader::LogStats(
+    const std::string &profile_file, const BranchStackCache &cache,
+    const SampleDownsampler &downsampler) const {
+  if (absl::GetFlag(FLAGS_lbr_stack_cache_size) > 0) {
+    LOG(INFO) << "LBR stack cache for " << profile_file << ": "
+              << cache.StatsString();
+  }
+  if (downsampler.factor() > 1) {
+    LOG(INFO) << "Downsampled " << profile_file << ": "
+              << downsampler.StatsString();
+  }
+}
+
+bool PerfDataSampleReader::AppendStreaming(const std::string &profile_file) {
+  // The file is read twice. quipper reads an uncompressed file from its path
+  // both times, so that it is never held in memory as a whole. A compressed
+  // file, or one restricted to a time window, is only decompressed or
+  // filtered once, into a buffer.
+  PerfSampleFilter::PreparedFile file;
+  if (!sample_filter_.Prepare(profile_file, &file)) {
+    return false;
+  }
+
+  // The first pass only parses the non-sample events, which is cheap, to find
+  // where the profiled binary is mapped in each process over time.
+  MMapHistory mmaps;
+  {
+    quipper::PerfReader reader;
+    reader.SetEventTypesToSkipWhenSerializing({quipper::PERF_RECORD_SAMPLE});
+    quipper::PerfParser parser(&reader);
+    if (!sample_filter_.ReadPrepared(file, &reader) ||
+        !parser.ParseRawEvents()) {
+      return false;
+    }
+    if (build_id_ != "") {
+      GetFileNameFromBuildID(&reader);
+      if (focus_bins_.empty())
+        return false;
+    } else {
+      LOG(ERROR) << "No buildid found in binary";
     }
-    for (int i = 1; i < event.branch_stack.size(); i++) {
-      if (!MatchBinary(event.branch_stack[i].to)) {
+    ReadEventNames(reader);
+    for (const auto &event : parser.parsed_events()) {
+      if (!event.event_ptr) continue;
+      if (event.event_ptr->event_type_case() ==
+          quipper::PerfDataProto_PerfEvent::kForkEvent) {
+        const quipper::PerfDataProto_ForkEvent &fork =
+            event.event_ptr->fork_event();
+        mmaps.AddFork(event.event_ptr->timestamp(), fork.pid(), fork.ppid());
         continue;
       }
-
-      // TODO(b/62827958): Get rid of this temporary workaround once the issue
-      // of duplicate entries in LBR is resolved. It only happens at the head
-      // of the LBR. In addition, it is possible that the duplication is
-      // legitimate if there's self loop. However, it's very rare to have basic
-      // blocks larger than 0x1000 formed by such self loop. So, we're ignoring
-      // duplication when the resulting basic block is larger than 0x1000 (the
-      // default value of FLAGS_strip_dup_backedge_stride_limit).
-      if (i == 1 &&
-          (event.branch_stack[0].from.offset() ==
-           event.branch_stack[1].from.offset()) &&
-          (event.branch_stack[0].to.offset() ==
-           event.branch_stack[1].to.offset()) &&
-          (event.branch_stack[0].from.offset() -
-               event.branch_stack[0].to.offset() >
-           absl::GetFlag(FLAGS_strip_dup_backedge_stride_limit)))
-        continue;
-      uint64_t begin = event.branch_stack[i].to.offset();
-      uint64_t end = event.branch_stack[i - 1].from.offset();
-      // The interval between two taken branches should not be too large.
-      if (end < begin || end - begin > (1 << 20)) {
-        LOG(WARNING) << "Bogus LBR data: " << begin << "->" << end;
+      if (event.event_ptr->event_type_case() !=
+          quipper::PerfDataProto_PerfEvent::kMmapEvent)
         continue;
+      const quipper::PerfDataProto_MMapEvent &mmap =
+          event.event_ptr->mmap_event();
+      mmaps.AddMMap(event.event_ptr->timestamp(), mmap.pid(), mmap.start(),
+                    mmap.len(), mmap.pgoff(),
+                    mmap.has_filename() && MatchBinaryName(mmap.filename()));
+    }
+  }
+  if (mmaps.empty()) {
+    LOG(WARNING) << "No mmap of the profiled binary found in " << profile_file;
+    return true;
+  }
+  mmaps.Finish();
+
+  // The second pass aggregates each sample as soon as quipper decodes it,
+  // possibly in a SamplePipeline. The cached stacks are made of the raw ip and
+  // branch addresses and of the epoch of the mmaps at the time of the sample,
+  // and are only translated once per distinct stack, epoch and pid.
+  SamplePipeline pipeline(
+      absl::GetFlag(FLAGS_lbr_stack_cache_size),
+      [&mmaps](uint32_t pid, absl::Span<const uint64_t> stack,
+               std::vector<uint64_t> *translated) {
+        const uint32_t epoch = stack[1];
+        uint64_t ip = 0;
+        translated->push_back(stack[0]);
+        translated->push_back(mmaps.ToOffset(pid, epoch, stack[2], &ip));
+        translated->push_back(ip);
+        for (size_t i = 3; i + 1 < stack.size(); i += 2) {
+          uint64_t from = stack[i];
+          uint64_t to = stack[i + 1];
+          bool from_matched = mmaps.ToOffset(pid, epoch, stack[i], &from);
+          bool to_matched = mmaps.ToOffset(pid, epoch, stack[i + 1], &to);
+          translated->push_back(from);
+          translated->push_back(to);
+          translated->push_back(from_matched | (to_matched << 1));
+        }
+      },
+      [this](absl::Span<const uint64_t> translated, uint64_t count) {
+        AddEncodedSample(translated, count);
+      },
+      absl::GetFlag(FLAGS_pipeline_perf_samples));
+  SampleDownsampler downsampler(downsample_factor_, downsample_seed_);
+  auto process_event = [&](const quipper::PerfDataProto::SampleEvent &event) {
+    if (!sample_filter_.Matches(event) || !downsampler.KeepNext()) return;
+    stack_buffer_.clear();
+    stack_buffer_.push_back(EventIndex(event));
+    // The samples without a time see the mmaps of the whole file.
+    stack_buffer_.push_back(mmaps.Epoch(
+        event.has_sample_time_ns() ? event.sample_time_ns()
+                                   : std::numeric_limits<uint64_t>::max()));
+    stack_buffer_.push_back(event.ip());
+    for (const auto &branch : event.branch_stack()) {
+      stack_buffer_.push_back(branch.from_ip());
+      stack_buffer_.push_back(branch.to_ip());
+    }
+    pipeline.Add(event.pid(), stack_buffer_);
+  };
+
+  quipper::PerfReader reader;
+  // Nothing needs to be serialized, the samples are consumed by the callback.
+  reader.SetEventTypesToSkipWhenSerializing(
+      {quipper::PERF_RECORD_SAMPLE, quipper::PERF_RECORD_MMAP,
+       quipper::PERF_RECORD_FORK, quipper::PERF_RECORD_COMM});
+  reader.SetSampleCallback(process_event);
+  bool success = sample_filter_.ReadPrepared(file, &reader);
+  pipeline.Finish();
+  if (success) {
+    LogStats(profile_file, pipeline.cache(), downsampler);
+  }
+  return success;
+}
+
+bool MultiFileSampleReader::Read() {
+  int num_threads = num_threads_ > 0
+                        ? num_threads_
+                        : std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min<int>(num_threads, profile_files_.size());
+  if (num_threads == 0) {
+    LOG(ERROR) << "No profile file to read.";
+    return false;
+  }
+
+  // Each worker owns one shard. Every file it picks is read into a reader of
+  // its own, which is merged into the shard only once the whole file is read,
+  // so that a file failing midway leaves no partial counts.
+  std::vector<std::unique_ptr<FileSampleReader>> shards(num_threads);
+  std::atomic<size_t> next_file(0);
+  std::atomic<int> files_read(0);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_threads; ++i) {
+    workers.emplace_back([&, i]() {
+      for (size_t f = next_file++; f < profile_files_.size(); f = next_file++) {
+        const std::string &profile_file = profile_files_[f];
+        std::unique_ptr<FileSampleReader> file_reader(factory_(profile_file));
+        if (file_reader == nullptr || !file_reader->Append(profile_file)) {
+          LOG(WARNING) << "Skipped profile " << profile_file
+                       << ", because reading it failed.";
+          continue;
+        }
+        ++files_read;
+        if (shards[i] == nullptr) {
+          shards[i] = std::move(file_reader);
+        } else {
+          shards[i]->MergeAndClear(file_reader.get());
+        }
       }
-      range_count_map_[Range(begin, end)]++;
-      if (MatchBinary(event.branch_stack[i].from)) {
-        branch_count_map_[Branch(event.branch_stack[i].from.offset(),
-                                 event.branch_stack[i].to.offset())]++;
+    });
+  }
+  for (std::thread &worker : workers) worker.join();
+
+  if (files_read == 0) {
+    LOG(ERROR) << "None of the " << profile_files_.size()
+               << " profile files could be read.";
+    return false;
+  }
+  LOG(INFO) << "Read " << files_read << " of " << profile_files_.size()
+            << " profile files with " << num_threads << " threads.";
+
+  // Pairwise parallel reduction: at each round, shard i absorbs shard
+  // i + step, so that the merge finishes in log2(num_threads) rounds.
+  for (int step = 1; step < num_threads; step *= 2) {
+    std::vector<std::thread> mergers;
+    for (int i = 0; i + step < num_threads; i += 2 * step) {
+      if (shards[i + step] == nullptr) continue;
+      if (shards[i] == nullptr) {
+        shards[i] = std::move(shards[i + step]);
+        continue;
       }
+      mergers.emplace_back([&shards, i, step]() {
+        shards[i]->MergeAndClear(shards[i + step].get());
+      });
     }
+    for (std::thread &merger : mergers) merger.join();
   }
+  MergeAndClear(shards[0].get());
   return true;
 }
+
+std::vector<std::string> GetProfileNames(const std::string &profile) {
+  std::vector<std::string> profile_names;
+  if (!profile.empty() && profile[0] == '@') {
+    std::ifstream fin(profile.substr(1));
+    std::string pf;
+    while (std::getline(fin, pf)) {
+      if (!pf.empty() && pf[0] != '#') {
+        profile_names.push_back(pf);
+      }
+    }
+  } else {
+    for (absl::string_view pf :
+         absl::StrSplit(profile, ';', absl::SkipEmpty())) {
+      profile_names.emplace_back(pf);
+    }
+  }
+  return profile_names;
+}
 }  // namespace devtools_crosstool_autofdo
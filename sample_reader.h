@@ -6,16 +6,28 @@
 #ifndef AUTOFDO_SAMPLE_READER_H_
 #define AUTOFDO_SAMPLE_READER_H_
 
+#include <stdio.h>
+
 #include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <regex>  // NOLINT
 #include <set>
 #include <string>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 #include "base/integral_types.h"
 #include "base/macros.h"
+#include "branch_stack_cache.h"
+#include "flat_count_map.h"
+#include "perf_sample_filter.h"
+#include "sample_downsampler.h"
+#include "sample_pipeline.h"
 #include "third_party/abseil/absl/container/flat_hash_map.h"
+#include "third_party/abseil/absl/types/span.h"
 #include "quipper/perf_parser.h"
 
 namespace quipper {
@@ -30,11 +42,13 @@ namespace devtools_crosstool_autofdo {
 
 // All counter type is using uint64 instead of int64 because GCC's gcov
 // functions only takes unsigned variables.
-typedef std::map<uint64_t, uint64_t> AddressCountMap;
+// The counters are hashed while the samples are aggregated, and are iterated
+// in increasing key order once reading finishes, see FlatCountMap.
+typedef FlatCountMap<uint64_t> AddressCountMap;
 typedef std::pair<uint64_t, uint64_t> Range;
-typedef std::map<Range, uint64_t> RangeCountMap;
+typedef FlatCountMap<Range> RangeCountMap;
 typedef std::pair<uint64_t, uint64_t> Branch;
-typedef std::map<Branch, uint64_t> BranchCountMap;
+typedef FlatCountMap<Branch> BranchCountMap;
 
 // Reads in the profile data, and represent it in address_count_map_.
 class SampleReader {
@@ -56,6 +70,13 @@ class SampleReader {
     return branch_count_map_;
   }
 
+  // The address counts of the samples of each perf event, by event name, when
+  // they are collected, see PerfDataSampleReader::SetPerEventCounts.
+  const std::map<std::string, AddressCountMap> &event_address_count_maps()
+      const {
+    return event_address_count_maps_;
+  }
+
   std::set<uint64_t> GetSampledAddresses() const;
 
   // Returns the sample count for a given instruction.
@@ -64,12 +85,26 @@ class SampleReader {
   uint64_t GetTotalSampleCount() const;
   // Returns the max count.
   uint64_t GetTotalCount() const { return total_count_; }
+  // Sorts all maps, after which they can be read concurrently, but no longer
+  // written to.
+  void Freeze() {
+    address_count_map_.Freeze();
+    range_count_map_.Freeze();
+    branch_count_map_.Freeze();
+    for (auto &[event, map] : event_address_count_maps_) map.Freeze();
+  }
   // Clear all maps to release memory.
   void Clear() {
     address_count_map_.clear();
     range_count_map_.clear();
     branch_count_map_.clear();
+    event_address_count_maps_.clear();
   }
+  // Adds the counts of reader to this reader.
+  void Merge(const SampleReader &reader);
+  // Adds the counts of reader to this reader, and clears reader. This avoids
+  // copying the maps when this reader is still empty.
+  void MergeAndClear(SampleReader *reader);
 
  protected:
   // Virtual read function to read from different types of profiles.
@@ -79,6 +114,19 @@ class SampleReader {
   AddressCountMap address_count_map_;
   RangeCountMap range_count_map_;
   BranchCountMap branch_count_map_;
+  std::map<std::string, AddressCountMap> event_address_count_maps_;
+};
+
+// Holds address counts that are already in memory, e.g. those of one perf
+// event read by a PerfDataSampleReader, to compute a profile from them.
+class AddressCountSampleReader : public SampleReader {
+ public:
+  explicit AddressCountSampleReader(const AddressCountMap &address_count_map) {
+    address_count_map_ = address_count_map;
+  }
+
+ protected:
+  bool Read() override { return true; }
 };
 
 // Base class that reads in the profile from a sample data file.
@@ -88,6 +136,7 @@ class FileSampleReader : public SampleReader {
       : profile_file_(profile_file) {}
 
   virtual bool Append(const std::string &profile_file) = 0;
+  bool IsFileExist() const;
 
  protected:
   bool Read() override;
@@ -114,10 +163,8 @@ class TextSampleReaderWriter : public FileSampleReader {
       : FileSampleReader(profile_file) {}
   explicit TextSampleReaderWriter() : FileSampleReader("") { }
   bool Append(const std::string &profile_file) override;
-  void Merge(const SampleReader &reader);
   // Writes the profile to file, and appending aux_info at the end.
   bool Write(const char *aux_info);
-  bool IsFileExist() const;
   void SetAddressCountMap(const AddressCountMap &map) {
     address_count_map_ = map;
   }
@@ -134,7 +181,148 @@ class TextSampleReaderWriter : public FileSampleReader {
   DISALLOW_COPY_AND_ASSIGN(TextSampleReaderWriter);
 };
 
+// Reads/Writes sample data from/to a compact binary file, which is much
+// faster to load and save than the text format. The file is mmapped when read.
+// The binary file format:
+//
+// magic "AFDOSMP\0" (8 bytes)
+// version (varint)
+// number of entries in range_count_map (varint)
+// (from_i - from_{i-1}, zigzag(to_i - from_i), count_i) (varints)
+// ......
+// number of entries in address_count_map (varint)
+// (addr_i - addr_{i-1}, count_i) (varints)
+// ......
+// number of entries in branch_count_map (varint)
+// (from_i - from_{i-1}, zigzag(to_i - from_i), count_i) (varints)
+// ......
+//
+// All the records are sorted, so the deltas of the first fields are never
+// negative, and from_0/addr_0 are encoded relative to 0.
+class BinarySampleReaderWriter : public FileSampleReader {
+ public:
+  static const uint32_t kVersion = 1;
+
+  explicit BinarySampleReaderWriter(const std::string &profile_file)
+      : FileSampleReader(profile_file) {}
+  bool Append(const std::string &profile_file) override;
+  // Writes the profile to file, and appending aux_info at the end.
+  bool Write(const char *aux_info);
+  void set_profile_file(const std::string &file) { profile_file_ = file; }
+
+ private:
+  // Decodes the file content in [begin, end), adding the counts to the maps.
+  bool Decode(const uint8_t *begin, const uint8_t *end);
+
+  DISALLOW_COPY_AND_ASSIGN(BinarySampleReaderWriter);
+};
+
+// A record of a text or binary sample file. The records of a file are sorted
+// by section, then by key: the ranges, then the addresses, whose second is
+// always 0, then the branches.
+struct SampleRecord {
+  enum Section { kRange = 0, kAddress = 1, kBranch = 2 };
+
+  std::tuple<int, uint64_t, uint64_t> key() const {
+    return std::make_tuple(section, first, second);
+  }
+
+  Section section;
+  uint64_t first;
+  uint64_t second;
+  uint64_t count;
+};
+
+// Reads the records of a text or binary sample file one at a time, without
+// building the count maps, so that files can be merged in constant memory.
+class SampleRecordReader {
+ public:
+  // Opens PROFILE_FILE, whose format is found from its contents. Returns
+  // nullptr if the file cannot be opened.
+  static std::unique_ptr<SampleRecordReader> Open(
+      const std::string &profile_file);
+
+  virtual ~SampleRecordReader() {}
+
+  // Reads the next record into RECORD. Returns false after the last record,
+  // or if the file is malformed or not sorted, in which case error() is true.
+  bool Next(SampleRecord *record);
+  bool error() const { return error_; }
+
+ protected:
+  explicit SampleRecordReader(const std::string &profile_file)
+      : profile_file_(profile_file) {}
+
+  // Reads the number of records of the next section.
+  virtual bool ReadCount(uint64_t *count) = 0;
+  // Reads the key and count of the next record of RECORD->section.
+  virtual bool ReadRecord(SampleRecord *record) = 0;
+
+  const std::string profile_file_;
+
+ private:
+  int next_section_ = SampleRecord::kRange;
+  uint64_t remaining_ = 0;
+  bool error_ = false;
+  bool has_last_ = false;
+  SampleRecord last_;
+
+  DISALLOW_COPY_AND_ASSIGN(SampleRecordReader);
+};
+
+// Writes a text or binary sample file one record at a time. The number of
+// records of each section, which precedes them, is written with a fixed width
+// and filled in once the section is complete.
+class SampleRecordWriter {
+ public:
+  // Creates PROFILE_FILE in FORMAT, either "text" or "binary". Returns nullptr
+  // on error.
+  static std::unique_ptr<SampleRecordWriter> Create(
+      const std::string &profile_file, const std::string &format);
+
+  virtual ~SampleRecordWriter();
+
+  // Appends RECORD, which must come after the records already added.
+  bool Add(const SampleRecord &record);
+  // Completes the file. Returns false if it could not be written.
+  bool Close();
+
+ protected:
+  SampleRecordWriter(const std::string &profile_file, FILE *fp)
+      : profile_file_(profile_file), fp_(fp) {}
+
+  // Writes COUNT with the same width whatever its value.
+  virtual void WriteCount(uint64_t count) = 0;
+  virtual void WriteRecord(const SampleRecord &record) = 0;
+
+  const std::string profile_file_;
+  FILE *fp_;
+
+ private:
+  // Fills in the number of records of the current section, and starts the
+  // next one.
+  void NextSection();
+
+  int section_ = -1;
+  long count_offset_ = 0;  // NOLINT(runtime/int)
+  uint64_t count_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(SampleRecordWriter);
+};
+
 // Reads in the sample data from 'perf -g' output file.
+//
+// By default the whole perf.data file is parsed into quipper ParsedEvents
+// before any counter is updated. With --stream_perf_samples, the mmap events
+// are parsed first, and the samples are then aggregated one at a time as
+// quipper decodes them, so that peak memory is proportional to the number of
+// distinct counters rather than to the number of events.
+//
+// With --lbr_stack_cache_size, repeated branch stacks are counted in a
+// BranchStackCache first, and each distinct stack is aggregated once. With
+// SetDownsampling, only a fraction of the sample events is aggregated, and
+// with SetSampleFilter, only the samples of a time window, or of some
+// processes or CPUs.
 class PerfDataSampleReader : public FileSampleReader {
  public:
   PerfDataSampleReader(const std::string &profile_file, const std::string &re,
@@ -142,20 +330,122 @@ class PerfDataSampleReader : public FileSampleReader {
   ~PerfDataSampleReader() override;
   bool Append(const std::string &profile_file) override;
 
+  // Only keeps about one sample event in FACTOR, selected deterministically
+  // from SEED, and scales the counters back up by FACTOR. See
+  // SampleDownsampler.
+  void SetDownsampling(uint32_t factor, uint64_t seed) {
+    downsample_factor_ = factor;
+    downsample_seed_ = seed;
+  }
+
+  // Only aggregates the samples selected by FILTER.
+  void SetSampleFilter(PerfSampleFilter filter) {
+    sample_filter_ = std::move(filter);
+  }
+
+  // Also counts the sampled addresses of each perf event separately, in
+  // event_address_count_maps(), so that a profile can be computed for each of
+  // the events recorded together, e.g. cycles and LLC misses.
+  void SetPerEventCounts(bool per_event_counts) {
+    per_event_counts_ = per_event_counts;
+  }
+
  protected:
+  // A branch stack entry, whose addresses have been translated to offsets in
+  // the profiled binary. The offsets are only meaningful when the
+  // corresponding address is matched to the profiled binary.
+  struct BranchEntry {
+    uint64_t from;
+    uint64_t to;
+    bool from_matched;
+    bool to_matched;
+  };
+
   virtual bool MatchBinary(
       const quipper::ParsedEvent::DSOAndOffset &dso_and_offset);
+  // Returns true if the DSO named NAME is the profiled binary.
+  bool MatchBinaryName(const std::string &name) const;
   virtual void GetFileNameFromBuildID(const quipper::PerfReader *reader);
 
+  // Updates the address, range and branch counters with COUNT samples whose
+  // addresses have already been translated to binary offsets.
+  void AddSample(bool ip_matched, uint64_t ip,
+                 const std::vector<BranchEntry> &branch_stack, uint64_t count);
+  // Same as AddSample for a translated stack encoded as the index of the
+  // perf event in event_names_, the ip_matched bit and the ip, followed by
+  // the from and to offsets and the matched bits (from in bit 0, to in bit 1)
+  // of each branch.
+  void AddEncodedSample(absl::Span<const uint64_t> stack, uint64_t count);
+
+  // Reads the names of the perf events of the file read by READER, when the
+  // samples of each event are counted separately.
+  void ReadEventNames(const quipper::PerfReader &reader);
+  // Returns the index in event_names_ of the event which produced EVENT.
+  uint32_t EventIndex(const quipper::PerfDataProto::SampleEvent &event) const;
+
+  // Appends the samples of PROFILE_FILE by decoding and aggregating the
+  // sample events one at a time, without materializing the parsed events.
+  bool AppendStreaming(const std::string &profile_file);
+
+  // Logs the statistics of the branch stack cache and of the downsampler used
+  // to read PROFILE_FILE, when they are enabled.
+  void LogStats(const std::string &profile_file, const BranchStackCache &cache,
+                const SampleDownsampler &downsampler) const;
+
   const std::string build_id_;
 
  private:
   std::set<std::string> focus_bins_;
+  // Scratch buffers reused across samples to avoid per-sample allocations.
+  std::vector<BranchEntry> branch_stack_buffer_;
+  std::vector<uint64_t> stack_buffer_;
+  uint32_t downsample_factor_ = 1;
+  uint64_t downsample_seed_ = 0;
+  PerfSampleFilter sample_filter_;
+  bool per_event_counts_ = false;
+  // The names of the perf events of the file being read, and the index of
+  // the event of each sample id.
+  std::vector<std::string> event_names_;
+  absl::flat_hash_map<uint64_t, uint32_t> event_index_by_id_;
   absl::flat_hash_map<const quipper::DSOInfo *, bool> re_cache_;
   const std::regex re_;
 
   DISALLOW_COPY_AND_ASSIGN(PerfDataSampleReader);
 };
+
+// Reads the samples from several profile files of the same binary. The files
+// are read in parallel, each worker thread merging the files it picks into its
+// own thread-local reader. A file that cannot be read entirely is skipped with
+// none of its counts. The per-thread counters are then merged with a parallel
+// pairwise reduction.
+class MultiFileSampleReader : public SampleReader {
+ public:
+  // Creates the reader for a single profile file, or returns nullptr.
+  typedef std::function<FileSampleReader *(const std::string &)> Factory;
+
+  // num_threads is the maximum number of worker threads, 0 means one thread
+  // per hardware thread.
+  MultiFileSampleReader(const std::vector<std::string> &profile_files,
+                        Factory factory, int num_threads)
+      : profile_files_(profile_files),
+        factory_(std::move(factory)),
+        num_threads_(num_threads) {}
+
+ protected:
+  bool Read() override;
+
+ private:
+  const std::vector<std::string> profile_files_;
+  Factory factory_;
+  const int num_threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(MultiFileSampleReader);
+};
+
+// Returns the profile file names given by a --profile flag, either a ';'
+// separated list or, with prefix '@', a list file with one name per line.
+// Empty names, and the lines of the list file starting with '#', are skipped.
+std::vector<std::string> GetProfileNames(const std::string &profile);
 }  // namespace devtools_crosstool_autofdo
 
 #endif  // AUTOFDO_SAMPLE_READER_H_
@@ -8,16 +8,26 @@
 
 #include "sample_reader.h"
 
+#include <stdio.h>
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "base/commandlineflags.h"
 #include "gtest/gtest.h"
+#include "perf_data_index.h"
+#include "profile_creator.h"
 #include "third_party/abseil/absl/flags/declare.h"
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/strings/str_cat.h"
 
 ABSL_DECLARE_FLAG(uint64_t, strip_dup_backedge_stride_limit);
+ABSL_DECLARE_FLAG(bool, stream_perf_samples);
 
 #define FLAGS_test_tmpdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
 
@@ -68,6 +78,302 @@ TEST_F(SampleReaderTest, ReadLBR) {
   EXPECT_EQ(reader.GetTotalCount(), 5383657);
 }
 
+TEST_F(SampleReaderTest, ReadLBRStreaming) {
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(
+      FLAGS_test_srcdir + kTestDataDir + "test.lbr",
+      "test.binary", "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+
+  absl::SetFlag(&FLAGS_stream_perf_samples, true);
+  devtools_crosstool_autofdo::PerfDataSampleReader streaming_reader(
+      FLAGS_test_srcdir + kTestDataDir + "test.lbr",
+      "test.binary", "");
+  bool streaming_read = streaming_reader.ReadAndSetTotalCount();
+  absl::SetFlag(&FLAGS_stream_perf_samples, false);
+  ASSERT_TRUE(streaming_read);
+
+  EXPECT_EQ(streaming_reader.address_count_map(), reader.address_count_map());
+  EXPECT_EQ(streaming_reader.range_count_map(), reader.range_count_map());
+  EXPECT_EQ(streaming_reader.branch_count_map(), reader.branch_count_map());
+  EXPECT_EQ(streaming_reader.GetTotalCount(), 5383657);
+}
+
+TEST_F(SampleReaderTest, ReadLBRStreamingForkAndRemap) {
+  // test.lbr, with the samples after the 3000th alternating with a child
+  // process forked from the profiled one, which inherits its mmaps. After the
+  // 6000th sample, the profiled process maps another file over the page at
+  // 0x401000, which hides it from the later samples of that process only.
+  const std::string profile =
+      FLAGS_test_srcdir + kTestDataDir + "test_fork_remap.lbr";
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(profile,
+                                                          "test.binary", "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+
+  absl::SetFlag(&FLAGS_stream_perf_samples, true);
+  devtools_crosstool_autofdo::PerfDataSampleReader streaming_reader(
+      profile, "test.binary", "");
+  bool streaming_read = streaming_reader.ReadAndSetTotalCount();
+  absl::SetFlag(&FLAGS_stream_perf_samples, false);
+  ASSERT_TRUE(streaming_read);
+
+  EXPECT_EQ(streaming_reader.address_count_map(), reader.address_count_map());
+  EXPECT_EQ(streaming_reader.range_count_map(), reader.range_count_map());
+  EXPECT_EQ(streaming_reader.branch_count_map(), reader.branch_count_map());
+  EXPECT_EQ(streaming_reader.GetTotalCount(), reader.GetTotalCount());
+
+  // The samples whose ip is in the binary as mapped at their time.
+  uint64_t ip_count = 0;
+  for (const auto &[addr, count] : streaming_reader.address_count_map()) {
+    ip_count += count;
+  }
+  EXPECT_EQ(ip_count, 8018);
+}
+
+TEST_F(SampleReaderTest, ReadLBRPipelined) {
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(
+      FLAGS_test_srcdir + kTestDataDir + "test.lbr", "test.binary", "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+
+  absl::SetFlag(&FLAGS_stream_perf_samples, true);
+  absl::SetFlag(&FLAGS_pipeline_perf_samples, true);
+  devtools_crosstool_autofdo::PerfDataSampleReader pipelined_reader(
+      FLAGS_test_srcdir + kTestDataDir + "test.lbr", "test.binary", "");
+  bool pipelined_read = pipelined_reader.ReadAndSetTotalCount();
+  absl::SetFlag(&FLAGS_pipeline_perf_samples, false);
+  absl::SetFlag(&FLAGS_stream_perf_samples, false);
+  ASSERT_TRUE(pipelined_read);
+
+  EXPECT_EQ(pipelined_reader.address_count_map(), reader.address_count_map());
+  EXPECT_EQ(pipelined_reader.range_count_map(), reader.range_count_map());
+  EXPECT_EQ(pipelined_reader.branch_count_map(), reader.branch_count_map());
+}
+
+TEST_F(SampleReaderTest, ReadLBRPerEvent) {
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(
+      FLAGS_test_srcdir + kTestDataDir + "test.lbr", "test.binary", "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+  EXPECT_TRUE(reader.event_address_count_maps().empty());
+
+  // test.lbr records a single event, whose counts are all the counts.
+  for (bool stream : {false, true}) {
+    absl::SetFlag(&FLAGS_stream_perf_samples, stream);
+    devtools_crosstool_autofdo::PerfDataSampleReader event_reader(
+        FLAGS_test_srcdir + kTestDataDir + "test.lbr", "test.binary", "");
+    event_reader.SetPerEventCounts(true);
+    bool event_read = event_reader.ReadAndSetTotalCount();
+    absl::SetFlag(&FLAGS_stream_perf_samples, false);
+    ASSERT_TRUE(event_read);
+
+    ASSERT_EQ(event_reader.event_address_count_maps().size(), 1);
+    EXPECT_EQ(event_reader.event_address_count_maps().begin()->second,
+              reader.address_count_map());
+    EXPECT_EQ(event_reader.address_count_map(), reader.address_count_map());
+    EXPECT_EQ(event_reader.range_count_map(), reader.range_count_map());
+  }
+}
+
+// test_two_events.lbr holds the first 1000 samples of test.lbr, recorded
+// for br_inst_exec:taken, with a PERF_SAMPLE_IDENTIFIER. It has a second
+// event, cycles, whose sample ids are those of the odd samples.
+TEST_F(SampleReaderTest, ReadLBRTwoEvents) {
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(
+      FLAGS_test_srcdir + kTestDataDir + "test_two_events.lbr", "test.binary",
+      "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+
+  for (bool stream : {false, true}) {
+    absl::SetFlag(&FLAGS_stream_perf_samples, stream);
+    devtools_crosstool_autofdo::PerfDataSampleReader event_reader(
+        FLAGS_test_srcdir + kTestDataDir + "test_two_events.lbr",
+        "test.binary", "");
+    event_reader.SetPerEventCounts(true);
+    bool event_read = event_reader.ReadAndSetTotalCount();
+    absl::SetFlag(&FLAGS_stream_perf_samples, false);
+    ASSERT_TRUE(event_read);
+
+    const auto &event_maps = event_reader.event_address_count_maps();
+    ASSERT_EQ(event_maps.size(), 2);
+    ASSERT_EQ(event_maps.count("br_inst_exec:taken"), 1);
+    ASSERT_EQ(event_maps.count("cycles"), 1);
+    // The samples in the binary of each event.
+    std::map<std::string, uint64_t> totals;
+    devtools_crosstool_autofdo::AddressCountMap merged;
+    for (const auto &[event, address_count_map] : event_maps) {
+      for (const auto &[addr, count] : address_count_map) {
+        totals[event] += count;
+        merged[addr] += count;
+      }
+    }
+    EXPECT_EQ(totals["br_inst_exec:taken"], 498);
+    EXPECT_EQ(totals["cycles"], 497);
+    EXPECT_EQ(merged, reader.address_count_map());
+    EXPECT_EQ(event_reader.address_count_map(), reader.address_count_map());
+    EXPECT_EQ(event_reader.range_count_map(), reader.range_count_map());
+  }
+}
+
+TEST_F(SampleReaderTest, ReadLBRWithStackCache) {
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(
+      FLAGS_test_srcdir + kTestDataDir + "test.lbr",
+      "test.binary", "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+
+  // A small cache, so that it is flushed many times while reading.
+  absl::SetFlag(&FLAGS_lbr_stack_cache_size, 16);
+  for (bool stream : {false, true}) {
+    absl::SetFlag(&FLAGS_stream_perf_samples, stream);
+    devtools_crosstool_autofdo::PerfDataSampleReader cached_reader(
+        FLAGS_test_srcdir + kTestDataDir + "test.lbr",
+        "test.binary", "");
+    bool cached_read = cached_reader.ReadAndSetTotalCount();
+    absl::SetFlag(&FLAGS_stream_perf_samples, false);
+    ASSERT_TRUE(cached_read);
+
+    EXPECT_EQ(cached_reader.address_count_map(), reader.address_count_map());
+    EXPECT_EQ(cached_reader.range_count_map(), reader.range_count_map());
+    EXPECT_EQ(cached_reader.branch_count_map(), reader.branch_count_map());
+  }
+  absl::SetFlag(&FLAGS_lbr_stack_cache_size, 0);
+}
+
+TEST_F(SampleReaderTest, ReadLBRDownsampled) {
+  const std::string profile = FLAGS_test_srcdir + kTestDataDir + "test.lbr";
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(profile,
+                                                          "test.binary", "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+
+  devtools_crosstool_autofdo::PerfDataSampleReader downsampled_reader(
+      profile, "test.binary", "");
+  downsampled_reader.SetDownsampling(4, 1);
+  ASSERT_TRUE(downsampled_reader.ReadAndSetTotalCount());
+  for (const auto &[range, count] : downsampled_reader.range_count_map()) {
+    EXPECT_EQ(count % 4, 0);
+  }
+  EXPECT_NEAR(downsampled_reader.GetTotalCount(), reader.GetTotalCount(),
+              reader.GetTotalCount() * 0.05);
+
+  // The same seed selects the same samples.
+  devtools_crosstool_autofdo::PerfDataSampleReader same_seed_reader(
+      profile, "test.binary", "");
+  same_seed_reader.SetDownsampling(4, 1);
+  ASSERT_TRUE(same_seed_reader.ReadAndSetTotalCount());
+  EXPECT_EQ(same_seed_reader.range_count_map(),
+            downsampled_reader.range_count_map());
+}
+
+TEST_F(SampleReaderTest, ReadLBRFiltered) {
+  const std::string profile = FLAGS_test_srcdir + kTestDataDir + "test.lbr";
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(profile,
+                                                          "test.binary", "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+
+  // No sample is taken on a CPU that does not exist.
+  devtools_crosstool_autofdo::PerfSampleFilter cpu_filter;
+  cpu_filter.set_cpus({100000});
+  devtools_crosstool_autofdo::PerfDataSampleReader cpu_reader(
+      profile, "test.binary", "");
+  cpu_reader.SetSampleFilter(cpu_filter);
+  ASSERT_TRUE(cpu_reader.ReadAndSetTotalCount());
+  EXPECT_EQ(cpu_reader.GetTotalCount(), 0);
+
+  // Keep the first samples of the profile, both when streaming or not.
+  devtools_crosstool_autofdo::PerfDataIndex index;
+  std::ifstream file(profile, std::ios::binary);
+  const std::string data((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+  ASSERT_TRUE(index.Build(data));
+  devtools_crosstool_autofdo::PerfSampleFilter time_filter;
+  time_filter.set_time_range(0, index.chunks().front().max_time);
+  uint64_t window_count[2];
+  for (bool stream : {false, true}) {
+    absl::SetFlag(&FLAGS_stream_perf_samples, stream);
+    devtools_crosstool_autofdo::PerfDataSampleReader time_reader(
+        profile, "test.binary", "");
+    time_reader.SetSampleFilter(time_filter);
+    bool time_read = time_reader.ReadAndSetTotalCount();
+    absl::SetFlag(&FLAGS_stream_perf_samples, false);
+    ASSERT_TRUE(time_read);
+    window_count[stream] = time_reader.GetTotalCount();
+  }
+  remove((profile + ".index").c_str());
+  EXPECT_GT(window_count[0], 0);
+  EXPECT_LT(window_count[0], reader.GetTotalCount());
+  EXPECT_EQ(window_count[1], window_count[0]);
+}
+
+TEST_F(SampleReaderTest, ReadMultipleFiles) {
+  const std::string profile = FLAGS_test_srcdir + kTestDataDir + "test.lbr";
+  devtools_crosstool_autofdo::PerfDataSampleReader reader(profile,
+                                                          "test.binary", "");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+
+  devtools_crosstool_autofdo::MultiFileSampleReader multi_reader(
+      {profile, profile, profile},
+      [](const std::string &profile_file) {
+        return new devtools_crosstool_autofdo::PerfDataSampleReader(
+            profile_file, "test.binary", "");
+      },
+      /*num_threads=*/2);
+  ASSERT_TRUE(multi_reader.ReadAndSetTotalCount());
+
+  EXPECT_EQ(multi_reader.GetSampleCountOrZero(0xfe0), 3 * 55);
+  EXPECT_EQ(multi_reader.range_count_map().size(),
+            reader.range_count_map().size());
+  EXPECT_EQ(multi_reader.GetTotalSampleCount(),
+            3 * reader.GetTotalSampleCount());
+  EXPECT_EQ(multi_reader.GetTotalCount(), 3 * reader.GetTotalCount());
+}
+
+TEST_F(SampleReaderTest, ReadMultipleFilesSkipsPartialFiles) {
+  const std::string good_file = FLAGS_test_tmpdir + "/multi_good.txt";
+  const std::string truncated_file = FLAGS_test_tmpdir + "/multi_truncated.txt";
+  devtools_crosstool_autofdo::TextSampleReaderWriter writer(good_file);
+  writer.IncRange(0x10, 0x20);
+  writer.IncAddress(0x10);
+  writer.IncBranch(0x20, 0x30);
+  ASSERT_TRUE(writer.Write(nullptr));
+  // The range is read before the missing address records fail the read.
+  {
+    std::ofstream truncated(truncated_file);
+    truncated << "1\n10-20:5\n";
+  }
+
+  // A single thread merges all the files into the same shard.
+  devtools_crosstool_autofdo::MultiFileSampleReader multi_reader(
+      {good_file, truncated_file, good_file},
+      [](const std::string &profile_file) {
+        return new devtools_crosstool_autofdo::TextSampleReaderWriter(
+            profile_file);
+      },
+      /*num_threads=*/1);
+  ASSERT_TRUE(multi_reader.ReadAndSetTotalCount());
+  remove(good_file.c_str());
+  remove(truncated_file.c_str());
+
+  devtools_crosstool_autofdo::TextSampleReaderWriter expected;
+  expected.Merge(writer);
+  expected.Merge(writer);
+  expected.Freeze();
+  EXPECT_EQ(multi_reader.range_count_map(), expected.range_count_map());
+  EXPECT_EQ(multi_reader.address_count_map(), expected.address_count_map());
+  EXPECT_EQ(multi_reader.branch_count_map(), expected.branch_count_map());
+}
+
+TEST_F(SampleReaderTest, GetProfileNames) {
+  EXPECT_EQ(devtools_crosstool_autofdo::GetProfileNames("a.data;;b.data;"),
+            std::vector<std::string>({"a.data", "b.data"}));
+  EXPECT_TRUE(devtools_crosstool_autofdo::GetProfileNames("").empty());
+
+  const std::string list_file = FLAGS_test_tmpdir + "/profile_list.txt";
+  {
+    std::ofstream list(list_file);
+    list << "a.data\n# b.data\n\nc;d.data\n";
+  }
+  EXPECT_EQ(devtools_crosstool_autofdo::GetProfileNames("@" + list_file),
+            std::vector<std::string>({"a.data", "c;d.data"}));
+  remove(list_file.c_str());
+}
+
 TEST_F(SampleReaderTest, ReadText) {
   devtools_crosstool_autofdo::PerfDataSampleReader lbr_reader(
       FLAGS_test_srcdir + kTestDataDir + "test.lbr",
@@ -77,8 +383,8 @@ TEST_F(SampleReaderTest, ReadText) {
   devtools_crosstool_autofdo::TextSampleReaderWriter writer(
       FLAGS_test_tmpdir + "test.txt");
   writer.Merge(lbr_reader);
-  EXPECT_EQ(writer.GetSampleCountOrZero(0xfe0), 55);
   EXPECT_TRUE(writer.Write(nullptr));
+  EXPECT_EQ(writer.GetSampleCountOrZero(0xfe0), 55);
 
   devtools_crosstool_autofdo::TextSampleReaderWriter reader(
       FLAGS_test_tmpdir + "test.txt");
@@ -87,6 +393,109 @@ TEST_F(SampleReaderTest, ReadText) {
   EXPECT_EQ(reader.GetTotalCount(), 5383657);
 }
 
+TEST_F(SampleReaderTest, ReadBinary) {
+  devtools_crosstool_autofdo::PerfDataSampleReader lbr_reader(
+      FLAGS_test_srcdir + kTestDataDir + "test.lbr",
+      "test.binary", "");
+  ASSERT_TRUE(lbr_reader.ReadAndSetTotalCount());
+
+  devtools_crosstool_autofdo::BinarySampleReaderWriter writer(
+      FLAGS_test_tmpdir + "test.bin");
+  writer.Merge(lbr_reader);
+  EXPECT_TRUE(writer.Write(nullptr));
+
+  devtools_crosstool_autofdo::BinarySampleReaderWriter reader(
+      FLAGS_test_tmpdir + "test.bin");
+  ASSERT_TRUE(reader.ReadAndSetTotalCount());
+  EXPECT_EQ(reader.address_count_map(), lbr_reader.address_count_map());
+  EXPECT_EQ(reader.range_count_map(), lbr_reader.range_count_map());
+  EXPECT_EQ(reader.branch_count_map(), lbr_reader.branch_count_map());
+  EXPECT_EQ(reader.GetTotalCount(), 5383657);
+
+  // A text file is not a valid binary sample file.
+  devtools_crosstool_autofdo::TextSampleReaderWriter text_writer(
+      FLAGS_test_tmpdir + "test.txt");
+  text_writer.Merge(lbr_reader);
+  EXPECT_TRUE(text_writer.Write(nullptr));
+  devtools_crosstool_autofdo::BinarySampleReaderWriter text_reader(
+      FLAGS_test_tmpdir + "test.txt");
+  EXPECT_FALSE(text_reader.ReadAndSetTotalCount());
+
+  // A file claiming more records than it holds is rejected, without first
+  // reserving room for them.
+  const std::string corrupt_file = FLAGS_test_tmpdir + "/corrupt.bin";
+  {
+    std::ofstream corrupt(corrupt_file, std::ios::binary);
+    corrupt << std::string("AFDOSMP\0", 8)
+            << static_cast<char>(
+                   devtools_crosstool_autofdo::BinarySampleReaderWriter::
+                       kVersion)
+            << std::string(8, '\xff') << '\x7f' << std::string(16, '\x01');
+  }
+  devtools_crosstool_autofdo::BinarySampleReaderWriter corrupt_reader(
+      corrupt_file);
+  EXPECT_FALSE(corrupt_reader.ReadAndSetTotalCount());
+  remove(corrupt_file.c_str());
+}
+
+TEST_F(SampleReaderTest, MergeSampleFiles) {
+  devtools_crosstool_autofdo::PerfDataSampleReader lbr_reader(
+      FLAGS_test_srcdir + kTestDataDir + "test.lbr", "test.binary", "");
+  ASSERT_TRUE(lbr_reader.ReadAndSetTotalCount());
+  const std::string text_file = FLAGS_test_tmpdir + "/merge_input.txt";
+  const std::string binary_file = FLAGS_test_tmpdir + "/merge_input.bin";
+  devtools_crosstool_autofdo::TextSampleReaderWriter text_writer(text_file);
+  text_writer.Merge(lbr_reader);
+  text_writer.IncAddress(0x1);
+  ASSERT_TRUE(text_writer.Write(nullptr));
+  devtools_crosstool_autofdo::BinarySampleReaderWriter binary_writer(
+      binary_file);
+  devtools_crosstool_autofdo::TextSampleReaderWriter extra_samples;
+  extra_samples.IncRange(0x2, 0x3);
+  binary_writer.Merge(lbr_reader);
+  binary_writer.Merge(extra_samples);
+  ASSERT_TRUE(binary_writer.Write(nullptr));
+
+  // Three inputs merged two at a time need two rounds.
+  for (const std::string format : {"text", "binary"}) {
+    const std::string output_file =
+        absl::StrCat(FLAGS_test_tmpdir, "/merged.", format);
+    ASSERT_TRUE(devtools_crosstool_autofdo::MergeSampleFiles(
+        {text_file, binary_file, text_file}, output_file, format,
+        /*max_open_files=*/2));
+
+    devtools_crosstool_autofdo::TextSampleReaderWriter expected;
+    expected.Merge(text_writer);
+    expected.Merge(binary_writer);
+    expected.Merge(text_writer);
+    expected.Freeze();
+    std::unique_ptr<devtools_crosstool_autofdo::FileSampleReader> merged;
+    if (format == "text") {
+      merged = std::make_unique<
+          devtools_crosstool_autofdo::TextSampleReaderWriter>(output_file);
+    } else {
+      merged = std::make_unique<
+          devtools_crosstool_autofdo::BinarySampleReaderWriter>(output_file);
+    }
+    ASSERT_TRUE(merged->ReadAndSetTotalCount());
+    EXPECT_EQ(merged->address_count_map(), expected.address_count_map());
+    EXPECT_EQ(merged->range_count_map(), expected.range_count_map());
+    EXPECT_EQ(merged->branch_count_map(), expected.branch_count_map());
+    EXPECT_EQ(merged->GetSampleCountOrZero(0x1), 2);
+    remove(output_file.c_str());
+  }
+
+  // Unsorted text files are rejected.
+  FILE *fp = fopen(text_file.c_str(), "w");
+  fprintf(fp, "0\n2\n20:1\n10:1\n0\n");
+  fclose(fp);
+  EXPECT_FALSE(devtools_crosstool_autofdo::MergeSampleFiles(
+      {text_file}, FLAGS_test_tmpdir + "/merged.txt", "text",
+      /*max_open_files=*/2));
+  remove(text_file.c_str());
+  remove(binary_file.c_str());
+}
+
 TEST_F(SampleReaderTest, ReadLBRWithDupEntries) {
   devtools_crosstool_autofdo::PerfDataSampleReader reader(
       FLAGS_test_srcdir + kTestDataDir + "dup.lbr", "dup.binary",
@@ -2,11 +2,115 @@
 
 #include "source_info.h"
 
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "base/logging.h"
+#include "third_party/abseil/absl/container/flat_hash_map.h"
+#include "third_party/abseil/absl/synchronization/mutex.h"
+
 namespace devtools_crosstool_autofdo {
 
+namespace {
+// The interned names, by index and by value.
+//
+// The names are appended to chunks which never move, the chunk C holding
+// kFirstChunkSize << C names, so that the chunks of the 2^32 indices fit in
+// a fixed array. Intern adds the names under the mutex, then publishes the
+// new size. DirName and FileName only read the published names, without the
+// mutex: the acquire load of the size makes the names of the smaller
+// indices visible.
+class Pool {
+ public:
+  Pool() : size_(0) {
+    for (auto &chunk : chunks_) chunk = nullptr;
+    // kNoFile has the empty names.
+    absl::MutexLock lock(&mutex_);
+    Append(absl::string_view(), absl::string_view());
+  }
+
+  uint32_t Intern(absl::string_view dir_name, absl::string_view file_name) {
+    absl::MutexLock lock(&mutex_);
+    auto it = indices_.find(std::make_pair(dir_name, file_name));
+    if (it != indices_.end()) return it->second;
+    return Append(dir_name, file_name);
+  }
+
+  const std::pair<std::string, std::string> &Get(uint32_t index) const {
+    CHECK_LT(index, size_.load(std::memory_order_acquire));
+    const uint64_t position = static_cast<uint64_t>(index) + kFirstChunkSize;
+    const int chunk = Log2Floor(position) - kFirstChunkBits;
+    return chunks_[chunk][position - (kFirstChunkSize << chunk)];
+  }
+
+  uint32_t Size() const { return size_.load(std::memory_order_acquire); }
+
+ private:
+  static constexpr int kFirstChunkBits = 10;
+  static constexpr uint64_t kFirstChunkSize = 1 << kFirstChunkBits;
+  static constexpr int kNumChunks = 33 - kFirstChunkBits;
+
+  static int Log2Floor(uint64_t n) { return 63 - __builtin_clzll(n); }
+
+  uint32_t Append(absl::string_view dir_name, absl::string_view file_name)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    const uint32_t index = size_.load(std::memory_order_relaxed);
+    CHECK_LT(index, UINT32_MAX);
+    const uint64_t position = static_cast<uint64_t>(index) + kFirstChunkSize;
+    const int chunk = Log2Floor(position) - kFirstChunkBits;
+    if (chunks_[chunk] == nullptr) {
+      chunks_[chunk] =
+          new std::pair<std::string, std::string>[kFirstChunkSize << chunk];
+    }
+    auto &names = chunks_[chunk][position - (kFirstChunkSize << chunk)];
+    names.first = std::string(dir_name);
+    names.second = std::string(file_name);
+    indices_.emplace(std::make_pair(absl::string_view(names.first),
+                                    absl::string_view(names.second)),
+                     index);
+    size_.store(index + 1, std::memory_order_release);
+    return index;
+  }
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::pair<absl::string_view, absl::string_view>,
+                      uint32_t>
+      indices_ ABSL_GUARDED_BY(mutex_);
+  // Written under the mutex before the size which covers them is published.
+  std::pair<std::string, std::string> *chunks_[kNumChunks];
+  std::atomic<uint32_t> size_;
+};
+
+Pool &GetPool() {
+  static Pool *pool = new Pool();
+  return *pool;
+}
+}  // namespace
+
+uint32_t SourceFilePool::Intern(absl::string_view dir_name,
+                                absl::string_view file_name) {
+  if (file_name.empty()) return kNoFile;
+  return GetPool().Intern(dir_name, file_name);
+}
+
+absl::string_view SourceFilePool::DirName(uint32_t index) {
+  if (index == kNoFile) return absl::string_view();
+  return GetPool().Get(index).first;
+}
+
+absl::string_view SourceFilePool::FileName(uint32_t index) {
+  if (index == kNoFile) return absl::string_view();
+  return GetPool().Get(index).second;
+}
+
+uint32_t SourceFilePool::Size() { return GetPool().Size(); }
+
 #if defined(HAVE_LLVM)
 bool SourceInfo::use_fs_discriminator = false;
 bool SourceInfo::use_base_only_in_fs_discriminator = false;
+bool SourceInfo::use_pseudo_probe = false;
 #endif
 
 }  // namespace devtools_crosstool_autofdo
@@ -3,38 +3,81 @@
 #ifndef AUTOFDO_SOURCE_INFO_H_
 #define AUTOFDO_SOURCE_INFO_H_
 
+#include <string.h>
+
 #include <cstdint>
 #include <string>
 #include <vector>
 
 #include "base/integral_types.h"
 #include "base/macros.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 #if defined(HAVE_LLVM)
 #include "llvm/IR/DebugInfoMetadata.h"
 #endif
 
 namespace devtools_crosstool_autofdo {
 
+// Process-wide pool of the directory and file names of the source positions.
+// A SourceInfo only holds the 32-bit index of its names in the pool, so that
+// the many copies of an inline stack, one per instruction and per symbol, do
+// not copy the paths. Names are never removed, and are safe to intern and
+// read from several threads; reading them does not lock.
+class SourceFilePool {
+ public:
+  // Index of the empty directory and file names.
+  static constexpr uint32_t kNoFile = 0;
+
+  // Returns the index of DIR_NAME and FILE_NAME, adding them to the pool if
+  // they are not there yet. A position without a file name has no directory
+  // either, and gets kNoFile.
+  static uint32_t Intern(absl::string_view dir_name,
+                         absl::string_view file_name);
+
+  // Returns the names at INDEX, which live as long as the process.
+  static absl::string_view DirName(uint32_t index);
+  static absl::string_view FileName(uint32_t index);
+
+  // Returns the number of interned pairs of names.
+  static uint32_t Size();
+};
+
 // Represents the source position.
 struct SourceInfo {
-  SourceInfo() : func_name(nullptr), start_line(0), line(0), discriminator(0) {}
+  SourceInfo()
+      : func_name(nullptr),
+        file_index(SourceFilePool::kNoFile),
+        start_line(0),
+        line(0),
+        discriminator(0) {}
 
 #if defined(HAVE_LLVM)
   SourceInfo(const char *func_name, llvm::StringRef dir_name,
              llvm::StringRef file_name, uint32_t start_line, uint32_t line,
              uint32_t discriminator)
+      : func_name(func_name),
+        file_index(SourceFilePool::Intern(
+            absl::string_view(dir_name.data(), dir_name.size()),
+            absl::string_view(file_name.data(), file_name.size()))),
 #else
-  SourceInfo(const char *func_name, std::string dir_name, std::string file_name,
-             uint32_t start_line, uint32_t line, uint32_t discriminator)
-#endif
+  SourceInfo(const char *func_name, absl::string_view dir_name,
+             absl::string_view file_name, uint32_t start_line, uint32_t line,
+             uint32_t discriminator)
       : func_name(func_name),
-        dir_name(dir_name),
-        file_name(file_name),
+        file_index(SourceFilePool::Intern(dir_name, file_name)),
+#endif
         start_line(start_line),
         line(line),
         discriminator(discriminator) {
   }
 
+  absl::string_view dir_name() const {
+    return SourceFilePool::DirName(file_index);
+  }
+  absl::string_view file_name() const {
+    return SourceFilePool::FileName(file_index);
+  }
+
   uint64_t Offset(bool use_discriminator_encoding) const {
 #if defined(HAVE_LLVM)
     bool use_base_discriminator;
@@ -63,7 +106,21 @@ struct SourceInfo {
 #endif
   }
 
+  bool operator==(const SourceInfo &other) const {
+    return line == other.line && discriminator == other.discriminator &&
+           start_line == other.start_line &&
+           (func_name == other.func_name ||
+            (func_name != nullptr && other.func_name != nullptr &&
+             strcmp(func_name, other.func_name) == 0)) &&
+           file_index == other.file_index;
+  }
+  bool operator!=(const SourceInfo &other) const { return !(*this == other); }
+
   bool HasInvalidInfo() const {
+#if defined(HAVE_LLVM)
+    // A pseudo probe is identified by its index alone.
+    if (use_pseudo_probe) return line == 0;
+#endif
     if (start_line == 0 || line == 0) return true;
     return false;
   }
@@ -95,11 +152,16 @@ struct SourceInfo {
   static bool use_fs_discriminator;
   // If we want to use the base discriminator only in fsprofile.
   static bool use_base_only_in_fs_discriminator;
+  // If the positions are pseudo probes rather than lines: the line is the
+  // index of the probe in its function, and the start line is 0.
+  static bool use_pseudo_probe;
 #endif
 
+  // Not interned: it points to the names which the symbolizer or the symbol
+  // map own for their lifetime, so the copies of a position already share it.
   const char *func_name;
-  std::string dir_name;
-  std::string file_name;
+  // Index of the directory and file names in the SourceFilePool.
+  uint32_t file_index;
   uint32_t start_line;
   uint32_t line;
   uint32_t discriminator;
@@ -0,0 +1,84 @@
+// Bounded lock-free queue between two threads.
+
+#ifndef AUTOFDO_SPSC_QUEUE_H_
+#define AUTOFDO_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "third_party/abseil/absl/numeric/bits.h"
+
+namespace devtools_crosstool_autofdo {
+
+// A ring buffer of values passed from a single producer thread to a single
+// consumer thread. Each index is only written by one side, so pushing and
+// popping take no lock; a full or empty queue makes the caller spin and then
+// yield, which throttles the faster side.
+template <typename T>
+class SpscQueue {
+ public:
+  // Creates a queue holding at least CAPACITY values.
+  explicit SpscQueue(size_t capacity)
+      : slots_(absl::bit_ceil(capacity < 2 ? 2 : capacity)),
+        mask_(slots_.size() - 1) {}
+
+  // Appends VALUE, or returns false if the queue is full. Only called by the
+  // producer.
+  bool TryPush(T &&value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+      return false;
+    }
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Removes the first value into VALUE, or returns false if the queue is
+  // empty. Only called by the consumer.
+  bool TryPop(T *value) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (tail_.load(std::memory_order_acquire) == head) {
+      return false;
+    }
+    *value = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Blocking versions of TryPush and TryPop.
+  void Push(T value) {
+    for (int spins = 0; !TryPush(std::move(value)); ++spins) Wait(spins);
+  }
+  T Pop() {
+    T value;
+    for (int spins = 0; !TryPop(&value); ++spins) Wait(spins);
+    return value;
+  }
+
+  size_t capacity() const { return slots_.size(); }
+
+ private:
+  static void Wait(int spins) {
+    if (spins >= kSpinsBeforeYield) std::this_thread::yield();
+  }
+
+  static constexpr int kSpinsBeforeYield = 64;
+
+  std::vector<T> slots_;
+  const size_t mask_;
+  // Index of the next value to pop, written by the consumer.
+  alignas(64) std::atomic<size_t> head_{0};
+  // Index of the next value to push, written by the producer.
+  alignas(64) std::atomic<size_t> tail_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SpscQueue);
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_SPSC_QUEUE_H_
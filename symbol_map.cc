@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <set>
@@ -18,9 +19,9 @@
 #include "third_party/abseil/absl/container/node_hash_map.h"
 #include "third_party/abseil/absl/debugging/internal/demangle.h"
 #include "third_party/abseil/absl/flags/flag.h"
-#include "third_party/abseil/absl/memory/memory.h"
 #include "third_party/abseil/absl/strings/match.h"
 #include "third_party/abseil/absl/strings/str_format.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 #include <regex>
 #include "util/symbolize/elf_reader.h"
 
@@ -79,10 +80,12 @@ void PrintSourceLocation(uint32_t start_line, uint64_t offset, int ident) {
 
 static const char *selectedSuffixes[] = {".cold", ".llvm.", ".lto_priv.", ".part.", ".isra."};
 
-std::string getPrintName(const char *name) {
+std::string getPrintName(absl::string_view name) {
   char tmp_buf[1024];
-  if (!absl::GetFlag(FLAGS_demangle_symbol_names)) return name;
-  if (!absl::debugging_internal::Demangle(name, tmp_buf, sizeof(tmp_buf))) {
+  // The names of the symbol maps are null-terminated.
+  if (!absl::GetFlag(FLAGS_demangle_symbol_names)) return std::string(name);
+  if (!absl::debugging_internal::Demangle(name.data(), tmp_buf,
+                                          sizeof(tmp_buf))) {
     LOG(WARNING) << "Demangle failed: " << std::string(name);
     return "";
   }
@@ -123,18 +126,11 @@ bool SymbolMap::IsLLVMCompiler(const std::string &path) {
   return absl::StrContains(path, "-llvm-");
 }
 
-Symbol::~Symbol() {
-  for (auto &callsite_symbol : callsites) {
-    delete callsite_symbol.second;
-  }
-}
-
 void Symbol::Merge(const Symbol *other) {
   total_count += other->total_count;
   head_count += other->head_count;
-  if (info.file_name.empty()) {
-      info.file_name = other->info.file_name;
-      info.dir_name = other->info.dir_name;
+  if (info.file_index == SourceFilePool::kNoFile) {
+      info.file_index = other->info.file_index;
   }
   for (const auto &pos_count : other->pos_counts)
     pos_counts[pos_count.first] += pos_count.second;
@@ -145,7 +141,7 @@ void Symbol::Merge(const Symbol *other) {
     // If the callsite does not exist in the current symbol, create a
     // new callee symbol with the clone's function name.
     if (ret.second) {
-      ret.first->second = new Symbol();
+      ret.first->second = arena()->New<Symbol>(arena());
       ret.first->second->info.func_name = ret.first->first.second;
     }
     ret.first->second->Merge(callsite_symbol.second);
@@ -318,12 +314,35 @@ std::string SymbolMap::GetOriginalName(const char *name) const {
   }
 }
 
+std::pair<NameSymbolMap::iterator, bool> SymbolMap::InsertName(
+    absl::string_view name) {
+  auto iter = map_.find(name);
+  if (iter != map_.end()) {
+    return std::make_pair(iter, false);
+  }
+  char *interned = static_cast<char *>(arena_.Allocate(name.size() + 1, 1));
+  memcpy(interned, name.data(), name.size());
+  interned[name.size()] = '\0';
+  return map_.emplace(absl::string_view(interned, name.size()), nullptr);
+}
+
+NameSymbolVector SymbolMap::GetSortedSymbols() const {
+  NameSymbolVector symbols(map_.begin(), map_.end());
+  std::sort(symbols.begin(), symbols.end(),
+            [](const NameSymbolVector::value_type &a,
+               const NameSymbolVector::value_type &b) {
+              return a.first < b.first;
+            });
+  return symbols;
+}
+
 void SymbolMap::ElideSuffixesAndMerge() {
+  // The symbols are merged in the order of their names, so that the merged
+  // profile does not depend on the order of map_.
   std::vector<std::string> suffix_elide_set;
-  for (auto &name_symbol : map_) {
-    std::string orig_name = GetOriginalName(name_symbol.first.c_str());
-    if (orig_name != name_symbol.first)
-      suffix_elide_set.push_back(name_symbol.first.c_str());
+  for (const auto &[name, symbol] : GetSortedSymbols()) {
+    if (GetOriginalName(name.data()) != name)
+      suffix_elide_set.push_back(std::string(name));
   }
   for (const auto &name : suffix_elide_set) {
     std::string orig_name = GetOriginalName(name.c_str());
@@ -332,12 +351,11 @@ void SymbolMap::ElideSuffixesAndMerge() {
     Symbol *sym = iter->second;
     map_.erase(iter);
 
-    std::pair<NameSymbolMap::iterator, bool> ret =
-        map_.insert(NameSymbolMap::value_type(orig_name, nullptr));
+    std::pair<NameSymbolMap::iterator, bool> ret = InsertName(orig_name);
     if (ret.second || sym == ret.first->second) {
-      unique_symbols_.push_back(
-          std::make_unique<Symbol>(ret.first->first.c_str(), "", "", 0));
-      ret.first->second = unique_symbols_.back().get();
+      ret.first->second =
+          arena_.New<Symbol>(&arena_, ret.first->first.data(), "", "", 0);
+      symbols_.push_back(ret.first->second);
     }
 
     ret.first->second->Merge(sym);
@@ -348,31 +366,22 @@ void SymbolMap::ElideSuffixesAndMerge() {
   }
 }
 
-void SymbolMap::AddSymbol(const std::string &name) {
-  std::pair<NameSymbolMap::iterator, bool> ret = map_.insert(
-      NameSymbolMap::value_type(name, nullptr));
-  if (ret.second) {
-    unique_symbols_.push_back(
-        std::make_unique<Symbol>(ret.first->first.c_str(), "", "", 0));
-    ret.first->second = unique_symbols_.back().get();
-    NameAliasMap::const_iterator alias_iter = name_alias_map_.find(name);
-    if (alias_iter != name_alias_map_.end()) {
-      for (const auto &name : alias_iter->second) {
-        map_[name] = ret.first->second;
-      }
-    }
+Symbol *SymbolMap::AddSymbol(const std::string &name) {
+  std::pair<NameSymbolMap::iterator, bool> ret = InsertName(name);
+  if (!ret.second) {
+    return ret.first->second;
   }
-}
-
-void SymbolMap::AddSymbolMappings(const NameSymbolMap &new_map) {
-  absl::flat_hash_set<Symbol *> new_symbols;
-  for (const auto &name_symbol : new_map) {
-    auto ret = new_symbols.insert(name_symbol.second);
-    if (ret.second) {
-      unique_symbols_.push_back(absl::WrapUnique(name_symbol.second));
+  Symbol *symbol =
+      arena_.New<Symbol>(&arena_, ret.first->first.data(), "", "", 0);
+  ret.first->second = symbol;
+  symbols_.push_back(symbol);
+  NameAliasMap::const_iterator alias_iter = name_alias_map_.find(name);
+  if (alias_iter != name_alias_map_.end()) {
+    for (const auto &name : alias_iter->second) {
+      InsertName(name).first->second = symbol;
     }
-    map_[name_symbol.first] = name_symbol.second;
   }
+  return symbol;
 }
 
 void SymbolMap::CalculateThresholdFromTotalCount(int64_t total_count) {
@@ -467,6 +476,7 @@ void SymbolMap::BuildSymbolMap() {
 #if defined(HAVE_LLVM)
   SourceInfo::use_fs_discriminator = false;
   SourceInfo::use_base_only_in_fs_discriminator = false;
+  SourceInfo::use_pseudo_probe = false;
 #endif
   SymbolReader symbol_reader(&name_alias_map_, &address_symbol_map_);
   symbol_reader.filter = [](const char *name, uint64 address, uint64 size,
@@ -482,28 +492,49 @@ void SymbolMap::BuildSymbolMap() {
     SourceInfo::use_fs_discriminator = true;
   if (absl::GetFlag(FLAGS_use_base_only_in_fs_discriminator))
     SourceInfo::use_base_only_in_fs_discriminator = true;
+  // A binary with pseudo probes is profiled by probe, its discriminators
+  // encode the probes rather than the lines.
+  ElfReader::SectionInfo probe_section;
+  if (elf_reader.GetSectionInfoByName(".pseudo_probe", &probe_section) !=
+      nullptr)
+    SourceInfo::use_pseudo_probe = true;
 #endif
 }
 
-void SymbolMap::AddSymbolEntryCount(const std::string &symbol_name,
+uint64_t SymbolMap::GetFunctionHash(const std::string &name) const {
+  auto iter = function_hashes_.find(name);
+  return iter == function_hashes_.end() ? 0 : iter->second;
+}
+
+void SymbolMap::AddSymbolEntryCount(absl::string_view symbol_name,
                                     uint64_t head_count, uint64_t total_count) {
-  Symbol *symbol = map_.find(symbol_name)->second;
+  AddSymbolEntryCount(map_.find(symbol_name)->second, head_count, total_count);
+}
+
+void SymbolMap::AddSymbolEntryCount(Symbol *symbol, uint64_t head_count,
+                                    uint64_t total_count) {
   symbol->head_count += head_count;
   symbol->total_count += total_count;
 }
 
-Symbol *SymbolMap::TraverseInlineStack(const std::string &symbol_name,
+Symbol *SymbolMap::TraverseInlineStack(absl::string_view symbol_name,
                                        const SourceStack &src, uint64_t count,
                                        DataSource data_source) {
   if (src.empty()) return nullptr;
+  return TraverseInlineStack(map_.find(symbol_name)->second, src, count,
+                             data_source);
+}
+
+Symbol *SymbolMap::TraverseInlineStack(Symbol *symbol, const SourceStack &src,
+                                       uint64_t count,
+                                       DataSource data_source) {
+  if (src.empty()) return nullptr;
   bool use_discriminator_encoding =
       absl::GetFlag(FLAGS_use_discriminator_encoding);
-  Symbol *symbol = map_.find(symbol_name)->second;
   symbol->total_count += count;
   const SourceInfo &info = src[src.size() - 1];
-  if (symbol->info.file_name.empty() && !info.file_name.empty()) {
-    symbol->info.file_name = info.file_name;
-    symbol->info.dir_name = info.dir_name;
+  if (symbol->info.file_index == SourceFilePool::kNoFile) {
+    symbol->info.file_index = info.file_index;
   }
   for (int i = src.size() - 1; i > 0; i--) {
     if ((data_source == PERFDATA || data_source == AFDOPROTO) &&
@@ -515,10 +546,9 @@ Symbol *SymbolMap::TraverseInlineStack(const std::string &symbol_name,
                      src[i - 1].func_name),
             nullptr));
     if (ret.second) {
-      ret.first->second = new Symbol(src[i - 1].func_name,
-                                     src[i - 1].dir_name,
-                                     src[i - 1].file_name,
-                                     src[i - 1].start_line);
+      ret.first->second = arena_.New<Symbol>(&arena_, src[i - 1].func_name,
+                                             src[i - 1].file_index,
+                                             src[i - 1].start_line);
     }
     symbol = ret.first->second;
     symbol->total_count += count;
@@ -526,16 +556,24 @@ Symbol *SymbolMap::TraverseInlineStack(const std::string &symbol_name,
   return symbol;
 }
 
-void SymbolMap::AddSourceCount(const std::string &symbol_name,
+void SymbolMap::AddSourceCount(absl::string_view symbol_name,
                                const SourceStack &src, uint64_t count,
                                uint64_t num_inst, uint32_t duplication,
                                DataSource data_source) {
+  if (src.empty()) return;
+  AddSourceCount(map_.find(symbol_name)->second, src, count, num_inst,
+                 duplication, data_source);
+}
+
+void SymbolMap::AddSourceCount(Symbol *top_symbol, const SourceStack &src,
+                               uint64_t count, uint64_t num_inst,
+                               uint32_t duplication, DataSource data_source) {
   bool use_discriminator_encoding =
       absl::GetFlag(FLAGS_use_discriminator_encoding);
   if (duplication != 1 &&
       absl::GetFlag(FLAGS_use_discriminator_multiply_factor))
     count *= duplication;
-  Symbol *symbol = TraverseInlineStack(symbol_name, src, count, data_source);
+  Symbol *symbol = TraverseInlineStack(top_symbol, src, count, data_source);
   if (!symbol) return;
   bool need_conversion = (data_source == PERFDATA || data_source == AFDOPROTO);
   if (need_conversion && src[0].HasInvalidInfo()) return;
@@ -553,13 +591,22 @@ void SymbolMap::AddSourceCount(const std::string &symbol_name,
   symbol->pos_counts[offset].num_inst += num_inst;
 }
 
-bool SymbolMap::AddIndirectCallTarget(const std::string &symbol_name,
+bool SymbolMap::AddIndirectCallTarget(absl::string_view symbol_name,
+                                      const SourceStack &src,
+                                      const std::string &target, uint64_t count,
+                                      DataSource data_source) {
+  if (src.empty()) return false;
+  return AddIndirectCallTarget(map_.find(symbol_name)->second, src, target,
+                               count, data_source);
+}
+
+bool SymbolMap::AddIndirectCallTarget(Symbol *top_symbol,
                                       const SourceStack &src,
                                       const std::string &target, uint64_t count,
                                       DataSource data_source) {
   bool use_discriminator_encoding =
       absl::GetFlag(FLAGS_use_discriminator_encoding);
-  Symbol *symbol = TraverseInlineStack(symbol_name, src, 0, data_source);
+  Symbol *symbol = TraverseInlineStack(top_symbol, src, 0, data_source);
   if (!symbol) return false;
   if ((data_source == PERFDATA || data_source == AFDOPROTO) &&
       src[0].HasInvalidInfo())
@@ -935,7 +982,7 @@ void SymbolMap::ComputeTotalCountIncl() {
 }
 
 void SymbolMap::Dump(bool dump_for_analysis) const {
-  std::map<uint64_t, std::set<std::string> > count_names_map;
+  std::map<uint64_t, std::set<absl::string_view> > count_names_map;
   for (const auto &name_symbol : map_) {
     if (name_symbol.second->total_count > 0) {
       count_names_map[~name_symbol.second->total_count].insert(
@@ -954,7 +1001,7 @@ void SymbolMap::Dump(bool dump_for_analysis) const {
 }
 
 float SymbolMap::Overlap(const SymbolMap &map) const {
-  std::map<std::string, std::pair<uint64_t, uint64_t> > overlap_map;
+  std::map<absl::string_view, std::pair<uint64_t, uint64_t> > overlap_map;
 
   // Prepare for overlap_map
   uint64_t total_1 = 0;
@@ -999,7 +1046,7 @@ void SymbolMap::DumpFuncLevelProfileCompare(const SymbolMap &map) const {
   }
 
   // Sort map_1
-  std::map<uint64_t, std::vector<std::string> > count_names_map;
+  std::map<uint64_t, std::vector<absl::string_view> > count_names_map;
   for (const auto &name_symbol : map_) {
     if (name_symbol.second->total_count > 0) {
       count_names_map[name_symbol.second->total_count].push_back(
@@ -1024,7 +1071,7 @@ void SymbolMap::DumpFuncLevelProfileCompare(const SymbolMap &map) const {
       printf("%3.4f%% %3.4f%% %s\n",
              100 * static_cast<double>(symbol->total_count) / max_1,
              100 * static_cast<double>(compare_count) / max_2,
-             getPrintName(name.c_str()).c_str());
+             getPrintName(name).c_str());
     }
   }
 
@@ -1058,7 +1105,7 @@ void SymbolMap::DumpFuncLevelProfileCompare(const SymbolMap &map) const {
       printf("%3.4f%% %3.4f%% %s\n",
              100 * static_cast<double>(compare_count) / max_1,
              100 * static_cast<double>(symbol->total_count) / max_2,
-             getPrintName(name.c_str()).c_str());
+             getPrintName(name).c_str());
     }
   }
 }
@@ -1086,11 +1133,11 @@ void SymbolMap::ComputeWorkingSets() {
   uint64_t total_count = 0;
 
   // Step 1. Compute histogram.
-  for (const auto &symbol : unique_symbols_) {
+  for (const Symbol *symbol : symbols_) {
     if (symbol->total_count == 0) {
       continue;
     }
-    total_count += AddSymbolProfileToHistogram(symbol.get(), &histogram);
+    total_count += AddSymbolProfileToHistogram(symbol, &histogram);
   }
   int bucket_num = 0;
   uint64_t accumulated_count = 0;
@@ -1179,12 +1226,12 @@ bool SymbolMap::Validate() const {
   bool has_call = false;
   bool has_discriminator = false;
   std::vector<const Symbol *> symbols;
-  for (const auto &s : unique_symbols_) {
+  for (const Symbol *s : symbols_) {
     if (s->total_count == 0) {
       continue;
     }
     total_count += s->total_count;
-    symbols.push_back(s.get());
+    symbols.push_back(s);
     if (!s->callsites.empty()) {
       has_inline_stack = true;
     }
@@ -1264,9 +1311,8 @@ void Symbol::PopulateSymbolRetainingHotInlineStacks(Symbol &other,
                                                     uint64_t &num_flattened) {
   total_count += other.total_count;
   head_count += other.head_count;
-  if (info.file_name.empty()) {
-    info.file_name = other.info.file_name;
-    info.dir_name = other.info.dir_name;
+  if (info.file_index == SourceFilePool::kNoFile) {
+    info.file_index = other.info.file_index;
   }
   for (const auto &callsite_symbol : other.callsites) {
     ++total;
@@ -1289,7 +1335,7 @@ void Symbol::PopulateSymbolRetainingHotInlineStacks(Symbol &other,
       // If the callsite does not exist in the current symbol, create a new
       // callee symbol with the clone's function name.
       if (ret.second) {
-        ret.first->second = new Symbol();
+        ret.first->second = arena()->New<Symbol>(arena());
         ret.first->second->info.func_name = ret.first->first.second;
       }
       // This can be a direct call since there is a symbol for this callsite in
@@ -1380,11 +1426,10 @@ bool SymbolMap::EnsureEntryInFuncForSymbol(const std::string &func_name,
 
 // Removes a symbol by setting total and head count to zero.
 void SymbolMap::RemoveSymbol(const std::string &name) {
-  for (const auto &name_symbol : map()) {
-    if (name == name_symbol.first) {
-      name_symbol.second->total_count = 0;
-      name_symbol.second->head_count = 0;
-    }
+  auto iter = map_.find(name);
+  if (iter != map_.end()) {
+    iter->second->total_count = 0;
+    iter->second->head_count = 0;
   }
 }
 
@@ -1392,8 +1437,10 @@ void SymbolMap::RemoveSymbol(const std::string &name) {
 // "regex_str" by setting their total and head counts to zero. Those
 // symbols with zero counts will be removed when profile is written out.
 void SymbolMap::RemoveSymsMatchingRegex(const std::string &regex) {
+  const std::regex re(regex);
   for (const auto &name_symbol : map()) {
-    if (std::regex_match(name_symbol.first, std::regex(regex))) {
+    if (std::regex_match(name_symbol.first.begin(), name_symbol.first.end(),
+                         re)) {
       name_symbol.second->total_count = 0;
       name_symbol.second->head_count = 0;
     }
@@ -1421,7 +1468,8 @@ llvm::StringSet<> SymbolMap::collectNamesInProfile() {
       // Multiple entries in map_ may share the same Symbol object
       // because of alias. Save the alias name of each entry into
       // names set.
-      names.insert(name_symbol.first);
+      names.insert(
+          llvm::StringRef(name_symbol.first.data(), name_symbol.first.size()));
     }
   }
 
@@ -1504,9 +1552,9 @@ void SymbolMap::throttleInlineInstancesAtSameLocation() {
       }
     }
 
-    // Remove those to_removed_callsites from symbol->callsites.
+    // Remove those to_removed_callsites from symbol->callsites. Their
+    // symbols are released with the arena.
     for (const auto &callsite_sym : to_removed_callsites) {
-      delete callsite_sym.second;
       symbol->callsites.erase(callsite_sym.first);
     }
 
@@ -16,11 +16,13 @@
 #include "base/logging.h"
 #include "base/macros.h"
 #include "addr2line.h"
+#include "arena.h"
 #include "source_info.h"
 #include "third_party/abseil/absl/container/flat_hash_map.h"
 #include "third_party/abseil/absl/container/flat_hash_set.h"
 #include "third_party/abseil/absl/container/node_hash_map.h"
 #include "third_party/abseil/absl/flags/declare.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 
 #if defined(HAVE_LLVM)
 #include "llvm/ADT/StringSet.h"
@@ -88,7 +90,9 @@ class ProfileInfo {
 typedef std::map<const SourceStack, ProfileInfo> SourceStackCountMap;
 
 // Map from a source location (represented by offset+discriminator) to profile.
-typedef std::map<uint64_t, ProfileInfo> PositionCountMap;
+typedef std::map<uint64_t, ProfileInfo, std::less<uint64_t>,
+                 ArenaAllocator<std::pair<const uint64_t, ProfileInfo>>>
+    PositionCountMap;
 
 // callsite_location, callee_name
 typedef std::pair<uint64_t, const char *> Callsite;
@@ -110,11 +114,16 @@ struct CallsiteEqual {
 class Symbol;
 class SymbolMap;
 // Map from a callsite to the callee symbol.
-typedef absl::node_hash_map<Callsite, Symbol *, CallsiteHash, CallsiteEqual>
+typedef absl::node_hash_map<Callsite, Symbol *, CallsiteHash, CallsiteEqual,
+                            ArenaAllocator<std::pair<const Callsite, Symbol *>>>
     CallsiteMap;
 // Maps function names to symbols. Symbols are not owned and multiple names can
-// map to the same symbol.
-typedef std::map<std::string, Symbol *> NameSymbolMap;
+// map to the same symbol. The names are interned, null-terminated, in the
+// arena of the SymbolMap. The map is unordered, see
+// SymbolMap::GetSortedSymbols() for a deterministic order.
+typedef absl::flat_hash_map<absl::string_view, Symbol *> NameSymbolMap;
+// Function names and their symbols, sorted by name.
+typedef std::vector<std::pair<absl::string_view, Symbol *>> NameSymbolVector;
 
 struct SCCNode;
 class CallGraph;
@@ -126,42 +135,65 @@ class CallGraph;
 // 2. Inlined symbol: the symbol is cloned in another function. It does not
 //                    have the begin_address and end_address, and its name
 //                    could be a short bfd_name.
+//
+// The symbols are allocated in the Arena of their SymbolMap, which owns them.
+// The callsites and the positions of a symbol, as well as its callee symbols,
+// are allocated in the same arena.
 class Symbol {
  public:
   // This constructor is used to create inlined symbol.
 #if defined(HAVE_LLVM)
-  Symbol(const char *name, llvm::StringRef dir, llvm::StringRef file,
-         uint32_t start)
+  Symbol(Arena *arena, const char *name, llvm::StringRef dir,
+         llvm::StringRef file, uint32_t start)
 #else
-  Symbol(const char *name, std::string dir, std::string file, uint32_t start)
+  Symbol(Arena *arena, const char *name, std::string dir, std::string file,
+         uint32_t start)
 #endif
       : info(SourceInfo(name, dir, file, start, 0, 0)),
         total_count(0),
         total_count_incl(0),
         head_count(0),
-        callsites(0),
-        pos_counts() {
+        callsites(0, CallsiteHash(), CallsiteEqual(),
+                  CallsiteMap::allocator_type(arena)),
+        pos_counts(PositionCountMap::allocator_type(arena)) {
+  }
+
+  // This constructor is used to create inlined symbol whose file names are
+  // already in the SourceFilePool at FILE_INDEX.
+  Symbol(Arena *arena, const char *name, uint32_t file_index, uint32_t start)
+      : total_count(0),
+        total_count_incl(0),
+        head_count(0),
+        callsites(0, CallsiteHash(), CallsiteEqual(),
+                  CallsiteMap::allocator_type(arena)),
+        pos_counts(PositionCountMap::allocator_type(arena)) {
+    info.func_name = name;
+    info.file_index = file_index;
+    info.start_line = start;
   }
 
   // This constructor is used to create aliased symbol.
-  Symbol(const Symbol *src, const char *new_func_name)
+  Symbol(Arena *arena, const Symbol *src, const char *new_func_name)
       : info(src->info),
         total_count(src->total_count),
         total_count_incl(src->total_count_incl),
         head_count(src->head_count),
-        callsites(0),
-        pos_counts() {
+        callsites(0, CallsiteHash(), CallsiteEqual(),
+                  CallsiteMap::allocator_type(arena)),
+        pos_counts(PositionCountMap::allocator_type(arena)) {
     info.func_name = new_func_name;
   }
 
-  Symbol()
+  explicit Symbol(Arena *arena)
       : total_count(0),
         total_count_incl(0),
         head_count(0),
-        callsites(0),
-        pos_counts() {}
+        callsites(0, CallsiteHash(), CallsiteEqual(),
+                  CallsiteMap::allocator_type(arena)),
+        pos_counts(PositionCountMap::allocator_type(arena)) {}
 
-  ~Symbol();
+  // Returns the arena the symbol is allocated in.
+  Arena *arena() const { return callsites.get_allocator().arena(); }
 
   static std::string Name(const char *name) {
     return (name && strlen(name) > 0) ? name : "noname";
@@ -222,8 +254,6 @@ class Symbol {
   PositionCountMap pos_counts;
 };
 
-// Vector of unique pointers to symbols.
-typedef std::vector<std::unique_ptr<Symbol>> SymbolUniquePtrVector;
 // Maps symbol's start address to its name and size.
 typedef std::map<uint64_t, std::pair<std::string, uint64_t>> AddressSymbolMap;
 // Maps from symbol's name to its start address.
@@ -298,8 +328,17 @@ class SymbolMap {
 
   Addr2line *get_addr2line() const { return addr2line_.get(); }
 
-  // Adds an empty named symbol.
-  void AddSymbol(const std::string &name);
+  // Sets the CFG checksum of the function NAME, which the compiler checks
+  // against a pseudo-probe based profile.
+  void SetFunctionHash(const std::string &name, uint64_t hash) {
+    function_hashes_[name] = hash;
+  }
+
+  // Returns the CFG checksum of the function NAME, or 0 if it has none.
+  uint64_t GetFunctionHash(const std::string &name) const;
+
+  // Adds an empty named symbol, and returns the symbol of NAME.
+  Symbol *AddSymbol(const std::string &name);
 
   // Removes a symbol by setting total and head count to zero.
   void RemoveSymbol(const std::string &name);
@@ -309,17 +348,20 @@ class SymbolMap {
   // symbols with zero counts will be removed when profile is written out.
   void RemoveSymsMatchingRegex(const std::string &regex_str);
 
-  // Adds the given symbols and their mappings to the symbol map. SymbolMap
-  // takes ownership of the symbols in new_map. Existing mappings in SymbolMap
-  // that overlap with entries in new_map, will be updated to the new symbols.
-  void AddSymbolMappings(const NameSymbolMap &new_map);
-
   const NameSymbolMap &map() const {
     return map_;
   }
 
+  // Returns the entries of map(), sorted by name, for the passes whose output
+  // depends on the order of the symbols.
+  NameSymbolVector GetSortedSymbols() const;
+
   const NameAddressMap &GetNameAddrMap() const { return name_addr_map_; }
 
+  // The arena of the symbols, whose statistics tell how much memory the
+  // profile takes.
+  const Arena &arena() const { return arena_; }
+
   const gcov_working_set_info *GetWorkingSets() const {
     return working_set_;
   }
@@ -337,7 +379,7 @@ class SymbolMap {
     working_set_[i].min_counter += min_counter;
   }
 
-  const Symbol *GetSymbolByName(const std::string &name) const {
+  const Symbol *GetSymbolByName(absl::string_view name) const {
     NameSymbolMap::const_iterator ret = map_.find(name);
     if (ret != map_.end()) {
       return ret->second;
@@ -346,6 +388,14 @@ class SymbolMap {
     }
   }
 
+  // Returns the symbol of NAME, or nullptr if there is none. The symbol can
+  // be given instead of its name to the methods below which update the
+  // profile, so that the name is looked up once for many samples.
+  Symbol *GetMutableSymbolByName(absl::string_view name) {
+    NameSymbolMap::const_iterator ret = map_.find(name);
+    return ret != map_.end() ? ret->second : nullptr;
+  }
+
   // Trims suffix from name, returning trimmed name (according to
   // current suffix elision policy).
   std::string GetOriginalName(const char *name) const;
@@ -357,7 +407,9 @@ class SymbolMap {
   void ElideSuffixesAndMerge();
 
   // Increments symbol's entry count.
-  void AddSymbolEntryCount(const std::string &symbol, uint64_t head_count,
+  void AddSymbolEntryCount(absl::string_view symbol, uint64_t head_count,
+                           uint64_t total_count = 0);
+  void AddSymbolEntryCount(Symbol *symbol, uint64_t head_count,
                            uint64_t total_count = 0);
 
   // DataSource represents what kind of data is used to generate afdo profile.
@@ -375,7 +427,11 @@ class SymbolMap {
   //   data_source: the type of data used to generate autofdo profile.
   //   Typically it is perf data, autofdo proto or some other autofdo
   //   profile.
-  void AddSourceCount(const std::string &symbol, const SourceStack &source,
+  void AddSourceCount(absl::string_view symbol, const SourceStack &source,
+                      uint64_t count, uint64_t num_inst,
+                      uint32_t duplication = 1,
+                      DataSource data_source = AFDOPROFILE);
+  void AddSourceCount(Symbol *symbol, const SourceStack &source,
                       uint64_t count, uint64_t num_inst,
                       uint32_t duplication = 1,
                       DataSource data_source = AFDOPROFILE);
@@ -416,7 +472,10 @@ class SymbolMap {
   //   Typically it is perf data, autofdo proto or some other autofdo
   //   profile.
   // Returns false if we failed to add the call target.
-  bool AddIndirectCallTarget(const std::string &symbol, const SourceStack &src,
+  bool AddIndirectCallTarget(absl::string_view symbol, const SourceStack &src,
+                             const std::string &target, uint64_t count,
+                             DataSource data_source = AFDOPROFILE);
+  bool AddIndirectCallTarget(Symbol *symbol, const SourceStack &src,
                              const std::string &target, uint64_t count,
                              DataSource data_source = AFDOPROFILE);
 
@@ -426,9 +485,12 @@ class SymbolMap {
   //   data_source: the type of data used to generate autofdo profile.
   //   Typically it is perf data, autofdo proto or some other autofdo
   //   profile.
-  Symbol *TraverseInlineStack(const std::string &symbol,
+  Symbol *TraverseInlineStack(absl::string_view symbol,
                               const SourceStack &source, uint64_t count,
                               DataSource data_source = AFDOPROFILE);
+  Symbol *TraverseInlineStack(Symbol *symbol, const SourceStack &source,
+                              uint64_t count,
+                              DataSource data_source = AFDOPROFILE);
 
   // Updates function name, start_addr, end_addr of a function that has a
   // given address. Returns false if no such symbol exists.
@@ -508,6 +570,10 @@ class SymbolMap {
   // Initialize suffix elision policy from flags.
   void initSuffixElisionPolicy();
 
+  // Returns the entry of NAME in map_, and whether it was inserted, with a
+  // null symbol and NAME interned in arena_.
+  std::pair<NameSymbolMap::iterator, bool> InsertName(absl::string_view name);
+
   // Reads from address_symbol_map_ and update name_addr_map_.
   void BuildNameAddressMap() {
     for (const auto &[addr, symbol] : address_symbol_map_) {
@@ -515,7 +581,10 @@ class SymbolMap {
     }
   }
 
-  SymbolUniquePtrVector unique_symbols_;  // Owns the symbols.
+  // Owns the symbols, and is destroyed last.
+  Arena arena_;
+  // The outline symbols, each once.
+  std::vector<Symbol *> symbols_;
   NameSymbolMap map_;
   NameAliasMap name_alias_map_;
   NameAddressMap name_addr_map_;
@@ -526,6 +595,8 @@ class SymbolMap {
   bool ignore_thresholds_;
   uint8_t suffix_elision_policy_;
   std::unique_ptr<Addr2line> addr2line_;
+  // The CFG checksums of the functions, by name.
+  absl::flat_hash_map<std::string, uint64_t> function_hashes_;
   /* working_set_[i] stores # of instructions that consumes
      i/NUM_GCOV_WORKING_SETS of total instruction counts.  */
   gcov_working_set_info working_set_[NUM_GCOV_WORKING_SETS];
@@ -6,6 +6,9 @@
 #include "symbol_map.h"
 
 #include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "base/logging.h"
 #include "llvm_profile_reader.h"
@@ -76,6 +79,35 @@ TEST(SymbolMapTest, SymbolMap) {
   EXPECT_FALSE(symbol_map.Validate());
 }
 
+TEST(SymbolMapTest, SortedSymbolsAndHandles) {
+  SymbolMap symbol_map;
+  std::string name = "foo";
+  devtools_crosstool_autofdo::Symbol *foo = symbol_map.AddSymbol(name);
+  // The map keeps its own copy of the name.
+  name = "xyz";
+  EXPECT_EQ(symbol_map.AddSymbol("foo"), foo);
+  EXPECT_STREQ(foo->info.func_name, "foo");
+  EXPECT_EQ(symbol_map.GetMutableSymbolByName("foo"), foo);
+  EXPECT_EQ(symbol_map.GetMutableSymbolByName("xyz"), nullptr);
+  symbol_map.AddSymbol("qux");
+  symbol_map.AddSymbol("bar");
+
+  std::vector<std::string> names;
+  for (const auto &[name, symbol] : symbol_map.GetSortedSymbols()) {
+    names.push_back(std::string(name));
+  }
+  EXPECT_THAT(names, testing::ElementsAre("bar", "foo", "qux"));
+
+  // The symbol of a name and the name update the same profile.
+  SourceStack stack = {{"foo", "", "", 0, 10, 0}};
+  symbol_map.AddSourceCount(foo, stack, 100, 1);
+  symbol_map.AddSourceCount("foo", stack, 50, 1);
+  symbol_map.AddSymbolEntryCount(foo, 10);
+  EXPECT_EQ(foo->total_count, 150);
+  EXPECT_EQ(foo->head_count, 10);
+  EXPECT_EQ(foo->pos_counts.at(stack[0].Offset(false)).count, 150);
+}
+
 TEST(SymbolMapTest, TestEntryCount) {
   SymbolMap symbol_map(
       FLAGS_test_srcdir + kTestDataDir + "test.binary");
@@ -169,7 +201,8 @@ TEST(SymbolMapTest, TestElideSuffixesAndMerge) {
 
   for (const auto &sym : symbol_map.map()) {
     if (symbol_map.ShouldEmit(sym.second->total_count))
-      EXPECT_PRED_FORMAT2(testing::IsNotSubstring, ".cold", sym.first);
+      EXPECT_PRED_FORMAT2(testing::IsNotSubstring, ".cold",
+                          std::string(sym.first));
   }
 }
 
@@ -396,6 +429,63 @@ TEST(SymbolMapTest, FSDiscriminatorUseBaseOnly) {
   EXPECT_TRUE(devtools_crosstool_autofdo::SourceInfo::
                   use_base_only_in_fs_discriminator);
 }
+
+TEST(SymbolMapTest, SourceInfoInternsFileNames) {
+  using devtools_crosstool_autofdo::SourceFilePool;
+  using devtools_crosstool_autofdo::SourceInfo;
+  const SourceInfo foo("foo", "/src", "foo.cc", 1, 2, 0);
+  const SourceInfo bar("bar", "/src", "foo.cc", 5, 6, 0);
+  const SourceInfo baz("baz", "/src", "baz.cc", 5, 6, 0);
+  const SourceInfo no_file("foo", "/src", "", 1, 2, 0);
+  // The same names share their index, and are only stored once.
+  EXPECT_EQ(foo.file_index, bar.file_index);
+  EXPECT_NE(foo.file_index, baz.file_index);
+  EXPECT_EQ(foo.dir_name(), "/src");
+  EXPECT_EQ(foo.file_name(), "foo.cc");
+  EXPECT_EQ(baz.file_name(), "baz.cc");
+  EXPECT_EQ(no_file.file_index, SourceFilePool::kNoFile);
+  EXPECT_TRUE(no_file.dir_name().empty());
+  EXPECT_TRUE(no_file.file_name().empty());
+  EXPECT_EQ(SourceInfo().file_index, SourceFilePool::kNoFile);
+  const uint32_t size = SourceFilePool::Size();
+  EXPECT_EQ(SourceInfo("qux", "/src", "baz.cc", 1, 1, 0).file_index,
+            baz.file_index);
+  EXPECT_EQ(SourceFilePool::Size(), size);
+}
+
+TEST(SymbolMapTest, SourceFilePoolReadsWhileInterning) {
+  using devtools_crosstool_autofdo::SourceFilePool;
+  // Enough names to fill several chunks of the pool. Each name is interned
+  // by two threads, while they read the names they interned before.
+  const int kNumNames = 5000;
+  const int kNumThreads = 4;
+  std::vector<std::vector<uint32_t>> indices(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([t, &indices]() {
+      for (int i = t; i < kNumNames; i += kNumThreads / 2) {
+        const std::string name = "pool" + std::to_string(i) + ".cc";
+        const uint32_t index = SourceFilePool::Intern("/pool", name);
+        indices[t].push_back(index);
+        for (uint32_t read : indices[t]) {
+          if (SourceFilePool::DirName(read) != "/pool") {
+            ADD_FAILURE() << "Wrong directory at " << read;
+            return;
+          }
+        }
+        if (SourceFilePool::FileName(index) != name) {
+          ADD_FAILURE() << "Wrong file name at " << index;
+          return;
+        }
+        if (indices[t].size() > 64) indices[t].erase(indices[t].begin());
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  EXPECT_EQ(SourceFilePool::Intern("/pool", "pool4999.cc"),
+            SourceFilePool::Intern("/pool", "pool4999.cc"));
+}
+
 TEST(SymbolMapTest, RemoveSymsMatchingRegex) {
   SymbolMap symbol_map;
   absl::node_hash_set<std::string> names;
@@ -0,0 +1,545 @@
+#include "symbolization_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "third_party/abseil/absl/container/flat_hash_map.h"
+#include "third_party/abseil/absl/strings/str_cat.h"
+#include "util/symbolize/elf_reader.h"
+
+namespace devtools_crosstool_autofdo {
+
+// The file starts with a FileHeader, followed by the tables, in this order:
+// FunctionRecord[num_functions], sorted by start address,
+// RangeRecord[num_ranges], the runs of each function in turn,
+// StackRecord[num_stacks],
+// uint32_t[num_stack_entries], the InfoRecord indices of the stacks,
+// InfoRecord[num_infos],
+// char[strings_size], the NUL terminated names.
+// All the fields are in the byte order of the host, and each table is
+// aligned for its records.
+struct SymbolizationCache::FunctionRecord {
+  uint64_t start_addr;
+  uint64_t end_addr;
+  uint64_t first_range;
+  uint64_t num_ranges;
+};
+
+struct SymbolizationCache::RangeRecord {
+  uint64_t start_addr;
+  uint64_t stack;
+};
+
+struct SymbolizationCache::StackRecord {
+  uint32_t first_entry;
+  uint32_t size;
+};
+
+struct SymbolizationCache::InfoRecord {
+  // Offsets in the strings table, kNoString for a null function name.
+  uint32_t func_name;
+  uint32_t dir_name;
+  uint32_t file_name;
+  uint32_t start_line;
+  uint32_t line;
+  uint32_t discriminator;
+};
+
+namespace {
+constexpr char kMagic[8] = {'A', 'F', 'D', 'O', 'S', 'Y', 'M', 'C'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kNoString = 0xffffffff;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t num_functions;
+  uint64_t num_ranges;
+  uint64_t num_stacks;
+  uint64_t num_stack_entries;
+  uint64_t num_infos;
+  uint64_t strings_size;
+};
+
+template <typename T>
+void Append(const T &value, std::string *data) {
+  data->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+void AppendTable(const std::vector<T> &table, std::string *data) {
+  data->append(reinterpret_cast<const char *>(table.data()),
+               table.size() * sizeof(T));
+}
+
+// Interns the stacks written to a cache file.
+class TableBuilder {
+ public:
+  typedef SymbolizationCache::StackRecord StackRecord;
+  typedef SymbolizationCache::InfoRecord InfoRecord;
+
+  // Returns the index of STACK in the stacks table.
+  uint64_t AddStack(const SourceStack &stack) {
+    std::vector<uint32_t> entries;
+    entries.reserve(stack.size());
+    for (const SourceInfo &info : stack) {
+      entries.push_back(AddInfo(info));
+    }
+    auto [iter, inserted] = stack_indices_.try_emplace(entries, stacks.size());
+    if (inserted) {
+      stacks.push_back({static_cast<uint32_t>(stack_entries.size()),
+                        static_cast<uint32_t>(entries.size())});
+      stack_entries.insert(stack_entries.end(), entries.begin(),
+                           entries.end());
+    }
+    return iter->second;
+  }
+
+  std::vector<StackRecord> stacks;
+  std::vector<uint32_t> stack_entries;
+  std::vector<InfoRecord> infos;
+  std::string strings;
+
+ private:
+  uint32_t AddString(const char *str, size_t size) {
+    auto [iter, inserted] =
+        string_offsets_.try_emplace(std::string(str, size), strings.size());
+    if (inserted) {
+      strings.append(str, size);
+      strings.push_back('\0');
+    }
+    return iter->second;
+  }
+
+  uint32_t AddInfo(const SourceInfo &info) {
+    const std::array<uint32_t, 6> key = {
+        info.func_name == nullptr
+            ? kNoString
+            : AddString(info.func_name, strlen(info.func_name)),
+        AddString(info.dir_name().data(), info.dir_name().size()),
+        AddString(info.file_name().data(), info.file_name().size()),
+        info.start_line, info.line, info.discriminator};
+    auto [iter, inserted] = info_indices_.try_emplace(key, infos.size());
+    if (inserted) {
+      infos.push_back({key[0], key[1], key[2], key[3], key[4], key[5]});
+    }
+    return iter->second;
+  }
+
+  absl::flat_hash_map<std::string, uint32_t> string_offsets_;
+  absl::flat_hash_map<std::array<uint32_t, 6>, uint32_t> info_indices_;
+  absl::flat_hash_map<std::vector<uint32_t>, uint64_t> stack_indices_;
+};
+}  // namespace
+
+SymbolizationCache::~SymbolizationCache() { Unload(); }
+
+std::string SymbolizationCache::FileName(const std::string &cache_dir,
+                                         const std::string &build_id) {
+  return absl::StrCat(cache_dir, "/", build_id, ".symcache");
+}
+
+void SymbolizationCache::Unload() {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, mapping_size_);
+  }
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  functions_ = nullptr;
+  num_functions_ = 0;
+  ranges_ = nullptr;
+  stacks_ = nullptr;
+  stack_entries_ = nullptr;
+  infos_ = nullptr;
+  strings_ = nullptr;
+}
+
+bool SymbolizationCache::Load(const std::string &file_name) {
+  Unload();
+  const int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+    close(fd);
+    LOG(WARNING) << "Ignoring malformed symbolization cache " << file_name;
+    return false;
+  }
+  void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    PLOG(WARNING) << "Could not mmap " << file_name;
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_size_ = st.st_size;
+
+  // Checks the sizes of the tables before computing their offsets, so that
+  // the offsets cannot overflow, and every index once, so that the lookups do
+  // not have to.
+  const char *data = static_cast<const char *>(mapping_);
+  FileHeader header;
+  memcpy(&header, data, sizeof(header));
+  const uint64_t max_records = mapping_size_;
+  bool valid = memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+               header.version == kVersion &&
+               header.num_functions <= max_records &&
+               header.num_ranges <= max_records &&
+               header.num_stacks <= max_records &&
+               header.num_stack_entries <= max_records &&
+               header.num_infos <= max_records &&
+               header.strings_size <= max_records &&
+               header.num_stack_entries <= kNoString &&
+               header.strings_size < kNoString;
+  if (valid) {
+    uint64_t offset = sizeof(FileHeader);
+    functions_ = reinterpret_cast<const FunctionRecord *>(data + offset);
+    offset += header.num_functions * sizeof(FunctionRecord);
+    ranges_ = reinterpret_cast<const RangeRecord *>(data + offset);
+    offset += header.num_ranges * sizeof(RangeRecord);
+    stacks_ = reinterpret_cast<const StackRecord *>(data + offset);
+    offset += header.num_stacks * sizeof(StackRecord);
+    stack_entries_ = reinterpret_cast<const uint32_t *>(data + offset);
+    offset += header.num_stack_entries * sizeof(uint32_t);
+    infos_ = reinterpret_cast<const InfoRecord *>(data + offset);
+    offset += header.num_infos * sizeof(InfoRecord);
+    strings_ = data + offset;
+    offset += header.strings_size;
+    valid = offset == mapping_size_ &&
+            (header.strings_size == 0 ||
+             strings_[header.strings_size - 1] == '\0');
+  }
+  for (uint64_t i = 0; valid && i < header.num_functions; ++i) {
+    const FunctionRecord &function = functions_[i];
+    valid = function.start_addr < function.end_addr &&
+            (i == 0 || functions_[i - 1].end_addr <= function.start_addr) &&
+            function.num_ranges > 0 &&
+            function.first_range <= header.num_ranges &&
+            function.num_ranges <= header.num_ranges - function.first_range &&
+            ranges_[function.first_range].start_addr == function.start_addr;
+    for (uint64_t j = 1; valid && j < function.num_ranges; ++j) {
+      const RangeRecord &range = ranges_[function.first_range + j];
+      const RangeRecord &previous = ranges_[function.first_range + j - 1];
+      valid = range.start_addr > previous.start_addr &&
+              range.start_addr < function.end_addr;
+    }
+  }
+  for (uint64_t i = 0; valid && i < header.num_ranges; ++i) {
+    valid = ranges_[i].stack < header.num_stacks;
+  }
+  for (uint64_t i = 0; valid && i < header.num_stacks; ++i) {
+    valid = stacks_[i].first_entry <= header.num_stack_entries &&
+            stacks_[i].size <=
+                header.num_stack_entries - stacks_[i].first_entry;
+  }
+  for (uint64_t i = 0; valid && i < header.num_stack_entries; ++i) {
+    valid = stack_entries_[i] < header.num_infos;
+  }
+  for (uint64_t i = 0; valid && i < header.num_infos; ++i) {
+    const InfoRecord &info = infos_[i];
+    valid = (info.func_name == kNoString ||
+             info.func_name < header.strings_size) &&
+            info.dir_name < header.strings_size &&
+            info.file_name < header.strings_size;
+  }
+  if (!valid) {
+    LOG(WARNING) << "Ignoring malformed symbolization cache " << file_name;
+    Unload();
+    return false;
+  }
+  num_functions_ = header.num_functions;
+  return true;
+}
+
+bool SymbolizationCache::Save(const std::string &file_name) const {
+  // The loaded functions are decoded and written again with the added ones,
+  // as the interned tables of the merged cache differ.
+  std::map<uint64_t, std::pair<uint64_t, const std::vector<std::pair<
+                                             uint64_t, SourceStack>> *>>
+      functions;
+  std::vector<std::vector<std::pair<uint64_t, SourceStack>>> loaded(
+      num_functions_);
+  for (uint64_t i = 0; i < num_functions_; ++i) {
+    DecodeFunction(i, &loaded[i]);
+    functions[functions_[i].start_addr] = {functions_[i].end_addr, &loaded[i]};
+  }
+  for (const auto &[start_addr, function] : added_) {
+    functions[start_addr] = {function.first, &function.second};
+  }
+
+  TableBuilder builder;
+  std::vector<FunctionRecord> function_records;
+  std::vector<RangeRecord> range_records;
+  function_records.reserve(functions.size());
+  for (const auto &[start_addr, function] : functions) {
+    const auto &[end_addr, ranges] = function;
+    // Overlapping functions would make the address lookups ambiguous.
+    if (!function_records.empty() &&
+        function_records.back().end_addr > start_addr) {
+      continue;
+    }
+    function_records.push_back(
+        {start_addr, end_addr, range_records.size(), ranges->size()});
+    for (const auto &[range_start, stack] : *ranges) {
+      range_records.push_back({range_start, builder.AddStack(stack)});
+    }
+  }
+
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.reserved = 0;
+  header.num_functions = function_records.size();
+  header.num_ranges = range_records.size();
+  header.num_stacks = builder.stacks.size();
+  header.num_stack_entries = builder.stack_entries.size();
+  header.num_infos = builder.infos.size();
+  header.strings_size = builder.strings.size();
+  std::string data;
+  Append(header, &data);
+  AppendTable(function_records, &data);
+  AppendTable(range_records, &data);
+  AppendTable(builder.stacks, &data);
+  AppendTable(builder.stack_entries, &data);
+  AppendTable(builder.infos, &data);
+  data.append(builder.strings);
+
+  const std::string tmp_file_name = absl::StrCat(file_name, ".tmp.", getpid());
+  FILE *fp = fopen(tmp_file_name.c_str(), "wb");
+  if (fp == nullptr) {
+    PLOG(WARNING) << "Could not create " << tmp_file_name;
+    return false;
+  }
+  const bool written = fwrite(data.data(), 1, data.size(), fp) == data.size();
+  if (fclose(fp) != 0 || !written ||
+      rename(tmp_file_name.c_str(), file_name.c_str()) != 0) {
+    PLOG(WARNING) << "Could not write " << file_name;
+    unlink(tmp_file_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+uint64_t SymbolizationCache::FindFunction(uint64_t addr) const {
+  const FunctionRecord *end = functions_ + num_functions_;
+  const FunctionRecord *function = std::upper_bound(
+      functions_, end, addr, [](uint64_t addr, const FunctionRecord &record) {
+        return addr < record.start_addr;
+      });
+  if (function == functions_ || addr >= (function - 1)->end_addr) {
+    return num_functions_;
+  }
+  return function - 1 - functions_;
+}
+
+void SymbolizationCache::DecodeStack(uint64_t stack_index,
+                                     SourceStack *stack) const {
+  const StackRecord &record = stacks_[stack_index];
+  stack->clear();
+  stack->reserve(record.size);
+  for (uint32_t i = 0; i < record.size; ++i) {
+    const InfoRecord &info = infos_[stack_entries_[record.first_entry + i]];
+    stack->emplace_back(
+        info.func_name == kNoString ? nullptr : strings_ + info.func_name,
+        strings_ + info.dir_name, strings_ + info.file_name, info.start_line,
+        info.line, info.discriminator);
+  }
+}
+
+void SymbolizationCache::DecodeFunction(
+    uint64_t index,
+    std::vector<std::pair<uint64_t, SourceStack>> *ranges) const {
+  const FunctionRecord &function = functions_[index];
+  ranges->resize(function.num_ranges);
+  for (uint64_t i = 0; i < function.num_ranges; ++i) {
+    const RangeRecord &range = ranges_[function.first_range + i];
+    (*ranges)[i].first = range.start_addr;
+    DecodeStack(range.stack, &(*ranges)[i].second);
+  }
+}
+
+bool SymbolizationCache::Contains(uint64_t start_addr,
+                                  uint64_t end_addr) const {
+  auto added = added_.find(start_addr);
+  if (added != added_.end()) {
+    return added->second.first == end_addr;
+  }
+  const uint64_t index = FindFunction(start_addr);
+  return index < num_functions_ &&
+         functions_[index].start_addr == start_addr &&
+         functions_[index].end_addr == end_addr;
+}
+
+bool SymbolizationCache::Lookup(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<std::pair<uint64_t, SourceStack>> *ranges) const {
+  auto added = added_.find(start_addr);
+  if (added != added_.end() && added->second.first == end_addr) {
+    *ranges = added->second.second;
+    return true;
+  }
+  const uint64_t index = FindFunction(start_addr);
+  if (index == num_functions_ || functions_[index].start_addr != start_addr ||
+      functions_[index].end_addr != end_addr) {
+    return false;
+  }
+  DecodeFunction(index, ranges);
+  return true;
+}
+
+bool SymbolizationCache::GetInlineStack(uint64_t addr,
+                                        SourceStack *stack) const {
+  auto added = added_.upper_bound(addr);
+  if (added != added_.begin() && addr < std::prev(added)->second.first) {
+    const auto &ranges = std::prev(added)->second.second;
+    auto range = std::upper_bound(
+        ranges.begin(), ranges.end(), addr,
+        [](uint64_t addr, const std::pair<uint64_t, SourceStack> &range) {
+          return addr < range.first;
+        });
+    if (range == ranges.begin()) {
+      return false;
+    }
+    const SourceStack &found = std::prev(range)->second;
+    stack->insert(stack->end(), found.begin(), found.end());
+    return true;
+  }
+  const uint64_t index = FindFunction(addr);
+  if (index == num_functions_) {
+    return false;
+  }
+  const FunctionRecord &function = functions_[index];
+  const RangeRecord *begin = ranges_ + function.first_range;
+  const RangeRecord *range = std::upper_bound(
+      begin, begin + function.num_ranges, addr,
+      [](uint64_t addr, const RangeRecord &record) {
+        return addr < record.start_addr;
+      });
+  // The first run starts at the start of the function.
+  SourceStack found;
+  DecodeStack((range - 1)->stack, &found);
+  stack->insert(stack->end(), found.begin(), found.end());
+  return true;
+}
+
+void SymbolizationCache::Add(
+    uint64_t start_addr, uint64_t end_addr,
+    const std::vector<std::pair<uint64_t, SourceStack>> &ranges) {
+  if (start_addr >= end_addr || ranges.empty() ||
+      ranges.front().first != start_addr) {
+    return;
+  }
+  added_[start_addr] = {end_addr, ranges};
+}
+
+CachedAddr2line *CachedAddr2line::Create(
+    const std::string &binary_name,
+    const std::map<uint64_t, uint64_t> *sampled_functions,
+    const std::string &cache_dir) {
+  const std::string build_id = ElfReader(binary_name).GetBuildId();
+  if (build_id.empty()) {
+    LOG(WARNING) << "Not caching the symbolization of " << binary_name
+                 << ", which has no build-id.";
+    return nullptr;
+  }
+  CachedAddr2line *addr2line = new CachedAddr2line(
+      binary_name, sampled_functions,
+      SymbolizationCache::FileName(cache_dir, build_id));
+  if (!addr2line->Prepare()) {
+    delete addr2line;
+    return nullptr;
+  }
+  return addr2line;
+}
+
+CachedAddr2line::CachedAddr2line(
+    const std::string &binary_name,
+    const std::map<uint64_t, uint64_t> *sampled_functions,
+    const std::string &cache_file)
+    : Addr2line(binary_name),
+      cache_file_(cache_file),
+      all_functions_(sampled_functions == nullptr) {
+  if (sampled_functions != nullptr) {
+    uncached_functions_ = *sampled_functions;
+  }
+}
+
+bool CachedAddr2line::Prepare() {
+  if (cache_.Load(cache_file_)) {
+    for (auto iter = uncached_functions_.begin();
+         iter != uncached_functions_.end();) {
+      if (cache_.Contains(iter->first, iter->first + iter->second)) {
+        iter = uncached_functions_.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+  LOG(INFO) << "Loaded " << cache_.num_loaded()
+            << " functions from the symbolization cache " << cache_file_;
+  return true;
+}
+
+Addr2line *CachedAddr2line::GetAddr2line() const {
+  if (addr2line_ == nullptr && !addr2line_failed_) {
+    addr2line_.reset(Addr2line::CreateWithSampledFunctions(
+        binary_name_, all_functions_ ? nullptr : &uncached_functions_));
+    if (addr2line_ == nullptr) {
+      LOG(ERROR) << "Error reading binary " << binary_name_;
+      addr2line_failed_ = true;
+    }
+  }
+  return addr2line_.get();
+}
+
+void CachedAddr2line::GetInlineStack(uint64_t addr, SourceStack *stack) const {
+  if (cache_.GetInlineStack(addr, stack)) {
+    return;
+  }
+  Addr2line *addr2line = GetAddr2line();
+  if (addr2line != nullptr) {
+    addr2line->GetInlineStack(addr, stack);
+  }
+}
+
+void CachedAddr2line::GetInlineStackRanges(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<std::pair<uint64_t, SourceStack>> *ranges) const {
+  if (cache_.Lookup(start_addr, end_addr, ranges)) {
+    return;
+  }
+  ranges->clear();
+  Addr2line *addr2line = GetAddr2line();
+  if (addr2line == nullptr) {
+    return;
+  }
+  addr2line->GetInlineStackRanges(start_addr, end_addr, ranges);
+  cache_.Add(start_addr, end_addr, *ranges);
+}
+
+bool CachedAddr2line::Flush() {
+  if (cache_.num_added() == 0) {
+    return true;
+  }
+  LOG(INFO) << "Adding " << cache_.num_added()
+            << " functions to the symbolization cache " << cache_file_;
+  return cache_.Save(cache_file_);
+}
+}  // namespace devtools_crosstool_autofdo
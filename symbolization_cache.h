@@ -0,0 +1,165 @@
+// On-disk cache of the inline stacks of the functions of a binary.
+
+#ifndef AUTOFDO_SYMBOLIZATION_CACHE_H_
+#define AUTOFDO_SYMBOLIZATION_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "addr2line.h"
+#include "source_info.h"
+
+namespace devtools_crosstool_autofdo {
+
+// The inline stacks of the sampled functions of a binary, as returned by
+// Addr2line::GetInlineStackRanges, saved to a file named after the build-id
+// of the binary so that later conversions against the same binary do not
+// have to read its DWARF again.
+//
+// The file holds the functions sorted by address, each with its runs of
+// addresses sharing an inline stack. The stacks, their SourceInfo entries and
+// the names they refer to are interned in tables, which are memory mapped and
+// used in place: loading a cache does not decode it, and the function names
+// of the returned stacks point into the mapping.
+//
+// Functions symbolized after the cache was loaded are added in memory, and
+// written along with the loaded ones by Save().
+class SymbolizationCache {
+ public:
+  SymbolizationCache() = default;
+  ~SymbolizationCache();
+
+  // Returns the name of the cache file of the binary with BUILD_ID in
+  // CACHE_DIR.
+  static std::string FileName(const std::string &cache_dir,
+                              const std::string &build_id);
+
+  // Maps the cache in FILE_NAME. Returns false, leaving the cache empty, if
+  // FILE_NAME does not exist or is malformed.
+  bool Load(const std::string &file_name);
+
+  // Writes the loaded and the added functions to FILE_NAME. The file is
+  // written aside and renamed, so that concurrent readers see either the old
+  // or the new cache.
+  bool Save(const std::string &file_name) const;
+
+  // Returns true if the function [START_ADDR, END_ADDR) is cached.
+  bool Contains(uint64_t start_addr, uint64_t end_addr) const;
+
+  // Stores in RANGES the inline stack runs of the function [START_ADDR,
+  // END_ADDR), in the format of Addr2line::GetInlineStackRanges. Returns false
+  // if the function is not cached.
+  bool Lookup(uint64_t start_addr, uint64_t end_addr,
+              std::vector<std::pair<uint64_t, SourceStack>> *ranges) const;
+
+  // Stores in STACK the inline stack of ADDR. Returns false if ADDR is not in
+  // a cached function.
+  bool GetInlineStack(uint64_t addr, SourceStack *stack) const;
+
+  // Adds the inline stack runs of the function [START_ADDR, END_ADDR). The
+  // function names of RANGES must outlive the cache.
+  void Add(uint64_t start_addr, uint64_t end_addr,
+           const std::vector<std::pair<uint64_t, SourceStack>> &ranges);
+
+  // Number of functions loaded from the file, and added since.
+  uint64_t num_loaded() const { return num_functions_; }
+  uint64_t num_added() const { return added_.size(); }
+
+  // Layout of the records of the file, see symbolization_cache.cc.
+  struct FunctionRecord;
+  struct RangeRecord;
+  struct StackRecord;
+  struct InfoRecord;
+
+ private:
+  // Unmaps the file and empties the loaded tables.
+  void Unload();
+
+  // Returns the index of the loaded function containing ADDR, or
+  // num_functions_ if there is none.
+  uint64_t FindFunction(uint64_t addr) const;
+
+  // Stores in STACK the loaded stack at index STACK_INDEX.
+  void DecodeStack(uint64_t stack_index, SourceStack *stack) const;
+
+  // Stores in RANGES the runs of the loaded function at index INDEX.
+  void DecodeFunction(
+      uint64_t index,
+      std::vector<std::pair<uint64_t, SourceStack>> *ranges) const;
+
+  // The mapped file, and its tables.
+  void *mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  const FunctionRecord *functions_ = nullptr;
+  uint64_t num_functions_ = 0;
+  const RangeRecord *ranges_ = nullptr;
+  const StackRecord *stacks_ = nullptr;
+  const uint32_t *stack_entries_ = nullptr;
+  const InfoRecord *infos_ = nullptr;
+  const char *strings_ = nullptr;
+
+  // The added functions by start address, with their end address and runs.
+  std::map<uint64_t,
+           std::pair<uint64_t, std::vector<std::pair<uint64_t, SourceStack>>>>
+      added_;
+
+  DISALLOW_COPY_AND_ASSIGN(SymbolizationCache);
+};
+
+// Addr2line which serves the functions found in the SymbolizationCache of the
+// binary, and only reads the DWARF of the binary, restricted to the sampled
+// functions which are not cached, the first time another function is
+// queried. The newly symbolized functions are added to the cache, which is
+// written back by Flush().
+class CachedAddr2line : public Addr2line {
+ public:
+  // Returns a new CachedAddr2line for the SAMPLED_FUNCTIONS of BINARY_NAME,
+  // which may be nullptr to symbolize any function, with its cache in
+  // CACHE_DIR. Returns nullptr if the binary has no build-id.
+  static CachedAddr2line *Create(
+      const std::string &binary_name,
+      const std::map<uint64_t, uint64_t> *sampled_functions,
+      const std::string &cache_dir);
+
+  bool Prepare() override;
+  void GetInlineStack(uint64_t addr, SourceStack *stack) const override;
+  void GetInlineStackRanges(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<std::pair<uint64_t, SourceStack>> *ranges) const override;
+
+  // Writes the cache if functions were added to it. Returns false if it
+  // cannot be written.
+  bool Flush();
+
+ private:
+  CachedAddr2line(const std::string &binary_name,
+                  const std::map<uint64_t, uint64_t> *sampled_functions,
+                  const std::string &cache_file);
+
+  // Returns the Addr2line reading the DWARF of the binary, created on first
+  // use, or nullptr if it cannot be created.
+  Addr2line *GetAddr2line() const;
+
+  const std::string cache_file_;
+  // Whether any function may be queried, or only the sampled ones.
+  const bool all_functions_;
+  // The sampled functions which are not cached, by start address with their
+  // size.
+  std::map<uint64_t, uint64_t> uncached_functions_;
+
+  // Filled with the functions symbolized by addr2line_.
+  mutable SymbolizationCache cache_;
+  mutable std::unique_ptr<Addr2line> addr2line_;
+  mutable bool addr2line_failed_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(CachedAddr2line);
+};
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_SYMBOLIZATION_CACHE_H_
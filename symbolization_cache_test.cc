@@ -0,0 +1,107 @@
+// Saving and loading of SymbolizationCache files.
+
+#include "symbolization_cache.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#define FLAGS_test_tmpdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+namespace {
+
+using devtools_crosstool_autofdo::SourceInfo;
+using devtools_crosstool_autofdo::SourceStack;
+using devtools_crosstool_autofdo::SymbolizationCache;
+
+typedef std::vector<std::pair<uint64_t, SourceStack>> Ranges;
+
+// Returns the runs of a function at 0x1000 made of an inlined call to bar in
+// the middle of foo, and those of a function at 0x2000 in baz with a run
+// without line information.
+std::vector<std::pair<uint64_t, Ranges>> TestFunctions() {
+  const SourceInfo foo("foo", "/src", "foo.cc", 10, 12, 0);
+  const SourceInfo foo_call("foo", "/src", "foo.cc", 10, 14, 3);
+  const SourceInfo bar("bar", "/src", "bar.h", 5, 6, 0);
+  const SourceInfo baz("baz", "", "baz.cc", 1, 2, 0);
+  return {
+      {0x1000, {{0x1000, {foo}}, {0x1008, {bar, foo_call}}, {0x1010, {foo}}}},
+      {0x2000, {{0x2000, {baz}}, {0x2004, {}}}}};
+}
+
+TEST(SymbolizationCacheTest, SaveAndLoad) {
+  const std::string file_name = FLAGS_test_tmpdir + "/test.symcache";
+  const auto functions = TestFunctions();
+  {
+    SymbolizationCache cache;
+    EXPECT_FALSE(cache.Load(FLAGS_test_tmpdir + "/missing.symcache"));
+    cache.Add(0x1000, 0x1020, functions[0].second);
+    EXPECT_TRUE(cache.Contains(0x1000, 0x1020));
+    EXPECT_FALSE(cache.Contains(0x2000, 0x2010));
+    ASSERT_TRUE(cache.Save(file_name));
+  }
+  {
+    // The second function is added to the loaded one, and both are saved.
+    SymbolizationCache cache;
+    ASSERT_TRUE(cache.Load(file_name));
+    EXPECT_EQ(cache.num_loaded(), 1);
+    cache.Add(0x2000, 0x2010, functions[1].second);
+    ASSERT_TRUE(cache.Save(file_name));
+  }
+
+  SymbolizationCache cache;
+  ASSERT_TRUE(cache.Load(file_name));
+  EXPECT_EQ(cache.num_loaded(), 2);
+  EXPECT_EQ(cache.num_added(), 0);
+  EXPECT_TRUE(cache.Contains(0x1000, 0x1020));
+  EXPECT_TRUE(cache.Contains(0x2000, 0x2010));
+  // The end of a function is part of its key.
+  EXPECT_FALSE(cache.Contains(0x1000, 0x1030));
+  EXPECT_FALSE(cache.Contains(0x1008, 0x1020));
+
+  Ranges ranges;
+  ASSERT_TRUE(cache.Lookup(0x1000, 0x1020, &ranges));
+  EXPECT_EQ(ranges, functions[0].second);
+  ASSERT_TRUE(cache.Lookup(0x2000, 0x2010, &ranges));
+  EXPECT_EQ(ranges, functions[1].second);
+  EXPECT_FALSE(cache.Lookup(0x3000, 0x3010, &ranges));
+
+  SourceStack stack;
+  ASSERT_TRUE(cache.GetInlineStack(0x100c, &stack));
+  EXPECT_EQ(stack, functions[0].second[1].second);
+  stack.clear();
+  ASSERT_TRUE(cache.GetInlineStack(0x2008, &stack));
+  EXPECT_TRUE(stack.empty());
+  EXPECT_FALSE(cache.GetInlineStack(0x1020, &stack));
+  EXPECT_FALSE(cache.GetInlineStack(0xfff, &stack));
+  remove(file_name.c_str());
+}
+
+TEST(SymbolizationCacheTest, IgnoreMalformedFile) {
+  const std::string file_name = FLAGS_test_tmpdir + "/malformed.symcache";
+  {
+    SymbolizationCache cache;
+    cache.Add(0x1000, 0x1020, TestFunctions()[0].second);
+    ASSERT_TRUE(cache.Save(file_name));
+  }
+  // Truncates the file in the middle of its tables.
+  FILE *fp = fopen(file_name.c_str(), "r+");
+  ASSERT_NE(fp, nullptr);
+  fseek(fp, 0, SEEK_END);
+  const long size = ftell(fp);
+  fclose(fp);
+  ASSERT_EQ(truncate(file_name.c_str(), size - 10), 0);
+
+  SymbolizationCache cache;
+  EXPECT_FALSE(cache.Load(file_name));
+  EXPECT_EQ(cache.num_loaded(), 0);
+  EXPECT_FALSE(cache.Contains(0x1000, 0x1020));
+  remove(file_name.c_str());
+}
+}  // namespace
@@ -0,0 +1,71 @@
+; Source of pseudo_probe.binary, built with:
+;   opt -passes='pseudo-probe,cgscc(inline)' pseudo_probe.ll -o pseudo_probe.bc
+;   llc -O2 -filetype=obj -relocation-model=pic pseudo_probe.bc -o pseudo_probe.o
+;   gcc pseudo_probe.o -o pseudo_probe.binary
+; leaf is inlined in main, and calls callee directly and then indirectly.
+
+target triple = "x86_64-pc-linux-gnu"
+
+@fp = global i32 (i32)* @callee
+
+define internal i32 @callee(i32 %x) noinline !dbg !10 {
+entry:
+  %c = icmp sgt i32 %x, 10, !dbg !11
+  br i1 %c, label %big, label %small, !dbg !11
+big:
+  %a = mul i32 %x, 3, !dbg !12
+  ret i32 %a, !dbg !12
+small:
+  %b = add i32 %x, 7, !dbg !13
+  ret i32 %b, !dbg !13
+}
+
+define internal i32 @leaf(i32 %x) !dbg !20 {
+entry:
+  %c = icmp eq i32 %x, 5, !dbg !21
+  br i1 %c, label %five, label %other, !dbg !21
+five:
+  ret i32 1, !dbg !22
+other:
+  %r = call i32 @callee(i32 %x), !dbg !23
+  %f = load i32 (i32)*, i32 (i32)** @fp, !dbg !24
+  %r2 = call i32 %f(i32 %r), !dbg !24
+  ret i32 %r2, !dbg !24
+}
+
+define i32 @main(i32 %argc, i8** %argv) !dbg !30 {
+entry:
+  br label %loop, !dbg !31
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s2, %loop ]
+  %v = call i32 @leaf(i32 %i), !dbg !32
+  %s2 = add i32 %s, %v, !dbg !33
+  %inc = add i32 %i, 1, !dbg !33
+  %done = icmp eq i32 %inc, 100000000, !dbg !33
+  br i1 %done, label %exit, label %loop, !dbg !33
+exit:
+  ret i32 %s2, !dbg !34
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!2, !3}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "test", isOptimized: true, runtimeVersion: 0, emissionKind: LineTablesOnly)
+!1 = !DIFile(filename: "t.c", directory: "/tmp")
+!2 = !{i32 2, !"Debug Info Version", i32 3}
+!3 = !{i32 7, !"Dwarf Version", i32 4}
+!5 = !DISubroutineType(types: !{})
+!10 = distinct !DISubprogram(name: "callee", scope: !1, file: !1, line: 1, type: !5, scopeLine: 1, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0)
+!11 = !DILocation(line: 2, scope: !10)
+!12 = !DILocation(line: 3, scope: !10)
+!13 = !DILocation(line: 4, scope: !10)
+!20 = distinct !DISubprogram(name: "leaf", scope: !1, file: !1, line: 10, type: !5, scopeLine: 10, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0)
+!21 = !DILocation(line: 11, scope: !20)
+!22 = !DILocation(line: 12, scope: !20)
+!23 = !DILocation(line: 13, scope: !20)
+!24 = !DILocation(line: 14, scope: !20)
+!30 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 20, type: !5, scopeLine: 20, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0)
+!31 = !DILocation(line: 21, scope: !30)
+!32 = !DILocation(line: 22, scope: !30)
+!33 = !DILocation(line: 23, scope: !30)
+!34 = !DILocation(line: 24, scope: !30)
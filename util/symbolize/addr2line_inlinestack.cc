@@ -673,6 +673,8 @@ void InlineStackHandler::PopulateSubprogramsByAddress() {
           *subprog->address_ranges(), subprog);
   }
 
+  subprograms_by_address_.Freeze();
+
   // Clear this vector to save some memory
   subprogram_insert_order_.clear();
   if (overlap_count_ > 0) {
@@ -680,6 +682,42 @@ void InlineStackHandler::PopulateSubprogramsByAddress() {
   }
 }
 
+void InlineStackHandler::MergeFrom(InlineStackHandler *other) {
+  // The first map holds the subprograms of the binary, whose offsets are
+  // unique across its compilation units. Each other map holds those of a .dwo
+  // file, and is renumbered after the maps of this handler.
+  for (int i = 0; i < other->subprograms_by_offset_maps_.size(); ++i) {
+    SubprogramsByOffsetMap *subprograms_by_offset =
+        other->subprograms_by_offset_maps_[i];
+    if (i == 0 && !subprograms_by_offset_maps_.empty()) {
+      subprograms_by_offset_maps_[0]->insert(subprograms_by_offset->begin(),
+                                             subprograms_by_offset->end());
+      delete subprograms_by_offset;
+      continue;
+    }
+    const int input_file_index = subprograms_by_offset_maps_.size();
+    for (const auto &offset_subprogram : *subprograms_by_offset) {
+      offset_subprogram.second->set_input_file_index(input_file_index);
+    }
+    subprograms_by_offset_maps_.push_back(subprograms_by_offset);
+  }
+  other->subprograms_by_offset_maps_.clear();
+  if (!subprograms_by_offset_maps_.empty()) {
+    input_file_index_ = 0;
+  }
+
+  subprogram_insert_order_.insert(subprogram_insert_order_.end(),
+                                  other->subprogram_insert_order_.begin(),
+                                  other->subprogram_insert_order_.end());
+  other->subprogram_insert_order_.clear();
+  compilation_unit_comp_dir_.insert(compilation_unit_comp_dir_.end(),
+                                    other->compilation_unit_comp_dir_.begin(),
+                                    other->compilation_unit_comp_dir_.end());
+  other->compilation_unit_comp_dir_.clear();
+  overlap_count_ += other->overlap_count_;
+  other->overlap_count_ = 0;
+}
+
 AddressRangeList::RangeList InlineStackHandler::SortAndMerge(
     AddressRangeList::RangeList rangelist) {
   AddressRangeList::RangeList merged;
@@ -702,12 +740,14 @@ AddressRangeList::RangeList InlineStackHandler::SortAndMerge(
 
 const SubprogramInfo *InlineStackHandler::GetSubprogramForAddress(
     uint64 address) {
-  NonOverlappingRangeMap<SubprogramInfo*>::ConstIterator iter =
-      subprograms_by_address_.Find(address);
-  if (iter != subprograms_by_address_.End())
-    return iter->second;
-  else
-    return NULL;
+  return GetSubprogramForAddress(address, NULL, NULL);
+}
+
+const SubprogramInfo *InlineStackHandler::GetSubprogramForAddress(
+    uint64 address, uint64 *low, uint64 *high) {
+  SubprogramInfo *const *subprog =
+      subprograms_by_address_.Lookup(address, low, high);
+  return subprog != NULL ? *subprog : NULL;
 }
 
 const SubprogramInfo *InlineStackHandler::GetDeclaration(
@@ -718,16 +758,18 @@ const SubprogramInfo *InlineStackHandler::GetDeclaration(
   SubprogramsByOffsetMap* subprograms_by_offset =
       subprograms_by_offset_maps_[input_file_index];
   while (declaration->name().empty() || declaration->callsite_line() == 0) {
-    uint64 specification = declaration->specification();
-    if (specification) {
-      declaration = subprograms_by_offset->find(specification)->second;
-    } else {
-      uint64 abstract_origin = declaration->abstract_origin();
-      if (abstract_origin)
-        declaration = subprograms_by_offset->find(abstract_origin)->second;
-      else
-        break;
-    }
+    uint64 reference = declaration->specification();
+    if (!reference)
+      reference = declaration->abstract_origin();
+    if (!reference)
+      break;
+    // The referenced DIE may not have been read, e.g. if it is nested in a
+    // DIE which is not a subprogram.
+    SubprogramsByOffsetMap::const_iterator iter =
+        subprograms_by_offset->find(reference);
+    if (iter == subprograms_by_offset->end())
+      break;
+    declaration = iter->second;
   }
   return declaration;
 }
@@ -738,13 +780,36 @@ const SubprogramInfo *InlineStackHandler::GetAbstractOrigin(
   CHECK(input_file_index < subprograms_by_offset_maps_.size());
   SubprogramsByOffsetMap* subprograms_by_offset =
       subprograms_by_offset_maps_[input_file_index];
-  if (subprog->abstract_origin())
-    return subprograms_by_offset->find(subprog->abstract_origin())->second;
-  else
-    return subprog;
+  if (subprog->abstract_origin()) {
+    SubprogramsByOffsetMap::const_iterator iter =
+        subprograms_by_offset->find(subprog->abstract_origin());
+    if (iter != subprograms_by_offset->end())
+      return iter->second;
+  }
+  return subprog;
+}
+
+void InlineStackHandler::GetUnresolvedReferences(
+    std::set<uint64> *references) const {
+  if (subprograms_by_offset_maps_.empty())
+    return;
+  const SubprogramsByOffsetMap *subprograms_by_offset =
+      subprograms_by_offset_maps_[0];
+  for (const auto &offset_subprogram : *subprograms_by_offset) {
+    for (uint64 reference : {offset_subprogram.second->specification(),
+                             offset_subprogram.second->abstract_origin()}) {
+      if (reference && subprograms_by_offset->count(reference) == 0)
+        references->insert(reference);
+    }
+  }
 }
 
 void InlineStackHandler::GetSubprogramAddresses(std::set<uint64> *addrs) {
+  if (subprograms_by_address_.Frozen()) {
+    for (const auto &entry : subprograms_by_address_.FrozenRanges())
+      addrs->insert(entry.first.first);
+    return;
+  }
   for (auto it = subprograms_by_address_.Begin();
        it != subprograms_by_address_.End(); ++it) {
     addrs->insert(it->first.first);
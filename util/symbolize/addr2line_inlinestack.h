@@ -59,6 +59,7 @@ class SubprogramInfo {
         used_(false) { }
 
   const int input_file_index() const { return input_file_index_; }
+  void set_input_file_index(int index) { input_file_index_ = index; }
 
   const uint64 offset() const { return offset_; }
   const SubprogramInfo *parent() const { return parent_; }
@@ -229,10 +230,20 @@ class InlineStackHandler: public Dwarf2Handler {
 
   const SubprogramInfo *GetSubprogramForAddress(uint64 address);
 
+  // Same as above, also stores in LOW and HIGH the bounds of the address
+  // range in which the same subprogram is returned.
+  const SubprogramInfo *GetSubprogramForAddress(uint64 address, uint64 *low,
+                                                uint64 *high);
+
   const SubprogramInfo *GetDeclaration(const SubprogramInfo *subprog) const;
 
   const SubprogramInfo *GetAbstractOrigin(const SubprogramInfo *subprog) const;
 
+  // Puts into REFERENCES the offsets of the declarations and abstract origins
+  // which the subprograms of the binary refer to, but which were not read,
+  // e.g. because they are in a compilation unit which was skipped.
+  void GetUnresolvedReferences(std::set<uint64> *references) const;
+
   // Puts the start addresses of all inlined subprograms into the given set.
   void GetSubprogramAddresses(std::set<uint64> *addrs);
 
@@ -241,6 +252,11 @@ class InlineStackHandler: public Dwarf2Handler {
 
   void PopulateSubprogramsByAddress();
 
+  // Takes over the subprograms read by OTHER from the compilation units
+  // which follow those read by this handler, as if this handler had read
+  // them too. Must be called before PopulateSubprogramsByAddress.
+  void MergeFrom(InlineStackHandler *other);
+
   ~InlineStackHandler();
 
  private:
@@ -30,9 +30,33 @@
 #include "symbolize/line_state_machine.h"
 #include "symbolize/addr2line_inlinestack.h"
 #include "symbolize/index_helper.h"
+#include "symbolize/split_dwarf_loader.h"
 
 namespace devtools_crosstool_autofdo {
 
+namespace {
+// Handler which only asks for the unit DIE of a compilation unit, for
+// CompilationUnit::ReadSkeletonUnit.
+class SkeletonUnitHandler : public Dwarf2Handler {
+ public:
+  SkeletonUnitHandler() {}
+
+  bool StartCompilationUnit(uint64 offset, uint8 address_size,
+                            uint8 offset_size, uint64 cu_length,
+                            uint8 dwarf_version) override {
+    return true;
+  }
+
+  bool StartDIE(uint64 offset, enum DwarfTag tag,
+                const AttributeList& attrs) override {
+    return tag == DW_TAG_compile_unit || tag == DW_TAG_skeleton_unit;
+  }
+
+ private:
+  DISALLOW_EVIL_CONSTRUCTORS(SkeletonUnitHandler);
+};
+}  // namespace
+
 CompilationUnit::CompilationUnit(const string& path,
                                  const SectionMap& sections, uint64 offset,
                                  ByteReader* reader, Dwarf2Handler* handler)
@@ -43,7 +67,8 @@ CompilationUnit::CompilationUnit(const string& path,
       addr_buffer_(NULL), addr_buffer_length_(0),
       is_split_dwarf_(false), dwo_name_(),
       skeleton_dwo_id_(0), have_checked_for_dwp_(false), dwp_path_(),
-      dwp_byte_reader_(NULL), dwp_reader_(NULL), malformed_(false) {}
+      dwp_byte_reader_(NULL), dwp_reader_(NULL), split_dwarf_loader_(NULL),
+      unit_die_only_(false), malformed_(false) {}
 
 CompilationUnit::CompilationUnit(const string& path, const string& dwp_path,
                                  const SectionMap& sections, uint64 offset,
@@ -55,7 +80,8 @@ CompilationUnit::CompilationUnit(const string& path, const string& dwp_path,
       addr_buffer_(NULL), addr_buffer_length_(0),
       is_split_dwarf_(false), dwo_name_(),
       skeleton_dwo_id_(0), have_checked_for_dwp_(false), dwp_path_(dwp_path),
-      dwp_byte_reader_(NULL), dwp_reader_(NULL), malformed_(false) {}
+      dwp_byte_reader_(NULL), dwp_reader_(NULL), split_dwarf_loader_(NULL),
+      unit_die_only_(false), malformed_(false) {}
 
 CompilationUnit::~CompilationUnit() {
   if (abbrevs_) delete abbrevs_;
@@ -79,6 +105,23 @@ void CompilationUnit::SetSplitDwarf(const char* addr_buffer,
   skeleton_dwo_id_ = dwo_id;
 }
 
+bool CompilationUnit::ReadSkeletonUnit(const char** dwo_name,
+                                       uint64* dwo_id) {
+  SkeletonUnitHandler handler;
+  Dwarf2Handler* saved_handler = handler_;
+  handler_ = &handler;
+  unit_die_only_ = true;
+  header_.dwo_id = 0;
+  Start(offset_from_section_start_);
+  unit_die_only_ = false;
+  handler_ = saved_handler;
+  if (malformed() || dwo_name_ == NULL)
+    return false;
+  *dwo_name = dwo_name_;
+  *dwo_id = header_.dwo_id;
+  return true;
+}
+
 // Read a DWARF2/3 abbreviation section.
 // Each abbrev consists of a abbreviation number, a tag, a byte
 // specifying whether the tag has children, and a list of
@@ -925,6 +968,10 @@ void CompilationUnit::ProcessDIEs() {
       }
     }
 
+    // The unit DIE comes first.
+    if (unit_die_only_)
+      break;
+
     if (abbrev.has_children) {
       die_stack.push(absolute_offset);
     } else {
@@ -947,40 +994,50 @@ inline int GetElfWidth(const ElfReader& elf) {
 void CompilationUnit::ProcessSplitDwarf() {
   struct stat statbuf;
 
-  if (!have_checked_for_dwp_) {
-    have_checked_for_dwp_ = true;
-    if (dwp_path_.empty()) {
-      // Look for a .dwp file in the same directory as the executable.
-      dwp_path_ = path_ + ".dwp";
-    }
-    if (stat(dwp_path_.c_str(), &statbuf) == 0) {
-      ElfReader* elf = new ElfReader(dwp_path_);
-      int width = GetElfWidth(*elf);
-      if (width != 0) {
-        dwp_byte_reader_ = new ByteReader(ENDIANNESS_NATIVE);
-        dwp_byte_reader_->SetAddressSize(width);
-        dwp_reader_ = new DwpReader(*dwp_byte_reader_, elf);
-        dwp_reader_->Initialize();
-      } else {
-        LOG(WARNING) << "File '" << dwp_path_ << "' is not an ELF file.";
-        delete elf;
-      }
-    }
-  }
   bool found_in_dwp = false;
-  if (dwp_reader_ != NULL) {
-    // If we have a .dwp file, read the debug sections for the requested CU.
+  bool have_dwp;
+  if (split_dwarf_loader_ != NULL) {
+    // The .dwp file is shared by the units of the binary, and the
+    // .dwo files may already be in the page cache.
+    have_dwp = split_dwarf_loader_->has_dwp();
     SectionMap sections;
-    dwp_reader_->ReadDebugSectionsForCU(header_.dwo_id, &sections);
-    if (!sections.empty()) {
+    if (split_dwarf_loader_->ReadDwpSections(header_.dwo_id, &sections)) {
       found_in_dwp = true;
-      CompilationUnit dwp_comp_unit(dwp_path_, sections, 0,
-                                    dwp_byte_reader_, handler_);
-      dwp_comp_unit.SetSplitDwarf(addr_buffer_, addr_buffer_length_, header_.dwo_id);
-      dwp_comp_unit.Start();
-      if (dwp_comp_unit.malformed())
-        LOG(WARNING) << "File '" << dwp_path_ << "' has mangled "
-                     << ".debug_info.dwo section.";
+      ByteReader dwp_byte_reader(ENDIANNESS_NATIVE);
+      dwp_byte_reader.SetAddressSize(split_dwarf_loader_->dwp_width());
+      ProcessDwpUnit(split_dwarf_loader_->dwp_path(), sections,
+                     &dwp_byte_reader);
+    }
+  } else {
+    if (!have_checked_for_dwp_) {
+      have_checked_for_dwp_ = true;
+      if (dwp_path_.empty()) {
+        // Look for a .dwp file in the same directory as the executable.
+        dwp_path_ = path_ + ".dwp";
+      }
+      if (stat(dwp_path_.c_str(), &statbuf) == 0) {
+        ElfReader* elf = new ElfReader(dwp_path_);
+        int width = GetElfWidth(*elf);
+        if (width != 0) {
+          dwp_byte_reader_ = new ByteReader(ENDIANNESS_NATIVE);
+          dwp_byte_reader_->SetAddressSize(width);
+          dwp_reader_ = new DwpReader(*dwp_byte_reader_, elf);
+          dwp_reader_->Initialize();
+        } else {
+          LOG(WARNING) << "File '" << dwp_path_ << "' is not an ELF file.";
+          delete elf;
+        }
+      }
+    }
+    have_dwp = dwp_reader_ != NULL;
+    if (dwp_reader_ != NULL) {
+      // If we have a .dwp file, read the debug sections for the requested CU.
+      SectionMap sections;
+      dwp_reader_->ReadDebugSectionsForCU(header_.dwo_id, &sections);
+      if (!sections.empty()) {
+        found_in_dwp = true;
+        ProcessDwpUnit(dwp_path_, sections, dwp_byte_reader_);
+      }
     }
   }
   if (!found_in_dwp) {
@@ -1026,12 +1083,25 @@ void CompilationUnit::ProcessSplitDwarf() {
       } else {
         LOG(WARNING) << "File '" << dwo_name_ << "' is not an ELF file.";
       }
-    } else if (dwp_reader_ == NULL) {
+    } else if (!have_dwp) {
       LOG(WARNING) << "Cannot open file '" << dwo_name_ << "'.";
     }
   }
 }
 
+void CompilationUnit::ProcessDwpUnit(const string& dwp_path,
+                                     const SectionMap& sections,
+                                     ByteReader* dwp_byte_reader) {
+  CompilationUnit dwp_comp_unit(dwp_path, sections, 0, dwp_byte_reader,
+                                handler_);
+  dwp_comp_unit.SetSplitDwarf(addr_buffer_, addr_buffer_length_,
+                              header_.dwo_id);
+  dwp_comp_unit.Start();
+  if (dwp_comp_unit.malformed())
+    LOG(WARNING) << "File '" << dwp_path << "' has mangled "
+                 << ".debug_info.dwo section.";
+}
+
 void CompilationUnit::ReadDebugSectionsFromDwo(ElfReader* elf_reader,
                                               SectionMap* sections) {
   static const char* section_names[] = {
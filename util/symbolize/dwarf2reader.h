@@ -42,6 +42,7 @@ class ByteReader;
 class Dwarf2Handler;
 class LineInfoHandler;
 class DwpReader;
+class SplitDwarfLoader;
 
 
 struct AttributeSpec {
@@ -515,6 +516,20 @@ class CompilationUnit {
   // in offset.
   uint64 Start(uint64 offset);
 
+  // Reads only the unit DIE of the compilation unit, without calling
+  // the handler, and stores in DWO_NAME and DWO_ID where the full
+  // debug info of a skeleton compilation unit is.  DWO_NAME points
+  // into the sections of the unit.  Returns false if the unit is
+  // malformed or is not a skeleton compilation unit.
+  bool ReadSkeletonUnit(const char** dwo_name, uint64* dwo_id);
+
+  // Reads the .dwo and .dwp files of skeleton compilation units
+  // through LOADER, which is shared with the other units of the
+  // binary, instead of opening them for this unit only.
+  void set_split_dwarf_loader(SplitDwarfLoader* loader) {
+    split_dwarf_loader_ = loader;
+  }
+
  private:
   // This struct represents a single DWARF2/3 abbreviation
   // The abbreviation tells how to read a DWARF2/3 DIE, and consist of a
@@ -642,6 +657,11 @@ class CompilationUnit {
   // Process the actual debug information in a split DWARF file.
   void ProcessSplitDwarf();
 
+  // Process the compilation unit of the .dwp file DWP_PATH in
+  // SECTIONS, read with DWP_BYTE_READER.
+  void ProcessDwpUnit(const string& dwp_path, const SectionMap& sections,
+                      ByteReader* dwp_byte_reader);
+
   // Read the debug sections from a .dwo file.
   void ReadDebugSectionsFromDwo(ElfReader* elf_reader,
                                 SectionMap* sections);
@@ -718,6 +738,12 @@ class CompilationUnit {
   // DWP reader.
   DwpReader* dwp_reader_;
 
+  // Shared loader of the .dwo and .dwp files, if any.
+  SplitDwarfLoader* split_dwarf_loader_;
+
+  // True if only the unit DIE is read, see ReadSkeletonUnit.
+  bool unit_die_only_;
+
   bool malformed_;
   DISALLOW_EVIL_CONSTRUCTORS(CompilationUnit);
 };
@@ -50,11 +50,29 @@
 
 #include <algorithm>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "symbolize/elf_reader.h"
 #include "base/common.h"
+#include "third_party/abseil/absl/flags/flag.h"
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+ABSL_FLAG(std::string, debug_section_cache_dir, "",
+          "Directory where the compressed debug sections of binaries are "
+          "saved once decompressed, by build-id, so that they are only "
+          "decompressed once. Empty means no cache.");
+
+#ifndef ELFCOMPRESS_ZSTD
+#define ELFCOMPRESS_ZSTD 2
+#endif
 
 namespace {
 
@@ -66,6 +84,68 @@ template <typename T>
 T AdjustARMThumbSymbolValue(const T& symbol_table_value) {
   return symbol_table_value & ~(1 << kARMThumbBitOffset);
 }
+
+// Decompresses the SIZE bytes of DATA, compressed with the
+// ELFCOMPRESS_* algorithm TYPE, into the DECOMPRESSED_SIZE bytes of
+// OUT.  Returns false if DATA cannot be decompressed.
+bool DecompressSection(uint32 type, const char *data, size_t size,
+                       char *out, size_t decompressed_size,
+                       const string &path) {
+  switch (type) {
+    case ELFCOMPRESS_ZLIB: {
+#if defined(HAVE_ZLIB)
+      uLongf out_size = decompressed_size;
+      return uncompress(reinterpret_cast<Bytef *>(out), &out_size,
+                        reinterpret_cast<const Bytef *>(data),
+                        size) == Z_OK &&
+             out_size == decompressed_size;
+#else
+      LOG(WARNING) << path << " has zlib compressed debug sections, which "
+                   << "this build cannot read. Decompress them with "
+                   << "'objcopy --decompress-debug-sections'.";
+      return false;
+#endif
+    }
+    case ELFCOMPRESS_ZSTD: {
+#if defined(HAVE_ZSTD)
+      const size_t out_size =
+          ZSTD_decompress(out, decompressed_size, data, size);
+      return !ZSTD_isError(out_size) && out_size == decompressed_size;
+#else
+      LOG(WARNING) << path << " has zstd compressed debug sections, which "
+                   << "this build cannot read. Decompress them with "
+                   << "'objcopy --decompress-debug-sections'.";
+      return false;
+#endif
+    }
+    default:
+      LOG(WARNING) << path << " has debug sections compressed with unknown "
+                   << "type " << type << ".";
+      return false;
+  }
+}
+
+// Writes the SIZE bytes of DATA to FILE_NAME.  The file is written
+// aside and renamed, so that concurrent readers see a whole file.
+void WriteCacheFile(const string &file_name, const char *data, size_t size) {
+  const string tmp_name = file_name + ".tmp" + std::to_string(getpid());
+  const int fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    PLOG(WARNING) << "Could not create " << tmp_name;
+    return;
+  }
+  size_t written = 0;
+  while (written < size) {
+    const ssize_t n = write(fd, data + written, size - written);
+    if (n <= 0) break;
+    written += n;
+  }
+  close(fd);
+  if (written != size || rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+    PLOG(WARNING) << "Could not write " << file_name;
+    unlink(tmp_name.c_str());
+  }
+}
 }  // namespace
 
 namespace devtools_crosstool_autofdo {
@@ -83,6 +163,7 @@ class Elf32 {
   typedef Elf32_Phdr Phdr;
   typedef Elf32_Word Word;
   typedef Elf32_Sym Sym;
+  typedef Elf32_Chdr Chdr;
 
   // What should be in the EI_CLASS header.
   static const int kElfClass = ELFCLASS32;
@@ -105,6 +186,7 @@ class Elf64 {
   typedef Elf64_Phdr Phdr;
   typedef Elf64_Word Word;
   typedef Elf64_Sym Sym;
+  typedef Elf64_Chdr Chdr;
 
   // What should be in the EI_CLASS header.
   static const int kElfClass = ELFCLASS64;
@@ -125,11 +207,18 @@ class Elf64 {
 // The motivation for mmaping individual sections of the file is that
 // many Google executables are large enough when unstripped that we
 // have to worry about running out of virtual address space.
+//
+// Compressed debug sections, either SHF_COMPRESSED or named
+// .zdebug_*, are decompressed into anonymous memory, or mapped from
+// CACHE_FILE if it already has them, and the header then describes
+// the decompressed section.  The decompressed sections are saved to
+// CACHE_FILE unless it is empty.
 template<class ElfArch>
 class ElfSectionReader {
  public:
-  ElfSectionReader(const string &path, int fd,
-                   const typename ElfArch::Shdr &section_header)
+  ElfSectionReader(const string &path, int fd, const char *name,
+                   const typename ElfArch::Shdr &section_header,
+                   const string &cache_file)
       : header_(section_header) {
     // Back up to the beginning of the page we're interested in.
     const size_t additional = header_.sh_offset % getpagesize();
@@ -143,10 +232,17 @@ class ElfSectionReader {
     // Set where the offset really should begin.
     contents_ = reinterpret_cast<const char*>(contents_aligned_) +
                 (header_.sh_offset - offset_aligned);
+
+    if (header_.sh_type != SHT_NOBITS &&
+        ((header_.sh_flags & SHF_COMPRESSED) != 0 ||
+         (name != NULL && strncmp(name, ".zdebug", 7) == 0))) {
+      Decompress(path, name, cache_file);
+    }
   }
 
   ~ElfSectionReader() {
-    munmap(contents_aligned_, size_aligned_);
+    if (contents_aligned_ != NULL)
+      munmap(contents_aligned_, size_aligned_);
   }
 
   // Return the section header for this section.
@@ -162,6 +258,101 @@ class ElfSectionReader {
   size_t section_size() const { return section_size_; }
 
  private:
+  // Replaces the mapped compressed section by its decompressed bytes,
+  // or by no contents if it cannot be decompressed.
+  void Decompress(const string &path, const char *name,
+                  const string &cache_file) {
+    uint32 type;
+    uint64 decompressed_size;
+    const char *data;
+    size_t size;
+    if ((header_.sh_flags & SHF_COMPRESSED) != 0) {
+      typename ElfArch::Chdr chdr;
+      if (section_size_ < sizeof(chdr)) {
+        LOG(WARNING) << "Section " << name << " of " << path
+                     << " is truncated.";
+        Replace(NULL, 0);
+        return;
+      }
+      memcpy(&chdr, contents_, sizeof(chdr));
+      type = chdr.ch_type;
+      decompressed_size = chdr.ch_size;
+      data = contents_ + sizeof(chdr);
+      size = section_size_ - sizeof(chdr);
+    } else {
+      // GNU .zdebug_* sections start with "ZLIB" and the big-endian
+      // size of the decompressed section.
+      if (section_size_ < 12 || memcmp(contents_, "ZLIB", 4) != 0) {
+        LOG(WARNING) << "Section " << name << " of " << path
+                     << " is not a zlib compressed section.";
+        Replace(NULL, 0);
+        return;
+      }
+      type = ELFCOMPRESS_ZLIB;
+      decompressed_size = 0;
+      for (int i = 4; i < 12; ++i) {
+        decompressed_size = (decompressed_size << 8) |
+                            static_cast<unsigned char>(contents_[i]);
+      }
+      data = contents_ + 12;
+      size = section_size_ - 12;
+    }
+
+    // Maps the section decompressed by an earlier run, if it is
+    // complete.
+    if (!cache_file.empty()) {
+      const int cache_fd = open(cache_file.c_str(), O_RDONLY);
+      if (cache_fd != -1) {
+        struct stat statbuf;
+        void *cached = MAP_FAILED;
+        if (fstat(cache_fd, &statbuf) == 0 &&
+            static_cast<uint64>(statbuf.st_size) == decompressed_size &&
+            decompressed_size > 0) {
+          cached = mmap(NULL, decompressed_size, PROT_READ, MAP_SHARED,
+                        cache_fd, 0);
+        }
+        close(cache_fd);
+        if (cached != MAP_FAILED) {
+          Replace(cached, decompressed_size);
+          return;
+        }
+      }
+    }
+
+    void *decompressed = mmap(NULL, std::max<uint64>(decompressed_size, 1),
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (decompressed == MAP_FAILED)
+      PLOG(FATAL) << "Could not allocate " << decompressed_size
+                  << " bytes for section " << name << " of " << path;
+    if (!DecompressSection(type, data, size,
+                           reinterpret_cast<char *>(decompressed),
+                           decompressed_size, path)) {
+      LOG(WARNING) << "Could not decompress section " << name << " of "
+                   << path << ".";
+      munmap(decompressed, std::max<uint64>(decompressed_size, 1));
+      Replace(NULL, 0);
+      return;
+    }
+    if (!cache_file.empty()) {
+      WriteCacheFile(cache_file, reinterpret_cast<char *>(decompressed),
+                     decompressed_size);
+    }
+    Replace(decompressed, decompressed_size);
+  }
+
+  // Unmaps the compressed section, and uses the SIZE bytes mapped at
+  // CONTENTS, if not NULL, instead.
+  void Replace(void *contents, size_t size) {
+    munmap(contents_aligned_, size_aligned_);
+    contents_aligned_ = contents;
+    size_aligned_ = std::max<size_t>(size, 1);
+    contents_ = reinterpret_cast<const char *>(contents);
+    section_size_ = contents != NULL ? size : 0;
+    header_.sh_size = section_size_;
+    header_.sh_flags &= ~SHF_COMPRESSED;
+  }
+
   // page-aligned file contents
   void *contents_aligned_;
   // pointer within contents_aligned_ to where the section data begins
@@ -170,7 +361,9 @@ class ElfSectionReader {
   size_t size_aligned_;
   // size of contents.
   size_t section_size_;
-  const typename ElfArch::Shdr header_;
+  // The header of the section, which describes the decompressed
+  // section if it was compressed.
+  typename ElfArch::Shdr header_;
 
   DISALLOW_EVIL_CONSTRUCTORS(ElfSectionReader);
 };
@@ -256,14 +449,20 @@ static inline bool MyHasSuffixString(const string& str, const string& suffix) {
 // can't print line numbers. It takes a path to an elf file and a
 // readable file descriptor for that file, which it does not assume
 // ownership of.
+//
+// The sections are read on first use, which is thread-safe.  The
+// cache file of a compressed debug section is named after the build-id
+// returned by GET_BUILD_ID.
 template<class ElfArch>
 class ElfReaderImpl {
  public:
-  explicit ElfReaderImpl(const string &path, int fd)
+  explicit ElfReaderImpl(const string &path, int fd,
+                         std::function<string()> get_build_id = nullptr)
       : path_(path),
         fd_(fd),
         section_headers_(NULL),
-        program_headers_(NULL) {
+        program_headers_(NULL),
+        get_build_id_(get_build_id) {
     CHECK_GE(fd_, 0);
     string error;
     CHECK(IsArchElfFile(fd, &error)) << " Could not parse file: " << error;
@@ -543,11 +742,30 @@ class ElfReaderImpl {
       name = ".shstrtab";
     else
       name = GetSectionNameByIndex(num);
-    ElfSectionReader<ElfArch> *& reader = sections_[num];
-    if (reader == NULL)
-      reader = new ElfSectionReader<ElfArch>(path_, fd_,
-                                             section_headers_[num]);
-    return reader;
+    std::call_once(section_once_[num], [&]() {
+      sections_[num] = new ElfSectionReader<ElfArch>(
+          path_, fd_, name, section_headers_[num], GetCacheFile(num, name));
+    });
+    return sections_[num];
+  }
+
+  // Return the file where the compressed debug section "shndx" named
+  // NAME is saved once decompressed, or an empty string if it is not a
+  // compressed debug section or if there is no cache.
+  string GetCacheFile(int shndx, const char *name) {
+    const string cache_dir = absl::GetFlag(FLAGS_debug_section_cache_dir);
+    if (cache_dir.empty() || name == NULL || get_build_id_ == nullptr)
+      return "";
+    const bool compressed_debug_section =
+        strncmp(name, ".zdebug", 7) == 0 ||
+        ((section_headers_[shndx].sh_flags & SHF_COMPRESSED) != 0 &&
+         strncmp(name, ".debug", 6) == 0);
+    if (!compressed_debug_section)
+      return "";
+    std::call_once(build_id_once_, [this]() { build_id_ = get_build_id_(); });
+    if (build_id_.empty())
+      return "";
+    return cache_dir + "/" + build_id_ + name;
   }
 
   // Parse out the overall header information from the file and assert
@@ -611,6 +829,7 @@ class ElfReaderImpl {
 
     // Presize the sections array for efficiency.
     sections_.resize(GetNumSections(), NULL);
+    section_once_.reset(new std::once_flag[GetNumSections()]);
     return true;
   }
 
@@ -661,6 +880,14 @@ class ElfReaderImpl {
   // mmaped as they're needed and not released until this object is
   // destroyed.
   vector<ElfSectionReader<ElfArch>*> sections_;
+  // Guards the creation of each of sections_.
+  std::unique_ptr<std::once_flag[]> section_once_;
+
+  // Returns the build-id of the file, which names the cache files of its
+  // decompressed sections.
+  std::function<string()> get_build_id_;
+  std::once_flag build_id_once_;
+  string build_id_;
 
   // True if this is a .dwp file.
   bool is_dwp_;
@@ -911,16 +1138,18 @@ bool ElfReader::IsDynamicSharedObject() {
 }
 
 ElfReaderImpl<Elf32> *ElfReader::GetImpl32() {
-  if (impl32_ == NULL) {
-    impl32_ = new ElfReaderImpl<Elf32>(path_, fd_);
-  }
+  std::call_once(impl32_once_, [this]() {
+    impl32_ = new ElfReaderImpl<Elf32>(path_, fd_,
+                                       [this]() { return GetBuildId(); });
+  });
   return impl32_;
 }
 
 ElfReaderImpl<Elf64> *ElfReader::GetImpl64() {
-  if (impl64_ == NULL) {
-    impl64_ = new ElfReaderImpl<Elf64>(path_, fd_);
-  }
+  std::call_once(impl64_once_, [this]() {
+    impl64_ = new ElfReaderImpl<Elf64>(path_, fd_,
+                                       [this]() { return GetBuildId(); });
+  });
   return impl64_;
 }
 
@@ -26,6 +26,7 @@
 #define AUTOFDO_SYMBOLIZE_ELF_READER_H__
 
 #include <functional>
+#include <mutex>
 #include <string>
 #include "base/common.h"
 
@@ -98,7 +99,9 @@ class ElfReader {
   // Get section "shndx" from the given ELF file.  On success, return
   // the pointer to the section and store the size in "size".
   // On error, return NULL.  The returned section data is only valid
-  // until the ElfReader gets destroyed.
+  // until the ElfReader gets destroyed.  Compressed debug sections are
+  // returned decompressed, and are saved in --debug_section_cache_dir
+  // if it is set.  Sections may be read from several threads.
   const char *GetSectionByIndex(int shndx, size_t *size);
 
   // Get section with "section_name" (ex. ".text", ".symtab") in the
@@ -158,6 +161,8 @@ class ElfReader {
   int fd_;
   ElfReaderImpl<Elf32> *impl32_;
   ElfReaderImpl<Elf64> *impl64_;
+  std::once_flag impl32_once_;
+  std::once_flag impl64_once_;
 
   DISALLOW_COPY_AND_ASSIGN(ElfReader);
 };
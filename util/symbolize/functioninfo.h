@@ -147,6 +147,31 @@ class AddressToLineMap {
     line_map_[addr] = logical_num;
   }
 
+  // Appends the subprograms and logical lines of OTHER, built from
+  // compilation units which follow those of this map, and adds its actual
+  // lines, which replace those at the same addresses as a later compilation
+  // unit would.
+  void MergeFrom(const AddressToLineMap &other) {
+    const uint32 subprog_offset = subprogs_.size();
+    const uint32 logical_offset = logical_lines_.size();
+    subprogs_.insert(subprogs_.end(), other.subprogs_.begin(),
+                     other.subprogs_.end());
+    for (LineIdentifier line_id : other.logical_lines_) {
+      if (line_id.subprog_num > 0) {
+        line_id.subprog_num += subprog_offset;
+      }
+      if (line_id.context > 0) {
+        line_id.context += logical_offset;
+      }
+      logical_lines_.push_back(line_id);
+    }
+    for (const auto &addr_logical : other.line_map_) {
+      line_map_[addr_logical.first] =
+          addr_logical.second > 0 ? addr_logical.second + logical_offset : 0;
+    }
+    subprog_bias_ = subprogs_.size();
+  }
+
   const_iterator begin() const {
     return line_map_.begin();
   }
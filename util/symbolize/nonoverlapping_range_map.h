@@ -20,6 +20,7 @@
 #define AUTOFDO_SYMBOLIZE_NONOVERLAPPING_RANGE_MAP_H_
 
 #include <algorithm>
+#include <limits>
 #include <map>
 #include <utility>
 #include <vector>
@@ -55,18 +56,28 @@ struct RangeStartLt {
 // identical to the following three inserts: [0,5), [7,10), [12,15).
 // This convenience behavior is useful when inserting data for
 // hierarchical structures in bottom-up order.
+//
+// Once all the ranges are inserted, Freeze() moves them out of the
+// std::map into flat arrays, where Lookup() searches the start addresses
+// laid out in Eytzinger (breadth-first) order: the first levels of the
+// implicit search tree share a few cache lines, the children of a node are
+// next to each other so that the nodes a few levels down can be prefetched,
+// and the descent has no unpredictable branch.
 template<typename T>
 class NonOverlappingRangeMap {
  public:
   typedef map<AddressRangeList::Range, T, RangeStartLt> RangeMap;
   typedef typename RangeMap::iterator Iterator;
   typedef typename RangeMap::const_iterator ConstIterator;
+  typedef pair<AddressRangeList::Range, T> Entry;
 
   NonOverlappingRangeMap();
 
   void InsertRangeList(const AddressRangeList::RangeList& range_list,
                            const T& value);
   void InsertRange(uint64 low, uint64 high, const T& value);
+  // Find, Begin and End iterate over the std::map, and thus can only be
+  // used before Freeze().
   Iterator Find(uint64 address);
   ConstIterator Find(uint64 address) const;
 
@@ -75,10 +86,36 @@ class NonOverlappingRangeMap {
   Iterator End();
   ConstIterator End() const;
 
-  bool Empty() const { return ranges_.empty(); }
+  bool Empty() const { return ranges_.empty() && frozen_ranges_.empty(); }
+
+  // Moves the ranges to the flat arrays searched by Lookup(), and frees the
+  // std::map. No range can be inserted afterwards.
+  void Freeze();
+  bool Frozen() const { return frozen_; }
+
+  // Returns the data of the range containing ADDRESS, and stores the bounds
+  // of that range in LOW and HIGH if they are not NULL. Returns NULL if no
+  // range contains ADDRESS.
+  const T* Lookup(uint64 address, uint64* low, uint64* high) const;
+
+  // The ranges sorted by start address, once frozen.
+  const vector<Entry>& FrozenRanges() const { return frozen_ranges_; }
 
  private:
+  // Stores the start addresses of frozen_ranges_ from index I on in the
+  // subtree of the Eytzinger layout rooted at K. Returns the index of the
+  // first range which is not in the subtree.
+  size_t FillEytzinger(size_t i, size_t k);
+
   RangeMap ranges_;
+  bool frozen_;
+  // The frozen ranges, sorted by start address.
+  vector<Entry> frozen_ranges_;
+  // The start addresses of the frozen ranges in Eytzinger order, from index
+  // 1 on, and the index in frozen_ranges_ of each of them. The first element
+  // of both is a sentinel for the search falling off the tree.
+  vector<uint64> eytzinger_lows_;
+  vector<uint32> eytzinger_ranks_;
   template<class IteratorType>
   IteratorType FindHelper(uint64 address, IteratorType iter,
                           IteratorType end) const;
@@ -89,7 +126,7 @@ class NonOverlappingRangeMap {
 };
 
 template<class T>
-NonOverlappingRangeMap<T>::NonOverlappingRangeMap() { }
+NonOverlappingRangeMap<T>::NonOverlappingRangeMap() : frozen_(false) { }
 
 template<class T>
 void NonOverlappingRangeMap<T>::InsertRangeList(
@@ -104,6 +141,7 @@ void NonOverlappingRangeMap<T>::InsertRangeList(
 template<class T>
 void NonOverlappingRangeMap<T>::InsertRange(uint64 low, uint64 high,
                                             const T& value) {
+  CHECK(!frozen_);
   if (low == high)
     return;
 
@@ -207,6 +245,74 @@ NonOverlappingRangeMap<T>::End() const {
   return ranges_.end();
 }
 
+template<class T>
+void NonOverlappingRangeMap<T>::Freeze() {
+  CHECK(!frozen_);
+  CHECK(ranges_.size() < numeric_limits<uint32>::max());
+  frozen_ = true;
+  frozen_ranges_.assign(ranges_.begin(), ranges_.end());
+  RangeMap().swap(ranges_);
+
+  const size_t n = frozen_ranges_.size();
+  eytzinger_lows_.resize(n + 1);
+  eytzinger_ranks_.resize(n + 1);
+  eytzinger_lows_[0] = 0;
+  eytzinger_ranks_[0] = n;
+  FillEytzinger(0, 1);
+}
+
+template<class T>
+size_t NonOverlappingRangeMap<T>::FillEytzinger(size_t i, size_t k) {
+  if (k < eytzinger_lows_.size()) {
+    i = FillEytzinger(i, 2 * k);
+    eytzinger_lows_[k] = frozen_ranges_[i].first.first;
+    eytzinger_ranks_[k] = i;
+    i = FillEytzinger(i + 1, 2 * k + 1);
+  }
+  return i;
+}
+
+template<class T>
+const T* NonOverlappingRangeMap<T>::Lookup(uint64 address, uint64* low,
+                                           uint64* high) const {
+  const AddressRangeList::Range* range;
+  const T* value;
+  if (!frozen_) {
+    ConstIterator iter = Find(address);
+    if (iter == End())
+      return NULL;
+    range = &iter->first;
+    value = &iter->second;
+  } else {
+    // Descends to the right of the nodes which start at or before ADDRESS,
+    // and to the left of the others. The path ends with the node of the
+    // first range starting after ADDRESS followed by a run of right turns,
+    // which are shifted out. No such range leaves the sentinel index 0.
+    const size_t n = frozen_ranges_.size();
+    const uint64* lows = eytzinger_lows_.data();
+    size_t k = 1;
+    while (k <= n) {
+      __builtin_prefetch(lows + 8 * k);
+      k = 2 * k + (lows[k] <= address);
+    }
+    k >>= __builtin_ffsll(~k);
+    // The range before the first one starting after ADDRESS is the only
+    // one which may contain it.
+    const size_t rank = eytzinger_ranks_[k];
+    if (rank == 0)
+      return NULL;
+    range = &frozen_ranges_[rank - 1].first;
+    value = &frozen_ranges_[rank - 1].second;
+    if (range->second <= address)
+      return NULL;
+  }
+  if (low != NULL)
+    *low = range->first;
+  if (high != NULL)
+    *high = range->second;
+  return value;
+}
+
 template<class T>
 bool NonOverlappingRangeMap<T>::RangeStrictlyContains(
     const AddressRangeList::Range& outer,
@@ -0,0 +1,176 @@
+// Loader of the split DWARF of the compilation units of a binary.
+
+#include "symbolize/split_dwarf_loader.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "symbolize/bytereader.h"
+#include "symbolize/elf_reader.h"
+
+namespace devtools_crosstool_autofdo {
+
+namespace {
+// Reads the pages of [DATA, DATA + SIZE), which is mapped from a file.
+void TouchPages(const char* data, size_t size) {
+  static const size_t page_size = getpagesize();
+  volatile char sink = 0;
+  for (size_t offset = 0; offset < size; offset += page_size) {
+    sink += data[offset];
+  }
+  if (size > 0)
+    sink += data[size - 1];
+}
+
+// Brings the file at PATH in the page cache.
+void ReadAheadFile(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) == 0)
+    readahead(fd, 0, statbuf.st_size);
+  close(fd);
+}
+}  // namespace
+
+SplitDwarfLoader::SplitDwarfLoader(const string& binary_path)
+    : binary_path_(binary_path), dwp_path_(binary_path + ".dwp"),
+      dwp_width_(0), width_(0), next_batch_(0), max_batches_ahead_(0),
+      num_started_batches_(0), stopped_(false) {
+  struct stat statbuf;
+  if (stat(dwp_path_.c_str(), &statbuf) != 0)
+    return;
+  ElfReader* elf = new ElfReader(dwp_path_);
+  if (elf->IsElf32File()) {
+    dwp_width_ = 4;
+  } else if (elf->IsElf64File()) {
+    dwp_width_ = 8;
+  } else {
+    LOG(WARNING) << "File '" << dwp_path_ << "' is not an ELF file.";
+    delete elf;
+    return;
+  }
+  dwp_byte_reader_.reset(new ByteReader(ENDIANNESS_NATIVE));
+  dwp_byte_reader_->SetAddressSize(dwp_width_);
+  dwp_reader_.reset(new DwpReader(*dwp_byte_reader_, elf));
+  dwp_reader_->Initialize();
+}
+
+SplitDwarfLoader::~SplitDwarfLoader() {
+  Stop();
+}
+
+bool SplitDwarfLoader::Prefetch(
+    const SectionMap& sections, int width,
+    const std::vector<std::vector<uint64>>& unit_batches, int num_threads,
+    int max_batches_ahead) {
+  CHECK(threads_.empty());
+  if (unit_batches.empty() || unit_batches[0].empty())
+    return false;
+
+  // The units are all skeleton units or none is.
+  ByteReader reader(ENDIANNESS_LITTLE);
+  reader.SetAddressSize(width);
+  Dwarf2Handler handler;
+  CompilationUnit unit(binary_path_, sections, unit_batches[0][0], &reader,
+                       &handler);
+  const char* dwo_name;
+  uint64 dwo_id;
+  if (!unit.ReadSkeletonUnit(&dwo_name, &dwo_id))
+    return false;
+
+  sections_ = sections;
+  width_ = width;
+  unit_batches_ = unit_batches;
+  next_batch_ = 0;
+  max_batches_ahead_ = std::max(1, max_batches_ahead);
+  num_started_batches_ = 0;
+  stopped_ = false;
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&SplitDwarfLoader::PrefetchBatches, this);
+  }
+  return true;
+}
+
+void SplitDwarfLoader::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    stopped_ = true;
+  }
+  batch_changed_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+bool SplitDwarfLoader::ReadDwpSections(uint64 dwo_id, SectionMap* sections) {
+  if (dwp_reader_ == NULL)
+    return false;
+  std::lock_guard<std::mutex> lock(dwp_mutex_);
+  dwp_reader_->ReadDebugSectionsForCU(dwo_id, sections);
+  return !sections->empty();
+}
+
+void SplitDwarfLoader::StartBatch(size_t batch) {
+  {
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    if (batch < num_started_batches_)
+      return;
+    num_started_batches_ = batch + 1;
+  }
+  batch_changed_.notify_all();
+}
+
+void SplitDwarfLoader::PrefetchBatches() {
+  for (size_t i = next_batch_++; i < unit_batches_.size();
+       i = next_batch_++) {
+    {
+      // Waits until the batch is close enough to the parser, so that
+      // the pages read ahead are not evicted before they are used.
+      std::unique_lock<std::mutex> lock(batch_mutex_);
+      batch_changed_.wait(lock, [this, i]() {
+        return stopped_ || i < num_started_batches_ + max_batches_ahead_;
+      });
+      if (stopped_)
+        return;
+      // The parser is already reading the batch.
+      if (i < num_started_batches_)
+        continue;
+    }
+    for (uint64 unit_offset : unit_batches_[i]) {
+      PrefetchUnit(unit_offset);
+    }
+  }
+}
+
+void SplitDwarfLoader::PrefetchUnit(uint64 unit_offset) {
+  ByteReader reader(ENDIANNESS_LITTLE);
+  reader.SetAddressSize(width_);
+  Dwarf2Handler handler;
+  CompilationUnit unit(binary_path_, sections_, unit_offset, &reader,
+                       &handler);
+  const char* dwo_name;
+  uint64 dwo_id;
+  if (!unit.ReadSkeletonUnit(&dwo_name, &dwo_id))
+    return;
+
+  SectionMap sections;
+  if (ReadDwpSections(dwo_id, &sections)) {
+    for (const auto& section : sections) {
+      // The string section is shared by all the units of the .dwp file.
+      if (section.first != ".debug_str")
+        TouchPages(section.second.first, section.second.second);
+    }
+  } else {
+    ReadAheadFile(dwo_name);
+  }
+}
+
+}  // namespace devtools_crosstool_autofdo
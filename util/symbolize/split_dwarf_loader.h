@@ -0,0 +1,113 @@
+// Loader of the split DWARF of the compilation units of a binary.
+
+#ifndef AUTOFDO_SYMBOLIZE_SPLIT_DWARF_LOADER_H_
+#define AUTOFDO_SYMBOLIZE_SPLIT_DWARF_LOADER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/common.h"
+#include "symbolize/dwarf2reader.h"
+
+namespace devtools_crosstool_autofdo {
+
+class ByteReader;
+
+// This class loads the split DWARF of the skeleton compilation units
+// of a binary, which is either in one .dwo file per unit or in the
+// .dwp file of the binary.
+//
+// The .dwp file is opened once, and shared by the compilation units
+// which are read through the loader, possibly from several threads.
+// The loader also reads ahead the .dwo files and the .dwp
+// contributions of the compilation units about to be read, with
+// threads of its own, so that the I/O overlaps with the parsing of
+// the units by their Dwarf2Handler.
+class SplitDwarfLoader {
+ public:
+  // Loads the split DWARF of the skeleton compilation units of
+  // BINARY_PATH, whose .dwp file is BINARY_PATH.dwp.
+  explicit SplitDwarfLoader(const string& binary_path);
+
+  // Stops prefetching.
+  ~SplitDwarfLoader();
+
+  // Starts NUM_THREADS threads which read ahead the .dwo files or the
+  // .dwp contributions of the skeleton compilation units of the
+  // .debug_info section in SECTIONS, whose offsets are in
+  // UNIT_BATCHES.  The batches are read ahead in their order, several
+  // at a time, and at most MAX_BATCHES_AHEAD batches past the last one
+  // started by the parser, see StartBatch.  The units are only brought
+  // in the page cache, the compilation units still open their .dwo
+  // files themselves.  Returns false, without starting any thread, if
+  // the first unit is not a skeleton compilation unit.
+  bool Prefetch(const SectionMap& sections, int width,
+                const std::vector<std::vector<uint64>>& unit_batches,
+                int num_threads, int max_batches_ahead);
+
+  // Tells that the parser starts reading the batch BATCH, an index in
+  // the batches given to Prefetch.  The batches it reached are not read
+  // ahead any more, and those which follow them can be.
+  void StartBatch(size_t batch);
+
+  // Waits for the prefetching threads to stop, after the batch they
+  // are reading ahead.
+  void Stop();
+
+  // Returns true if the binary has a .dwp file.
+  bool has_dwp() const { return dwp_reader_ != NULL; }
+
+  // Path and address size of the .dwp file.
+  const string& dwp_path() const { return dwp_path_; }
+  int dwp_width() const { return dwp_width_; }
+
+  // Stores in SECTIONS the sections of the .dwp file holding the
+  // compilation unit DWO_ID.  Returns false if there is no .dwp file,
+  // or if it does not have DWO_ID.  This may be called from several
+  // threads.
+  bool ReadDwpSections(uint64 dwo_id, SectionMap* sections);
+
+ private:
+  // Reads ahead batches of units until there is no batch left, or
+  // until the loader is stopped.
+  void PrefetchBatches();
+
+  // Reads ahead the split DWARF of the skeleton unit at UNIT_OFFSET.
+  void PrefetchUnit(uint64 unit_offset);
+
+  const string binary_path_;
+  string dwp_path_;
+  int dwp_width_;
+  std::unique_ptr<ByteReader> dwp_byte_reader_;
+  std::unique_ptr<DwpReader> dwp_reader_;
+  // Guards dwp_reader_, which maps the sections of the .dwp file on
+  // first use.
+  std::mutex dwp_mutex_;
+
+  // The sections of the binary, and the batches of units to read ahead.
+  SectionMap sections_;
+  int width_;
+  std::vector<std::vector<uint64>> unit_batches_;
+  std::atomic<size_t> next_batch_;
+  size_t max_batches_ahead_;
+  // Guards num_started_batches_ and stopped_, and signals when they
+  // change.
+  std::mutex batch_mutex_;
+  std::condition_variable batch_changed_;
+  // The number of batches the parser has started, i.e. the index of
+  // the last one plus one.
+  size_t num_started_batches_;
+  bool stopped_;
+  std::vector<std::thread> threads_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(SplitDwarfLoader);
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_SYMBOLIZE_SPLIT_DWARF_LOADER_H_